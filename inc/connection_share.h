@@ -0,0 +1,64 @@
+/** **************************************************************************
+ * connection_share.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#ifndef CONNECTION_SHARE_H
+#define CONNECTION_SHARE_H
+
+#include <curl/curl.h>
+#include "libs3.h"
+
+
+// Connection share functions
+// ----------------------------------------------------------------------------
+
+// Every curl handle that libs3 creates is attached to a single, library-wide
+// CURLSH, so that DNS lookups and TLS sessions (and optionally connections;
+// see S3_INIT_SHARE_CONNECTIONS) obtained by one handle are available to all
+// others, including those running within any S3RequestContext.  This module
+// also keeps the counters reported by S3_get_connection_stats().
+
+// Initialize the connection share; flags are as passed to S3_initialize()
+S3Status connection_share_initialize(int flags);
+
+// Deinitialize the connection share.  All curl handles must have been
+// cleaned up before this is called.
+void connection_share_deinitialize();
+
+// Attach a curl handle to the connection share
+S3Status connection_share_attach(CURL *curl);
+
+// Called once per request while its connection is still attached to the
+// curl handle (i.e. during the transfer), to record TLS session resumption;
+// returns nonzero if the request resumed a previous TLS session
+int connection_share_record_connected(CURL *curl);
+
+// Called once per request when its transfer has completed, to record
+// whether a new connection was needed.  responseReceived should be nonzero
+// if any HTTP response was received.
+void connection_share_record_finished(CURL *curl, int responseReceived);
+
+
+#endif /* CONNECTION_SHARE_H */
@@ -27,6 +27,7 @@
 #ifndef LIBS3_H
 #define LIBS3_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/select.h>
 
@@ -219,6 +220,35 @@ extern "C" {
  * basis by calling S3_set_request_context_verify_peer).
  */
 #define S3_INIT_VERIFY_PEER                2
+/**
+ * This constant is used by the S3_initialize() function, to make all requests
+ * share a single connection cache, rather than each request context (and
+ * each handle used for requests made without a request context) keeping its
+ * own.  DNS lookups and TLS sessions are always shared.  Because libcurl does
+ * not support sharing connections between threads, this must only be used
+ * when all requests are made from a single thread at a time.
+ **/
+#define S3_INIT_SHARE_CONNECTIONS          4
+/**
+ * This constant is used by the S3_initialize() function, to parse the XML
+ * documents of S3 responses with a small built-in tokenizer instead of with
+ * libxml2.  The built-in tokenizer understands only what S3 sends (elements,
+ * attributes, character data, the predefined and numeric entity references,
+ * CDATA sections, comments and processing instructions); it does not
+ * allocate memory, and has no per-document setup cost, which is most of
+ * the cost of parsing the small responses of most requests.
+ **/
+#define S3_INIT_BUILTIN_XML                8
+
+
+/**
+ * This constant is used by the S3_initialize() function, to enable the
+ * recording of metrics for every request: counts, byte counts and latency
+ * histograms, by operation, HTTP method and status.  They are recorded
+ * without locks, at the cost of a few atomic additions per request, and are
+ * read with S3_get_metrics().
+ **/
+#define S3_INIT_METRICS                    16
 
 
 /**
@@ -228,6 +258,78 @@ extern "C" {
 #define S3_INIT_ALL                        (S3_INIT_WINSOCK)
 
 
+/**
+ * These constants are passed to and from the S3SocketCallback of an
+ * S3RequestContext of mode S3RequestContextModeExternal, and to
+ * S3_process_request_context_socket(), to describe I/O events on a socket.
+ **/
+#define S3_SOCKET_EVENT_READ               1
+#define S3_SOCKET_EVENT_WRITE              2
+#define S3_SOCKET_EVENT_ERROR              4
+
+
+/**
+ * This is the number of buckets in the latency histogram of an
+ * S3MetricsSeries.  Latencies are recorded in microseconds: each of the
+ * first 8 buckets counts a single value, from 0 to 7 microseconds, and
+ * after that each power of two is split into 8 buckets of equal width, so
+ * that a latency is known to within 12.5%.  The last bucket also counts
+ * every latency beyond the range of the histogram, which is over an hour.
+ **/
+#define S3_METRICS_HISTOGRAM_BUCKETS       240
+
+
+/**
+ * These constants give the defaults used by S3_put_object_multipart() for
+ * any S3MultipartUploadOptions field left as 0: the size of each part, the
+ * number of parts uploaded concurrently, and the number of times each
+ * request is attempted before the upload is given up on.
+ **/
+#define S3_MULTIPART_DEFAULT_PART_SIZE     (15 << 20)
+#define S3_MULTIPART_DEFAULT_CONCURRENCY   4
+#define S3_MULTIPART_DEFAULT_MAX_ATTEMPTS  4
+
+
+/**
+ * S3_MULTIPART_MAX_PARTS is the maximum number of parts that S3 allows in a
+ * multipart upload.  S3_put_object_multipart() enlarges the part size as
+ * necessary to stay within it.
+ **/
+#define S3_MULTIPART_MAX_PARTS             10000
+
+
+/**
+ * These constants give the defaults used by S3_get_object_to_fd() for any
+ * S3ParallelGetOptions field left as 0: the size of each byte range, the
+ * number of ranges downloaded concurrently, and the number of times each
+ * request is attempted before the download is given up on.
+ **/
+#define S3_PARALLEL_GET_DEFAULT_RANGE_SIZE   (8 << 20)
+#define S3_PARALLEL_GET_DEFAULT_CONCURRENCY  8
+#define S3_PARALLEL_GET_DEFAULT_MAX_ATTEMPTS 4
+
+
+/**
+ * These constants give the defaults used by S3_list_bucket_parallel() for
+ * S3ParallelListOptions fields left as 0: the number of list requests made
+ * concurrently, the number of times each request is attempted, and the
+ * number of levels of common prefixes that the keyspace is split on.
+ **/
+#define S3_PARALLEL_LIST_DEFAULT_CONCURRENCY  16
+#define S3_PARALLEL_LIST_DEFAULT_MAX_ATTEMPTS 4
+#define S3_PARALLEL_LIST_DEFAULT_SPLIT_DEPTH  1
+
+
+/**
+ * These constants give the defaults used by S3_create_list_iterator() for
+ * S3ListIteratorOptions fields left as 0: the number of pages listed ahead
+ * of the one being iterated over, and the number of times each list request
+ * is attempted.
+ **/
+#define S3_LIST_ITERATOR_DEFAULT_PREFETCH_PAGES 2
+#define S3_LIST_ITERATOR_DEFAULT_MAX_ATTEMPTS   4
+
+
 /**
  * The default region identifier used to scope the signing key
  */
@@ -299,6 +401,7 @@ typedef enum
     S3StatusConnectionFailed                                ,
     S3StatusAbortedByCallback                               ,
     S3StatusNotSupported                                    ,
+    S3StatusDestinationTooSmall                             ,
 
     /**
      * Errors from the S3 service
@@ -502,6 +605,110 @@ typedef enum
 } S3CannedAcl;
 
 
+/**
+ * S3RequestContextMode selects how an S3RequestContext waits for and
+ * dispatches network I/O for the requests it manages.
+ * Select - the requests are run by polling every connection on each call to
+ *     S3_runonce_request_context, and S3_runall_request_context waits for
+ *     I/O using select().  The number of simultaneous connections is limited
+ *     by FD_SETSIZE, and each wakeup costs time proportional to the number of
+ *     connections.  This is the mode used by S3_create_request_context.
+ * Epoll - only connections with pending I/O are serviced, as reported by an
+ *     epoll instance, so each wakeup costs time proportional to the number
+ *     of active connections, and there is no limit on the number of
+ *     simultaneous connections.  This mode is only available on Linux.
+ * External - the caller's own event loop (epoll, libuv, libevent, etc) waits
+ *     for I/O, being told which sockets and timeouts to watch via callbacks,
+ *     and reports back using S3_process_request_context_socket() and
+ *     S3_process_request_context_timeout().  A request context of this mode
+ *     can only be created by S3_create_request_context_external().
+ **/
+typedef enum
+{
+    S3RequestContextModeSelect          = 0,
+    S3RequestContextModeEpoll           = 1,
+    S3RequestContextModeExternal        = 2
+} S3RequestContextMode;
+
+
+/**
+ * S3MultipartSourceType identifies where S3_put_object_multipart() reads
+ * the data of the object being uploaded from.
+ * Buffer - the data is read from a buffer in memory holding the entire
+ *     object.
+ * Fd - the data is read from a file descriptor using pread(), so that parts
+ *     can be read independently of each other; the file descriptor must
+ *     therefore refer to a regular file (or something else seekable).  Its
+ *     file offset is not used, and is not changed except on Windows.
+ * Callback - the data is read sequentially from a callback.  Because each
+ *     part may have to be re-sent, each part is read in its entirety into
+ *     memory before being uploaded, so up to concurrency * partSize bytes of
+ *     memory are used.
+ **/
+typedef enum
+{
+    S3MultipartSourceTypeBuffer         = 0,
+    S3MultipartSourceTypeFd             = 1,
+    S3MultipartSourceTypeCallback       = 2
+} S3MultipartSourceType;
+
+
+/**
+ * S3GetDestinationType identifies where S3_get_object_into() places the
+ * data of the object being read.
+ * Buffer - a single buffer in memory.
+ * IoVec - a sequence of buffers in memory, filled in order.
+ * Fd - a file descriptor, written at a given offset using pwrite(), so that
+ *     several requests can write to different parts of the same file at
+ *     once.  Its file offset is not used, and is not changed except on
+ *     Windows.
+ **/
+typedef enum
+{
+    S3GetDestinationTypeBuffer          = 0,
+    S3GetDestinationTypeIoVec           = 1,
+    S3GetDestinationTypeFd              = 2
+} S3GetDestinationType;
+
+
+/**
+ * S3Operation identifies the kind of operation that a request made by libs3
+ * performs, for its metrics and stats.  Each of the operations made up of
+ * several requests, such as S3_put_object_multipart(), is reported as the
+ * requests that it makes.
+ * GetSubResource, SetSubResource - getting or setting a sub-resource of a
+ *     bucket or object, such as its ACL or lifecycle configuration.
+ * Other - any request not otherwise identified.
+ **/
+typedef enum
+{
+    S3OperationListService                  = 0,
+    S3OperationListBucket                   = 1,
+    S3OperationCreateBucket                 = 2,
+    S3OperationDeleteBucket                 = 3,
+    S3OperationGetObject                    = 4,
+    S3OperationHeadObject                   = 5,
+    S3OperationPutObject                    = 6,
+    S3OperationCopyObject                   = 7,
+    S3OperationDeleteObject                 = 8,
+    S3OperationCreateMultipartUpload        = 9,
+    S3OperationUploadPart                   = 10,
+    S3OperationUploadPartCopy               = 11,
+    S3OperationCompleteMultipartUpload      = 12,
+    S3OperationAbortMultipartUpload         = 13,
+    S3OperationListParts                    = 14,
+    S3OperationListMultipartUploads         = 15,
+    S3OperationGetSubResource               = 16,
+    S3OperationSetSubResource               = 17,
+    S3OperationOther                        = 18
+} S3Operation;
+
+/**
+ * This is the number of values of S3Operation
+ **/
+#define S3_OPERATION_COUNT                  (S3OperationOther + 1)
+
+
 /** **************************************************************************
  * Data Types
  ************************************************************************** **/
@@ -513,6 +720,13 @@ typedef enum
 typedef struct S3RequestContext S3RequestContext;
 
 
+/**
+ * An S3ListIterator iterates over the keys of a bucket, listing them ahead
+ * of the caller; see S3_create_list_iterator() below for details
+ **/
+typedef struct S3ListIterator S3ListIterator;
+
+
 /**
  * S3NameValue represents a single Name - Value pair, used to represent either
  * S3 metadata associated with a key, or S3 error details.
@@ -906,6 +1120,20 @@ typedef struct S3PutProperties
      * response has the usesServerSideEncryption flag set.
      **/
     char useServerSideEncryption;
+
+    /**
+     * This is a boolean value indicating whether or not the object data
+     * should be signed as it is sent.  If this value is 0, then the data is
+     * sent as an "UNSIGNED-PAYLOAD" and its integrity relies upon the
+     * transport (i.e. HTTPS).  If this value is non-zero, then the data is
+     * sent using the aws-chunked content encoding, with a signature computed
+     * for each chunk as the data is read from the put object data callback
+     * (STREAMING-AWS4-HMAC-SHA256-PAYLOAD), so that S3 rejects data that has
+     * been modified in transit even over plain HTTP.  This is only used by
+     * S3_put_object and S3_upload_part; the object data is never buffered in
+     * its entirety.
+     **/
+    char useStreamingSignature;
 } S3PutProperties;
 
 
@@ -988,6 +1216,546 @@ typedef struct S3ErrorDetails
 } S3ErrorDetails;
 
 
+/**
+ * S3ConnectionStats reports how effectively libs3 is re-using connections
+ * and TLS sessions; see S3_get_connection_stats().
+ **/
+typedef struct S3ConnectionStats
+{
+    /**
+     * The number of requests completed
+     **/
+    uint64_t requestCount;
+
+    /**
+     * The number of requests for which a new connection was established
+     **/
+    uint64_t newConnectionCount;
+
+    /**
+     * The number of requests which re-used an existing connection
+     **/
+    uint64_t reusedConnectionCount;
+
+    /**
+     * The number of TLS handshakes performed when establishing connections.
+     * TLS handshakes are only counted with libcurl 7.48.0 or later.
+     **/
+    uint64_t tlsHandshakeCount;
+
+    /**
+     * The number of TLS handshakes which resumed a previous TLS session
+     * rather than performing a full handshake.  This is only counted when
+     * libcurl uses OpenSSL.
+     **/
+    uint64_t tlsResumedCount;
+} S3ConnectionStats;
+
+
+/**
+ * S3RequestStats describes a single HTTP request made by libs3, as it
+ * completes; see S3_set_request_stats_callback().  The times are those of
+ * the phases of the request, in microseconds; a phase which did not take
+ * place, such as connecting for a request which re-used a connection, is 0.
+ **/
+typedef struct S3RequestStats
+{
+    /**
+     * The HTTP method of the request: "GET", "HEAD", "PUT", "POST" or
+     * "DELETE"
+     **/
+    const char *method;
+
+    /**
+     * The bucket of the request, or NULL if it was not made to a bucket
+     **/
+    const char *bucketName;
+
+    /**
+     * The key of the request, or NULL if it was not made to an object
+     **/
+    const char *key;
+
+    /**
+     * The name of the sub-resource of the request, without any value, such
+     * as "acl", "uploads" or "uploadId"; or NULL if it had none
+     **/
+    const char *subResource;
+
+    /**
+     * The kind of operation that the request performed
+     **/
+    S3Operation operation;
+
+    /**
+     * The status of the request, as passed to its complete callback
+     **/
+    S3Status status;
+
+    /**
+     * The HTTP status code of the response, or 0 if none was received
+     **/
+    int httpResponseCode;
+
+    /**
+     * The time taken to look up the host name
+     **/
+    int64_t nameLookupUs;
+
+    /**
+     * The time taken to establish the TCP connection, after the name lookup
+     **/
+    int64_t connectUs;
+
+    /**
+     * The time taken by the TLS handshake, after the TCP connection
+     **/
+    int64_t tlsHandshakeUs;
+
+    /**
+     * The time from when the request began to be sent until the first byte
+     * of the response arrived, which includes the sending of any request
+     * body as well as the time taken by S3 to respond
+     **/
+    int64_t firstByteUs;
+
+    /**
+     * The time from the first byte of the response until the last
+     **/
+    int64_t transferUs;
+
+    /**
+     * The time taken by the request as a whole
+     **/
+    int64_t totalUs;
+
+    /**
+     * The number of bytes of request body sent
+     **/
+    uint64_t bytesSent;
+
+    /**
+     * The number of bytes of response body received
+     **/
+    uint64_t bytesReceived;
+
+    /**
+     * Nonzero if the request re-used a connection left open by an earlier
+     * request
+     **/
+    int connectionReused;
+
+    /**
+     * Nonzero if the request established a new TLS connection which resumed
+     * a previous TLS session.  This is only detected when libcurl uses
+     * OpenSSL.
+     **/
+    int tlsSessionResumed;
+} S3RequestStats;
+
+
+/**
+ * S3TraceEventType identifies a point in the life of an HTTP request made by
+ * libs3, as reported to the trace callback; see S3_set_trace_callback().
+ * The events of a request are reported in this order.  Every request which
+ * is created is finished; of the events between, only those which the
+ * request reaches are reported, so that for example a request which fails
+ * to connect reports none of the events from connection acquired to body
+ * complete.
+ **/
+typedef enum
+{
+    /**
+     * The request has been issued, before anything else has been done for
+     * it
+     **/
+    S3TraceEventCreated                     = 0,
+
+    /**
+     * The headers and signature of the request have been computed
+     **/
+    S3TraceEventSigned                      = 1,
+
+    /**
+     * The request has been added to an S3RequestContext; this is not
+     * reported for requests performed immediately
+     **/
+    S3TraceEventQueued                      = 2,
+
+    /**
+     * libcurl has connected, or re-used an existing connection, and is
+     * about to send the request.  With libcurl older than 7.80.0, this is
+     * instead reported with the next event of the request.
+     **/
+    S3TraceEventConnectionAcquired          = 3,
+
+    /**
+     * The request has begun to be sent: for a request with a body, when
+     * libcurl first asks for body data, just after it has sent the request
+     * headers; otherwise, along with S3TraceEventConnectionAcquired
+     **/
+    S3TraceEventFirstByteSent               = 4,
+
+    /**
+     * The headers of the final response, other than any 1xx response, have
+     * been received
+     **/
+    S3TraceEventHeadersReceived             = 5,
+
+    /**
+     * libcurl has finished the transfer of a request whose response headers
+     * were received; unless the transfer failed, the whole response body
+     * has been received
+     **/
+    S3TraceEventBodyComplete                = 6,
+
+    /**
+     * The complete callback of the request has returned, and the request is
+     * done with
+     **/
+    S3TraceEventFinished                    = 7
+} S3TraceEventType;
+
+
+/**
+ * S3TraceEvent describes one event in the life of an HTTP request made by
+ * libs3; see S3_set_trace_callback().
+ **/
+typedef struct S3TraceEvent
+{
+    /**
+     * The event
+     **/
+    S3TraceEventType type;
+
+    /**
+     * Identifies the request, to which all of its events refer; the
+     * requests made by a process are numbered from 1
+     **/
+    uint64_t requestId;
+
+    /**
+     * The time of the event, in nanoseconds from an arbitrary point, as
+     * given by clock_gettime(CLOCK_MONOTONIC)
+     **/
+    int64_t timeNs;
+
+    /**
+     * The kind of operation that the request performs, and its HTTP method
+     * ("GET", "HEAD", "PUT", "POST" or "DELETE")
+     **/
+    S3Operation operation;
+    const char *method;
+
+    /**
+     * The status of the request as of the event; for S3TraceEventFinished,
+     * this is the status that was passed to its complete callback
+     **/
+    S3Status status;
+
+    /**
+     * The HTTP status code of the response, from S3TraceEventHeadersReceived
+     * on, or 0 if none was received
+     **/
+    int httpResponseCode;
+} S3TraceEvent;
+
+
+/**
+ * S3MetricsSeries gives the metrics of the requests for one operation, with
+ * one HTTP method, which completed with one status; see S3_get_metrics().
+ **/
+typedef struct S3MetricsSeries
+{
+    /**
+     * The operation, HTTP method ("GET", "HEAD", "PUT", "POST" or "DELETE")
+     * and status of the requests
+     **/
+    S3Operation operation;
+    const char *method;
+    S3Status status;
+
+    /**
+     * The number of requests; this is the sum of the histogram buckets
+     **/
+    uint64_t count;
+
+    /**
+     * The sum of the latencies of the requests, in microseconds
+     **/
+    uint64_t totalUs;
+
+    /**
+     * The number of bytes of request body sent, and of response body
+     * received, by the requests
+     **/
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+
+    /**
+     * The number of requests whose latency fell in each bucket of the
+     * histogram; see S3_METRICS_HISTOGRAM_BUCKETS.  The latency of a request
+     * is from when libcurl started it until it completed.
+     **/
+    uint64_t histogram[S3_METRICS_HISTOGRAM_BUCKETS];
+} S3MetricsSeries;
+
+
+/**
+ * S3Metrics is a snapshot of the metrics recorded when libs3 is initialized
+ * with S3_INIT_METRICS; see S3_get_metrics().
+ **/
+typedef struct S3Metrics
+{
+    /**
+     * The number of requests started but not yet completed, for each
+     * operation
+     **/
+    int64_t requestsInFlight[S3_OPERATION_COUNT];
+
+    /**
+     * The series of metrics of completed requests, one for each combination
+     * of operation, HTTP method and status that has been seen
+     **/
+    int seriesCount;
+    S3MetricsSeries *series;
+
+    /**
+     * The number of completed requests which were not recorded because
+     * there was no room for another series.  This can only happen if an
+     * unusually large number of combinations of operation, HTTP method and
+     * status are seen.
+     **/
+    uint64_t droppedCount;
+} S3Metrics;
+
+
+/**
+ * S3MultipartUploadOptions controls how S3_put_object_multipart() splits an
+ * object into parts and uploads them.  Any field which is 0 takes its
+ * default value.
+ **/
+typedef struct S3MultipartUploadOptions
+{
+    /**
+     * The size of each part, in bytes, except the last which may be
+     * smaller.  S3 requires every part other than the last to be at least
+     * 5 MB.  This is increased as necessary to keep the number of parts
+     * within S3_MULTIPART_MAX_PARTS, and is limited to 2 GB - 1.  Defaults to
+     * S3_MULTIPART_DEFAULT_PART_SIZE.
+     **/
+    int64_t partSize;
+
+    /**
+     * The maximum number of parts being uploaded at once.  Defaults to
+     * S3_MULTIPART_DEFAULT_CONCURRENCY.
+     **/
+    int concurrency;
+
+    /**
+     * The number of times that each request of the upload is attempted
+     * before giving up, if it fails with a status for which
+     * S3_status_is_retryable() is true.  1 disables retries.  Defaults to
+     * S3_MULTIPART_DEFAULT_MAX_ATTEMPTS.
+     **/
+    int maxAttempts;
+} S3MultipartUploadOptions;
+
+
+/**
+ * S3IoVec describes one buffer of a scatter list; see S3GetDestination.
+ **/
+typedef struct S3IoVec
+{
+    /**
+     * The start of the buffer
+     **/
+    void *base;
+
+    /**
+     * The size of the buffer, in bytes
+     **/
+    size_t length;
+} S3IoVec;
+
+
+/**
+ * S3GetDestination describes where S3_get_object_into() places the data of
+ * the object being read.  Only the fields for the given type are used.  The
+ * memory or file described must remain valid until the request completes.
+ **/
+typedef struct S3GetDestination
+{
+    /**
+     * The type of the destination
+     **/
+    S3GetDestinationType type;
+
+    /**
+     * S3GetDestinationTypeBuffer: the buffer, and its size in bytes
+     **/
+    char *buffer;
+    size_t bufferSize;
+
+    /**
+     * S3GetDestinationTypeIoVec: the buffers, and the number of them
+     **/
+    const S3IoVec *ioVecs;
+    int ioVecCount;
+
+    /**
+     * S3GetDestinationTypeFd: the file descriptor, and the offset within it
+     * at which the first byte received is written
+     **/
+    int fd;
+    int64_t fdOffset;
+} S3GetDestination;
+
+
+/**
+ * S3ParallelGetOptions controls how S3_get_object_to_fd() splits an object
+ * into byte ranges and downloads them.  Any field which is 0 takes its
+ * default value.
+ **/
+typedef struct S3ParallelGetOptions
+{
+    /**
+     * The size of each byte range, in bytes, except the last which may be
+     * smaller.  Defaults to S3_PARALLEL_GET_DEFAULT_RANGE_SIZE.
+     **/
+    int64_t rangeSize;
+
+    /**
+     * The maximum number of ranges being downloaded at once.  Defaults to
+     * S3_PARALLEL_GET_DEFAULT_CONCURRENCY.
+     **/
+    int concurrency;
+
+    /**
+     * The number of times that each request of the download is attempted
+     * before giving up, if it fails with a status for which
+     * S3_status_is_retryable() is true.  A retried range only requests the
+     * bytes not yet received.  1 disables retries.  Defaults to
+     * S3_PARALLEL_GET_DEFAULT_MAX_ATTEMPTS.
+     **/
+    int maxAttempts;
+} S3ParallelGetOptions;
+
+
+/**
+ * S3ParallelListOptions controls how S3_list_bucket_parallel() splits the
+ * keyspace into partitions which are listed concurrently.  Any numeric field
+ * which is 0 takes its default value.
+ *
+ * If splitPointsCount is nonzero, the keyspace is split at the given keys.
+ * Otherwise, if delimiter is given, the keyspace is split on the common
+ * prefixes found by listing with it, each being listed as a partition of its
+ * own.  Otherwise the bucket is listed as a single partition.
+ **/
+typedef struct S3ParallelListOptions
+{
+    /**
+     * Keys at which to split the keyspace, in ascending order.  Each key
+     * ends a partition: the first partition holds the keys up to and
+     * including splitPoints[0], the next those after it up to and including
+     * splitPoints[1], and the last those after the final split point.
+     **/
+    const char **splitPoints;
+    int splitPointsCount;
+
+    /**
+     * If non-NULL, the delimiter to discover common prefixes with, such as
+     * "/".  Keys which are not under any common prefix are reported from
+     * the listing which found the common prefixes.
+     **/
+    const char *delimiter;
+
+    /**
+     * The number of levels of common prefixes to split the keyspace on;
+     * partitions deeper than this are listed in full without the delimiter.
+     * Defaults to S3_PARALLEL_LIST_DEFAULT_SPLIT_DEPTH.
+     **/
+    int splitDepth;
+
+    /**
+     * The maximum number of list requests in flight at once.  Defaults to
+     * S3_PARALLEL_LIST_DEFAULT_CONCURRENCY.
+     **/
+    int concurrency;
+
+    /**
+     * The number of times each list request is attempted before giving up,
+     * if it fails with a status for which S3_status_is_retryable() is true.
+     * Defaults to S3_PARALLEL_LIST_DEFAULT_MAX_ATTEMPTS.
+     **/
+    int maxAttempts;
+
+    /**
+     * The max-keys of each list request; 0 leaves it to S3, which returns
+     * up to 1000 keys per response.
+     **/
+    int maxKeys;
+
+    /**
+     * If nonzero, the owner of each key is requested and reported.
+     **/
+    int fetchOwner;
+
+    /**
+     * If nonzero, keys are reported in ascending order, as S3_list_bucket
+     * reports them.  Keys listed ahead of those not yet reported are held
+     * in memory until they can be.  If zero, each response is reported as
+     * soon as it arrives.
+     **/
+    int sorted;
+} S3ParallelListOptions;
+
+
+/**
+ * S3ListIteratorOptions controls how S3_create_list_iterator() lists a
+ * bucket.  Any numeric field which is 0 takes its default value.
+ **/
+typedef struct S3ListIteratorOptions
+{
+    /**
+     * If non-NULL, only keys after this one are listed
+     **/
+    const char *startAfter;
+
+    /**
+     * If non-NULL, keys which contain the delimiter after the prefix are
+     * rolled up into common prefixes, which are iterated over among the keys
+     **/
+    const char *delimiter;
+
+    /**
+     * The max-keys of each list request, and so the number of keys in each
+     * page; 0 leaves it to S3, which returns up to 1000 keys per response
+     **/
+    int maxKeys;
+
+    /**
+     * If nonzero, the owner of each key is requested and reported
+     **/
+    int fetchOwner;
+
+    /**
+     * The number of pages which are listed ahead of the page being iterated
+     * over.  Once this many are waiting, no more requests are made until
+     * the caller has moved on to the next page, so the memory held by the
+     * iterator is bounded by (prefetchPages + 1) pages however large the
+     * bucket is.  Defaults to S3_LIST_ITERATOR_DEFAULT_PREFETCH_PAGES.
+     **/
+    int prefetchPages;
+
+    /**
+     * The number of times each list request is attempted before giving up,
+     * if it fails with a status for which S3_status_is_retryable() is true.
+     * Defaults to S3_LIST_ITERATOR_DEFAULT_MAX_ATTEMPTS.
+     **/
+    int maxAttempts;
+} S3ListIteratorOptions;
+
 /** **************************************************************************
  * Callback Signatures
  ************************************************************************** **/
@@ -1030,6 +1798,55 @@ typedef void (S3ResponseCompleteCallback)(S3Status status,
                                           void *callbackData);
 
 
+/**
+ * This callback is made, if set with S3_set_request_stats_callback(), as
+ * each HTTP request made by libs3 completes, just before the complete
+ * callback of the request.  It may be made from any thread making requests,
+ * at the same time as from others.
+ *
+ * @param stats describes the request; it, and the strings it refers to, are
+ *        only valid for the duration of the callback
+ * @param callbackData is the callback data as given to
+ *        S3_set_request_stats_callback()
+ **/
+typedef void (S3RequestStatsCallback)(const S3RequestStats *stats,
+                                      void *callbackData);
+
+
+/**
+ * This callback is made, if set with S3_set_trace_callback(), at each event
+ * in the life of each HTTP request made by libs3.  It is made from whichever
+ * thread is performing the request at the time, at the same time as from
+ * others, and so must be quick and must not make requests itself.
+ *
+ * @param event describes the event; it is only valid for the duration of
+ *        the callback
+ * @param callbackData is the callback data as given to
+ *        S3_set_trace_callback()
+ **/
+typedef void (S3TraceCallback)(const S3TraceEvent *event, void *callbackData);
+
+
+/**
+ * This callback is made when an S3_get_object_into() request has completed,
+ * in place of an S3ResponseCompleteCallback.  As with that callback, it is
+ * always made, as the very last callback made for the request.
+ *
+ * @param status gives the overall status of the response, as for
+ *        S3ResponseCompleteCallback
+ * @param byteCount is the number of bytes of the object placed in the
+ *        destination; if the request failed partway through, these bytes
+ *        are valid, and only the rest need be requested again
+ * @param errorDetails if non-NULL, gives details as returned by the S3
+ *        service, describing the error
+ * @param callbackData is the callback data as specified when the request
+ *        was issued.
+ **/
+typedef void (S3GetObjectIntoCompleteCallback)
+    (S3Status status, uint64_t byteCount, const S3ErrorDetails *errorDetails,
+     void *callbackData);
+
+
 /**
  * This callback is made for each bucket resulting from a list service
  * operation.
@@ -1059,7 +1876,9 @@ typedef S3Status (S3ListServiceCallback)(const char *ownerId,
  * This callback is made repeatedly as a list bucket operation progresses.
  * The contents reported via this callback are only reported once per list
  * bucket operation, but multiple calls to this callback may be necessary to
- * report all items resulting from the list bucket operation.
+ * report all items resulting from the list bucket operation.  A truncated
+ * response with no contents and no common prefixes still results in one
+ * call, with contentsCount and commonPrefixesCount 0.
  *
  * @param isTruncated is true if the list bucket request was truncated by the
  *        S3 service, in which case the remainder of the list may be obtained
@@ -1068,7 +1887,8 @@ typedef S3Status (S3ListServiceCallback)(const char *ownerId,
  * @param nextMarker if present, gives the largest (alphabetically) key
  *        returned in the response, which, if isTruncated is true, may be used
  *        as the marker in a subsequent list buckets operation to continue
- *        listing
+ *        listing.  For S3_list_objects_v2, this is instead the continuation
+ *        token to pass to continue listing.
  * @param contentsCount is the number of ListBucketContent structures in the
  *        contents parameter
  * @param contents is an array of ListBucketContent structures, each one
@@ -1094,6 +1914,25 @@ typedef S3Status (S3ListBucketCallback)(int isTruncated,
                                         void *callbackData);
 
 
+/**
+ * This callback is made repeatedly as a parallel list bucket operation
+ * progresses, each time with the keys of one list response.
+ *
+ * @param contentsCount is the number of ListBucketContent structures in the
+ *        contents parameter
+ * @param contents is an array of ListBucketContent structures, each one
+ *        describing an object in the bucket; they are valid only for the
+ *        duration of the callback
+ * @param callbackData is the callback data as specified when the operation
+ *        was started
+ * @return S3StatusOK to continue the operation, anything else to stop it;
+ *         the status is then passed to the S3ResponseCompleteCallback.
+ **/
+typedef S3Status (S3ParallelListCallback)(int contentsCount,
+                                          const S3ListBucketContent *contents,
+                                          void *callbackData);
+
+
 /**
  * This callback is made during a put object operation, to obtain the next
  * chunk of data to put to the S3 service as the contents of the object.  This
@@ -1240,6 +2079,44 @@ typedef S3Status (S3MultipartCommitResponseCallback)(const char *location,
                                                      void *callbackData);
 
 
+/**
+ * This callback is made by an S3RequestContext of mode
+ * S3RequestContextModeExternal whenever the I/O events that it is interested
+ * in on a socket change.  The caller's event loop should watch fd for the
+ * given events, replacing any events previously requested for fd, and call
+ * S3_process_request_context_socket() when any of them occur.  This callback
+ * is made from within libs3 functions, and must not call back into libs3.
+ *
+ * @param fd is the socket
+ * @param events is S3_SOCKET_EVENT_READ and/or S3_SOCKET_EVENT_WRITE, or 0
+ *        if fd should no longer be watched at all
+ * @param callbackData is the callback data as specified when the request
+ *        context was created
+ * @return 0 on success, nonzero if the event loop could not watch fd, which
+ *         will fail the request using the socket
+ **/
+typedef int (S3SocketCallback)(int fd, int events, void *callbackData);
+
+
+/**
+ * This callback is made by an S3RequestContext of mode
+ * S3RequestContextModeExternal whenever the time at which it needs
+ * S3_process_request_context_timeout() to be called changes.  There is only
+ * ever one such timer per request context; each call replaces the previous
+ * one.  This callback is made from within libs3 functions, and must not call
+ * back into libs3; a timeoutMs of 0 means that
+ * S3_process_request_context_timeout() should be called as soon as control
+ * returns to the event loop.
+ *
+ * @param timeoutMs is the number of milliseconds from now after which
+ *        S3_process_request_context_timeout() should be called, or -1 to
+ *        cancel the timer
+ * @param callbackData is the callback data as specified when the request
+ *        context was created
+ **/
+typedef void (S3TimerCallback)(int64_t timeoutMs, void *callbackData);
+
+
 /** **************************************************************************
  * Callback Structures
  ************************************************************************** **/
@@ -1308,6 +2185,27 @@ typedef struct S3ListBucketHandler
 } S3ListBucketHandler;
 
 
+/**
+ * An S3ParallelListHandler defines the callbacks which are made for
+ * S3_list_bucket_parallel operations.
+ **/
+typedef struct S3ParallelListHandler
+{
+    /**
+     * responseHandler provides the properties and complete callback.  The
+     * properties callback, if not NULL, is made for each list response; the
+     * complete callback is made exactly once, when the operation as a whole
+     * has succeeded or failed.
+     **/
+    S3ResponseHandler responseHandler;
+
+    /**
+     * The listCallback is called with the keys of each list response.
+     **/
+    S3ParallelListCallback *listCallback;
+} S3ParallelListHandler;
+
+
 /**
  * An S3PutObjectHandler defines the callbacks which are made for
  * put_object requests.
@@ -1351,6 +2249,27 @@ typedef struct S3GetObjectHandler
 } S3GetObjectHandler;
 
 
+/**
+ * An S3GetObjectIntoHandler defines the callbacks which are made for
+ * S3_get_object_into() requests.  There is no data callback, because the
+ * data is placed directly in the destination given with the request.
+ **/
+typedef struct S3GetObjectIntoHandler
+{
+    /**
+     * The propertiesCallback is made when the response properties have
+     * successfully been returned from S3.  It is optional.
+     **/
+    S3ResponsePropertiesCallback *propertiesCallback;
+
+    /**
+     * The completeCallback is always made when the request has completed,
+     * with the number of bytes placed in the destination.
+     **/
+    S3GetObjectIntoCompleteCallback *completeCallback;
+} S3GetObjectIntoHandler;
+
+
 typedef struct S3MultipartInitialHandler {
     /**
      * responseHandler provides the properties and complete callback
@@ -1406,6 +2325,32 @@ typedef struct S3AbortMultipartUploadHandler
 
 } S3AbortMultipartUploadHandler;
 
+typedef struct S3MultipartUploadHandler
+{
+    /**
+     * responseHandler provides the properties and complete callback.  The
+     * properties callback is made with the properties of the response to
+     * the request completing the upload.  The complete callback is made
+     * exactly once, when the upload as a whole has succeeded or failed.
+     **/
+    S3ResponseHandler responseHandler;
+
+    /**
+     * The sourceDataCallback supplies the data of the object when the
+     * source is of type S3MultipartSourceTypeCallback, and is otherwise
+     * unused.  It is made repeatedly, in order, until the whole object has
+     * been supplied, and may return fewer bytes than requested.  Returning
+     * a negative number aborts the upload with S3StatusAbortedByCallback.
+     **/
+    S3PutObjectDataCallback *sourceDataCallback;
+
+    /**
+     * Made, if non-NULL, just before the complete callback of a successful
+     * upload, with the location and ETag of the completed object
+     **/
+    S3MultipartCommitResponseCallback *responseXmlCallback;
+} S3MultipartUploadHandler;
+
 /** **************************************************************************
  * General Library Functions
  ************************************************************************** **/
@@ -1460,6 +2405,31 @@ S3Status S3_initialize(const char *userAgentInfo, int flags,
 void S3_deinitialize();
 
 
+/**
+ * Configures the pool in which libs3 keeps idle request handles (each of
+ * which may hold an open connection) for re-use by later requests.  Each
+ * thread caches a few handles of its own, without any locking; beyond that,
+ * handles go into a pool shared by all threads.  The options are applied by
+ * the next call to S3_initialize(); while libs3 is initialized, the pool
+ * keeps the options that it was initialized with.  This is NOT thread-safe.
+ *
+ * @param threadCacheSize is the maximum number of idle handles cached by
+ *        each thread; the default is 4.  On Microsoft Windows, handles
+ *        cached by a thread are only destroyed by S3_deinitialize(), even if
+ *        the thread exits earlier.
+ * @param globalSize is the maximum number of idle handles in the pool shared
+ *        by all threads; the default is 32.  Handles released when both the
+ *        releasing thread's cache and the shared pool are full are
+ *        destroyed.
+ * @param maxIdleSeconds is the number of seconds after which an idle handle
+ *        is destroyed rather than re-used, since its connection has most
+ *        likely been closed by the server; the default is 30, and 0 means
+ *        that idle handles never expire
+ **/
+void S3_set_request_pool_options(int threadCacheSize, int globalSize,
+                                 int maxIdleSeconds);
+
+
 /**
  * Returns a string with the textual name of an S3Status code
  *
@@ -1583,11 +2553,66 @@ int S3_status_is_retryable(S3Status status);
 S3Status S3_create_request_context(S3RequestContext **requestContextReturn);
 
 
+/**
+ * Same as S3_create_request_context, but allows the caller to select how the
+ * S3RequestContext services the requests that it manages.  All of the
+ * S3_XXX_request_context functions may be used with a request context of any
+ * mode.  For a request context of mode S3RequestContextModeEpoll,
+ * S3_get_request_context_fdsets sets a single file descriptor into
+ * readFdSet, which becomes readable whenever any request has I/O available.
+ *
+ * @param requestContextReturn returns the newly-created S3RequestContext
+ *        structure, as for S3_create_request_context
+ * @param mode gives the mode of the new request context
+ * @return One of:
+ *         S3StatusOK if the request context was successfully created
+ *         S3StatusOutOfMemory if the request context could not be created due
+ *             to an out of memory error
+ *         S3StatusNotSupported if mode is not supported on this platform,
+ *             or is S3RequestContextModeExternal
+ *         S3StatusInternalError if the request context could not be created
+ *             due to some other error
+ **/
+S3Status S3_create_request_context_ex(S3RequestContext **requestContextReturn,
+                                      S3RequestContextMode mode);
+
+
+/**
+ * Creates an S3RequestContext of mode S3RequestContextModeExternal, for
+ * running requests from within an existing event loop.  Rather than being run
+ * by S3_runall_request_context() or S3_runonce_request_context(), such a
+ * request context tells the event loop what to wait for via socketCallback
+ * and timerCallback, and the event loop calls
+ * S3_process_request_context_socket() and
+ * S3_process_request_context_timeout() as those events occur.
+ * S3_runall_request_context() and S3_get_request_context_fdsets() return
+ * S3StatusNotSupported for a request context of this mode, and
+ * S3_runonce_request_context() only processes an expired timeout.
+ *
+ * @param requestContextReturn returns the newly-created S3RequestContext
+ *        structure, as for S3_create_request_context
+ * @param socketCallback is called whenever the events to watch for on a
+ *        socket change
+ * @param timerCallback is called whenever the timeout to wait for changes
+ * @param callbackData is passed to socketCallback and timerCallback
+ * @return One of:
+ *         S3StatusOK if the request context was successfully created
+ *         S3StatusOutOfMemory if the request context could not be created due
+ *             to an out of memory error
+ **/
+S3Status S3_create_request_context_external
+    (S3RequestContext **requestContextReturn,
+     S3SocketCallback *socketCallback, S3TimerCallback *timerCallback,
+     void *callbackData);
+
+
 /**
  * Destroys an S3RequestContext which was created with
- * S3_create_request_context.  Any requests which are currently being
+ * S3_create_request_context, S3_create_request_context_ex or
+ * S3_create_request_context_external.  Any requests which are currently being
  * processed by the S3RequestContext will immediately be aborted and their
  * request completed callbacks made with the status S3StatusInterrupted.
+ * Operations waiting to retry a request are finished in the same way.
  *
  * @param requestContext is the S3RequestContext to destroy
  **/
@@ -1624,7 +2649,8 @@ S3Status S3_runall_request_context(S3RequestContext *requestContext);
  * @param requestContext is the S3RequestContext to process
  * @param requestsRemainingReturn returns the number of requests remaining
  *            and not yet completed within the S3RequestContext after this
- *            function returns.
+ *            function returns.  Requests which are waiting to be retried,
+ *            such as those of S3_put_object_multipart(), are counted too.
  * @return One of:
  *         S3StatusOK if request processing proceeded without error
  *         S3StatusConnectionFailed if the socket connection to the server
@@ -1640,6 +2666,60 @@ S3Status S3_runonce_request_context(S3RequestContext *requestContext,
                                     int *requestsRemainingReturn);
 
 
+/**
+ * Processes I/O on a single socket of an S3RequestContext created with
+ * S3_create_request_context_external(), or of mode
+ * S3RequestContextModeEpoll.  This should be called by the event loop when
+ * one of the events most recently requested for fd by the request context's
+ * S3SocketCallback occurs.  As with S3_runonce_request_context, callbacks may
+ * be made on requests, and requests may complete.
+ *
+ * @param requestContext is the S3RequestContext to process
+ * @param fd is the socket on which events occurred
+ * @param events is any combination of S3_SOCKET_EVENT_READ,
+ *        S3_SOCKET_EVENT_WRITE and S3_SOCKET_EVENT_ERROR
+ * @param requestsRemainingReturn returns the number of requests remaining
+ *            and not yet completed within the S3RequestContext after this
+ *            function returns.
+ * @return One of:
+ *         S3StatusOK if request processing proceeded without error
+ *         S3StatusNotSupported if requestContext is of mode
+ *             S3RequestContextModeSelect
+ *         S3StatusInternalError if an internal error prevented the
+ *             S3RequestContext from running one or more requests
+ *         S3StatusOutOfMemory if requests could not be processed due to
+ *             an out of memory error
+ **/
+S3Status S3_process_request_context_socket(S3RequestContext *requestContext,
+                                           int fd, int events,
+                                           int *requestsRemainingReturn);
+
+
+/**
+ * Processes timeouts of an S3RequestContext created with
+ * S3_create_request_context_external(), or of mode
+ * S3RequestContextModeEpoll.  This should be called by the event loop when
+ * the timer most recently requested by the request context's S3TimerCallback
+ * expires.  As with S3_runonce_request_context, callbacks may be made on
+ * requests, and requests may complete.
+ *
+ * @param requestContext is the S3RequestContext to process
+ * @param requestsRemainingReturn returns the number of requests remaining
+ *            and not yet completed within the S3RequestContext after this
+ *            function returns.
+ * @return One of:
+ *         S3StatusOK if request processing proceeded without error
+ *         S3StatusNotSupported if requestContext is of mode
+ *             S3RequestContextModeSelect
+ *         S3StatusInternalError if an internal error prevented the
+ *             S3RequestContext from running one or more requests
+ *         S3StatusOutOfMemory if requests could not be processed due to
+ *             an out of memory error
+ **/
+S3Status S3_process_request_context_timeout(S3RequestContext *requestContext,
+                                            int *requestsRemainingReturn);
+
+
 /**
  * This function, in conjunction allows callers to manually manage a set of
  * requests using an S3RequestContext.  This function returns the set of file
@@ -1683,7 +2763,9 @@ S3Status S3_get_request_context_fdsets(S3RequestContext *requestContext,
  * longer than this) to ensure that internal timeout code of libs3 can work
  * properly.  This function should be called right before select() each time
  * select() on the request_context fdsets are to be performed by the libs3
- * user.
+ * user.  It also allows for requests waiting to be retried, which are made
+ * by S3_runonce_request_context once their delay has passed, even if no
+ * file descriptors are set.
  *
  * @param requestContext is the S3RequestContext to get the timeout from
  * @return the maximum number of milliseconds to select() on fdsets.  Callers
@@ -1705,6 +2787,130 @@ void S3_set_request_context_verify_peer(S3RequestContext *requestContext,
                                         int verifyPeer);
 
 
+/** **************************************************************************
+ * Connection Statistics Functions
+ ************************************************************************** **/
+
+/**
+ * Returns counters describing connection and TLS session re-use by all
+ * requests made since S3_initialize() or the last call to
+ * S3_reset_connection_stats().
+ *
+ * @param statsReturn returns the counters
+ **/
+void S3_get_connection_stats(S3ConnectionStats *statsReturn);
+
+
+/**
+ * Resets all counters returned by S3_get_connection_stats() to zero.
+ **/
+void S3_reset_connection_stats();
+
+
+/**
+ * Sets a callback to be made with the timings, byte counts, and connection
+ * details of each HTTP request made by libs3 as it completes; including
+ * each of the requests making up operations such as
+ * S3_put_object_multipart().  This is NOT thread-safe, and should be called
+ * while no requests are being made.
+ *
+ * @param callback is the callback to make, or NULL to make none, which is
+ *        the default
+ * @param callbackData will be passed in as the callbackData parameter of
+ *        the callback
+ **/
+void S3_set_request_stats_callback(S3RequestStatsCallback *callback,
+                                   void *callbackData);
+
+
+/**
+ * Sets a callback to be made at each event in the life of each HTTP request
+ * made by libs3, from its creation to its completion, such as for emitting
+ * the spans of a distributed trace.  When no callback is set, tracing costs
+ * nothing beyond a check of whether one is.  This is NOT thread-safe, and
+ * should be called while no requests are being made.
+ *
+ * @param callback is the callback to make, or NULL to make none, which is
+ *        the default
+ * @param callbackData will be passed in as the callbackData parameter of
+ *        the callback
+ **/
+void S3_set_trace_callback(S3TraceCallback *callback, void *callbackData);
+
+
+/** **************************************************************************
+ * Metrics Functions
+ ************************************************************************** **/
+
+/**
+ * Returns a snapshot of the metrics of all requests made since
+ * S3_initialize() or the last call to S3_reset_metrics().  Metrics are only
+ * recorded if S3_INIT_METRICS was passed to S3_initialize(); otherwise the
+ * snapshot is empty.
+ *
+ * @param metricsReturn returns the snapshot, which must be freed with
+ *        S3_free_metrics()
+ * @return S3StatusOK on success, or S3StatusOutOfMemory
+ **/
+S3Status S3_get_metrics(S3Metrics **metricsReturn);
+
+
+/**
+ * Frees a snapshot returned by S3_get_metrics().
+ *
+ * @param metrics is the snapshot to free
+ **/
+void S3_free_metrics(S3Metrics *metrics);
+
+
+/**
+ * Resets the counts and histograms of all metrics to zero.  The number of
+ * requests in flight is not reset.  Requests completing at the same time
+ * may be recorded either before or after the reset.
+ **/
+void S3_reset_metrics();
+
+
+/**
+ * Returns the latency below which a given percentage of the requests of a
+ * series fell, to within the precision of its histogram.
+ *
+ * @param series is the series
+ * @param percentile is the percentage, from 0 to 100, such as 99.9
+ * @return the latency, in microseconds, or 0 if the series has no requests
+ **/
+uint64_t S3_get_metrics_percentile(const S3MetricsSeries *series,
+                                   double percentile);
+
+
+/**
+ * Returns a string naming an S3Operation, such as "get_object"
+ *
+ * @param operation is the operation
+ * @return the name of the operation
+ **/
+const char *S3_get_operation_name(S3Operation operation);
+
+
+/**
+ * Formats a snapshot of metrics in the Prometheus text exposition format.
+ * Latencies are given as histograms in seconds, whose buckets range from
+ * one millisecond to one minute; each request is counted in the smallest
+ * bucket which is certain to include it given the precision of the
+ * histogram of its series.
+ *
+ * @param metrics is the snapshot to format
+ * @param buffer is the buffer to format the metrics into; the output is
+ *        truncated, but always terminated, if it does not fit
+ * @param bufferSize is the size of buffer, in bytes
+ * @return the length of the output, not counting the terminating 0; if
+ *         this is bufferSize or more, the output was truncated, and a
+ *         buffer of at least one more than this many bytes is needed
+ **/
+int S3_format_metrics_prometheus(const S3Metrics *metrics, char *buffer,
+                                 int bufferSize);
+
+
 /** **************************************************************************
  * S3 Utility Functions
  ************************************************************************** **/
@@ -1923,6 +3129,189 @@ void S3_list_bucket(const S3BucketContext *bucketContext,
                     const S3ListBucketHandler *handler, void *callbackData);
 
 
+/**
+ * Lists keys within a bucket, as S3_list_bucket does, but with control over
+ * how many items are passed to each call of the listBucketCallback.
+ * S3_list_bucket calls it for every 32 keys or 8 common prefixes.  The
+ * strings of each call are packed into a single buffer owned by the
+ * request, which grows only as large as the batch requires.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param prefix if present and non-empty, gives a prefix for matching keys
+ * @param marker if present and non-empty, only keys occuring after this value
+ *        will be listed
+ * @param delimiter if present and non-empty, causes keys that contain the
+ *        same string between the prefix and the first occurrence of the
+ *        delimiter to be rolled up into a single result element
+ * @param maxkeys is the maximum number of keys to return
+ * @param batchSize if greater than 0, the listBucketCallback is called each
+ *        time this many keys, or this many common prefixes, have been read.
+ *        If 0, it is called once, with everything in the response.
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param timeoutMs if not 0 contains total request timeout in milliseconds
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_list_bucket_ex(const S3BucketContext *bucketContext,
+                       const char *prefix, const char *marker,
+                       const char *delimiter, int maxkeys, int batchSize,
+                       S3RequestContext *requestContext,
+                       int timeoutMs,
+                       const S3ListBucketHandler *handler, void *callbackData);
+
+
+/**
+ * Lists keys within a bucket using the ListObjectsV2 API.  Pages are
+ * chained by continuation tokens rather than by keys, which keeps paging
+ * stable while keys are being written.  Owner information is only returned,
+ * and parsed, if fetchOwner is set.  The listBucketCallback is called as for
+ * S3_list_bucket_ex, with the NextContinuationToken of the response in
+ * place of the next marker.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param prefix if present and non-empty, gives a prefix for matching keys
+ * @param continuationToken if present and non-empty, continues the listing
+ *        from the NextContinuationToken of a previous, truncated response
+ * @param startAfter if present and non-empty, only keys occuring after this
+ *        value will be listed; ignored by S3 if continuationToken is given
+ * @param delimiter if present and non-empty, causes keys that contain the
+ *        same string between the prefix and the first occurrence of the
+ *        delimiter to be rolled up into a single result element
+ * @param maxkeys is the maximum number of keys to return
+ * @param fetchOwner if nonzero, the owner of each key is returned
+ * @param batchSize if greater than 0, the listBucketCallback is called each
+ *        time this many keys, or this many common prefixes, have been read.
+ *        If 0, it is called once, with everything in the response.
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param timeoutMs if not 0 contains total request timeout in milliseconds
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_list_objects_v2(const S3BucketContext *bucketContext,
+                        const char *prefix, const char *continuationToken,
+                        const char *startAfter, const char *delimiter,
+                        int maxkeys, int fetchOwner, int batchSize,
+                        S3RequestContext *requestContext,
+                        int timeoutMs,
+                        const S3ListBucketHandler *handler,
+                        void *callbackData);
+
+
+/**
+ * Lists all keys within a bucket which begin with a prefix, by listing
+ * partitions of the keyspace concurrently.  A single listing is serial,
+ * since each page of it needs the continuation token of the previous one;
+ * this splits the keyspace as options directs, and lists every partition
+ * with ListObjectsV2 requests of its own.  Common prefixes found for
+ * splitting are not themselves reported.
+ *
+ * The requests involved are all added to requestContext, more being added
+ * as earlier ones complete, so the whole operation proceeds as the request
+ * context is run.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request; it is copied, and need not remain valid after this call
+ * @param prefix if present and non-empty, only keys beginning with it are
+ *        listed
+ * @param options optionally controls how the keyspace is split and listed;
+ *        if NULL, the bucket is listed as a single partition.  It is copied,
+ *        and need not remain valid after this call.
+ * @param requestContext if non-NULL, gives the S3RequestContext to add the
+ *        requests of this operation to, and does not perform them
+ *        immediately.  If NULL, performs the operation immediately and
+ *        synchronously.
+ * @param timeoutMs if not 0 contains the timeout, in milliseconds, of each
+ *        of the requests making up the operation
+ * @param handler gives the callbacks to call as the operation is processed
+ *        and completed; it is copied, and need not remain valid after this
+ *        call
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this operation
+ **/
+void S3_list_bucket_parallel(const S3BucketContext *bucketContext,
+                             const char *prefix,
+                             const S3ParallelListOptions *options,
+                             S3RequestContext *requestContext, int timeoutMs,
+                             const S3ParallelListHandler *handler,
+                             void *callbackData);
+
+
+/**
+ * Creates an iterator over the keys within a bucket which begin with a
+ * prefix.  Unlike the other list functions, which call back with keys from
+ * within the transfer of each response, the iterator is pulled from by the
+ * caller, with S3_list_iterator_next(), at whatever pace suits it.  A
+ * thread of the iterator's own makes the ListObjectsV2 requests, listing
+ * pages ahead of the caller while it processes the keys of earlier ones,
+ * and pausing between requests while options->prefetchPages pages are
+ * waiting.  A slow caller thus never holds up a transfer, which could
+ * otherwise be aborted as too slow.
+ *
+ * Failed requests for which S3_status_is_retryable() is true are retried,
+ * and no key is iterated over twice.
+ *
+ * @param bucketContext gives the bucket and associated parameters for the
+ *        requests; it is copied, and need not remain valid after this call
+ * @param prefix if present and non-empty, only keys beginning with it are
+ *        listed
+ * @param options optionally controls the listing; it is copied, and need
+ *        not remain valid after this call
+ * @param timeoutMs if not 0 contains the timeout, in milliseconds, of each
+ *        of the list requests
+ * @param iteratorReturn returns the new iterator, which must be destroyed
+ *        with S3_destroy_list_iterator()
+ * @return S3StatusOK if the iterator was created and has started listing,
+ *         or an error status if not
+ **/
+S3Status S3_create_list_iterator(const S3BucketContext *bucketContext,
+                                 const char *prefix,
+                                 const S3ListIteratorOptions *options,
+                                 int timeoutMs,
+                                 S3ListIterator **iteratorReturn);
+
+
+/**
+ * Moves an iterator on to the next key or common prefix of the listing, in
+ * ascending order, waiting for it to be listed if it has not been yet.  The
+ * strings returned remain valid until the next call to this function for
+ * the iterator, or until it is destroyed.
+ *
+ * @param iterator is the iterator to move on
+ * @param contentReturn returns the next key, or NULL if the next item is a
+ *        common prefix or the listing is finished
+ * @param commonPrefixReturn if non-NULL, returns the next common prefix, or
+ *        NULL if the next item is a key or the listing is finished.  If
+ *        NULL, common prefixes are skipped over.
+ * @return S3StatusOK if the iterator moved on, or reached the end of the
+ *         listing, which is when both of contentReturn and
+ *         commonPrefixReturn return NULL; otherwise, the status of the
+ *         request which failed, after which every call returns it again
+ **/
+S3Status S3_list_iterator_next(S3ListIterator *iterator,
+                               const S3ListBucketContent **contentReturn,
+                               const char **commonPrefixReturn);
+
+
+/**
+ * Destroys an iterator, interrupting any request that it has in flight and
+ * freeing every page that it holds.  This may be called at any point in the
+ * listing.
+ *
+ * @param iterator is the iterator to destroy
+ **/
+void S3_destroy_list_iterator(S3ListIterator *iterator);
+
+
 /** **************************************************************************
  * Object Functions
  ************************************************************************** **/
@@ -2084,6 +3473,107 @@ void S3_get_object(const S3BucketContext *bucketContext, const char *key,
                    const S3GetObjectHandler *handler, void *callbackData);
 
 
+/**
+ * Gets an object or a byte range of it, as S3_get_object() does, except
+ * that instead of passing the data to a callback, libs3 places it directly
+ * in the destination given.  This saves the caller a copy of every byte out
+ * of a data callback's buffer, and the cost of the callback itself; it is
+ * best suited to reading fixed-size blocks straight into their final place,
+ * such as cache pages.  Many such requests may be added to one request
+ * context, each completing on its own.
+ *
+ * If the response holds more data than fits in the destination, or than
+ * byteCount, if nonzero, the request fails with
+ * S3StatusDestinationTooSmall.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to get
+ * @param getConditions if non-NULL, gives a set of conditions which must be
+ *        met in order for the request to succeed
+ * @param startByte gives the start byte for the byte range of the contents
+ *        to be returned
+ * @param byteCount gives the number of bytes to return; a value of 0
+ *        indicates that the contents up to the end should be returned
+ * @param destination gives where to place the data; it is copied, and need
+ *        not remain valid after this call, but the memory or file that it
+ *        describes must remain valid until the request completes
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param timeoutMs if not 0 contains total request timeout in milliseconds
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_get_object_into(const S3BucketContext *bucketContext,
+                        const char *key,
+                        const S3GetConditions *getConditions,
+                        uint64_t startByte, uint64_t byteCount,
+                        const S3GetDestination *destination,
+                        S3RequestContext *requestContext, int timeoutMs,
+                        const S3GetObjectIntoHandler *handler,
+                        void *callbackData);
+
+
+/**
+ * Downloads an object into a file, using several connections at once.  The
+ * object is first HEADed to learn its size and ETag; the file is then sized
+ * to match, and the object is downloaded as a number of byte ranges, with
+ * up to a configurable number of them in flight at once, each written
+ * directly to its offset in the file.  A range which fails with a
+ * retryable status (as given by S3_status_is_retryable(), or
+ * S3StatusErrorSlowDown) is retried on its own.  Every range is requested on
+ * condition that the object's ETag is still the one returned by the HEAD,
+ * so that the file never mixes the data of two versions of the object.  If
+ * the HEAD returns no ETag, the object is instead downloaded with a single
+ * GET, which is retried from its beginning.
+ *
+ * Retries of the HEAD and of ranges are delayed as for
+ * S3_put_object_multipart(), without holding up requestContext.
+ *
+ * The requests involved are all added to requestContext, more being added
+ * as earlier ones complete, so the whole download proceeds as the request
+ * context is run.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request; it is copied, and need not remain valid after this call
+ * @param key is the key of the object to get
+ * @param getConditions if non-NULL, gives a set of conditions which must be
+ *        met in order for the download to succeed; it is copied, and need
+ *        not remain valid after this call
+ * @param fd is the file to write the object to, from offset 0; it must be
+ *        a regular file (or something else seekable which can be sized
+ *        with ftruncate()).  Its file offset is not used, and is not changed
+ *        except on Windows.  If the download fails, the file may have been
+ *        partially written.
+ * @param options optionally controls how the object is downloaded; if
+ *        NULL, the defaults are used
+ * @param requestContext if non-NULL, gives the S3RequestContext to add the
+ *        requests of this download to, and does not perform them
+ *        immediately.  If NULL, performs the download immediately and
+ *        synchronously.
+ * @param timeoutMs if not 0 contains the timeout, in milliseconds, of each
+ *        of the requests making up the download
+ * @param handler gives the callbacks to call as the download is processed
+ *        and completed.  The properties callback is made once, with the
+ *        properties of the object returned by the HEAD request.  The
+ *        complete callback is made exactly once, when the download as a
+ *        whole has succeeded or failed.  The handler is copied, and need not
+ *        remain valid after this call.
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this download
+ **/
+void S3_get_object_to_fd(const S3BucketContext *bucketContext,
+                         const char *key,
+                         const S3GetConditions *getConditions, int fd,
+                         const S3ParallelGetOptions *options,
+                         S3RequestContext *requestContext, int timeoutMs,
+                         const S3ResponseHandler *handler,
+                         void *callbackData);
+
+
 /**
  * Gets the response properties for the object, but not the object contents.
  *
@@ -2473,7 +3963,8 @@ void S3_list_parts(S3BucketContext *bucketContext, const char *key,
  *        listed.
  * @param timeoutMs if not 0 contains total request timeout in milliseconds
  * @param handler gives the callbacks to call as the request is processed and
- *        completed
+ *        completed; they are passed 0 as their callbackData.  The request is
+ *        always performed synchronously.
  **/
 void S3_abort_multipart_upload(S3BucketContext *bucketContext, const char *key,
                                const char *uploadId,
@@ -2521,6 +4012,68 @@ void S3_list_multipart_uploads(S3BucketContext *bucketContext,
                                const S3ListMultipartUploadsHandler *handler,
                                void *callbackData);
 
+
+/**
+ * Uploads an object as a multipart upload: initiates the upload, uploads
+ * its parts with up to a configurable number of them in flight at once,
+ * retrying any part that fails with a retryable status (as given by
+ * S3_status_is_retryable(), or S3StatusErrorSlowDown), and then completes
+ * the upload.  If the upload fails once it has been initiated, it is
+ * aborted, so that S3 discards the parts already uploaded.
+ *
+ * Each retry of a request is delayed, by 100 ms for the first and twice as
+ * long for each one after, up to 5 seconds.  Nothing waits out the delay:
+ * other parts, and the other requests of requestContext, carry on, and the
+ * retry is made as requestContext is run once the delay has passed.  The
+ * delay is allowed for by S3_get_request_context_timeout() and by the
+ * S3TimerCallback of an external request context.
+ * A commit which S3 answers with a 200 response carrying no ETag (as it does
+ * when it fails after starting to respond) is retried in the same way.
+ *
+ * This is the equivalent of S3_initiate_multipart(), S3_upload_part() and
+ * S3_complete_multipart_upload() combined; the requests involved are all
+ * added to requestContext, more being added as earlier ones complete, so
+ * the whole upload proceeds as the request context is run.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request; it is copied, and need not remain valid after this call
+ * @param key is the key of the object to put
+ * @param contentLength is the size of the object, in bytes
+ * @param putProperties optionally provides additional properties to apply
+ *        to the object; it is copied, and need not remain valid after this
+ *        call.  Its md5 field is ignored.
+ * @param sourceType identifies where the data of the object comes from
+ * @param sourceBuffer is the data of the object, if sourceType is
+ *        S3MultipartSourceTypeBuffer; it must remain valid until the upload
+ *        is complete
+ * @param sourceFd is the file descriptor to read the data of the object
+ *        from, if sourceType is S3MultipartSourceTypeFd
+ * @param sourceFdOffset is the offset within sourceFd at which the data of
+ *        the object begins, if sourceType is S3MultipartSourceTypeFd
+ * @param options optionally controls how the object is uploaded; if NULL,
+ *        the defaults are used
+ * @param requestContext if non-NULL, gives the S3RequestContext to add the
+ *        requests of this upload to, and does not perform them immediately.
+ *        If NULL, performs the upload immediately and synchronously.
+ * @param timeoutMs if not 0 contains the timeout, in milliseconds, of each
+ *        of the requests making up the upload
+ * @param handler gives the callbacks to call as the upload is processed and
+ *        completed; it is copied, and need not remain valid after this call
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this upload
+ **/
+void S3_put_object_multipart(const S3BucketContext *bucketContext,
+                             const char *key, uint64_t contentLength,
+                             const S3PutProperties *putProperties,
+                             S3MultipartSourceType sourceType,
+                             const char *sourceBuffer, int sourceFd,
+                             int64_t sourceFdOffset,
+                             const S3MultipartUploadOptions *options,
+                             S3RequestContext *requestContext,
+                             int timeoutMs,
+                             const S3MultipartUploadHandler *handler,
+                             void *callbackData);
+
 #ifdef __cplusplus
 }
 #endif
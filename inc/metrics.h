@@ -0,0 +1,65 @@
+/** **************************************************************************
+ * metrics.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "libs3.h"
+#include "request.h"
+
+
+// Metrics functions
+// ----------------------------------------------------------------------------
+
+// The metrics of completed requests are kept in a fixed-size table of
+// series, one for each combination of operation, HTTP method and status.
+// Each series is allocated when the first request with its combination
+// completes, and claims its slot in the table with compare-and-swap; its
+// counters are then updated with atomic additions, so that recording a
+// request never takes a lock.
+
+// Initialize metrics; flags are as passed to S3_initialize(), and metrics
+// are only recorded if they include S3_INIT_METRICS
+void metrics_initialize(int flags);
+
+// Deinitialize metrics, freeing every series
+void metrics_deinitialize();
+
+// Returns nonzero if metrics are being recorded
+int metrics_enabled();
+
+// Returns the operation that a request performs
+S3Operation metrics_operation(const RequestParams *params);
+
+// Records that a request performing an operation has started
+void metrics_request_started(S3Operation operation);
+
+// Records a request which has completed, as described by its stats
+void metrics_request_finished(HttpRequestType httpRequestType,
+                              const S3RequestStats *stats);
+
+
+#endif /* METRICS_H */
@@ -0,0 +1,98 @@
+/** **************************************************************************
+ * mocks3.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#ifndef MOCKS3_H
+#define MOCKS3_H
+
+#include <stdint.h>
+#include "libs3.h"
+
+
+// A stand-in for S3 that keeps buckets and objects in memory, served over
+// plain HTTP/1.1 with keep-alive from threads within the calling process.  It
+// is not part of libs3; it exists so that tests and benchmarks can drive the
+// full request path reproducibly, without credentials or a network.
+//
+// It supports listing buckets; creating, deleting and listing (with both
+// versions of ListObjects) buckets; putting, copying, getting (including byte
+// ranges), heading and deleting objects; and multipart uploads, including
+// copied parts and the listing of parts and uploads.  Other sub-resources,
+// such as ACLs and lifecycles, fail with 501 NotImplemented.  Request
+// signatures are not checked, and only path style URIs are supported.
+//
+// Responses can be slowed down by a fixed latency and a bandwidth limit, and
+// a percentage of requests can be made to fail with 503 SlowDown, which
+// libs3 considers retryable.
+
+typedef struct MockS3 MockS3;
+
+
+typedef struct MockS3Options
+{
+    // Delay before each response is sent, in microseconds
+    int latencyUs;
+
+    // The most bytes per second that each connection sends or receives of
+    // request and response bodies, or 0 for no limit
+    int64_t bandwidth;
+
+    // The percentage of requests, from 0 to 100, that fail with 503 SlowDown
+    // instead of being performed
+    int errorPercent;
+
+    // Seeds the choice of the requests that fail
+    unsigned int seed;
+} MockS3Options;
+
+
+// Mock S3 functions
+// ----------------------------------------------------------------------------
+
+// Starts a mock S3 listening on an ephemeral port on 127.0.0.1, with no
+// buckets.  options may be 0 for no latency, bandwidth limit or errors.
+S3Status mocks3_start(MockS3 **mockReturn, const MockS3Options *options);
+
+// Stops the mock S3, closing all connections, and frees it along with
+// everything stored in it
+void mocks3_stop(MockS3 *mock);
+
+// Returns "127.0.0.1:<port>", suitable for use as an S3BucketContext
+// hostName; the bucket context must use S3ProtocolHTTP and S3UriStylePath
+const char *mocks3_host_name(const MockS3 *mock);
+
+// Returns the number of connections accepted and requests served so far
+void mocks3_get_counts(MockS3 *mock, uint64_t *connectionsReturn,
+                       uint64_t *requestsReturn);
+
+// Puts an object directly into the mock S3, without a request, creating its
+// bucket if it does not exist.  If data is 0, the object consists of size
+// 'x' characters.  This lets tests and benchmarks set up state quickly, and
+// regardless of any errors that are being injected.
+S3Status mocks3_put_object(MockS3 *mock, const char *bucketName,
+                           const char *key, const char *data, int64_t size);
+
+
+#endif /* MOCKS3_H */
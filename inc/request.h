@@ -30,8 +30,31 @@
 #include "libs3.h"
 #include "error_parser.h"
 #include "response_headers_handler.h"
+#include "signing_key_cache.h"
 #include "util.h"
 
+#ifdef __APPLE__
+#include <CommonCrypto/CommonHMAC.h>
+#define S3_SHA256_DIGEST_LENGTH CC_SHA256_DIGEST_LENGTH
+#else
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+#define S3_SHA256_DIGEST_LENGTH SHA256_DIGEST_LENGTH
+#endif
+
+// The longest credential scope (date/region/s3/aws4_request) used in a
+// signature
+#define SIGNATURE_SCOPE_SIZE 64
+
+// The number of bytes of object data carried by each chunk of an aws-chunked
+// (streaming signature) upload.  S3 requires at least 8 KB in every chunk but
+// the last.
+#define STREAMING_CHUNK_SIZE (64 * 1024)
+
+// The longest sub-resource name reported to the stats callback; all of
+// those that libs3 uses are shorter
+#define MAX_STATS_SUB_RESOURCE_SIZE 31
+
 // Describes a type of HTTP request (these are our supported HTTP "verbs")
 typedef enum
 {
@@ -108,6 +131,97 @@ typedef struct RequestParams
 } RequestParams;
 
 
+// The values computed from a RequestParams in order to sign it and to set up
+// the curl request for it
+typedef struct RequestComputedValues
+{
+    // All x-amz- headers, in normalized form (i.e. NAME: VALUE, no other ws)
+    char *amzHeaders[S3_MAX_METADATA_COUNT + 2]; // + 2 for acl and date
+
+    // The number of x-amz- headers
+    int amzHeadersCount;
+
+    // Storage for amzHeaders (the +256 is for x-amz-acl and x-amz-date)
+    char amzHeadersRaw[COMPACTED_METADATA_BUFFER_SIZE + 256 + 1];
+
+    // Length of populated data in raw buffer
+    int amzHeadersRawLength;
+
+    // Canonicalized headers for signature
+    string_multibuffer(canonicalizedSignatureHeaders,
+                       COMPACTED_METADATA_BUFFER_SIZE + 256 + 1);
+
+    // Delimited list of header names used for signature
+    char signedHeaders[COMPACTED_METADATA_BUFFER_SIZE];
+
+    // URL-Encoded key
+    char urlEncodedKey[MAX_URLENCODED_KEY_SIZE + 1];
+
+    // Canonicalized resource
+    char canonicalURI[MAX_CANONICALIZED_RESOURCE_SIZE + 1];
+
+    // Canonical sub-resource & query string
+    char canonicalQueryString[MAX_CANONICALIZED_RESOURCE_SIZE + 1];
+
+    // Cache-Control header (or empty)
+    char cacheControlHeader[128];
+
+    // Content-Type header (or empty)
+    char contentTypeHeader[128];
+
+    // Content-MD5 header (or empty)
+    char md5Header[128];
+
+    // Content-Disposition header (or empty)
+    char contentDispositionHeader[128];
+
+    // Content-Encoding header (or empty)
+    char contentEncodingHeader[128];
+
+    // Expires header (or empty)
+    char expiresHeader[128];
+
+    // If-Modified-Since header
+    char ifModifiedSinceHeader[128];
+
+    // If-Unmodified-Since header
+    char ifUnmodifiedSinceHeader[128];
+
+    // If-Match header
+    char ifMatchHeader[128];
+
+    // If-None-Match header
+    char ifNoneMatchHeader[128];
+
+    // Range header
+    char rangeHeader[128];
+
+    // Authorization header
+    char authorizationHeader[1024];
+
+    // Request date stamp
+    char requestDateISO8601[64];
+
+    // Credential used for authorization signature
+    char authCredential[MAX_CREDENTIAL_SIZE + 1];
+
+    // Computed request signature (hex string)
+    char requestSignatureHex[S3_SHA256_DIGEST_LENGTH * 2 + 1];
+
+    // Host header
+    char hostHeader[128];
+
+    // Hex string of hash of request payload
+    char payloadHash[S3_SHA256_DIGEST_LENGTH * 2 + 1];
+
+    // Credential scope of the signature
+    char signatureScope[SIGNATURE_SCOPE_SIZE + 1];
+
+    // Key that the signature was computed with
+    unsigned char signingKey[SIGNING_KEY_SIZE];
+} RequestComputedValues;
+
+
 // This is the stuff associated with a request that needs to be on the heap
 // (and thus live while a curl_multi is in use).
 typedef struct Request
@@ -144,6 +258,25 @@ typedef struct Request
     // Number of bytes total that readCallback has left to supply
     int64_t toS3CallbackBytesRemaining;
 
+    // Nonzero if the data from toS3Callback is being sent aws-chunked, each
+    // chunk signed with the signature of the one before it as the seed
+    int streamingSignature;
+
+    // What is needed to sign each chunk
+    unsigned char signingKey[SIGNING_KEY_SIZE];
+    char requestDateISO8601[17];
+    char signatureScope[SIGNATURE_SCOPE_SIZE + 1];
+    char previousSignatureHex[64 + 1];
+
+    // The encoded chunk being sent (allocated only for streaming signature
+    // requests), the length of it, and how much of it has been sent
+    char *chunkBuffer;
+    int chunkLength;
+    int chunkPosition;
+
+    // Set once the final, zero length, chunk has been encoded
+    int finalChunkEncoded;
+
     // Callback to be made that supplies data read from S3.
     // Might not be called.
     S3GetObjectDataCallback *fromS3Callback;
@@ -161,11 +294,41 @@ typedef struct Request
     // This is set to nonzero after the properties callback has been made
     int propertiesCallbackMade;
 
+    // This is set to nonzero after the request's connection has been
+    // recorded in the connection statistics
+    int connectionRecorded;
+
+    // Nonzero if the request's connection resumed a previous TLS session
+    int tlsSessionResumed;
+
+    // The request as described to the stats callback and to metrics; the
+    // strings are empty unless there is a stats callback and the request has
+    // them
+    HttpRequestType httpRequestType;
+    S3Operation operation;
+    char statsBucketName[S3_MAX_BUCKET_NAME_SIZE + 1];
+    char statsKey[S3_MAX_KEY_SIZE + 1];
+    char statsSubResource[MAX_STATS_SUB_RESOURCE_SIZE + 1];
+
     // Parser of errors
     ErrorParser errorParser;
+
+    // While the Request is idle in the request pool, the monotonic time in
+    // seconds at which it was released
+    int64_t idleSinceSeconds;
+
+    // If there is a trace callback, the ID of the request reported with its
+    // trace events, and a bit (1 << S3TraceEventType) for each event of the
+    // transfer that has been reported
+    uint64_t traceId;
+    int traceEvents;
 } Request;
 
 
+// As set by S3_set_trace_callback
+extern S3TraceCallback *requestTraceCallbackG;
+
+
 // Request functions
 // ----------------------------------------------------------------------------
 
@@ -187,5 +350,46 @@ void request_finish(Request *request);
 // Convert a CURLE code to an S3Status
 S3Status request_curl_code_to_status(CURLcode code);
 
+// Reports a trace event for [request], if there is a trace callback; when
+// there is not, this costs only the check for one
+#define request_trace(request, type)                                    \
+    do {                                                                \
+        if (requestTraceCallbackG) {                                    \
+            request_trace_event(request, type);                         \
+        }                                                               \
+    } while (0)
+
+// Reports a trace event for [request] to the trace callback, which must be
+// set.  The events of the transfer, from S3TraceEventConnectionAcquired to
+// S3TraceEventBodyComplete, are each reported at most once, and any of them
+// before [type] which libcurl gave no chance to observe are reported first.
+void request_trace_event(Request *request, S3TraceEventType type);
+
+
+// Request signing functions, used by request_perform to compute a request's
+// headers and signature; they are also run directly by the micro-benchmarks
+// ----------------------------------------------------------------------------
+
+// Computes all of [computed] for [params], as of the current time, including
+// the Authorization header.  If [forceUnsignedPayload] is nonzero, the
+// payload is not hashed into the signature even when it could have been.
+S3Status setup_request(const RequestParams *params,
+                       RequestComputedValues *computed,
+                       int forceUnsignedPayload);
+
+// Sorts and folds the x-amz- headers and the other signed headers of [values]
+// into its canonicalizedSignatureHeaders and signedHeaders
+void canonicalize_signature_headers(RequestComputedValues *values);
+
+// Appends the '&' separated parameters of [queryString], sorted by name, to
+// [result], which must have room for at least strlen(queryString) + 1 more
+// characters
+void sort_query_string(const char *queryString, char *result);
+
+// Computes the signature of the canonicalized request in [values], and the
+// Authorization header carrying it
+S3Status compose_auth_header(const RequestParams *params,
+                             RequestComputedValues *values);
+
 
 #endif /* REQUEST_H */
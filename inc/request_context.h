@@ -29,6 +29,27 @@
 
 #include "libs3.h"
 
+
+// A callback to be made once a monotonic time has passed, as the request
+// context that it is added to is run.  Operations use these to delay their
+// retries without holding up the other requests of the request context.  The
+// owner of a timer allocates it, typically within a larger structure, and it
+// must remain valid until its callback is made or it is removed.
+typedef struct RequestContextTimer
+{
+    // Monotonic time, in milliseconds, at which the callback is due
+    int64_t dueMs;
+
+    // Made with S3StatusOK once the timer is due, or with
+    // S3StatusInterrupted if the request context is destroyed first
+    void (*callback)(S3Status status, void *data);
+    void *data;
+
+    // Links the timers of a request context, in order of dueMs
+    struct RequestContextTimer *next;
+} RequestContextTimer;
+
+
 struct S3RequestContext
 {
     CURLM *curlm;
@@ -37,7 +58,50 @@ struct S3RequestContext
     long verifyPeer;
 
     struct Request *requests;
+
+    // How curlm is driven; see S3RequestContextMode
+    S3RequestContextMode mode;
+
+    // In every mode other than S3RequestContextModeSelect, curlm is driven
+    // by curl_multi_socket_action, and the following track its state.
+
+    // Number of transfers that curl reported as still running after the
+    // most recent call to curl_multi_socket_action
+    int runningCount;
+
+    // Monotonic time, in milliseconds, at which curl wants
+    // curl_multi_socket_action to be called with CURL_SOCKET_TIMEOUT, or -1
+    // if curl has no timeout pending
+    int64_t timeoutDeadlineMs;
+
+    // S3RequestContextModeEpoll only: the epoll instance watching curl's
+    // sockets
+    int epollFd;
+
+    // S3RequestContextModeExternal only: the callbacks telling the caller's
+    // event loop what to wait for, and the data to pass to them
+    S3SocketCallback *socketCallback;
+    S3TimerCallback *timerCallback;
+    void *callbackData;
+
+    // Timers waiting to be due, soonest first, and their number
+    RequestContextTimer *timers;
+    int timersCount;
 };
 
 
+// Returns the monotonic time in milliseconds, as used for timer due times
+int64_t request_context_now_ms();
+
+// Adds a timer to the request context; its dueMs, callback and data must be
+// set, and it must not already be in a request context
+void request_context_add_timer(S3RequestContext *requestContext,
+                               RequestContextTimer *timer);
+
+// Removes a timer from the request context without making its callback;
+// does nothing if the timer is not waiting in the request context
+void request_context_remove_timer(S3RequestContext *requestContext,
+                                  RequestContextTimer *timer);
+
+
 #endif /* REQUEST_CONTEXT_H */
@@ -0,0 +1,60 @@
+/** **************************************************************************
+ * request_pool.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#ifndef REQUEST_POOL_H
+#define REQUEST_POOL_H
+
+#include "request.h"
+
+
+// Request pool functions
+// ----------------------------------------------------------------------------
+
+// Idle Requests (and thus their curl handles, and the connections they hold)
+// are kept for re-use in two tiers: a small per-thread cache, which needs no
+// synchronization at all, and beneath that a global array of slots shared by
+// all threads, which is claimed and filled using compare-and-swap rather than
+// a lock.  Requests which have been idle for longer than the configured
+// maximum are destroyed instead of being re-used, since the server has most
+// likely closed their connections anyway.
+
+// Initialize the request pool; destroyRequest is used to destroy Requests
+// which the pool has no room for, or which have been idle too long
+S3Status request_pool_initialize(void (*destroyRequest)(Request *));
+
+// Deinitialize the request pool, destroying every Request in it, including
+// those cached by threads other than the calling thread
+void request_pool_deinitialize();
+
+// Returns an idle Request from the pool, or 0 if there is none
+Request *request_pool_get();
+
+// Returns a Request, which is no longer in use, to the pool; if the pool has
+// no room for it, it is destroyed
+void request_pool_release(Request *request);
+
+
+#endif /* REQUEST_POOL_H */
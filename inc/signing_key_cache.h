@@ -0,0 +1,67 @@
+/** **************************************************************************
+ * signing_key_cache.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#ifndef SIGNING_KEY_CACHE_H
+#define SIGNING_KEY_CACHE_H
+
+#include "libs3.h"
+
+// Size in bytes of an AWS Signature Version 4 signing key (a SHA-256 HMAC)
+#define SIGNING_KEY_SIZE 32
+
+
+// Signing key functions
+// ----------------------------------------------------------------------------
+
+// The AWS4 signing key only depends upon the secret access key, the date
+// (YYYYMMDD), and the region, so it changes at most once per day per
+// credential and region.  Rather than running the four-HMAC derivation chain
+// for every request, derived keys are cached, one per (access key ID,
+// region), and re-derived whenever the date or the secret access key
+// associated with that access key ID changes.
+
+// Initialize the signing key cache
+void signing_key_cache_initialize();
+
+// Deinitialize the signing key cache, wiping all cached keys
+void signing_key_cache_deinitialize();
+
+// Derives the signing key for [secretAccessKey], [date] (only the first 8
+// characters, YYYYMMDD, are used) and [region] into [keyReturn], which must
+// be at least SIGNING_KEY_SIZE bytes.  This always runs the full derivation
+// and never consults the cache.
+void signing_key_derive(const char *secretAccessKey, const char *date,
+                        const char *region, unsigned char *keyReturn);
+
+// Same as signing_key_derive, but returns a cached key if one has already
+// been derived for [accessKeyId] and [region] with the same secret access key
+// and date.  Safe to call from multiple threads simultaneously.
+void signing_key_cache_get(const char *accessKeyId,
+                           const char *secretAccessKey, const char *date,
+                           const char *region, unsigned char *keyReturn);
+
+
+#endif /* SIGNING_KEY_CACHE_H */
@@ -43,8 +43,85 @@
 typedef S3Status (SimpleXmlCallback)(const char *elementPath, const char *data,
                                      int dataLen, void *callbackData);
 
+
+// Simple XML element callback.
+//
+// Like SimpleXmlCallback, but is also given the element ID of the element
+// from the SimpleXmlElements that the SimpleXml was initialized with; this
+// is 0 for any element which is not one of the element paths of the
+// SimpleXmlElements.
+typedef S3Status (SimpleXmlElementCallback)(int elementId,
+                                            const char *elementPath,
+                                            const char *data, int dataLen,
+                                            void *callbackData);
+
+
+// The most distinct element paths and path prefixes that a SimpleXmlElements
+// can hold
+#define SIMPLEXML_MAX_ELEMENT_NODES 32
+
+// The most character data that the built-in tokenizer gathers up to pass to
+// the callback in one piece
+#define SIMPLEXML_TEXT_SIZE 1024
+
+// The size of the hash table of a SimpleXmlElements; a power of two
+#define SIMPLEXML_ELEMENT_SLOTS 512
+
+// One element (path component) of a SimpleXmlElements
+typedef struct SimpleXmlElementNode
+{
+    // Name of the element, which is not terminated
+    const char *name;
+
+    int nameLen;
+
+    // Index of the parent node, or -1 for a root element
+    int parent;
+
+    // Element ID of the path ending with this element, or 0 if it is only a
+    // prefix of element paths
+    int id;
+} SimpleXmlElementNode;
+
+// A set of element paths to be identified by small integer element IDs
+// rather than by comparing element paths.  The element ID of paths[i] is i;
+// paths[0], and any other element of paths, may be 0 to leave its element ID
+// unused.  These are meant to be static, declared with SIMPLEXML_ELEMENTS;
+// they are compiled into a perfect hash of (parent, element name) upon first
+// use, so that each element costs one hash and one comparison no matter how
+// many element paths there are.
+typedef struct SimpleXmlElements
+{
+    const char * const *paths;
+
+    int pathsCount;
+
+    // The rest is filled in when the element paths are compiled
+    int compiled;
+
+    S3Status compileStatus;
+
+    unsigned int hashSeed;
+
+    int nodesCount;
+
+    SimpleXmlElementNode nodes[SIMPLEXML_MAX_ELEMENT_NODES];
+
+    // Index + 1 of the node hashed to each slot, or 0 for none
+    unsigned char slots[SIMPLEXML_ELEMENT_SLOTS];
+} SimpleXmlElements;
+
+#define SIMPLEXML_ELEMENTS(pathsArray)                                  \
+    { .paths = pathsArray,                                              \
+      .pathsCount = sizeof(pathsArray) / sizeof(pathsArray[0]) }
+
+
 typedef struct SimpleXml
 {
+    // Nonzero if this is parsed by the built-in tokenizer rather than by
+    // libxml2
+    int builtin;
+
     void *xmlParser;
 
     SimpleXmlCallback *callback;
@@ -56,16 +133,61 @@ typedef struct SimpleXml
     int elementPathLen;
 
     S3Status status;
+
+    // Only for a SimpleXml initialized with simplexml_initialize_elements:
+    // the element paths, the element callback, the node of the current
+    // element (-1 at the root), and the number of elements that the current
+    // element is nested below that node without having a node of its own
+    SimpleXmlElements *elements;
+
+    SimpleXmlElementCallback *elementCallback;
+
+    int elementNode;
+
+    int unmatchedDepth;
+
+    // The state of the built-in tokenizer, which is kept between calls to
+    // simplexml_add() since tokens may be split across them: the token
+    // being parsed, a count or position whose meaning depends upon it, the
+    // start in elementPath of the name an end tag must match, the quote
+    // character ending an attribute value, and an entity reference
+    int tokenState;
+
+    int tokenIndex;
+
+    int endNameStart;
+
+    char quote;
+
+    char entity[12];
+
+    int entityLen;
+
+    // Character data of the current element gathered by the built-in
+    // tokenizer, which has not been passed to the callback yet
+    char text[SIMPLEXML_TEXT_SIZE];
+
+    int textLen;
 } SimpleXml;
 
 
 // Simple XML parsing
 // ----------------------------------------------------------------------------
 
+// Selects the parser used by SimpleXmls initialized from now on: libxml2, or
+// the built-in tokenizer if S3_INIT_BUILTIN_XML is set in flags
+void simplexml_api_initialize(int flags);
+
 // Always call this, even if the simplexml doesn't end up being used
 void simplexml_initialize(SimpleXml *simpleXml, SimpleXmlCallback *callback,
                           void *callbackData);
 
+// Alternative to simplexml_initialize, for callbacks to be given element IDs
+void simplexml_initialize_elements(SimpleXml *simpleXml,
+                                   SimpleXmlElements *elements,
+                                   SimpleXmlElementCallback *callback,
+                                   void *callbackData);
+
 S3Status simplexml_add(SimpleXml *simpleXml, const char *data, int dataLen);
 
 
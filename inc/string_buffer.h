@@ -28,6 +28,7 @@
 #define STRING_BUFFER_H
 
 #include <stdio.h>
+#include <string.h>
 
 
 // Declare a string_buffer with the given name of the given maximum length
@@ -45,18 +46,18 @@
 
 
 // Append [len] bytes of [str] to [sb], setting [all_fit] to 1 if it fit, and
-// 0 if it did not
+// 0 if it did not, in which case as much of it as fits is appended
 #define string_buffer_append(sb, str, len, all_fit)                     \
     do {                                                                \
-        sb##Len += snprintf(&(sb[sb##Len]), sizeof(sb) - sb##Len - 1,   \
-                            "%.*s", (int) (len), str);                  \
-        if (sb##Len > (int) (sizeof(sb) - 1)) {                         \
-            sb##Len = sizeof(sb) - 1;                                   \
-            all_fit = 0;                                                \
-        }                                                               \
-        else {                                                          \
-            all_fit = 1;                                                \
+        int sbCopyLen = (int) (len);                                    \
+        int sbRoom = (int) (sizeof(sb) - 1) - sb##Len;                  \
+        all_fit = (sbCopyLen <= sbRoom);                                \
+        if (!all_fit) {                                                 \
+            sbCopyLen = sbRoom;                                         \
         }                                                               \
+        memcpy(&(sb[sb##Len]), str, sbCopyLen);                         \
+        sb##Len += sbCopyLen;                                           \
+        sb[sb##Len] = 0;                                                \
     } while (0)
 
 
@@ -78,19 +79,24 @@
     &(smb[smb##Size])
 
 
-// Adds a new string to the string_multibuffer
+// Adds a new string to the string_multibuffer, setting [all_fit] to 1 if it
+// fit, and 0 if it did not, in which case as much of it as fits is added and
+// the string_multibuffer is left full
 #define string_multibuffer_add(smb, str, len, all_fit)                  \
     do {                                                                \
-        smb##Size += (snprintf(&(smb[smb##Size]),                       \
-                               sizeof(smb) - smb##Size,                 \
-                               "%.*s", (int) (len), str) + 1);          \
-        if (smb##Size > (int) sizeof(smb)) {                            \
-            smb##Size = sizeof(smb);                                    \
+        int smbCopyLen = (int) (len);                                   \
+        int smbRoom = (int) (sizeof(smb) - 1) - smb##Size;              \
+        if (smbRoom < 0) {                                              \
             all_fit = 0;                                                \
+            break;                                                      \
         }                                                               \
-        else {                                                          \
-            all_fit = 1;                                                \
+        all_fit = (smbCopyLen <= smbRoom);                              \
+        if (!all_fit) {                                                 \
+            smbCopyLen = smbRoom;                                       \
         }                                                               \
+        memcpy(&(smb[smb##Size]), str, smbCopyLen);                     \
+        smb[smb##Size + smbCopyLen] = 0;                                \
+        smb##Size += (smbCopyLen + 1);                                  \
     } while (0)
 
 
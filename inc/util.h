@@ -87,4 +87,20 @@ uint64_t parseUnsignedInt(const char *str);
 // easy function to write in any case
 int is_blank(char c);
 
+// Returns the number of bytes that copy_string() will use to copy [str]
+size_t string_copy_size(const char *str);
+
+// Copies [str] to [*pos], advancing [*pos] past the copy, and returns the
+// copy.  Returns 0 if [str] is 0.
+const char *copy_string(char **pos, const char *str);
+
+// Returns the number of bytes that bucket_context_copy() will use to copy
+// the strings of [bucketContext]
+size_t bucket_context_copy_size(const S3BucketContext *bucketContext);
+
+// Copies [src] to [dest], with its strings copied to [*pos] as if by
+// copy_string()
+void bucket_context_copy(S3BucketContext *dest, char **pos,
+                         const S3BucketContext *src);
+
 #endif /* UTIL_H */
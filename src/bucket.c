@@ -284,7 +284,8 @@ void S3_create_bucket(S3Protocol protocol, const char *accessKeyId,
         cannedAcl,                               // cannedAcl
         0,                                       // metaDataCount
         0,                                       // metaData
-        0                                        // useServerSideEncryption
+        0,                                       // useServerSideEncryption
+        0                                        // useStreamingSignature
     };
 
     // Set up the RequestParams
@@ -412,31 +413,24 @@ void S3_delete_bucket(S3Protocol protocol, S3UriStyle uriStyle,
 
 // list bucket ----------------------------------------------------------------
 
-typedef struct ListBucketContents
-{
-    string_buffer(key, 1024);
-    string_buffer(lastModified, 256);
-    string_buffer(eTag, 256);
-    string_buffer(size, 24);
-    string_buffer(ownerId, 256);
-    string_buffer(ownerDisplayName, 256);
-} ListBucketContents;
-
+// The number of Contents and of CommonPrefixes passed to each callback by
+// S3_list_bucket
+#define MAX_CONTENTS 32
+#define MAX_COMMON_PREFIXES 8
 
-static void initialize_list_bucket_contents(ListBucketContents *contents)
+typedef struct ListBucketEntry
 {
-    string_buffer_initialize(contents->key);
-    string_buffer_initialize(contents->lastModified);
-    string_buffer_initialize(contents->eTag);
-    string_buffer_initialize(contents->size);
-    string_buffer_initialize(contents->ownerId);
-    string_buffer_initialize(contents->ownerDisplayName);
-}
+    // Offsets into the arena of the strings of a Contents, or -1 for those
+    // not present
+    int key;
+    int eTag;
+    int ownerId;
+    int ownerDisplayName;
+
+    int64_t lastModified;
+    uint64_t size;
+} ListBucketEntry;
 
-// We read up to 32 Contents at a time
-#define MAX_CONTENTS 32
-// We read up to 8 CommonPrefixes at a time
-#define MAX_COMMON_PREFIXES 8
 
 typedef struct ListBucketData
 {
@@ -448,24 +442,185 @@ typedef struct ListBucketData
     void *callbackData;
 
     string_buffer(isTruncated, 64);
+    // NextMarker, or for ListObjectsV2, NextContinuationToken
     string_buffer(nextMarker, 1024);
 
-    int contentsCount;
-    ListBucketContents contents[MAX_CONTENTS];
+    // The callback is made when this many Contents, or this many
+    // CommonPrefixes, have been read; 0 means only at the end of the response
+    int maxContents;
+    int maxCommonPrefixes;
+
+    // The strings of the Contents and CommonPrefixes read so far, packed one
+    // after another, each terminated by a 0.  Entries refer to their strings
+    // by offset, since the arena may move as it grows.
+    char *arena;
+    int arenaLen, arenaSize;
+    // Offset of the last string in the arena
+    int arenaLast;
+
+    int contentsCount, contentsSize;
+    ListBucketEntry *entries;
+    // The S3ListBucketContent passed to the callback, one per entry
+    S3ListBucketContent *contents;
+
+    int commonPrefixesCount, commonPrefixesSize;
+    int *commonPrefixOffsets;
+    const char **commonPrefixes;
+
+    // LastModified and Size of the Contents being read, converted when it
+    // ends
+    string_buffer(lastModified, 256);
+    string_buffer(size, 24);
 
-    int commonPrefixesCount;
-    char commonPrefixes[MAX_COMMON_PREFIXES][1024];
-    int commonPrefixLens[MAX_COMMON_PREFIXES];
+    // Set once the list callback has been made for this response
+    int listCallbackMade;
 } ListBucketData;
 
 
+static void initialize_list_bucket_entry(ListBucketEntry *entry)
+{
+    entry->key = -1;
+    entry->eTag = -1;
+    entry->ownerId = -1;
+    entry->ownerDisplayName = -1;
+    entry->lastModified = -1;
+    entry->size = 0;
+}
+
+
+// Grows the arrays holding Contents so that there is room for one more, and
+// initializes it
+static S3Status add_list_bucket_entry(ListBucketData *lbData)
+{
+    if (lbData->contentsCount == lbData->contentsSize) {
+        int size = lbData->contentsSize ? (2 * lbData->contentsSize) : 32;
+        if (lbData->maxContents && (size > lbData->maxContents)) {
+            size = lbData->maxContents;
+        }
+        ListBucketEntry *entries = (ListBucketEntry *)
+            realloc(lbData->entries, size * sizeof(ListBucketEntry));
+        if (!entries) {
+            return S3StatusOutOfMemory;
+        }
+        lbData->entries = entries;
+        S3ListBucketContent *contents = (S3ListBucketContent *)
+            realloc(lbData->contents, size * sizeof(S3ListBucketContent));
+        if (!contents) {
+            return S3StatusOutOfMemory;
+        }
+        lbData->contents = contents;
+        lbData->contentsSize = size;
+    }
+
+    initialize_list_bucket_entry(&(lbData->entries[lbData->contentsCount]));
+
+    return S3StatusOK;
+}
+
+
+// As add_list_bucket_entry, for CommonPrefixes
+static S3Status add_list_bucket_common_prefix(ListBucketData *lbData)
+{
+    if (lbData->commonPrefixesCount == lbData->commonPrefixesSize) {
+        int size = lbData->commonPrefixesSize ?
+            (2 * lbData->commonPrefixesSize) : 8;
+        if (lbData->maxCommonPrefixes && (size > lbData->maxCommonPrefixes)) {
+            size = lbData->maxCommonPrefixes;
+        }
+        int *offsets = (int *)
+            realloc(lbData->commonPrefixOffsets, size * sizeof(int));
+        if (!offsets) {
+            return S3StatusOutOfMemory;
+        }
+        lbData->commonPrefixOffsets = offsets;
+        const char **commonPrefixes = (const char **)
+            realloc(lbData->commonPrefixes, size * sizeof(const char *));
+        if (!commonPrefixes) {
+            return S3StatusOutOfMemory;
+        }
+        lbData->commonPrefixes = commonPrefixes;
+        lbData->commonPrefixesSize = size;
+    }
+
+    lbData->commonPrefixOffsets[lbData->commonPrefixesCount] = -1;
+
+    return S3StatusOK;
+}
+
+
+// Appends [len] bytes of [data] to the arena, terminated by a 0.  If
+// *offset is -1, they start a new string, and *offset is set to where it
+// starts; otherwise they are appended to the string at *offset.
+static S3Status arena_append(ListBucketData *lbData, int *offset,
+                             const char *data, int len)
+{
+    int start = lbData->arenaLen;
+    if (*offset != -1) {
+        // Only the last string can be extended; anything else means that an
+        // element was repeated within a Contents
+        if (*offset != lbData->arenaLast) {
+            return S3StatusXmlParseFailure;
+        }
+        // Overwrite the 0 terminating the string
+        start--;
+    }
+
+    if ((start + len + 1) > lbData->arenaSize) {
+        int size = lbData->arenaSize ? lbData->arenaSize : 4096;
+        while ((start + len + 1) > size) {
+            size *= 2;
+        }
+        char *arena = (char *) realloc(lbData->arena, size);
+        if (!arena) {
+            return S3StatusOutOfMemory;
+        }
+        lbData->arena = arena;
+        lbData->arenaSize = size;
+    }
+
+    memcpy(&(lbData->arena[start]), data, len);
+    lbData->arena[start + len] = 0;
+    lbData->arenaLen = start + len + 1;
+
+    if (*offset == -1) {
+        *offset = lbData->arenaLast = start;
+    }
+
+    return S3StatusOK;
+}
+
+
+// Starts a new batch; there must be room for at least one Contents and one
+// CommonPrefixes
 static void initialize_list_bucket_data(ListBucketData *lbData)
 {
+    lbData->arenaLen = 0;
+    lbData->arenaLast = -1;
     lbData->contentsCount = 0;
-    initialize_list_bucket_contents(lbData->contents);
+    initialize_list_bucket_entry(lbData->entries);
     lbData->commonPrefixesCount = 0;
-    lbData->commonPrefixes[0][0] = 0;
-    lbData->commonPrefixLens[0] = 0;
+    lbData->commonPrefixOffsets[0] = -1;
+    string_buffer_initialize(lbData->lastModified);
+    string_buffer_initialize(lbData->size);
+}
+
+
+static void free_list_bucket_data(ListBucketData *lbData)
+{
+    free(lbData->arena);
+    free(lbData->entries);
+    free(lbData->contents);
+    free(lbData->commonPrefixOffsets);
+    free(lbData->commonPrefixes);
+    free(lbData);
+}
+
+
+// Converts IsTruncated
+static int list_bucket_is_truncated(const ListBucketData *lbData)
+{
+    return (!strcmp(lbData->isTruncated, "true") ||
+            !strcmp(lbData->isTruncated, "1")) ? 1 : 0;
 }
 
 
@@ -473,110 +628,131 @@ static S3Status make_list_bucket_callback(ListBucketData *lbData)
 {
     int i;
 
-    // Convert IsTruncated
-    int isTruncated = (!strcmp(lbData->isTruncated, "true") ||
-                       !strcmp(lbData->isTruncated, "1")) ? 1 : 0;
-
-    // Convert the contents
-    S3ListBucketContent contents[lbData->contentsCount];
+    int isTruncated = list_bucket_is_truncated(lbData);
 
+    // Now that the arena won't move, point the contents at their strings
+    const char *arena = lbData->arena;
     int contentsCount = lbData->contentsCount;
     for (i = 0; i < contentsCount; i++) {
-        S3ListBucketContent *contentDest = &(contents[i]);
-        ListBucketContents *contentSrc = &(lbData->contents[i]);
-        contentDest->key = contentSrc->key;
-        contentDest->lastModified =
-            parseIso8601Time(contentSrc->lastModified);
-        contentDest->eTag = contentSrc->eTag;
-        contentDest->size = parseUnsignedInt(contentSrc->size);
+        S3ListBucketContent *contentDest = &(lbData->contents[i]);
+        const ListBucketEntry *entry = &(lbData->entries[i]);
+        contentDest->key = (entry->key == -1) ? "" : &(arena[entry->key]);
+        contentDest->lastModified = entry->lastModified;
+        contentDest->eTag = (entry->eTag == -1) ? "" : &(arena[entry->eTag]);
+        contentDest->size = entry->size;
         contentDest->ownerId =
-            contentSrc->ownerId[0] ?contentSrc->ownerId : 0;
-        contentDest->ownerDisplayName = (contentSrc->ownerDisplayName[0] ?
-                                         contentSrc->ownerDisplayName : 0);
+            (entry->ownerId == -1) ? 0 : &(arena[entry->ownerId]);
+        contentDest->ownerDisplayName = (entry->ownerDisplayName == -1) ?
+            0 : &(arena[entry->ownerDisplayName]);
     }
 
-    // Make the common prefixes array
     int commonPrefixesCount = lbData->commonPrefixesCount;
-    char *commonPrefixes[commonPrefixesCount];
     for (i = 0; i < commonPrefixesCount; i++) {
-        commonPrefixes[i] = lbData->commonPrefixes[i];
+        int offset = lbData->commonPrefixOffsets[i];
+        lbData->commonPrefixes[i] = (offset == -1) ? "" : &(arena[offset]);
     }
 
+    lbData->listCallbackMade = 1;
+
     return (*(lbData->listBucketCallback))
         (isTruncated, lbData->nextMarker,
-         contentsCount, contents, commonPrefixesCount,
-         (const char **) commonPrefixes, lbData->callbackData);
+         contentsCount, lbData->contents, commonPrefixesCount,
+         lbData->commonPrefixes, lbData->callbackData);
 }
 
 
-static S3Status listBucketXmlCallback(const char *elementPath,
+// Element IDs of the elements of a ListBucketResult
+enum
+{
+    ListBucketElementIsTruncated = 1,
+    ListBucketElementNextMarker,
+    ListBucketElementNextContinuationToken,
+    ListBucketElementContents,
+    ListBucketElementContentsKey,
+    ListBucketElementContentsLastModified,
+    ListBucketElementContentsETag,
+    ListBucketElementContentsSize,
+    ListBucketElementContentsOwnerId,
+    ListBucketElementContentsOwnerDisplayName,
+    ListBucketElementCommonPrefixesPrefix
+};
+
+static const char *listBucketElementPathsG[] =
+{
+    [ListBucketElementIsTruncated] = "ListBucketResult/IsTruncated",
+    [ListBucketElementNextMarker] = "ListBucketResult/NextMarker",
+    [ListBucketElementNextContinuationToken] =
+        "ListBucketResult/NextContinuationToken",
+    [ListBucketElementContents] = "ListBucketResult/Contents",
+    [ListBucketElementContentsKey] = "ListBucketResult/Contents/Key",
+    [ListBucketElementContentsLastModified] =
+        "ListBucketResult/Contents/LastModified",
+    [ListBucketElementContentsETag] = "ListBucketResult/Contents/ETag",
+    [ListBucketElementContentsSize] = "ListBucketResult/Contents/Size",
+    [ListBucketElementContentsOwnerId] = "ListBucketResult/Contents/Owner/ID",
+    [ListBucketElementContentsOwnerDisplayName] =
+        "ListBucketResult/Contents/Owner/DisplayName",
+    [ListBucketElementCommonPrefixesPrefix] =
+        "ListBucketResult/CommonPrefixes/Prefix"
+};
+
+static SimpleXmlElements listBucketElementsG =
+    SIMPLEXML_ELEMENTS(listBucketElementPathsG);
+
+
+static S3Status listBucketXmlCallback(int elementId, const char *elementPath,
                                       const char *data, int dataLen,
                                       void *callbackData)
 {
+    (void) elementPath;
+
     ListBucketData *lbData = (ListBucketData *) callbackData;
 
+    ListBucketEntry *entry = &(lbData->entries[lbData->contentsCount]);
+
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "ListBucketResult/IsTruncated")) {
+        switch (elementId) {
+        case ListBucketElementIsTruncated:
             string_buffer_append(lbData->isTruncated, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListBucketResult/NextMarker")) {
+            break;
+        case ListBucketElementNextMarker:
+        case ListBucketElementNextContinuationToken:
             string_buffer_append(lbData->nextMarker, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/Key")) {
-            ListBucketContents *contents =
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->key, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListBucketResult/Contents/LastModified")) {
-            ListBucketContents *contents =
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->lastModified, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/ETag")) {
-            ListBucketContents *contents =
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->eTag, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/Size")) {
-            ListBucketContents *contents =
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->size, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/Owner/ID")) {
-            ListBucketContents *contents =
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->ownerId, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListBucketResult/Contents/Owner/DisplayName")) {
-            ListBucketContents *contents =
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append
-                (contents->ownerDisplayName, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListBucketResult/CommonPrefixes/Prefix")) {
-            int which = lbData->commonPrefixesCount;
-            size_t oldLen = lbData->commonPrefixLens[which];
-            lbData->commonPrefixLens[which] +=
-                snprintf(lbData->commonPrefixes[which]+oldLen,
-                         sizeof(lbData->commonPrefixes[which]) -
-                         oldLen - 1,
-                         "%.*s", dataLen, data);
-            if (lbData->commonPrefixLens[which] >=
-                (int) sizeof(lbData->commonPrefixes[which])) {
-                return S3StatusXmlParseFailure;
-            }
+            break;
+        case ListBucketElementContentsKey:
+            return arena_append(lbData, &(entry->key), data, dataLen);
+        case ListBucketElementContentsLastModified:
+            string_buffer_append(lbData->lastModified, data, dataLen, fit);
+            break;
+        case ListBucketElementContentsETag:
+            return arena_append(lbData, &(entry->eTag), data, dataLen);
+        case ListBucketElementContentsSize:
+            string_buffer_append(lbData->size, data, dataLen, fit);
+            break;
+        case ListBucketElementContentsOwnerId:
+            return arena_append(lbData, &(entry->ownerId), data, dataLen);
+        case ListBucketElementContentsOwnerDisplayName:
+            return arena_append
+                (lbData, &(entry->ownerDisplayName), data, dataLen);
+        case ListBucketElementCommonPrefixesPrefix:
+            return arena_append
+                (lbData, &(lbData->commonPrefixOffsets
+                           [lbData->commonPrefixesCount]), data, dataLen);
+        default:
+            break;
         }
     }
     else {
-        if (!strcmp(elementPath, "ListBucketResult/Contents")) {
+        if (elementId == ListBucketElementContents) {
             // Finished a Contents
+            entry->lastModified = parseIso8601Time(lbData->lastModified);
+            entry->size = parseUnsignedInt(lbData->size);
+            string_buffer_initialize(lbData->lastModified);
+            string_buffer_initialize(lbData->size);
             lbData->contentsCount++;
-            if (lbData->contentsCount == MAX_CONTENTS) {
+            if (lbData->contentsCount == lbData->maxContents) {
                 // Make the callback
                 S3Status status = make_list_bucket_callback(lbData);
                 if (status != S3StatusOK) {
@@ -585,16 +761,14 @@ static S3Status listBucketXmlCallback(const char *elementPath,
                 initialize_list_bucket_data(lbData);
             }
             else {
-                // Initialize the next one
-                initialize_list_bucket_contents
-                    (&(lbData->contents[lbData->contentsCount]));
+                // Make room for the next one
+                return add_list_bucket_entry(lbData);
             }
         }
-        else if (!strcmp(elementPath,
-                         "ListBucketResult/CommonPrefixes/Prefix")) {
+        else if (elementId == ListBucketElementCommonPrefixesPrefix) {
             // Finished a Prefix
             lbData->commonPrefixesCount++;
-            if (lbData->commonPrefixesCount == MAX_COMMON_PREFIXES) {
+            if (lbData->commonPrefixesCount == lbData->maxCommonPrefixes) {
                 // Make the callback
                 S3Status status = make_list_bucket_callback(lbData);
                 if (status != S3StatusOK) {
@@ -603,9 +777,8 @@ static S3Status listBucketXmlCallback(const char *elementPath,
                 initialize_list_bucket_data(lbData);
             }
             else {
-                // Initialize the next one
-                lbData->commonPrefixes[lbData->commonPrefixesCount][0] = 0;
-                lbData->commonPrefixLens[lbData->commonPrefixesCount] = 0;
+                // Make room for the next one
+                return add_list_bucket_common_prefix(lbData);
             }
         }
     }
@@ -642,9 +815,20 @@ static void listBucketCompleteCallback(S3Status requestStatus,
 {
     ListBucketData *lbData = (ListBucketData *) callbackData;
 
-    // Make the callback if there is anything
-    if (lbData->contentsCount || lbData->commonPrefixesCount) {
-        make_list_bucket_callback(lbData);
+    // Make the callback if there is anything, or if no callback has passed
+    // on that the listing continues: a truncated response may have no keys
+    // and no common prefixes at all
+    S3Status status = S3StatusOK;
+    if (lbData->contentsCount || lbData->commonPrefixesCount ||
+        (!lbData->listCallbackMade &&
+         (list_bucket_is_truncated(lbData) || lbData->nextMarker[0]))) {
+        status = make_list_bucket_callback(lbData);
+    }
+
+    // A failed callback fails the request, as it would have if it had been
+    // made while the response was being read
+    if ((requestStatus == S3StatusOK) && (status != S3StatusOK)) {
+        requestStatus = status;
     }
 
     (*(lbData->responseCompleteCallback))
@@ -652,20 +836,102 @@ static void listBucketCompleteCallback(S3Status requestStatus,
 
     simplexml_deinitialize(&(lbData->simpleXml));
 
-    free(lbData);
+    free_list_bucket_data(lbData);
 }
 
 
-void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
-                    const char *marker, const char *delimiter, int maxkeys,
-                    S3RequestContext *requestContext,
-                    int timeoutMs,
-                    const S3ListBucketHandler *handler, void *callbackData)
+// Performs a list bucket request with the given query params
+static void list_bucket(const S3BucketContext *bucketContext,
+                        const char *queryParams, int maxContents,
+                        int maxCommonPrefixes,
+                        S3RequestContext *requestContext, int timeoutMs,
+                        const S3ListBucketHandler *handler,
+                        void *callbackData)
 {
-    // Compose the query params
-    string_buffer(queryParams, 4096);
-    string_buffer_initialize(queryParams);
+    ListBucketData *lbData =
+        (ListBucketData *) malloc(sizeof(ListBucketData));
+
+    if (!lbData) {
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    simplexml_initialize_elements(&(lbData->simpleXml), &listBucketElementsG,
+                                  &listBucketXmlCallback, lbData);
+
+    lbData->responsePropertiesCallback =
+        handler->responseHandler.propertiesCallback;
+    lbData->listBucketCallback = handler->listBucketCallback;
+    lbData->responseCompleteCallback =
+        handler->responseHandler.completeCallback;
+    lbData->callbackData = callbackData;
+
+    string_buffer_initialize(lbData->isTruncated);
+    string_buffer_initialize(lbData->nextMarker);
+
+    lbData->maxContents = maxContents;
+    lbData->maxCommonPrefixes = maxCommonPrefixes;
+    lbData->arena = 0;
+    lbData->arenaSize = 0;
+    lbData->contentsCount = 0;
+    lbData->contentsSize = 0;
+    lbData->entries = 0;
+    lbData->contents = 0;
+    lbData->commonPrefixesCount = 0;
+    lbData->commonPrefixesSize = 0;
+    lbData->commonPrefixOffsets = 0;
+    lbData->commonPrefixes = 0;
+    lbData->listCallbackMade = 0;
+
+    if ((add_list_bucket_entry(lbData) != S3StatusOK) ||
+        (add_list_bucket_common_prefix(lbData) != S3StatusOK)) {
+        simplexml_deinitialize(&(lbData->simpleXml));
+        free_list_bucket_data(lbData);
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    initialize_list_bucket_data(lbData);
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypeGET,                           // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->securityToken,               // securityToken
+          bucketContext->authRegion },                // authRegion
+        0,                                            // key
+        queryParams,                                  // queryParams
+        0,                                            // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        0,                                            // putProperties
+        &listBucketPropertiesCallback,                // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        &listBucketDataCallback,                      // fromS3Callback
+        &listBucketCompleteCallback,                  // completeCallback
+        lbData,                                       // callbackData
+        timeoutMs                                     // timeoutMs
+    };
 
+    // Perform the request
+    request_perform(&params, requestContext);
+}
+
+
+// Appends a query param to queryParams, or completes the request with
+// S3StatusQueryParamsTooLong and returns if it does not fit
 #define safe_append(name, value)                                        \
     do {                                                                \
         int fit;                                                        \
@@ -701,6 +967,18 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
     } while (0)
 
 
+static void list_bucket_v1(const S3BucketContext *bucketContext,
+                           const char *prefix, const char *marker,
+                           const char *delimiter, int maxkeys,
+                           int maxContents, int maxCommonPrefixes,
+                           S3RequestContext *requestContext, int timeoutMs,
+                           const S3ListBucketHandler *handler,
+                           void *callbackData)
+{
+    // Compose the query params
+    string_buffer(queryParams, 4096);
+    string_buffer_initialize(queryParams);
+
     int amp = 0;
     if (prefix && *prefix) {
         safe_append("prefix", prefix);
@@ -717,58 +995,81 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
         safe_append("max-keys", maxKeysString);
     }
 
-    ListBucketData *lbData =
-        (ListBucketData *) malloc(sizeof(ListBucketData));
+    list_bucket(bucketContext, queryParams[0] ? queryParams : 0,
+                maxContents, maxCommonPrefixes, requestContext, timeoutMs,
+                handler, callbackData);
+}
 
-    if (!lbData) {
-        (*(handler->responseHandler.completeCallback))
-            (S3StatusOutOfMemory, 0, callbackData);
-        return;
+
+void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
+                    const char *marker, const char *delimiter, int maxkeys,
+                    S3RequestContext *requestContext,
+                    int timeoutMs,
+                    const S3ListBucketHandler *handler, void *callbackData)
+{
+    list_bucket_v1(bucketContext, prefix, marker, delimiter, maxkeys,
+                   MAX_CONTENTS, MAX_COMMON_PREFIXES, requestContext,
+                   timeoutMs, handler, callbackData);
+}
+
+
+void S3_list_bucket_ex(const S3BucketContext *bucketContext,
+                       const char *prefix, const char *marker,
+                       const char *delimiter, int maxkeys, int batchSize,
+                       S3RequestContext *requestContext,
+                       int timeoutMs,
+                       const S3ListBucketHandler *handler, void *callbackData)
+{
+    if (batchSize < 0) {
+        batchSize = 0;
     }
 
-    simplexml_initialize(&(lbData->simpleXml), &listBucketXmlCallback, lbData);
+    list_bucket_v1(bucketContext, prefix, marker, delimiter, maxkeys,
+                   batchSize, batchSize, requestContext, timeoutMs, handler,
+                   callbackData);
+}
 
-    lbData->responsePropertiesCallback =
-        handler->responseHandler.propertiesCallback;
-    lbData->listBucketCallback = handler->listBucketCallback;
-    lbData->responseCompleteCallback =
-        handler->responseHandler.completeCallback;
-    lbData->callbackData = callbackData;
 
-    string_buffer_initialize(lbData->isTruncated);
-    string_buffer_initialize(lbData->nextMarker);
-    initialize_list_bucket_data(lbData);
+void S3_list_objects_v2(const S3BucketContext *bucketContext,
+                        const char *prefix, const char *continuationToken,
+                        const char *startAfter, const char *delimiter,
+                        int maxkeys, int fetchOwner, int batchSize,
+                        S3RequestContext *requestContext,
+                        int timeoutMs,
+                        const S3ListBucketHandler *handler,
+                        void *callbackData)
+{
+    // Compose the query params
+    string_buffer(queryParams, 4096);
+    string_buffer_initialize(queryParams);
 
-    // Set up the RequestParams
-    RequestParams params =
-    {
-        HttpRequestTypeGET,                           // httpRequestType
-        { bucketContext->hostName,                    // hostName
-          bucketContext->bucketName,                  // bucketName
-          bucketContext->protocol,                    // protocol
-          bucketContext->uriStyle,                    // uriStyle
-          bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey,             // secretAccessKey
-          bucketContext->securityToken,               // securityToken
-          bucketContext->authRegion },                // authRegion
-        0,                                            // key
-        queryParams[0] ? queryParams : 0,             // queryParams
-        0,                                            // subResource
-        0,                                            // copySourceBucketName
-        0,                                            // copySourceKey
-        0,                                            // getConditions
-        0,                                            // startByte
-        0,                                            // byteCount
-        0,                                            // putProperties
-        &listBucketPropertiesCallback,                // propertiesCallback
-        0,                                            // toS3Callback
-        0,                                            // toS3CallbackTotalSize
-        &listBucketDataCallback,                      // fromS3Callback
-        &listBucketCompleteCallback,                  // completeCallback
-        lbData,                                       // callbackData
-        timeoutMs                                     // timeoutMs
-    };
+    int amp = 0;
+    safe_append("list-type", "2");
+    if (prefix && *prefix) {
+        safe_append("prefix", prefix);
+    }
+    if (continuationToken && *continuationToken) {
+        safe_append("continuation-token", continuationToken);
+    }
+    if (startAfter && *startAfter) {
+        safe_append("start-after", startAfter);
+    }
+    if (delimiter && *delimiter) {
+        safe_append("delimiter", delimiter);
+    }
+    if (maxkeys) {
+        char maxKeysString[64];
+        snprintf(maxKeysString, sizeof(maxKeysString), "%d", maxkeys);
+        safe_append("max-keys", maxKeysString);
+    }
+    if (fetchOwner) {
+        safe_append("fetch-owner", "true");
+    }
 
-    // Perform the request
-    request_perform(&params, requestContext);
+    if (batchSize < 0) {
+        batchSize = 0;
+    }
+
+    list_bucket(bucketContext, queryParams, batchSize, batchSize,
+                requestContext, timeoutMs, handler, callbackData);
 }
@@ -0,0 +1,208 @@
+/** **************************************************************************
+ * connection_share.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <pthread.h>
+#include <string.h>
+#include "connection_share.h"
+
+#ifndef __APPLE__
+#include <openssl/ssl.h>
+#endif
+
+
+static CURLSH *shareG;
+
+// One lock per type of data shared; curl never holds more than one at a time
+static pthread_mutex_t shareMutexesG[CURL_LOCK_DATA_LAST];
+
+static pthread_mutex_t statsMutexG;
+
+static S3ConnectionStats statsG;
+
+
+static void share_lock(CURL *curl, curl_lock_data data,
+                       curl_lock_access access, void *userptr)
+{
+    (void) curl;
+    (void) access;
+    (void) userptr;
+
+    pthread_mutex_lock(&(shareMutexesG[data]));
+}
+
+
+static void share_unlock(CURL *curl, curl_lock_data data, void *userptr)
+{
+    (void) curl;
+    (void) userptr;
+
+    pthread_mutex_unlock(&(shareMutexesG[data]));
+}
+
+
+S3Status connection_share_initialize(int flags)
+{
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&(shareMutexesG[i]), 0);
+    }
+
+    pthread_mutex_init(&statsMutexG, 0);
+
+    memset(&statsG, 0, sizeof(statsG));
+
+    if (!(shareG = curl_share_init())) {
+        return S3StatusOutOfMemory;
+    }
+
+#define curl_share_setopt_safe(opt, val)                                \
+    if (curl_share_setopt(shareG, opt, val) != CURLSHE_OK) {            \
+        curl_share_cleanup(shareG);                                     \
+        shareG = 0;                                                     \
+        return S3StatusInternalError;                                   \
+    }
+
+    curl_share_setopt_safe(CURLSHOPT_LOCKFUNC, &share_lock);
+    curl_share_setopt_safe(CURLSHOPT_UNLOCKFUNC, &share_unlock);
+    curl_share_setopt_safe(CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt_safe(CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+    // curl does not support sharing connections between handles that are
+    // in use by different threads at the same time, so this is only done
+    // when asked for
+    if (flags & S3_INIT_SHARE_CONNECTIONS) {
+#if LIBCURL_VERSION_NUM >= 0x073900
+        curl_share_setopt_safe(CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#else
+        curl_share_cleanup(shareG);
+        shareG = 0;
+        return S3StatusNotSupported;
+#endif
+    }
+
+    return S3StatusOK;
+}
+
+
+void connection_share_deinitialize()
+{
+    if (shareG) {
+        curl_share_cleanup(shareG);
+        shareG = 0;
+    }
+
+    pthread_mutex_destroy(&statsMutexG);
+
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&(shareMutexesG[i]));
+    }
+}
+
+
+S3Status connection_share_attach(CURL *curl)
+{
+    return ((curl_easy_setopt(curl, CURLOPT_SHARE, shareG) == CURLE_OK) ?
+            S3StatusOK : S3StatusFailedToInitializeRequest);
+}
+
+
+int connection_share_record_connected(CURL *curl)
+{
+    long connects;
+    if ((curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects) !=
+         CURLE_OK) || !connects) {
+        // Not a new connection, so there was no handshake
+        return 0;
+    }
+
+    int resumed = 0;
+#if LIBCURL_VERSION_NUM >= 0x073000 /* 7.48.0 */
+    struct curl_tlssessioninfo *tlsInfo;
+    if ((curl_easy_getinfo(curl, CURLINFO_TLS_SSL_PTR, &tlsInfo) !=
+         CURLE_OK) || (tlsInfo->backend == CURLSSLBACKEND_NONE) ||
+        !tlsInfo->internals) {
+        // Not a TLS connection
+        return 0;
+    }
+
+#ifndef __APPLE__
+    // Session resumption can only be detected with OpenSSL
+    if (tlsInfo->backend == CURLSSLBACKEND_OPENSSL) {
+        resumed = SSL_session_reused((SSL *) tlsInfo->internals);
+    }
+#endif
+#else
+    // Older curl can't give the TLS session, so TLS handshakes can't be told
+    // from plain connections, and none are recorded
+    return 0;
+#endif
+
+    pthread_mutex_lock(&statsMutexG);
+    statsG.tlsHandshakeCount++;
+    if (resumed) {
+        statsG.tlsResumedCount++;
+    }
+    pthread_mutex_unlock(&statsMutexG);
+
+    return resumed;
+}
+
+
+void connection_share_record_finished(CURL *curl, int responseReceived)
+{
+    long connects;
+    if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects) !=
+        CURLE_OK) {
+        connects = 0;
+    }
+
+    pthread_mutex_lock(&statsMutexG);
+    statsG.requestCount++;
+    if (connects) {
+        statsG.newConnectionCount++;
+    }
+    else if (responseReceived) {
+        statsG.reusedConnectionCount++;
+    }
+    pthread_mutex_unlock(&statsMutexG);
+}
+
+
+void S3_get_connection_stats(S3ConnectionStats *statsReturn)
+{
+    pthread_mutex_lock(&statsMutexG);
+    *statsReturn = statsG;
+    pthread_mutex_unlock(&statsMutexG);
+}
+
+
+void S3_reset_connection_stats()
+{
+    pthread_mutex_lock(&statsMutexG);
+    memset(&statsG, 0, sizeof(statsG));
+    pthread_mutex_unlock(&statsMutexG);
+}
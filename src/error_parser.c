@@ -28,8 +28,32 @@
 #include "error_parser.h"
 
 
-static S3Status errorXmlCallback(const char *elementPath, const char *data,
-                                 int dataLen, void *callbackData)
+// Element IDs of the elements of an Error
+enum
+{
+    ErrorElementError = 1,
+    ErrorElementCode,
+    ErrorElementMessage,
+    ErrorElementResource,
+    ErrorElementFurtherDetails
+};
+
+static const char *errorElementPathsG[] =
+{
+    [ErrorElementError] = "Error",
+    [ErrorElementCode] = "Error/Code",
+    [ErrorElementMessage] = "Error/Message",
+    [ErrorElementResource] = "Error/Resource",
+    [ErrorElementFurtherDetails] = "Error/FurtherDetails"
+};
+
+static SimpleXmlElements errorElementsG =
+    SIMPLEXML_ELEMENTS(errorElementPathsG);
+
+
+static S3Status errorXmlCallback(int elementId, const char *elementPath,
+                                 const char *data, int dataLen,
+                                 void *callbackData)
 {
     // We ignore end of element callbacks because we don't care about them
     if (!data) {
@@ -40,26 +64,27 @@ static S3Status errorXmlCallback(const char *elementPath, const char *data,
 
     int fit;
 
-    if (!strcmp(elementPath, "Error")) {
+    switch (elementId) {
+    case ErrorElementError:
         // Ignore, this is the Error element itself, we only care about subs
-    }
-    else if (!strcmp(elementPath, "Error/Code")) {
+        break;
+    case ErrorElementCode:
         string_buffer_append(errorParser->code, data, dataLen, fit);
-    }
-    else if (!strcmp(elementPath, "Error/Message")) {
+        break;
+    case ErrorElementMessage:
         string_buffer_append(errorParser->message, data, dataLen, fit);
         errorParser->s3ErrorDetails.message = errorParser->message;
-    }
-    else if (!strcmp(elementPath, "Error/Resource")) {
+        break;
+    case ErrorElementResource:
         string_buffer_append(errorParser->resource, data, dataLen, fit);
         errorParser->s3ErrorDetails.resource = errorParser->resource;
-    }
-    else if (!strcmp(elementPath, "Error/FurtherDetails")) {
+        break;
+    case ErrorElementFurtherDetails:
         string_buffer_append(errorParser->furtherDetails, data, dataLen, fit);
         errorParser->s3ErrorDetails.furtherDetails = 
             errorParser->furtherDetails;
-    }
-    else {
+        break;
+    default: {
         if (strncmp(elementPath, "Error/", sizeof("Error/") - 1)) {
             // If for some weird reason it's not within the Error element,
             // ignore it
@@ -109,6 +134,8 @@ static S3Status errorXmlCallback(const char *elementPath, const char *data,
               [errorParser->s3ErrorDetails.extraDetailsCount++]);
         nv->name = name;
         nv->value = value;
+        break;
+    }
     }
 
     return S3StatusOK;
@@ -135,8 +162,9 @@ S3Status error_parser_add(ErrorParser *errorParser, char *buffer,
                           int bufferSize)
 {
     if (!errorParser->errorXmlParserInitialized) {
-        simplexml_initialize(&(errorParser->errorXmlParser), &errorXmlCallback,
-                             errorParser);
+        simplexml_initialize_elements(&(errorParser->errorXmlParser),
+                                      &errorElementsG, &errorXmlCallback,
+                                      errorParser);
         errorParser->errorXmlParserInitialized = 1;
     }
 
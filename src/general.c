@@ -39,7 +39,16 @@ S3Status S3_initialize(const char *userAgentInfo, int flags,
         return S3StatusOK;
     }
 
-    return request_api_initialize(userAgentInfo, flags, defaultS3HostName);
+    simplexml_api_initialize(flags);
+
+    S3Status status =
+        request_api_initialize(userAgentInfo, flags, defaultS3HostName);
+    if (status != S3StatusOK) {
+        // Not initialized after all, so the next call tries again
+        initializeCountG--;
+    }
+
+    return status;
 }
 
 
@@ -108,6 +117,7 @@ const char *S3_get_status_name(S3Status status)
         handlecase(ConnectionFailed);
         handlecase(AbortedByCallback);
         handlecase(NotSupported);
+        handlecase(DestinationTooSmall);
         handlecase(ErrorAccessDenied);
         handlecase(ErrorAccountProblem);
         handlecase(ErrorAmbiguousGrantByEmailAddress);
@@ -0,0 +1,233 @@
+/** **************************************************************************
+ * get_object_into.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#define _XOPEN_SOURCE 600
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libs3.h"
+#include "request.h"
+
+
+typedef struct GetIntoData
+{
+    S3GetDestination destination;
+
+    // The most bytes that may be received, or 0 for no limit
+    uint64_t limit;
+
+    // Number of bytes placed in the destination so far
+    uint64_t received;
+
+    // S3GetDestinationTypeIoVec only: the buffer being filled, and the
+    // number of bytes of it already filled
+    int ioVecIndex;
+    size_t ioVecOffset;
+
+    S3ResponsePropertiesCallback *propertiesCallback;
+    S3GetObjectIntoCompleteCallback *completeCallback;
+    void *callbackData;
+} GetIntoData;
+
+
+// Writes to fd at offset, without using or changing its file offset
+static int write_at(int fd, const char *buffer, int size, int64_t offset)
+{
+    while (size) {
+#ifdef __MINGW32__
+        // There is no pwrite() on Windows, so this does change the file
+        // offset
+        if (_lseeki64(fd, offset, SEEK_SET) == -1) {
+            return -1;
+        }
+        int count = write(fd, buffer, size);
+#else
+        int count = pwrite(fd, buffer, size, (off_t) offset);
+#endif
+        if (count <= 0) {
+            return -1;
+        }
+        buffer += count;
+        size -= count;
+        offset += count;
+    }
+
+    return 0;
+}
+
+
+static S3Status write_io_vecs(GetIntoData *data, int bufferSize,
+                              const char *buffer)
+{
+    const S3GetDestination *d = &(data->destination);
+
+    while (bufferSize) {
+        if (data->ioVecIndex == d->ioVecCount) {
+            return S3StatusDestinationTooSmall;
+        }
+        const S3IoVec *ioVec = &(d->ioVecs[data->ioVecIndex]);
+        size_t toCopy = ioVec->length - data->ioVecOffset;
+        if (toCopy > (size_t) bufferSize) {
+            toCopy = bufferSize;
+        }
+        memcpy(&(((char *) ioVec->base)[data->ioVecOffset]), buffer, toCopy);
+        buffer += toCopy;
+        bufferSize -= toCopy;
+        data->ioVecOffset += toCopy;
+        if (data->ioVecOffset == ioVec->length) {
+            data->ioVecIndex++;
+            data->ioVecOffset = 0;
+        }
+    }
+
+    return S3StatusOK;
+}
+
+
+static S3Status getIntoDataCallback(int bufferSize, const char *buffer,
+                                    void *callbackData)
+{
+    GetIntoData *data = (GetIntoData *) callbackData;
+    const S3GetDestination *d = &(data->destination);
+
+    if (data->limit && ((data->limit - data->received) <
+                        (uint64_t) bufferSize)) {
+        return S3StatusDestinationTooSmall;
+    }
+
+    switch (d->type) {
+    case S3GetDestinationTypeBuffer:
+        if ((d->bufferSize - data->received) < (uint64_t) bufferSize) {
+            return S3StatusDestinationTooSmall;
+        }
+        memcpy(&(d->buffer[data->received]), buffer, bufferSize);
+        break;
+    case S3GetDestinationTypeIoVec: {
+        S3Status status = write_io_vecs(data, bufferSize, buffer);
+        if (status != S3StatusOK) {
+            return status;
+        }
+        break;
+    }
+    default:
+        if (write_at(d->fd, buffer, bufferSize,
+                     d->fdOffset + data->received)) {
+            return S3StatusAbortedByCallback;
+        }
+        break;
+    }
+
+    data->received += bufferSize;
+
+    return S3StatusOK;
+}
+
+
+static S3Status getIntoPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    GetIntoData *data = (GetIntoData *) callbackData;
+
+    if (data->propertiesCallback) {
+        return (*(data->propertiesCallback))
+            (responseProperties, data->callbackData);
+    }
+
+    return S3StatusOK;
+}
+
+
+static void getIntoCompleteCallback(S3Status requestStatus,
+                                    const S3ErrorDetails *s3ErrorDetails,
+                                    void *callbackData)
+{
+    GetIntoData *data = (GetIntoData *) callbackData;
+
+    (*(data->completeCallback))(requestStatus, data->received, s3ErrorDetails,
+                                data->callbackData);
+
+    free(data);
+}
+
+
+void S3_get_object_into(const S3BucketContext *bucketContext,
+                        const char *key,
+                        const S3GetConditions *getConditions,
+                        uint64_t startByte, uint64_t byteCount,
+                        const S3GetDestination *destination,
+                        S3RequestContext *requestContext, int timeoutMs,
+                        const S3GetObjectIntoHandler *handler,
+                        void *callbackData)
+{
+    GetIntoData *data = (GetIntoData *) malloc(sizeof(GetIntoData));
+    if (!data) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, 0,
+                                       callbackData);
+        return;
+    }
+
+    data->destination = *destination;
+    data->limit = byteCount;
+    data->received = 0;
+    data->ioVecIndex = 0;
+    data->ioVecOffset = 0;
+    data->propertiesCallback = handler->propertiesCallback;
+    data->completeCallback = handler->completeCallback;
+    data->callbackData = callbackData;
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypeGET,                           // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->securityToken,               // securityToken
+          bucketContext->authRegion },                // authRegion
+        key,                                          // key
+        0,                                            // queryParams
+        0,                                            // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        getConditions,                                // getConditions
+        startByte,                                    // startByte
+        byteCount,                                    // byteCount
+        0,                                            // putProperties
+        &getIntoPropertiesCallback,                   // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        &getIntoDataCallback,                         // fromS3Callback
+        &getIntoCompleteCallback,                     // completeCallback
+        data,                                         // callbackData
+        timeoutMs                                     // timeoutMs
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
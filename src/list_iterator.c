@@ -0,0 +1,587 @@
+/** **************************************************************************
+ * list_iterator.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#define _XOPEN_SOURCE 600
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include "libs3.h"
+#include "util.h"
+
+
+// The longest that the listing thread waits on its requests at a time, so
+// that it notices when the iterator is being destroyed
+#define LIST_ITERATOR_POLL_MS 100
+
+
+// The keys and common prefixes of one list response
+typedef struct ListPage
+{
+    struct ListPage *next;
+
+    int contentsCount;
+    S3ListBucketContent *contents;
+
+    int commonPrefixesCount;
+    const char **commonPrefixes;
+
+    // The contents, the common prefix pointers, and all of the strings that
+    // they refer to follow the page
+} ListPage;
+
+
+struct S3ListIterator
+{
+    // Everything needed to make the list requests is copied into here
+    S3BucketContext bucketContext;
+    const char *prefix;
+    const char *startAfter;
+    const char *delimiter;
+    int maxKeys;
+    int fetchOwner;
+    int prefetchPages;
+    int maxAttempts;
+    int timeoutMs;
+
+    // The bucket context strings, prefix, startAfter, and delimiter are
+    // copied into this single allocation
+    char *strings;
+
+    pthread_t thread;
+
+    // Guards everything shared by the caller and the listing thread, which
+    // is the fields up to the next comment; the condition is signalled
+    // whenever any of them change
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    // Pages listed which the caller has not yet moved on to, in order
+    ListPage *pagesHead, **pagesTail;
+    int pagesCount;
+
+    // Set once the listing thread has listed its last page, or failed
+    int finished;
+
+    // The status of the listing, once finished
+    S3Status status;
+
+    // Set once the iterator is being destroyed, to stop the listing thread
+    int destroying;
+
+    // Used only by the listing thread
+    S3RequestContext *requestContext;
+    char *continuationToken;
+    S3Status requestStatus;
+    ListPage *page;
+    int isTruncated;
+    char *nextContinuationToken;
+
+    // Used only by the caller: the page being iterated over, and the
+    // positions within its keys and common prefixes
+    ListPage *current;
+    int contentsIndex;
+    int commonPrefixesIndex;
+};
+
+
+// Pages ---------------------------------------------------------------------
+
+// Copies contents and common prefixes, and the strings they refer to, into
+// a single new page
+static ListPage *page_create(int contentsCount,
+                             const S3ListBucketContent *contents,
+                             int commonPrefixesCount,
+                             const char **commonPrefixes)
+{
+    size_t size = (sizeof(ListPage) +
+                   (contentsCount * sizeof(S3ListBucketContent)) +
+                   (commonPrefixesCount * sizeof(const char *)));
+    int i;
+    for (i = 0; i < contentsCount; i++) {
+        const S3ListBucketContent *content = &(contents[i]);
+        size += (string_copy_size(content->key) +
+                 string_copy_size(content->eTag) +
+                 string_copy_size(content->ownerId) +
+                 string_copy_size(content->ownerDisplayName));
+    }
+    for (i = 0; i < commonPrefixesCount; i++) {
+        size += string_copy_size(commonPrefixes[i]);
+    }
+
+    ListPage *page = (ListPage *) malloc(size);
+    if (!page) {
+        return 0;
+    }
+
+    page->next = 0;
+    page->contentsCount = contentsCount;
+    page->contents = (S3ListBucketContent *) &(page[1]);
+    page->commonPrefixesCount = commonPrefixesCount;
+    page->commonPrefixes =
+        (const char **) &(page->contents[contentsCount]);
+
+    char *pos = (char *) &(page->commonPrefixes[commonPrefixesCount]);
+    for (i = 0; i < contentsCount; i++) {
+        S3ListBucketContent *content = &(page->contents[i]);
+        *content = contents[i];
+        content->key = copy_string(&pos, contents[i].key);
+        content->eTag = copy_string(&pos, contents[i].eTag);
+        content->ownerId = copy_string(&pos, contents[i].ownerId);
+        content->ownerDisplayName =
+            copy_string(&pos, contents[i].ownerDisplayName);
+    }
+    for (i = 0; i < commonPrefixesCount; i++) {
+        page->commonPrefixes[i] = copy_string(&pos, commonPrefixes[i]);
+    }
+
+    return page;
+}
+
+
+static void pages_free(ListPage *page)
+{
+    while (page) {
+        ListPage *next = page->next;
+        free(page);
+        page = next;
+    }
+}
+
+
+// Listing thread ------------------------------------------------------------
+
+// Discards whatever has been received of the response to a list request
+static void response_reset(S3ListIterator *iterator)
+{
+    free(iterator->page);
+    iterator->page = 0;
+    free(iterator->nextContinuationToken);
+    iterator->nextContinuationToken = 0;
+    iterator->isTruncated = 0;
+}
+
+
+static S3Status iteratorPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    (void) responseProperties;
+    (void) callbackData;
+
+    return S3StatusOK;
+}
+
+
+// Keeps the page until the request completes, since a failed request is
+// retried and the caller must not have seen any of it
+static S3Status iteratorListCallback(int isTruncated,
+                                     const char *nextContinuationToken,
+                                     int contentsCount,
+                                     const S3ListBucketContent *contents,
+                                     int commonPrefixesCount,
+                                     const char **commonPrefixes,
+                                     void *callbackData)
+{
+    S3ListIterator *iterator = (S3ListIterator *) callbackData;
+
+    response_reset(iterator);
+
+    iterator->isTruncated = isTruncated;
+
+    if (nextContinuationToken && nextContinuationToken[0] &&
+        !(iterator->nextContinuationToken =
+          strdup(nextContinuationToken))) {
+        return S3StatusOutOfMemory;
+    }
+
+    if (!(iterator->page = page_create(contentsCount, contents,
+                                       commonPrefixesCount,
+                                       commonPrefixes))) {
+        return S3StatusOutOfMemory;
+    }
+
+    return S3StatusOK;
+}
+
+
+static void iteratorCompleteCallback(S3Status requestStatus,
+                                     const S3ErrorDetails *s3ErrorDetails,
+                                     void *callbackData)
+{
+    (void) s3ErrorDetails;
+
+    ((S3ListIterator *) callbackData)->requestStatus = requestStatus;
+}
+
+
+static int is_destroying(S3ListIterator *iterator)
+{
+    pthread_mutex_lock(&(iterator->mutex));
+    int destroying = iterator->destroying;
+    pthread_mutex_unlock(&(iterator->mutex));
+
+    return destroying;
+}
+
+
+// Runs the request context until the request in it has completed, or the
+// iterator is being destroyed, in which case S3StatusInterrupted is returned
+// and the request is left to be interrupted by destroying the context
+static S3Status run_request(S3ListIterator *iterator)
+{
+    int requestsRemaining;
+    do {
+        if (is_destroying(iterator)) {
+            return S3StatusInterrupted;
+        }
+        fd_set readfds, writefds, exceptfds;
+        FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
+        FD_ZERO(&exceptfds);
+        int maxfd;
+        S3Status status = S3_get_request_context_fdsets
+            (iterator->requestContext, &readfds, &writefds, &exceptfds,
+             &maxfd);
+        if (status != S3StatusOK) {
+            return status;
+        }
+        // As in S3_runall_request_context, there is nothing to wait on
+        // until curl has created the connection's socket
+        if (maxfd != -1) {
+            int64_t timeout =
+                S3_get_request_context_timeout(iterator->requestContext);
+            if ((timeout == -1) || (timeout > LIST_ITERATOR_POLL_MS)) {
+                timeout = LIST_ITERATOR_POLL_MS;
+            }
+            struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+            select(maxfd + 1, &readfds, &writefds, &exceptfds, &tv);
+        }
+        status = S3_runonce_request_context(iterator->requestContext,
+                                            &requestsRemaining);
+        if (status != S3StatusOK) {
+            return status;
+        }
+    } while (requestsRemaining);
+
+    return S3StatusOK;
+}
+
+
+// Lists the next page, retrying as allowed, and leaves it in iterator->page
+static S3Status list_page(S3ListIterator *iterator)
+{
+    S3ListBucketHandler handler =
+    {
+        { &iteratorPropertiesCallback, &iteratorCompleteCallback },
+        &iteratorListCallback
+    };
+
+    int attempts = 0;
+
+    while (1) {
+        attempts++;
+
+        // start-after is only needed until there is a continuation token
+        S3_list_objects_v2(&(iterator->bucketContext), iterator->prefix,
+                           iterator->continuationToken,
+                           iterator->continuationToken ?
+                           0 : iterator->startAfter,
+                           iterator->delimiter, iterator->maxKeys,
+                           iterator->fetchOwner, 0,
+                           iterator->requestContext, iterator->timeoutMs,
+                           &handler, iterator);
+
+        S3Status status = run_request(iterator);
+        if (status != S3StatusOK) {
+            return status;
+        }
+
+        if ((status = iterator->requestStatus) == S3StatusOK) {
+            // A last response with no keys at all makes no list callback
+            if (!iterator->page &&
+                !(iterator->page = page_create(0, 0, 0, 0))) {
+                return S3StatusOutOfMemory;
+            }
+            return S3StatusOK;
+        }
+
+        response_reset(iterator);
+
+        if (!S3_status_is_retryable(status) ||
+            (attempts >= iterator->maxAttempts)) {
+            return status;
+        }
+    }
+}
+
+
+// Lists pages until the last has been listed, the listing fails, or the
+// iterator is being destroyed, staying no more than prefetchPages pages
+// ahead of the caller
+static void *list_thread(void *arg)
+{
+    S3ListIterator *iterator = (S3ListIterator *) arg;
+
+    while (1) {
+        // Wait for the caller to move on if enough pages are waiting; no
+        // request is in flight while waiting, so no transfer is held up
+        pthread_mutex_lock(&(iterator->mutex));
+        while (!iterator->destroying &&
+               (iterator->pagesCount >= iterator->prefetchPages)) {
+            pthread_cond_wait(&(iterator->cond), &(iterator->mutex));
+        }
+        int destroying = iterator->destroying;
+        pthread_mutex_unlock(&(iterator->mutex));
+
+        if (destroying) {
+            break;
+        }
+
+        S3Status status = list_page(iterator);
+
+        ListPage *page = 0;
+        int last = 1;
+        if (status == S3StatusOK) {
+            page = iterator->page;
+            iterator->page = 0;
+            free(iterator->continuationToken);
+            iterator->continuationToken = iterator->nextContinuationToken;
+            iterator->nextContinuationToken = 0;
+            last = (!iterator->isTruncated ||
+                    !iterator->continuationToken);
+        }
+
+        pthread_mutex_lock(&(iterator->mutex));
+        if (page) {
+            *(iterator->pagesTail) = page;
+            iterator->pagesTail = &(page->next);
+            iterator->pagesCount++;
+        }
+        if (last) {
+            iterator->finished = 1;
+            iterator->status = status;
+        }
+        pthread_cond_broadcast(&(iterator->cond));
+        pthread_mutex_unlock(&(iterator->mutex));
+
+        if (last) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+// Public API ----------------------------------------------------------------
+
+static S3Status copy_parameters(S3ListIterator *iterator,
+                                const S3BucketContext *bucketContext,
+                                const char *prefix,
+                                const S3ListIteratorOptions *options)
+{
+    const char *startAfter = options ? options->startAfter : 0;
+    const char *delimiter = options ? options->delimiter : 0;
+
+    size_t size = (bucket_context_copy_size(bucketContext) +
+                   string_copy_size(prefix) + string_copy_size(startAfter) +
+                   string_copy_size(delimiter));
+
+    if (!(iterator->strings = (char *) malloc(size ? size : 1))) {
+        return S3StatusOutOfMemory;
+    }
+
+    char *pos = iterator->strings;
+
+    bucket_context_copy(&(iterator->bucketContext), &pos, bucketContext);
+    iterator->prefix = copy_string(&pos, prefix);
+    iterator->startAfter = copy_string(&pos, startAfter);
+    iterator->delimiter = copy_string(&pos, delimiter);
+
+    return S3StatusOK;
+}
+
+
+S3Status S3_create_list_iterator(const S3BucketContext *bucketContext,
+                                 const char *prefix,
+                                 const S3ListIteratorOptions *options,
+                                 int timeoutMs,
+                                 S3ListIterator **iteratorReturn)
+{
+    S3ListIterator *iterator =
+        (S3ListIterator *) calloc(1, sizeof(S3ListIterator));
+    if (!iterator) {
+        return S3StatusOutOfMemory;
+    }
+
+    S3Status status =
+        copy_parameters(iterator, bucketContext, prefix, options);
+    if (status != S3StatusOK) {
+        free(iterator);
+        return status;
+    }
+
+    iterator->timeoutMs = timeoutMs;
+    iterator->prefetchPages = S3_LIST_ITERATOR_DEFAULT_PREFETCH_PAGES;
+    iterator->maxAttempts = S3_LIST_ITERATOR_DEFAULT_MAX_ATTEMPTS;
+    if (options) {
+        if (options->prefetchPages > 0) {
+            iterator->prefetchPages = options->prefetchPages;
+        }
+        if (options->maxAttempts > 0) {
+            iterator->maxAttempts = options->maxAttempts;
+        }
+        iterator->maxKeys = options->maxKeys;
+        iterator->fetchOwner = options->fetchOwner;
+    }
+
+    iterator->pagesTail = &(iterator->pagesHead);
+    iterator->status = S3StatusOK;
+
+    if ((status = S3_create_request_context(&(iterator->requestContext)))
+        != S3StatusOK) {
+        free(iterator->strings);
+        free(iterator);
+        return status;
+    }
+
+    pthread_mutex_init(&(iterator->mutex), 0);
+    pthread_cond_init(&(iterator->cond), 0);
+
+    if (pthread_create(&(iterator->thread), 0, &list_thread, iterator)) {
+        pthread_cond_destroy(&(iterator->cond));
+        pthread_mutex_destroy(&(iterator->mutex));
+        S3_destroy_request_context(iterator->requestContext);
+        free(iterator->strings);
+        free(iterator);
+        return S3StatusInternalError;
+    }
+
+    *iteratorReturn = iterator;
+
+    return S3StatusOK;
+}
+
+
+S3Status S3_list_iterator_next(S3ListIterator *iterator,
+                               const S3ListBucketContent **contentReturn,
+                               const char **commonPrefixReturn)
+{
+    while (1) {
+        ListPage *page = iterator->current;
+
+        if (page) {
+            // Keys and common prefixes are each in order; merge them
+            const S3ListBucketContent *content =
+                (iterator->contentsIndex < page->contentsCount) ?
+                &(page->contents[iterator->contentsIndex]) : 0;
+            const char *commonPrefix =
+                (commonPrefixReturn && (iterator->commonPrefixesIndex <
+                                        page->commonPrefixesCount)) ?
+                page->commonPrefixes[iterator->commonPrefixesIndex] : 0;
+
+            if (content && commonPrefix) {
+                if (strcmp(commonPrefix, content->key) < 0) {
+                    content = 0;
+                }
+                else {
+                    commonPrefix = 0;
+                }
+            }
+
+            if (content || commonPrefix) {
+                if (content) {
+                    iterator->contentsIndex++;
+                }
+                else {
+                    iterator->commonPrefixesIndex++;
+                }
+                *contentReturn = content;
+                if (commonPrefixReturn) {
+                    *commonPrefixReturn = commonPrefix;
+                }
+                return S3StatusOK;
+            }
+
+            // Done with this page
+            free(page);
+            iterator->current = 0;
+        }
+
+        pthread_mutex_lock(&(iterator->mutex));
+        while (!iterator->pagesHead && !iterator->finished) {
+            pthread_cond_wait(&(iterator->cond), &(iterator->mutex));
+        }
+        if ((page = iterator->pagesHead)) {
+            if (!(iterator->pagesHead = page->next)) {
+                iterator->pagesTail = &(iterator->pagesHead);
+            }
+            iterator->pagesCount--;
+            // The listing thread may now list another page
+            pthread_cond_broadcast(&(iterator->cond));
+        }
+        S3Status status = iterator->status;
+        pthread_mutex_unlock(&(iterator->mutex));
+
+        if (!page) {
+            // The listing is finished, successfully or not
+            *contentReturn = 0;
+            if (commonPrefixReturn) {
+                *commonPrefixReturn = 0;
+            }
+            return status;
+        }
+
+        iterator->current = page;
+        iterator->contentsIndex = 0;
+        iterator->commonPrefixesIndex = 0;
+    }
+}
+
+
+void S3_destroy_list_iterator(S3ListIterator *iterator)
+{
+    pthread_mutex_lock(&(iterator->mutex));
+    iterator->destroying = 1;
+    pthread_cond_broadcast(&(iterator->cond));
+    pthread_mutex_unlock(&(iterator->mutex));
+
+    pthread_join(iterator->thread, 0);
+
+    // This interrupts any request left in flight, whose callbacks may still
+    // refer to the iterator
+    S3_destroy_request_context(iterator->requestContext);
+
+    response_reset(iterator);
+    free(iterator->continuationToken);
+    free(iterator->current);
+    pages_free(iterator->pagesHead);
+
+    pthread_cond_destroy(&(iterator->cond));
+    pthread_mutex_destroy(&(iterator->mutex));
+    free(iterator->strings);
+    free(iterator);
+}
@@ -0,0 +1,569 @@
+/** **************************************************************************
+ * metrics.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metrics.h"
+
+
+// The most series that are kept; a power of two.  Requests of any further
+// combinations of operation, HTTP method and status are only counted as
+// dropped.
+#define MAX_SERIES 256
+
+// Each power of two of latency is split into this many histogram buckets
+#define SUB_BUCKETS 8
+
+
+typedef struct Series
+{
+    // Set before the series is published in the table, and never changed
+    HttpRequestType httpRequestType;
+    S3Operation operation;
+    const char *method;
+    S3Status status;
+
+    // Updated with atomic additions; the number of requests is the sum of
+    // the histogram buckets
+    volatile uint64_t totalUs;
+    volatile uint64_t bytesSent;
+    volatile uint64_t bytesReceived;
+    volatile uint64_t histogram[S3_METRICS_HISTOGRAM_BUCKETS];
+} Series;
+
+
+static int enabledG;
+
+static Series * volatile seriesG[MAX_SERIES];
+
+static volatile int64_t requestsInFlightG[S3_OPERATION_COUNT];
+
+static volatile uint64_t droppedCountG;
+
+
+// Recording -----------------------------------------------------------------
+
+void metrics_initialize(int flags)
+{
+    enabledG = (flags & S3_INIT_METRICS) ? 1 : 0;
+}
+
+
+void metrics_deinitialize()
+{
+    int i;
+    for (i = 0; i < MAX_SERIES; i++) {
+        free(seriesG[i]);
+        seriesG[i] = 0;
+    }
+
+    for (i = 0; i < S3_OPERATION_COUNT; i++) {
+        requestsInFlightG[i] = 0;
+    }
+
+    droppedCountG = 0;
+    enabledG = 0;
+}
+
+
+int metrics_enabled()
+{
+    return enabledG;
+}
+
+
+// Returns nonzero if the name of a sub-resource or query parameter string,
+// which is the part before any '=' or '&', is name
+static int is_named(const char *str, const char *name)
+{
+    if (!str) {
+        return 0;
+    }
+
+    int len = strlen(name);
+
+    return (!strncmp(str, name, len) &&
+            ((str[len] == 0) || (str[len] == '=') || (str[len] == '&')));
+}
+
+
+S3Operation metrics_operation(const RequestParams *params)
+{
+    const char *subResource = params->subResource;
+    if (subResource && !subResource[0]) {
+        subResource = 0;
+    }
+
+    // Parts are identified by query parameters rather than by sub-resource
+    int part = is_named(params->queryParams, "partNumber");
+    int upload = (is_named(subResource, "uploadId") ||
+                  is_named(params->queryParams, "uploadId"));
+
+    if (!params->bucketContext.bucketName) {
+        return ((params->httpRequestType == HttpRequestTypeGET) ?
+                S3OperationListService : S3OperationOther);
+    }
+
+    if (!params->key) {
+        switch (params->httpRequestType) {
+        case HttpRequestTypeGET:
+            if (is_named(subResource, "uploads")) {
+                return S3OperationListMultipartUploads;
+            }
+            return (subResource ?
+                    S3OperationGetSubResource : S3OperationListBucket);
+        case HttpRequestTypePUT:
+            return (subResource ?
+                    S3OperationSetSubResource : S3OperationCreateBucket);
+        case HttpRequestTypeDELETE:
+            return (subResource ?
+                    S3OperationOther : S3OperationDeleteBucket);
+        default:
+            return S3OperationOther;
+        }
+    }
+
+    switch (params->httpRequestType) {
+    case HttpRequestTypeGET:
+        if (upload) {
+            return S3OperationListParts;
+        }
+        return (subResource ?
+                S3OperationGetSubResource : S3OperationGetObject);
+    case HttpRequestTypeHEAD:
+        return S3OperationHeadObject;
+    case HttpRequestTypePUT:
+        if (part) {
+            return S3OperationUploadPart;
+        }
+        return (subResource ?
+                S3OperationSetSubResource : S3OperationPutObject);
+    case HttpRequestTypeCOPY:
+        return (part ? S3OperationUploadPartCopy : S3OperationCopyObject);
+    case HttpRequestTypeDELETE:
+        return (upload ?
+                S3OperationAbortMultipartUpload : S3OperationDeleteObject);
+    case HttpRequestTypePOST:
+        if (is_named(subResource, "uploads")) {
+            return S3OperationCreateMultipartUpload;
+        }
+        return (upload ?
+                S3OperationCompleteMultipartUpload : S3OperationOther);
+    default:
+        return S3OperationOther;
+    }
+}
+
+
+void metrics_request_started(S3Operation operation)
+{
+    __sync_fetch_and_add(&(requestsInFlightG[operation]), 1);
+}
+
+
+static int histogram_bucket(uint64_t us)
+{
+    if (us < SUB_BUCKETS) {
+        return us;
+    }
+
+    // The power of two, and the eighth of it, that us falls in
+    int power = 63 - __builtin_clzll(us);
+    int bucket = (((power - 2) * SUB_BUCKETS) +
+                  ((us >> (power - 3)) & (SUB_BUCKETS - 1)));
+
+    return ((bucket < S3_METRICS_HISTOGRAM_BUCKETS) ?
+            bucket : (S3_METRICS_HISTOGRAM_BUCKETS - 1));
+}
+
+
+// Returns the smallest latency which is beyond a histogram bucket
+static uint64_t histogram_bucket_limit(int bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket + 1;
+    }
+
+    int shift = (bucket / SUB_BUCKETS) - 1;
+
+    return ((uint64_t) (SUB_BUCKETS + (bucket % SUB_BUCKETS) + 1)) << shift;
+}
+
+
+// Returns the series of a combination of HTTP method, operation and status,
+// creating it if need be, or 0 if there is no room for it
+static Series *get_series(HttpRequestType httpRequestType,
+                          S3Operation operation, const char *method,
+                          S3Status status)
+{
+    unsigned int hash = ((((unsigned int) operation * 31) +
+                          (unsigned int) httpRequestType) * 131) +
+        (unsigned int) status;
+    Series *created = 0;
+    int i;
+
+    for (i = 0; i < MAX_SERIES; i++) {
+        Series * volatile *slot = &(seriesG[(hash + i) & (MAX_SERIES - 1)]);
+        Series *series = *slot;
+
+        if (!series) {
+            if (!created) {
+                if (!(created = (Series *) calloc(1, sizeof(Series)))) {
+                    return 0;
+                }
+                created->httpRequestType = httpRequestType;
+                created->operation = operation;
+                created->method = method;
+                created->status = status;
+            }
+            if (__sync_bool_compare_and_swap(slot, 0, created)) {
+                return created;
+            }
+            // Another thread claimed the slot first
+            series = *slot;
+        }
+
+        if ((series->operation == operation) &&
+            (series->httpRequestType == httpRequestType) &&
+            (series->status == status)) {
+            free(created);
+            return series;
+        }
+    }
+
+    free(created);
+    return 0;
+}
+
+
+void metrics_request_finished(HttpRequestType httpRequestType,
+                              const S3RequestStats *stats)
+{
+    __sync_fetch_and_sub(&(requestsInFlightG[stats->operation]), 1);
+
+    Series *series = get_series(httpRequestType, stats->operation,
+                                stats->method, stats->status);
+    if (!series) {
+        __sync_fetch_and_add(&droppedCountG, 1);
+        return;
+    }
+
+    uint64_t us = (stats->totalUs > 0) ? stats->totalUs : 0;
+
+    __sync_fetch_and_add(&(series->totalUs), us);
+    __sync_fetch_and_add(&(series->bytesSent), stats->bytesSent);
+    __sync_fetch_and_add(&(series->bytesReceived), stats->bytesReceived);
+    __sync_fetch_and_add(&(series->histogram[histogram_bucket(us)]), 1);
+}
+
+
+// Snapshots -----------------------------------------------------------------
+
+S3Status S3_get_metrics(S3Metrics **metricsReturn)
+{
+    // Series may be added while this runs, so room is made for all of them
+    S3Metrics *metrics = (S3Metrics *)
+        malloc(sizeof(S3Metrics) + (MAX_SERIES * sizeof(S3MetricsSeries)));
+    if (!metrics) {
+        return S3StatusOutOfMemory;
+    }
+
+    int i, j;
+    for (i = 0; i < S3_OPERATION_COUNT; i++) {
+        metrics->requestsInFlight[i] = requestsInFlightG[i];
+    }
+
+    metrics->series = (S3MetricsSeries *) &(metrics[1]);
+    metrics->seriesCount = 0;
+
+    for (i = 0; i < MAX_SERIES; i++) {
+        Series *series = seriesG[i];
+        if (!series) {
+            continue;
+        }
+        S3MetricsSeries *copy = &(metrics->series[metrics->seriesCount++]);
+        copy->operation = series->operation;
+        copy->method = series->method;
+        copy->status = series->status;
+        copy->totalUs = series->totalUs;
+        copy->bytesSent = series->bytesSent;
+        copy->bytesReceived = series->bytesReceived;
+        // Counting the copied buckets, rather than keeping a separate count
+        // which requests being recorded meanwhile could make differ from
+        // them, keeps the count equal to their sum
+        copy->count = 0;
+        for (j = 0; j < S3_METRICS_HISTOGRAM_BUCKETS; j++) {
+            copy->histogram[j] = series->histogram[j];
+            copy->count += copy->histogram[j];
+        }
+    }
+
+    metrics->droppedCount = droppedCountG;
+
+    *metricsReturn = metrics;
+
+    return S3StatusOK;
+}
+
+
+void S3_free_metrics(S3Metrics *metrics)
+{
+    free(metrics);
+}
+
+
+void S3_reset_metrics()
+{
+    int i, j;
+    for (i = 0; i < MAX_SERIES; i++) {
+        Series *series = seriesG[i];
+        if (!series) {
+            continue;
+        }
+        __sync_lock_test_and_set(&(series->totalUs), 0);
+        __sync_lock_test_and_set(&(series->bytesSent), 0);
+        __sync_lock_test_and_set(&(series->bytesReceived), 0);
+        for (j = 0; j < S3_METRICS_HISTOGRAM_BUCKETS; j++) {
+            __sync_lock_test_and_set(&(series->histogram[j]), 0);
+        }
+    }
+
+    __sync_lock_test_and_set(&droppedCountG, 0);
+}
+
+
+uint64_t S3_get_metrics_percentile(const S3MetricsSeries *series,
+                                   double percentile)
+{
+    if (!series->count) {
+        return 0;
+    }
+
+    // The rank of the request at the percentile, counting from 1
+    double rank = (percentile / 100) * series->count;
+    uint64_t target = (rank < 1) ? 1 : (uint64_t) rank;
+    if (target < rank) {
+        target++;
+    }
+    if (target > series->count) {
+        target = series->count;
+    }
+
+    uint64_t seen = 0;
+    int i;
+    for (i = 0; i < (S3_METRICS_HISTOGRAM_BUCKETS - 1); i++) {
+        if ((seen += series->histogram[i]) >= target) {
+            break;
+        }
+    }
+
+    // The highest latency which the bucket counts
+    return histogram_bucket_limit(i) - 1;
+}
+
+
+const char *S3_get_operation_name(S3Operation operation)
+{
+    switch (operation) {
+    case S3OperationListService:
+        return "list_service";
+    case S3OperationListBucket:
+        return "list_bucket";
+    case S3OperationCreateBucket:
+        return "create_bucket";
+    case S3OperationDeleteBucket:
+        return "delete_bucket";
+    case S3OperationGetObject:
+        return "get_object";
+    case S3OperationHeadObject:
+        return "head_object";
+    case S3OperationPutObject:
+        return "put_object";
+    case S3OperationCopyObject:
+        return "copy_object";
+    case S3OperationDeleteObject:
+        return "delete_object";
+    case S3OperationCreateMultipartUpload:
+        return "create_multipart_upload";
+    case S3OperationUploadPart:
+        return "upload_part";
+    case S3OperationUploadPartCopy:
+        return "upload_part_copy";
+    case S3OperationCompleteMultipartUpload:
+        return "complete_multipart_upload";
+    case S3OperationAbortMultipartUpload:
+        return "abort_multipart_upload";
+    case S3OperationListParts:
+        return "list_parts";
+    case S3OperationListMultipartUploads:
+        return "list_multipart_uploads";
+    case S3OperationGetSubResource:
+        return "get_sub_resource";
+    case S3OperationSetSubResource:
+        return "set_sub_resource";
+    default:
+        return "other";
+    }
+}
+
+
+// Prometheus format ---------------------------------------------------------
+
+// The upper bounds of the buckets of the exported latency histograms, in
+// seconds, and in microseconds
+static const char *exportBoundsG[] =
+{
+    "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25",
+    "0.5", "1", "2.5", "5", "10", "30", "60"
+};
+
+static const uint64_t exportBoundsUsG[] =
+{
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+    500000, 1000000, 2500000, 5000000, 10000000, 30000000, 60000000
+};
+
+#define EXPORT_BOUNDS_COUNT \
+    (sizeof(exportBoundsUsG) / sizeof(exportBoundsUsG[0]))
+
+
+typedef struct Output
+{
+    char *buffer;
+    int bufferSize;
+
+    // The length of the output so far, which may be more than fits
+    int length;
+} Output;
+
+
+static void output(Output *out, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    int room = out->bufferSize - out->length;
+    int len = vsnprintf((room > 0) ? &(out->buffer[out->length]) : 0,
+                        (room > 0) ? room : 0, format, args);
+
+    va_end(args);
+
+    if (len > 0) {
+        out->length += len;
+    }
+}
+
+
+static void output_series_labels(Output *out, const S3MetricsSeries *series)
+{
+    output(out, "operation=\"%s\",method=\"%s\",status=\"%s\"",
+           S3_get_operation_name(series->operation), series->method,
+           S3_get_status_name(series->status));
+}
+
+
+int S3_format_metrics_prometheus(const S3Metrics *metrics, char *buffer,
+                                 int bufferSize)
+{
+    Output out = { buffer, bufferSize, 0 };
+    int i, j;
+
+    if (bufferSize > 0) {
+        buffer[0] = 0;
+    }
+
+    output(&out, "# HELP libs3_requests_in_flight "
+           "Requests started and not yet completed.\n"
+           "# TYPE libs3_requests_in_flight gauge\n");
+    for (i = 0; i < S3_OPERATION_COUNT; i++) {
+        output(&out, "libs3_requests_in_flight{operation=\"%s\"} %lld\n",
+               S3_get_operation_name((S3Operation) i),
+               (long long) metrics->requestsInFlight[i]);
+    }
+
+    output(&out, "# HELP libs3_request_duration_seconds "
+           "Latency of completed requests.\n"
+           "# TYPE libs3_request_duration_seconds histogram\n");
+    for (i = 0; i < metrics->seriesCount; i++) {
+        const S3MetricsSeries *series = &(metrics->series[i]);
+        // A histogram bucket is counted within a bound only if all of it is
+        int bucket = 0;
+        uint64_t cumulative = 0;
+        for (j = 0; j < (int) EXPORT_BOUNDS_COUNT; j++) {
+            while ((bucket < (S3_METRICS_HISTOGRAM_BUCKETS - 1)) &&
+                   (histogram_bucket_limit(bucket) <= exportBoundsUsG[j])) {
+                cumulative += series->histogram[bucket++];
+            }
+            output(&out, "libs3_request_duration_seconds_bucket{");
+            output_series_labels(&out, series);
+            output(&out, ",le=\"%s\"} %llu\n", exportBoundsG[j],
+                   (unsigned long long) cumulative);
+        }
+        output(&out, "libs3_request_duration_seconds_bucket{");
+        output_series_labels(&out, series);
+        output(&out, ",le=\"+Inf\"} %llu\n",
+               (unsigned long long) series->count);
+        output(&out, "libs3_request_duration_seconds_sum{");
+        output_series_labels(&out, series);
+        output(&out, "} %llu.%06llu\n",
+               (unsigned long long) (series->totalUs / 1000000),
+               (unsigned long long) (series->totalUs % 1000000));
+        output(&out, "libs3_request_duration_seconds_count{");
+        output_series_labels(&out, series);
+        output(&out, "} %llu\n", (unsigned long long) series->count);
+    }
+
+    output(&out, "# HELP libs3_request_sent_bytes_total "
+           "Bytes of request body sent.\n"
+           "# TYPE libs3_request_sent_bytes_total counter\n");
+    for (i = 0; i < metrics->seriesCount; i++) {
+        output(&out, "libs3_request_sent_bytes_total{");
+        output_series_labels(&out, &(metrics->series[i]));
+        output(&out, "} %llu\n",
+               (unsigned long long) metrics->series[i].bytesSent);
+    }
+
+    output(&out, "# HELP libs3_request_received_bytes_total "
+           "Bytes of response body received.\n"
+           "# TYPE libs3_request_received_bytes_total counter\n");
+    for (i = 0; i < metrics->seriesCount; i++) {
+        output(&out, "libs3_request_received_bytes_total{");
+        output_series_labels(&out, &(metrics->series[i]));
+        output(&out, "} %llu\n",
+               (unsigned long long) metrics->series[i].bytesReceived);
+    }
+
+    output(&out, "# HELP libs3_requests_dropped_total "
+           "Completed requests not recorded for lack of room.\n"
+           "# TYPE libs3_requests_dropped_total counter\n"
+           "libs3_requests_dropped_total %llu\n",
+           (unsigned long long) metrics->droppedCount);
+
+    return out.length;
+}
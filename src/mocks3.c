@@ -0,0 +1,2512 @@
+/** **************************************************************************
+ * mocks3.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "mocks3.h"
+
+// Largest request header block accepted
+#define MAX_REQUEST_HEADERS_SIZE (16 * 1024)
+
+// Largest query string accepted
+#define MAX_QUERY_SIZE (8 * 1024)
+
+// The most keys, uploads or parts returned by one listing
+#define MAX_LIST_COUNT 1000
+
+// The highest part number of a multipart upload
+#define MAX_PART_NUMBER 10000
+
+// Room for an ETag: 32 hex digits, followed for a multipart object by "-"
+// and the number of parts
+#define ETAG_SIZE (32 + sizeof("-4294967295"))
+
+// When bandwidth is limited, bodies are sent and received in pieces of this
+// size, with a pause after each as needed
+#define THROTTLE_PIECE_SIZE (16 * 1024)
+
+#define XML_DECLARATION "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+
+#define XML_NAMESPACE "xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\""
+
+#define XML_OWNER "<ID>mock</ID><DisplayName>mock</DisplayName>"
+
+
+typedef struct MockObject
+{
+    // One reference is held while the object is stored, and one by each
+    // response that is sending it; protected by the mock's mutex
+    int refs;
+
+    char *bucketName;
+
+    char *key;
+
+    // The Content-Type and x-amz-meta- headers that the object was put with,
+    // as header lines
+    char *headers;
+
+    char *data;
+
+    int64_t size;
+
+    // Not quoted; a hash of the data, but not its MD5 as S3 would use
+    char eTag[ETAG_SIZE];
+
+    time_t lastModified;
+} MockObject;
+
+
+typedef struct MockPart
+{
+    int number;
+
+    char *data;
+
+    int64_t size;
+
+    char eTag[ETAG_SIZE];
+
+    time_t lastModified;
+} MockPart;
+
+
+typedef struct MockUpload
+{
+    char uploadId[24];
+
+    char *bucketName;
+
+    char *key;
+
+    // As for MockObject
+    char *headers;
+
+    time_t initiated;
+
+    // Sorted by part number
+    MockPart *parts;
+
+    int partCount, partsSize;
+} MockUpload;
+
+
+typedef struct MockBucket
+{
+    char *name;
+
+    time_t created;
+} MockBucket;
+
+
+typedef struct MockConnection
+{
+    // Open connections are kept on a doubly-linked list so that they can be
+    // shut down when the mock is stopped
+    struct MockConnection *prev, *next;
+
+    MockS3 *mock;
+
+    int fd;
+
+    // Chooses the requests of this connection that fail
+    unsigned int seed;
+
+    pthread_t thread;
+} MockConnection;
+
+
+struct MockS3
+{
+    MockS3Options options;
+
+    int listenFd;
+
+    char hostName[32];
+
+    pthread_t acceptThread;
+
+    // Protects everything below
+    pthread_mutex_t mutex;
+
+    // Signalled when the last connection closes
+    pthread_cond_t cond;
+
+    int stopping;
+
+    MockConnection *connections;
+
+    int connectionCount;
+
+    uint64_t acceptedCount;
+
+    uint64_t requestCount;
+
+    // Sorted by name
+    MockBucket *buckets;
+
+    int bucketCount, bucketsSize;
+
+    // Sorted by bucket name and then key
+    MockObject **objects;
+
+    int objectCount, objectsSize;
+
+    MockUpload **uploads;
+
+    int uploadCount, uploadsSize;
+
+    uint64_t nextUploadId;
+};
+
+
+typedef struct MockRequest
+{
+    char method[16];
+
+    // Decoded from the path; empty if the path does not give them
+    char bucketName[S3_MAX_BUCKET_NAME_SIZE + 1];
+
+    char key[S3_MAX_KEY_SIZE + 1];
+
+    // As it appeared after the '?' of the request URI, still encoded
+    char query[MAX_QUERY_SIZE];
+
+    // The request line and headers, terminated by the end of the last
+    // header line
+    const char *headers;
+
+    // Owned by the request until a handler takes it; terminated by a NUL
+    // beyond bodyLength
+    char *body;
+
+    int64_t bodyLength;
+
+    int headOnly;
+
+    int closeConnection;
+} MockRequest;
+
+
+// A growable buffer in which responses are built
+typedef struct MockBuffer
+{
+    char *data;
+
+    int64_t length, size;
+
+    // Set if memory ran out; the contents are then incomplete
+    int failed;
+} MockBuffer;
+
+
+// Utilities -----------------------------------------------------------------
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (((int64_t) ts.tv_sec) * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+static void sleep_us(int64_t us)
+{
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts)) {
+    }
+}
+
+
+// Waits until no more than bytes have been transferred since startUs at the
+// given bandwidth
+static void throttle(int64_t startUs, int64_t bytes, int64_t bandwidth)
+{
+    int64_t due = startUs + ((bytes * 1000000) / bandwidth);
+    int64_t now = now_us();
+    if (due > now) {
+        sleep_us(due - now);
+    }
+}
+
+
+// Grows an array, if need be, so that it has room for one more element
+static int grow(void **array, int *size, int count, int elementSize)
+{
+    if (count < *size) {
+        return 0;
+    }
+
+    int newSize = *size ? (*size * 2) : 16;
+    void *newArray = realloc(*array, ((size_t) newSize) * elementSize);
+    if (!newArray) {
+        return -1;
+    }
+
+    *array = newArray;
+    *size = newSize;
+
+    return 0;
+}
+
+
+static char *copy_string(const char *str)
+{
+    int len = strlen(str);
+    char *copy = (char *) malloc(len + 1);
+    if (copy) {
+        memcpy(copy, str, len + 1);
+    }
+
+    return copy;
+}
+
+
+static void buffer_append(MockBuffer *buffer, const char *data, int64_t len)
+{
+    if (buffer->failed) {
+        return;
+    }
+
+    if ((buffer->length + len + 1) > buffer->size) {
+        int64_t newSize = buffer->size ? buffer->size : 1024;
+        while ((buffer->length + len + 1) > newSize) {
+            newSize *= 2;
+        }
+        char *newData = (char *) realloc(buffer->data, newSize);
+        if (!newData) {
+            buffer->failed = 1;
+            return;
+        }
+        buffer->data = newData;
+        buffer->size = newSize;
+    }
+
+    memcpy(&(buffer->data[buffer->length]), data, len);
+    buffer->length += len;
+    buffer->data[buffer->length] = 0;
+}
+
+
+static void buffer_printf(MockBuffer *buffer, const char *format, ...)
+{
+    char str[1024];
+
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(str, sizeof(str), format, args);
+    va_end(args);
+
+    if ((len < 0) || (len >= (int) sizeof(str))) {
+        buffer->failed = 1;
+        return;
+    }
+
+    buffer_append(buffer, str, len);
+}
+
+
+// Appends str escaped for use as XML text
+static void buffer_append_xml(MockBuffer *buffer, const char *str)
+{
+    while (*str) {
+        int len = strcspn(str, "&<>\"'");
+        buffer_append(buffer, str, len);
+        str += len;
+        switch (*str) {
+        case 0:
+            return;
+        case '&':
+            buffer_append(buffer, "&amp;", 5);
+            break;
+        case '<':
+            buffer_append(buffer, "&lt;", 4);
+            break;
+        case '>':
+            buffer_append(buffer, "&gt;", 4);
+            break;
+        case '"':
+            buffer_append(buffer, "&quot;", 6);
+            break;
+        default:
+            buffer_append(buffer, "&apos;", 6);
+            break;
+        }
+        str++;
+    }
+}
+
+
+// Appends <name>value</name>, with value escaped
+static void buffer_append_element(MockBuffer *buffer, const char *name,
+                                  const char *value)
+{
+    buffer_printf(buffer, "<%s>", name);
+    buffer_append_xml(buffer, value);
+    buffer_printf(buffer, "</%s>", name);
+}
+
+
+static void buffer_free(MockBuffer *buffer)
+{
+    free(buffer->data);
+}
+
+
+static int hex_value(char c)
+{
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+
+// Decodes the len bytes of the URL encoded src into dest.  Returns 0 on
+// success, or -1 if it doesn't fit.
+static int url_decode(const char *src, int len, char *dest, int destSize)
+{
+    int i, destLen = 0;
+    for (i = 0; i < len; i++) {
+        if (destLen == (destSize - 1)) {
+            return -1;
+        }
+        int high, low;
+        if ((src[i] == '%') && ((i + 2) < len) &&
+            ((high = hex_value(src[i + 1])) >= 0) &&
+            ((low = hex_value(src[i + 2])) >= 0)) {
+            dest[destLen++] = (high << 4) | low;
+            i += 2;
+        }
+        else {
+            dest[destLen++] = src[i];
+        }
+    }
+    dest[destLen] = 0;
+
+    return 0;
+}
+
+
+// Finds query parameter name within query, and decodes its value into
+// value, which is empty if the parameter has none.  Returns nonzero if the
+// parameter is present.
+static int get_param(const char *query, const char *name, char *value,
+                     int valueSize)
+{
+    int nameLen = strlen(name);
+
+    while (*query) {
+        int len = strcspn(query, "&");
+        if (!strncmp(query, name, nameLen) &&
+            ((len == nameLen) || (query[nameLen] == '='))) {
+            const char *v = (len == nameLen) ? &(query[len]) :
+                &(query[nameLen + 1]);
+            if (url_decode(v, &(query[len]) - v, value, valueSize)) {
+                value[0] = 0;
+            }
+            return 1;
+        }
+        query += len;
+        if (*query) {
+            query++;
+        }
+    }
+
+    return 0;
+}
+
+
+static int has_param(const char *query, const char *name)
+{
+    char value[S3_MAX_KEY_SIZE + 1];
+
+    return get_param(query, name, value, sizeof(value));
+}
+
+
+// Returns nonzero if query has any parameter that the mock does not know,
+// which would ask for a sub-resource that it does not support
+static int has_unsupported_param(const char *query)
+{
+    static const char *knownParams[] =
+    {
+        "prefix", "marker", "delimiter", "max-keys", "list-type",
+        "start-after", "continuation-token", "fetch-owner", "encoding-type",
+        "location", "uploads", "uploadId", "partNumber", "key-marker",
+        "upload-id-marker", "max-uploads", "part-number-marker",
+        "max-parts", 0
+    };
+
+    while (*query) {
+        int len = strcspn(query, "&="), i;
+        for (i = 0; knownParams[i]; i++) {
+            if ((len == (int) strlen(knownParams[i])) &&
+                !strncmp(query, knownParams[i], len)) {
+                break;
+            }
+        }
+        if (!knownParams[i]) {
+            return 1;
+        }
+        query += strcspn(query, "&");
+        if (*query) {
+            query++;
+        }
+    }
+
+    return 0;
+}
+
+
+// Finds the value of header [name] within the header block [headers], and
+// returns it, or 0 if the header is not present.  The value extends to the
+// next "\r\n".
+static const char *find_header(const char *headers, const char *name)
+{
+    int nameLen = strlen(name);
+
+    const char *line = strstr(headers, "\r\n");
+    while (line && line[2] && (line[2] != '\r')) {
+        line += 2;
+        if (!strncasecmp(line, name, nameLen) && (line[nameLen] == ':')) {
+            const char *value = &(line[nameLen + 1]);
+            while (*value == ' ') {
+                value++;
+            }
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+
+    return 0;
+}
+
+
+// Parses a "bytes=first-last" range, in which last may be omitted, against
+// an object of size bytes, into its first byte and length.  Returns 0 on
+// success, or -1 if the range is not satisfiable.
+static int parse_range(const char *range, int64_t size, int64_t *firstReturn,
+                       int64_t *lengthReturn)
+{
+    long long first, last;
+    int n = sscanf(range, "bytes=%lld-%lld", &first, &last);
+    if ((n < 1) || (first < 0) || (first >= size)) {
+        return -1;
+    }
+    if ((n < 2) || (last >= size)) {
+        last = size - 1;
+    }
+    if (last < first) {
+        return -1;
+    }
+
+    *firstReturn = first;
+    *lengthReturn = (last - first) + 1;
+
+    return 0;
+}
+
+
+// Returns the Content-Type and x-amz-meta- header lines of a header block,
+// to be given back by GETs of the object that the request puts
+static char *stored_headers(const char *headers)
+{
+    MockBuffer buffer = { 0, 0, 0, 0 };
+    buffer_append(&buffer, "", 0);
+
+    const char *line = strstr(headers, "\r\n");
+    while (line && line[2] && (line[2] != '\r')) {
+        line += 2;
+        const char *end = strstr(line, "\r\n");
+        int len = end ? (end - line) : (int) strlen(line);
+        if (!strncasecmp(line, "Content-Type:", 13) ||
+            !strncasecmp(line, "x-amz-meta-", 11)) {
+            buffer_append(&buffer, line, len);
+            buffer_append(&buffer, "\r\n", 2);
+        }
+        line = end;
+    }
+
+    if (buffer.failed) {
+        buffer_free(&buffer);
+        return 0;
+    }
+
+    return buffer.data;
+}
+
+
+// Computes an ETag for data; it is a hash of the data, like S3's, but not
+// its MD5, which is too slow to compute for a benchmark's stand-in
+static void compute_etag(const char *data, int64_t size, char *eTag)
+{
+    uint64_t h1 = 0xcbf29ce484222325ULL, h2 = 0x84222325cbf29ce4ULL;
+
+    int64_t i;
+    for (i = 0; (i + 8) <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, &(data[i]), 8);
+        h1 = (h1 ^ word) * 0x100000001b3ULL;
+        h2 = (h2 ^ (word >> 7)) * 0x100000001b3ULL;
+    }
+    for (; i < size; i++) {
+        h1 = (h1 ^ (unsigned char) data[i]) * 0x100000001b3ULL;
+        h2 = (h2 ^ (unsigned char) data[i]) * 0x100000001b3ULL;
+    }
+    h1 ^= size;
+
+    snprintf(eTag, 33, "%016llx%016llx", (unsigned long long) h1,
+             (unsigned long long) h2);
+}
+
+
+static void format_iso8601(time_t t, char *buffer, int bufferSize)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buffer, bufferSize, "%Y-%m-%dT%H:%M:%S.000Z", &tm);
+}
+
+
+static void format_rfc1123(time_t t, char *buffer, int bufferSize)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buffer, bufferSize, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+
+// Storage -------------------------------------------------------------------
+
+// All of these must be called with the mock's mutex held
+
+static int find_bucket(MockS3 *mock, const char *bucketName)
+{
+    int i;
+    for (i = 0; i < mock->bucketCount; i++) {
+        if (!strcmp(mock->buckets[i].name, bucketName)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+static int create_bucket(MockS3 *mock, const char *bucketName)
+{
+    if (find_bucket(mock, bucketName) != -1) {
+        return 0;
+    }
+
+    if (grow((void **) &(mock->buckets), &(mock->bucketsSize),
+             mock->bucketCount, sizeof(MockBucket))) {
+        return -1;
+    }
+
+    int i = mock->bucketCount;
+    while (i && (strcmp(mock->buckets[i - 1].name, bucketName) > 0)) {
+        mock->buckets[i] = mock->buckets[i - 1];
+        i--;
+    }
+
+    if (!(mock->buckets[i].name = copy_string(bucketName))) {
+        memmove(&(mock->buckets[i]), &(mock->buckets[i + 1]),
+                (mock->bucketCount - i) * sizeof(MockBucket));
+        return -1;
+    }
+    mock->buckets[i].created = time(0);
+    mock->bucketCount++;
+
+    return 0;
+}
+
+
+static int compare_object(const MockObject *object, const char *bucketName,
+                          const char *key)
+{
+    int cmp = strcmp(object->bucketName, bucketName);
+
+    return cmp ? cmp : strcmp(object->key, key);
+}
+
+
+// Returns the index of the first object at or after bucketName and key
+static int lower_bound(MockS3 *mock, const char *bucketName, const char *key)
+{
+    int low = 0, high = mock->objectCount;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (compare_object(mock->objects[mid], bucketName, key) < 0) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+
+static MockObject *find_object(MockS3 *mock, const char *bucketName,
+                               const char *key)
+{
+    int i = lower_bound(mock, bucketName, key);
+
+    if ((i < mock->objectCount) &&
+        !compare_object(mock->objects[i], bucketName, key)) {
+        return mock->objects[i];
+    }
+
+    return 0;
+}
+
+
+// Creates an object from data, which it takes ownership of; returns 0 if
+// memory runs out, in which case data is freed
+static MockObject *create_object(const char *bucketName, const char *key,
+                                 const char *headers, char *data,
+                                 int64_t size)
+{
+    int bucketNameLen = strlen(bucketName), keyLen = strlen(key);
+    int headersLen = strlen(headers);
+
+    MockObject *object = (MockObject *)
+        malloc(sizeof(MockObject) + bucketNameLen + keyLen + headersLen + 3);
+    if (!object) {
+        free(data);
+        return 0;
+    }
+
+    object->refs = 1;
+    object->bucketName = (char *) &(object[1]);
+    memcpy(object->bucketName, bucketName, bucketNameLen + 1);
+    object->key = &(object->bucketName[bucketNameLen + 1]);
+    memcpy(object->key, key, keyLen + 1);
+    object->headers = &(object->key[keyLen + 1]);
+    memcpy(object->headers, headers, headersLen + 1);
+    object->data = data;
+    object->size = size;
+    compute_etag(data, size, object->eTag);
+    object->lastModified = time(0);
+
+    return object;
+}
+
+
+static void release_object(MockObject *object)
+{
+    if (!--object->refs) {
+        free(object->data);
+        free(object);
+    }
+}
+
+
+// Stores an object, replacing any with the same key; returns -1 if memory
+// runs out, in which case the object is released
+static int store_object(MockS3 *mock, MockObject *object)
+{
+    int i = lower_bound(mock, object->bucketName, object->key);
+
+    if ((i < mock->objectCount) &&
+        !compare_object(mock->objects[i], object->bucketName, object->key)) {
+        release_object(mock->objects[i]);
+        mock->objects[i] = object;
+        return 0;
+    }
+
+    if (grow((void **) &(mock->objects), &(mock->objectsSize),
+             mock->objectCount, sizeof(MockObject *))) {
+        release_object(object);
+        return -1;
+    }
+
+    memmove(&(mock->objects[i + 1]), &(mock->objects[i]),
+            (mock->objectCount - i) * sizeof(MockObject *));
+    mock->objects[i] = object;
+    mock->objectCount++;
+
+    return 0;
+}
+
+
+static void remove_object(MockS3 *mock, int i)
+{
+    release_object(mock->objects[i]);
+    memmove(&(mock->objects[i]), &(mock->objects[i + 1]),
+            (mock->objectCount - i - 1) * sizeof(MockObject *));
+    mock->objectCount--;
+}
+
+
+static int find_upload(MockS3 *mock, const char *uploadId,
+                       const char *bucketName, const char *key)
+{
+    int i;
+    for (i = 0; i < mock->uploadCount; i++) {
+        MockUpload *upload = mock->uploads[i];
+        if (!strcmp(upload->uploadId, uploadId) &&
+            !strcmp(upload->bucketName, bucketName) &&
+            !strcmp(upload->key, key)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+static void remove_upload(MockS3 *mock, int i)
+{
+    MockUpload *upload = mock->uploads[i];
+
+    int j;
+    for (j = 0; j < upload->partCount; j++) {
+        free(upload->parts[j].data);
+    }
+    free(upload->parts);
+    free(upload->bucketName);
+    free(upload->key);
+    free(upload->headers);
+    free(upload);
+
+    mock->uploads[i] = mock->uploads[--mock->uploadCount];
+}
+
+
+// Responses -----------------------------------------------------------------
+
+static int send_all(int fd, const char *data, int len)
+{
+    while (len) {
+        int sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return -1;
+        }
+        data += sent, len -= sent;
+    }
+
+    return 0;
+}
+
+
+static int send_body(MockConnection *connection, const char *data,
+                     int64_t len)
+{
+    int64_t bandwidth = connection->mock->options.bandwidth;
+    int64_t pieceSize = bandwidth ? THROTTLE_PIECE_SIZE : (1 << 30);
+    int64_t start = now_us(), sent = 0;
+
+    while (sent < len) {
+        int piece = ((len - sent) < pieceSize) ?
+            (int) (len - sent) : (int) pieceSize;
+        if (send_all(connection->fd, &(data[sent]), piece)) {
+            return -1;
+        }
+        sent += piece;
+        if (bandwidth) {
+            throttle(start, sent, bandwidth);
+        }
+    }
+
+    return 0;
+}
+
+
+static const char *reason_phrase(int status)
+{
+    switch (status) {
+    case 200:
+        return "OK";
+    case 204:
+        return "No Content";
+    case 206:
+        return "Partial Content";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 409:
+        return "Conflict";
+    case 416:
+        return "Requested Range Not Satisfiable";
+    case 500:
+        return "Internal Server Error";
+    case 501:
+        return "Not Implemented";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Unknown";
+    }
+}
+
+
+// Sends a response; headers are any further header lines.  The body is
+// omitted, though its length is given, in responses to HEAD requests.
+// Returns 0 on success, or -1 if the connection is to be closed.
+static int send_response(MockConnection *connection, MockRequest *request,
+                         int status, const char *headers, const char *body,
+                         int64_t bodyLength)
+{
+    MockBuffer head = { 0, 0, 0, 0 };
+
+    buffer_printf(&head, "HTTP/1.1 %d %s\r\n"
+                  "x-amz-request-id: mock\r\n", status,
+                  reason_phrase(status));
+    if (status != 204) {
+        buffer_printf(&head, "Content-Length: %lld\r\n",
+                      (long long) bodyLength);
+    }
+    if (headers) {
+        buffer_append(&head, headers, strlen(headers));
+    }
+    if (request->closeConnection) {
+        buffer_printf(&head, "Connection: close\r\n");
+    }
+    buffer_append(&head, "\r\n", 2);
+
+    int result = (head.failed ||
+                  send_all(connection->fd, head.data, head.length) ||
+                  (!request->headOnly && bodyLength &&
+                   send_body(connection, body, bodyLength))) ? -1 : 0;
+
+    buffer_free(&head);
+
+    return result;
+}
+
+
+// Sends a response whose body is XML which has been built in body
+static int send_xml(MockConnection *connection, MockRequest *request,
+                    MockBuffer *body)
+{
+    int result;
+    if (body->failed) {
+        result = -1;
+    }
+    else {
+        result = send_response(connection, request, 200,
+                               "Content-Type: application/xml\r\n",
+                               body->data, body->length);
+    }
+
+    buffer_free(body);
+
+    return result;
+}
+
+
+static int send_error(MockConnection *connection, MockRequest *request,
+                      int status, const char *code, const char *message)
+{
+    MockBuffer body = { 0, 0, 0, 0 };
+
+    buffer_printf(&body, XML_DECLARATION "<Error><Code>%s</Code>"
+                  "<Message>%s</Message><Resource>/", code, message);
+    buffer_append_xml(&body, request->bucketName);
+    if (request->key[0]) {
+        buffer_append(&body, "/", 1);
+        buffer_append_xml(&body, request->key);
+    }
+    buffer_printf(&body, "</Resource><RequestId>mock</RequestId></Error>");
+
+    int result = body.failed ? -1 :
+        send_response(connection, request, status,
+                      "Content-Type: application/xml\r\n", body.data,
+                      body.length);
+
+    buffer_free(&body);
+
+    return result;
+}
+
+
+#define send_no_such_bucket(connection, request)                        \
+    send_error(connection, request, 404, "NoSuchBucket",                \
+               "The specified bucket does not exist")
+
+#define send_no_such_key(connection, request)                           \
+    send_error(connection, request, 404, "NoSuchKey",                   \
+               "The specified key does not exist.")
+
+#define send_no_such_upload(connection, request)                        \
+    send_error(connection, request, 404, "NoSuchUpload",                \
+               "The specified upload does not exist.")
+
+#define send_out_of_memory(connection, request)                         \
+    send_error(connection, request, 500, "InternalError",               \
+               "The mock ran out of memory.")
+
+
+// Service and bucket requests -----------------------------------------------
+
+static int list_service(MockConnection *connection, MockRequest *request)
+{
+    MockS3 *mock = connection->mock;
+    MockBuffer body = { 0, 0, 0, 0 };
+
+    buffer_printf(&body, XML_DECLARATION "<ListAllMyBucketsResult "
+                  XML_NAMESPACE "><Owner>" XML_OWNER "</Owner><Buckets>");
+
+    pthread_mutex_lock(&(mock->mutex));
+    int i;
+    for (i = 0; i < mock->bucketCount; i++) {
+        char created[64];
+        format_iso8601(mock->buckets[i].created, created, sizeof(created));
+        buffer_printf(&body, "<Bucket>");
+        buffer_append_element(&body, "Name", mock->buckets[i].name);
+        buffer_printf(&body, "<CreationDate>%s</CreationDate></Bucket>",
+                      created);
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    buffer_printf(&body, "</Buckets></ListAllMyBucketsResult>");
+
+    return send_xml(connection, request, &body);
+}
+
+
+static int delete_bucket(MockConnection *connection, MockRequest *request)
+{
+    MockS3 *mock = connection->mock;
+
+    pthread_mutex_lock(&(mock->mutex));
+    int i = find_bucket(mock, request->bucketName), empty = 1;
+    if (i != -1) {
+        int j = lower_bound(mock, request->bucketName, "");
+        if ((j < mock->objectCount) &&
+            !strcmp(mock->objects[j]->bucketName, request->bucketName)) {
+            empty = 0;
+        }
+        for (j = 0; j < mock->uploadCount; j++) {
+            if (!strcmp(mock->uploads[j]->bucketName, request->bucketName)) {
+                empty = 0;
+            }
+        }
+        if (empty) {
+            free(mock->buckets[i].name);
+            memmove(&(mock->buckets[i]), &(mock->buckets[i + 1]),
+                    (mock->bucketCount - i - 1) * sizeof(MockBucket));
+            mock->bucketCount--;
+        }
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    if (i == -1) {
+        return send_no_such_bucket(connection, request);
+    }
+    if (!empty) {
+        return send_error(connection, request, 409, "BucketNotEmpty",
+                          "The bucket you tried to delete is not empty");
+    }
+
+    return send_response(connection, request, 204, 0, 0, 0);
+}
+
+
+// Lists objects with either version of ListObjects
+static int list_objects(MockConnection *connection, MockRequest *request)
+{
+    MockS3 *mock = connection->mock;
+    const char *query = request->query;
+    char prefix[S3_MAX_KEY_SIZE + 1], delimiter[S3_MAX_KEY_SIZE + 1];
+    char marker[S3_MAX_KEY_SIZE + 1], value[32];
+    char continuationToken[S3_MAX_KEY_SIZE + 1];
+    char startAfter[S3_MAX_KEY_SIZE + 1];
+
+    int v2 = (get_param(query, "list-type", value, sizeof(value)) &&
+              !strcmp(value, "2"));
+    if (!get_param(query, "prefix", prefix, sizeof(prefix))) {
+        prefix[0] = 0;
+    }
+    if (!get_param(query, "delimiter", delimiter, sizeof(delimiter))) {
+        delimiter[0] = 0;
+    }
+    int maxKeys = MAX_LIST_COUNT;
+    if (get_param(query, "max-keys", value, sizeof(value))) {
+        maxKeys = atoi(value);
+        if ((maxKeys < 0) || (maxKeys > MAX_LIST_COUNT)) {
+            maxKeys = MAX_LIST_COUNT;
+        }
+    }
+    int fetchOwner = !v2;
+    continuationToken[0] = startAfter[0] = 0;
+    if (v2) {
+        get_param(query, "continuation-token", continuationToken,
+                  sizeof(continuationToken));
+        get_param(query, "start-after", startAfter, sizeof(startAfter));
+        fetchOwner = (get_param(query, "fetch-owner", value, sizeof(value)) &&
+                      !strcmp(value, "true"));
+        // The continuation token is simply the last key or common prefix
+        // listed
+        strcpy(marker, continuationToken[0] ? continuationToken : startAfter);
+    }
+    else if (!get_param(query, "marker", marker, sizeof(marker))) {
+        marker[0] = 0;
+    }
+
+    int prefixLen = strlen(prefix), delimiterLen = strlen(delimiter);
+    MockBuffer contents = { 0, 0, 0, 0 }, commonPrefixes = { 0, 0, 0, 0 };
+    char last[S3_MAX_KEY_SIZE + 1], lastModified[64];
+    int lastIsPrefix = 0, count = 0, truncated = 0;
+    last[0] = 0;
+
+    pthread_mutex_lock(&(mock->mutex));
+
+    if (find_bucket(mock, request->bucketName) == -1) {
+        pthread_mutex_unlock(&(mock->mutex));
+        return send_no_such_bucket(connection, request);
+    }
+
+    int i = lower_bound(mock, request->bucketName,
+                        (strcmp(marker, prefix) > 0) ? marker : prefix);
+    for (; i < mock->objectCount; i++) {
+        MockObject *object = mock->objects[i];
+        if (strcmp(object->bucketName, request->bucketName) ||
+            strncmp(object->key, prefix, prefixLen)) {
+            break;
+        }
+        if (strcmp(object->key, marker) <= 0) {
+            continue;
+        }
+        const char *d = delimiterLen ?
+            strstr(&(object->key[prefixLen]), delimiter) : 0;
+        if (d) {
+            int commonPrefixLen = (d - object->key) + delimiterLen;
+            // Skip keys under the common prefix just listed, or listed by
+            // an earlier page
+            if ((lastIsPrefix &&
+                 !strncmp(object->key, last, commonPrefixLen) &&
+                 !last[commonPrefixLen]) ||
+                !strncmp(object->key, marker, commonPrefixLen)) {
+                continue;
+            }
+            if (count == maxKeys) {
+                truncated = 1;
+                break;
+            }
+            memcpy(last, object->key, commonPrefixLen);
+            last[commonPrefixLen] = 0;
+            lastIsPrefix = 1;
+            buffer_printf(&commonPrefixes, "<CommonPrefixes>");
+            buffer_append_element(&commonPrefixes, "Prefix", last);
+            buffer_printf(&commonPrefixes, "</CommonPrefixes>");
+        }
+        else {
+            if (count == maxKeys) {
+                truncated = 1;
+                break;
+            }
+            strcpy(last, object->key);
+            lastIsPrefix = 0;
+            format_iso8601(object->lastModified, lastModified,
+                           sizeof(lastModified));
+            buffer_printf(&contents, "<Contents>");
+            buffer_append_element(&contents, "Key", object->key);
+            buffer_printf(&contents, "<LastModified>%s</LastModified>"
+                          "<ETag>&quot;%s&quot;</ETag><Size>%lld</Size>",
+                          lastModified, object->eTag,
+                          (long long) object->size);
+            if (fetchOwner) {
+                buffer_printf(&contents, "<Owner>" XML_OWNER "</Owner>");
+            }
+            buffer_printf(&contents, "<StorageClass>STANDARD</StorageClass>"
+                          "</Contents>");
+        }
+        count++;
+    }
+
+    pthread_mutex_unlock(&(mock->mutex));
+
+    MockBuffer body = { 0, 0, 0, 0 };
+    buffer_printf(&body, XML_DECLARATION "<ListBucketResult "
+                  XML_NAMESPACE ">");
+    buffer_append_element(&body, "Name", request->bucketName);
+    buffer_append_element(&body, "Prefix", prefix);
+    if (v2) {
+        if (continuationToken[0]) {
+            buffer_append_element(&body, "ContinuationToken",
+                                  continuationToken);
+        }
+        if (startAfter[0]) {
+            buffer_append_element(&body, "StartAfter", startAfter);
+        }
+        buffer_printf(&body, "<KeyCount>%d</KeyCount>", count);
+    }
+    else {
+        buffer_append_element(&body, "Marker", marker);
+    }
+    buffer_printf(&body, "<MaxKeys>%d</MaxKeys>", maxKeys);
+    if (delimiterLen) {
+        buffer_append_element(&body, "Delimiter", delimiter);
+    }
+    buffer_printf(&body, "<IsTruncated>%s</IsTruncated>",
+                  truncated ? "true" : "false");
+    if (truncated) {
+        buffer_append_element(&body, v2 ? "NextContinuationToken" :
+                              "NextMarker", last);
+    }
+    if (contents.data) {
+        buffer_append(&body, contents.data, contents.length);
+    }
+    if (commonPrefixes.data) {
+        buffer_append(&body, commonPrefixes.data, commonPrefixes.length);
+    }
+    buffer_printf(&body, "</ListBucketResult>");
+    if (contents.failed || commonPrefixes.failed) {
+        body.failed = 1;
+    }
+
+    buffer_free(&contents);
+    buffer_free(&commonPrefixes);
+
+    return send_xml(connection, request, &body);
+}
+
+
+static int compare_uploads(const void *a, const void *b)
+{
+    const MockUpload *uploadA = *((const MockUpload **) a);
+    const MockUpload *uploadB = *((const MockUpload **) b);
+
+    int cmp = strcmp(uploadA->key, uploadB->key);
+
+    return cmp ? cmp : strcmp(uploadA->uploadId, uploadB->uploadId);
+}
+
+
+static int list_multipart_uploads(MockConnection *connection,
+                                  MockRequest *request)
+{
+    MockS3 *mock = connection->mock;
+    const char *query = request->query;
+    char prefix[S3_MAX_KEY_SIZE + 1], keyMarker[S3_MAX_KEY_SIZE + 1];
+    char uploadIdMarker[64], value[32];
+
+    if (!get_param(query, "prefix", prefix, sizeof(prefix))) {
+        prefix[0] = 0;
+    }
+    if (!get_param(query, "key-marker", keyMarker, sizeof(keyMarker))) {
+        keyMarker[0] = 0;
+    }
+    if (!get_param(query, "upload-id-marker", uploadIdMarker,
+                   sizeof(uploadIdMarker))) {
+        uploadIdMarker[0] = 0;
+    }
+    int maxUploads = MAX_LIST_COUNT;
+    if (get_param(query, "max-uploads", value, sizeof(value))) {
+        maxUploads = atoi(value);
+        if ((maxUploads < 0) || (maxUploads > MAX_LIST_COUNT)) {
+            maxUploads = MAX_LIST_COUNT;
+        }
+    }
+
+    MockBuffer body = { 0, 0, 0, 0 }, uploadsXml = { 0, 0, 0, 0 };
+    const MockUpload *last = 0;
+    int count = 0, truncated = 0, i;
+
+    pthread_mutex_lock(&(mock->mutex));
+
+    if (find_bucket(mock, request->bucketName) == -1) {
+        pthread_mutex_unlock(&(mock->mutex));
+        return send_no_such_bucket(connection, request);
+    }
+
+    // Uploads are kept in no particular order, but are listed in order of
+    // key and then upload ID, which is the order in which they were started
+    MockUpload **uploads = (MockUpload **)
+        malloc((mock->uploadCount + 1) * sizeof(MockUpload *));
+    if (!uploads) {
+        pthread_mutex_unlock(&(mock->mutex));
+        return send_out_of_memory(connection, request);
+    }
+    int uploadCount = 0;
+    for (i = 0; i < mock->uploadCount; i++) {
+        MockUpload *upload = mock->uploads[i];
+        if (!strcmp(upload->bucketName, request->bucketName) &&
+            !strncmp(upload->key, prefix, strlen(prefix))) {
+            uploads[uploadCount++] = upload;
+        }
+    }
+    qsort(uploads, uploadCount, sizeof(MockUpload *), &compare_uploads);
+
+    for (i = 0; i < uploadCount; i++) {
+        MockUpload *upload = uploads[i];
+        int cmp = strcmp(upload->key, keyMarker);
+        if ((cmp < 0) || ((cmp == 0) &&
+                          (!uploadIdMarker[0] ||
+                           (strcmp(upload->uploadId, uploadIdMarker) <= 0)))) {
+            continue;
+        }
+        if (count == maxUploads) {
+            truncated = 1;
+            break;
+        }
+        char initiated[64];
+        format_iso8601(upload->initiated, initiated, sizeof(initiated));
+        buffer_printf(&uploadsXml, "<Upload>");
+        buffer_append_element(&uploadsXml, "Key", upload->key);
+        buffer_printf(&uploadsXml, "<UploadId>%s</UploadId>"
+                      "<Initiator>" XML_OWNER "</Initiator>"
+                      "<Owner>" XML_OWNER "</Owner>"
+                      "<StorageClass>STANDARD</StorageClass>"
+                      "<Initiated>%s</Initiated></Upload>",
+                      upload->uploadId, initiated);
+        last = upload;
+        count++;
+    }
+
+    buffer_printf(&body, XML_DECLARATION "<ListMultipartUploadsResult "
+                  XML_NAMESPACE ">");
+    buffer_append_element(&body, "Bucket", request->bucketName);
+    buffer_append_element(&body, "KeyMarker", keyMarker);
+    buffer_append_element(&body, "UploadIdMarker", uploadIdMarker);
+    if (truncated) {
+        buffer_append_element(&body, "NextKeyMarker", last->key);
+        buffer_append_element(&body, "NextUploadIdMarker", last->uploadId);
+    }
+
+    pthread_mutex_unlock(&(mock->mutex));
+
+    free(uploads);
+
+    buffer_append_element(&body, "Prefix", prefix);
+    buffer_printf(&body, "<MaxUploads>%d</MaxUploads>"
+                  "<IsTruncated>%s</IsTruncated>", maxUploads,
+                  truncated ? "true" : "false");
+    if (uploadsXml.data) {
+        buffer_append(&body, uploadsXml.data, uploadsXml.length);
+    }
+    buffer_printf(&body, "</ListMultipartUploadsResult>");
+    if (uploadsXml.failed) {
+        body.failed = 1;
+    }
+
+    buffer_free(&uploadsXml);
+
+    return send_xml(connection, request, &body);
+}
+
+
+static int serve_bucket_request(MockConnection *connection,
+                                MockRequest *request)
+{
+    MockS3 *mock = connection->mock;
+    const char *method = request->method;
+
+    if (has_unsupported_param(request->query)) {
+        return send_error(connection, request, 501, "NotImplemented",
+                          "The mock does not implement this sub-resource.");
+    }
+
+    if (!strcmp(method, "PUT")) {
+        pthread_mutex_lock(&(mock->mutex));
+        int result = create_bucket(mock, request->bucketName);
+        pthread_mutex_unlock(&(mock->mutex));
+        return result ? send_out_of_memory(connection, request) :
+            send_response(connection, request, 200, 0, 0, 0);
+    }
+    else if (!strcmp(method, "DELETE")) {
+        return delete_bucket(connection, request);
+    }
+    else if (!strcmp(method, "GET") || !strcmp(method, "HEAD")) {
+        if (has_param(request->query, "location")) {
+            pthread_mutex_lock(&(mock->mutex));
+            int exists = (find_bucket(mock, request->bucketName) != -1);
+            pthread_mutex_unlock(&(mock->mutex));
+            if (!exists) {
+                return send_no_such_bucket(connection, request);
+            }
+            MockBuffer body = { 0, 0, 0, 0 };
+            buffer_printf(&body, XML_DECLARATION "<LocationConstraint "
+                          XML_NAMESPACE "></LocationConstraint>");
+            return send_xml(connection, request, &body);
+        }
+        if (has_param(request->query, "uploads")) {
+            return list_multipart_uploads(connection, request);
+        }
+        return list_objects(connection, request);
+    }
+
+    return send_error(connection, request, 501, "NotImplemented",
+                      "The mock does not implement this request.");
+}
+
+
+// Object requests -----------------------------------------------------------
+
+static int put_object(MockConnection *connection, MockRequest *request)
+{
+    MockS3 *mock = connection->mock;
+
+    char *headers = stored_headers(request->headers);
+    if (!headers) {
+        return send_out_of_memory(connection, request);
+    }
+
+    MockObject *object = create_object(request->bucketName, request->key,
+                                       headers, request->body,
+                                       request->bodyLength);
+    request->body = 0;
+    free(headers);
+    if (!object) {
+        return send_out_of_memory(connection, request);
+    }
+
+    char responseHeaders[64];
+    snprintf(responseHeaders, sizeof(responseHeaders), "ETag: \"%s\"\r\n",
+             object->eTag);
+
+    pthread_mutex_lock(&(mock->mutex));
+    int result = -2;
+    if (find_bucket(mock, request->bucketName) == -1) {
+        release_object(object);
+    }
+    else {
+        result = store_object(mock, object);
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    if (result == -2) {
+        return send_no_such_bucket(connection, request);
+    }
+    if (result) {
+        return send_out_of_memory(connection, request);
+    }
+
+    return send_response(connection, request, 200, responseHeaders, 0, 0);
+}
+
+
+static int get_object(MockConnection *connection, MockRequest *request)
+{
+    MockS3 *mock = connection->mock;
+
+    pthread_mutex_lock(&(mock->mutex));
+    int bucketExists = (find_bucket(mock, request->bucketName) != -1);
+    MockObject *object = find_object(mock, request->bucketName, request->key);
+    if (object) {
+        object->refs++;
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    if (!object) {
+        return bucketExists ? send_no_such_key(connection, request) :
+            send_no_such_bucket(connection, request);
+    }
+
+    int64_t first = 0, length = object->size;
+    int status = 200, result;
+    MockBuffer headers = { 0, 0, 0, 0 };
+
+    const char *range = find_header(request->headers, "Range");
+    if (range) {
+        if (parse_range(range, object->size, &first, &length)) {
+            result = send_error(connection, request, 416, "InvalidRange",
+                                "The requested range is not satisfiable");
+            goto done;
+        }
+        status = 206;
+        buffer_printf(&headers, "Content-Range: bytes %lld-%lld/%lld\r\n",
+                      (long long) first, (long long) (first + length - 1),
+                      (long long) object->size);
+    }
+
+    char lastModified[64];
+    format_rfc1123(object->lastModified, lastModified, sizeof(lastModified));
+    buffer_printf(&headers, "ETag: \"%s\"\r\nLast-Modified: %s\r\n",
+                  object->eTag, lastModified);
+    if (strncasecmp(object->headers, "Content-Type:", 13)) {
+        buffer_printf(&headers, "Content-Type: binary/octet-stream\r\n");
+    }
+    buffer_append(&headers, object->headers, strlen(object->headers));
+
+    result = headers.failed ? -1 :
+        send_response(connection, request, status, headers.data,
+                      &(object->data[first]), length);
+
+ done:
+    buffer_free(&headers);
+
+    pthread_mutex_lock(&(mock->mutex));
+    release_object(object);
+    pthread_mutex_unlock(&(mock->mutex));
+
+    return result;
+}
+
+
+static int delete_object(MockConnection *connection, MockRequest *request)
+{
+    MockS3 *mock = connection->mock;
+
+    pthread_mutex_lock(&(mock->mutex));
+    int bucketExists = (find_bucket(mock, request->bucketName) != -1);
+    int i = lower_bound(mock, request->bucketName, request->key);
+    if ((i < mock->objectCount) &&
+        !compare_object(mock->objects[i], request->bucketName,
+                        request->key)) {
+        remove_object(mock, i);
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    // As with S3, deleting a key that does not exist succeeds
+    return bucketExists ? send_response(connection, request, 204, 0, 0, 0) :
+        send_no_such_bucket(connection, request);
+}
+
+
+// Copies the data, or the range of it given by the
+// x-amz-copy-source-range header, of the object named by the
+// x-amz-copy-source header.  Returns 0 on success, or else the HTTP status
+// of the error that has been sent in response.
+static int copy_source(MockConnection *connection, MockRequest *request,
+                       char **dataReturn, int64_t *sizeReturn,
+                       char **headersReturn, int *resultReturn)
+{
+    MockS3 *mock = connection->mock;
+    char bucketName[S3_MAX_BUCKET_NAME_SIZE + 1], key[S3_MAX_KEY_SIZE + 1];
+
+    const char *source = find_header(request->headers, "x-amz-copy-source");
+    const char *end = strstr(source, "\r\n");
+    int sourceLen = end ? (end - source) : (int) strlen(source);
+    if (*source == '/') {
+        source++, sourceLen--;
+    }
+    // Any version ID is ignored
+    const char *version = memchr(source, '?', sourceLen);
+    if (version) {
+        sourceLen = version - source;
+    }
+    const char *slash = memchr(source, '/', sourceLen);
+    if (!slash ||
+        url_decode(source, slash - source, bucketName, sizeof(bucketName)) ||
+        url_decode(slash + 1, sourceLen - (slash + 1 - source), key,
+                   sizeof(key))) {
+        *resultReturn = send_error(connection, request, 400,
+                                   "InvalidArgument",
+                                   "Copy Source must mention the source "
+                                   "bucket and key: sourcebucket/sourcekey");
+        return 400;
+    }
+
+    pthread_mutex_lock(&(mock->mutex));
+    MockObject *object = find_object(mock, bucketName, key);
+    if (object) {
+        object->refs++;
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    if (!object) {
+        *resultReturn = send_no_such_key(connection, request);
+        return 404;
+    }
+
+    int64_t first = 0, length = object->size;
+    const char *range = find_header(request->headers,
+                                    "x-amz-copy-source-range");
+    int status = 0;
+    if (range && parse_range(range, object->size, &first, &length)) {
+        *resultReturn = send_error(connection, request, 416, "InvalidRange",
+                                   "The requested range is not "
+                                   "satisfiable");
+        status = 416;
+    }
+    else if (!(*dataReturn = (char *) malloc(length + 1)) ||
+             (headersReturn &&
+              !(*headersReturn = copy_string(object->headers)))) {
+        free(*dataReturn);
+        *resultReturn = send_out_of_memory(connection, request);
+        status = 500;
+    }
+    else {
+        memcpy(*dataReturn, &(object->data[first]), length);
+        *sizeReturn = length;
+    }
+
+    pthread_mutex_lock(&(mock->mutex));
+    release_object(object);
+    pthread_mutex_unlock(&(mock->mutex));
+
+    return status;
+}
+
+
+static int copy_object(MockConnection *connection, MockRequest *request)
+{
+    MockS3 *mock = connection->mock;
+    char *data, *headers;
+    int64_t size;
+    int result;
+
+    if (copy_source(connection, request, &data, &size, &headers, &result)) {
+        return result;
+    }
+
+    // The metadata is copied too, unless it is to be replaced
+    const char *directive = find_header(request->headers,
+                                        "x-amz-metadata-directive");
+    if (directive && !strncasecmp(directive, "REPLACE", 7)) {
+        free(headers);
+        if (!(headers = stored_headers(request->headers))) {
+            free(data);
+            return send_out_of_memory(connection, request);
+        }
+    }
+
+    MockObject *object = create_object(request->bucketName, request->key,
+                                       headers, data, size);
+    free(headers);
+    if (!object) {
+        return send_out_of_memory(connection, request);
+    }
+
+    MockBuffer body = { 0, 0, 0, 0 };
+    char lastModified[64];
+    format_iso8601(object->lastModified, lastModified, sizeof(lastModified));
+    buffer_printf(&body, XML_DECLARATION "<CopyObjectResult>"
+                  "<LastModified>%s</LastModified>"
+                  "<ETag>&quot;%s&quot;</ETag></CopyObjectResult>",
+                  lastModified, object->eTag);
+
+    pthread_mutex_lock(&(mock->mutex));
+    int stored = -2;
+    if (find_bucket(mock, request->bucketName) == -1) {
+        release_object(object);
+    }
+    else {
+        stored = store_object(mock, object);
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    if (stored) {
+        buffer_free(&body);
+        return (stored == -2) ? send_no_such_bucket(connection, request) :
+            send_out_of_memory(connection, request);
+    }
+
+    return send_xml(connection, request, &body);
+}
+
+
+static int initiate_multipart(MockConnection *connection,
+                              MockRequest *request)
+{
+    MockS3 *mock = connection->mock;
+
+    MockUpload *upload = (MockUpload *) calloc(1, sizeof(MockUpload));
+    if (!upload ||
+        !(upload->bucketName = copy_string(request->bucketName)) ||
+        !(upload->key = copy_string(request->key)) ||
+        !(upload->headers = stored_headers(request->headers))) {
+        if (upload) {
+            free(upload->bucketName);
+            free(upload->key);
+            free(upload);
+        }
+        return send_out_of_memory(connection, request);
+    }
+    upload->initiated = time(0);
+
+    pthread_mutex_lock(&(mock->mutex));
+    int result = 0;
+    if (find_bucket(mock, request->bucketName) == -1) {
+        result = -2;
+    }
+    else if (grow((void **) &(mock->uploads), &(mock->uploadsSize),
+                  mock->uploadCount, sizeof(MockUpload *))) {
+        result = -1;
+    }
+    else {
+        // Upload IDs are of fixed width, so that they sort in the order in
+        // which they were started
+        snprintf(upload->uploadId, sizeof(upload->uploadId), "mock%016llx",
+                 (unsigned long long) ++mock->nextUploadId);
+        mock->uploads[mock->uploadCount++] = upload;
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    if (result) {
+        free(upload->bucketName);
+        free(upload->key);
+        free(upload->headers);
+        free(upload);
+        return (result == -2) ? send_no_such_bucket(connection, request) :
+            send_out_of_memory(connection, request);
+    }
+
+    MockBuffer body = { 0, 0, 0, 0 };
+    buffer_printf(&body, XML_DECLARATION "<InitiateMultipartUploadResult "
+                  XML_NAMESPACE ">");
+    buffer_append_element(&body, "Bucket", request->bucketName);
+    buffer_append_element(&body, "Key", request->key);
+    buffer_printf(&body, "<UploadId>%s</UploadId>"
+                  "</InitiateMultipartUploadResult>", upload->uploadId);
+
+    return send_xml(connection, request, &body);
+}
+
+
+// Uploads a part, or copies one if the request has an x-amz-copy-source
+// header
+static int upload_part(MockConnection *connection, MockRequest *request,
+                       const char *uploadId)
+{
+    MockS3 *mock = connection->mock;
+    char value[32];
+    int number = 0, result;
+
+    if (get_param(request->query, "partNumber", value, sizeof(value))) {
+        number = atoi(value);
+    }
+    if ((number < 1) || (number > MAX_PART_NUMBER)) {
+        return send_error(connection, request, 400, "InvalidArgument",
+                          "Part number must be an integer between 1 and "
+                          "10000, inclusive");
+    }
+
+    int copy = (find_header(request->headers, "x-amz-copy-source") != 0);
+    MockPart part;
+    part.number = number;
+    if (copy) {
+        if (copy_source(connection, request, &(part.data), &(part.size), 0,
+                        &result)) {
+            return result;
+        }
+    }
+    else {
+        part.data = request->body;
+        part.size = request->bodyLength;
+        request->body = 0;
+    }
+    compute_etag(part.data, part.size, part.eTag);
+    part.lastModified = time(0);
+
+    pthread_mutex_lock(&(mock->mutex));
+    int i = find_upload(mock, uploadId, request->bucketName, request->key);
+    if (i == -1) {
+        result = -2;
+    }
+    else {
+        MockUpload *upload = mock->uploads[i];
+        int j = 0;
+        while ((j < upload->partCount) &&
+               (upload->parts[j].number < number)) {
+            j++;
+        }
+        if ((j < upload->partCount) && (upload->parts[j].number == number)) {
+            free(upload->parts[j].data);
+            upload->parts[j] = part;
+            result = 0;
+        }
+        else if (grow((void **) &(upload->parts), &(upload->partsSize),
+                      upload->partCount, sizeof(MockPart))) {
+            result = -1;
+        }
+        else {
+            memmove(&(upload->parts[j + 1]), &(upload->parts[j]),
+                    (upload->partCount - j) * sizeof(MockPart));
+            upload->parts[j] = part;
+            upload->partCount++;
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    if (result) {
+        free(part.data);
+        return (result == -2) ? send_no_such_upload(connection, request) :
+            send_out_of_memory(connection, request);
+    }
+
+    if (copy) {
+        MockBuffer body = { 0, 0, 0, 0 };
+        char lastModified[64];
+        format_iso8601(part.lastModified, lastModified, sizeof(lastModified));
+        buffer_printf(&body, XML_DECLARATION "<CopyPartResult>"
+                      "<LastModified>%s</LastModified>"
+                      "<ETag>&quot;%s&quot;</ETag></CopyPartResult>",
+                      lastModified, part.eTag);
+        return send_xml(connection, request, &body);
+    }
+
+    char headers[64];
+    snprintf(headers, sizeof(headers), "ETag: \"%s\"\r\n", part.eTag);
+
+    return send_response(connection, request, 200, headers, 0, 0);
+}
+
+
+// Assembles the parts listed in the request body into an object; the ETags
+// of the list are not checked
+static int complete_multipart(MockConnection *connection,
+                              MockRequest *request, const char *uploadId)
+{
+    MockS3 *mock = connection->mock;
+
+    // Collect the part numbers, in the order given
+    int *numbers = (int *) malloc(MAX_PART_NUMBER * sizeof(int));
+    if (!numbers) {
+        return send_out_of_memory(connection, request);
+    }
+    int count = 0;
+    const char *body = request->body ? request->body : "";
+    while ((body = strstr(body, "<PartNumber>"))) {
+        body += 12;
+        if (count == MAX_PART_NUMBER) {
+            count = 0;
+            break;
+        }
+        numbers[count++] = atoi(body);
+    }
+    if (!count) {
+        free(numbers);
+        return send_error(connection, request, 400, "MalformedXML",
+                          "The XML you provided was not well-formed or did "
+                          "not validate against our published schema");
+    }
+
+    const char *code = 0, *message = 0;
+    int status = 0;
+    MockObject *object = 0;
+    char *data = 0;
+
+    pthread_mutex_lock(&(mock->mutex));
+
+    int i = find_upload(mock, uploadId, request->bucketName, request->key), j;
+    MockUpload *upload = (i == -1) ? 0 : mock->uploads[i];
+    int64_t size = 0;
+    for (j = 0; upload && (j < count); j++) {
+        if (j && (numbers[j] <= numbers[j - 1])) {
+            status = 400, code = "InvalidPartOrder";
+            message = "The list of parts was not in ascending order.";
+            break;
+        }
+    }
+    // Look up each part, remembering its index in place of its number
+    int k = 0;
+    for (j = 0; upload && !status && (j < count); j++) {
+        while ((k < upload->partCount) &&
+               (upload->parts[k].number < numbers[j])) {
+            k++;
+        }
+        if ((k == upload->partCount) ||
+            (upload->parts[k].number != numbers[j])) {
+            status = 400, code = "InvalidPart";
+            message = "One or more of the specified parts could not be "
+                "found.";
+            break;
+        }
+        numbers[j] = k;
+        size += upload->parts[k].size;
+    }
+
+    if (upload && !status) {
+        if (!(data = (char *) malloc(size + 1))) {
+            status = 500;
+        }
+        else {
+            // The ETag of a multipart object is a hash of the ETags of its
+            // parts, followed by the number of parts
+            MockBuffer eTags = { 0, 0, 0, 0 };
+            int64_t offset = 0;
+            for (j = 0; j < count; j++) {
+                MockPart *part = &(upload->parts[numbers[j]]);
+                memcpy(&(data[offset]), part->data, part->size);
+                offset += part->size;
+                buffer_append(&eTags, part->eTag, strlen(part->eTag));
+            }
+            object = eTags.failed ? 0 :
+                create_object(request->bucketName, request->key,
+                              upload->headers, data, size);
+            if (object) {
+                compute_etag(eTags.data, eTags.length, object->eTag);
+                snprintf(&(object->eTag[32]), sizeof(object->eTag) - 32,
+                         "-%u", (unsigned int) count);
+                if (store_object(mock, object)) {
+                    object = 0;
+                }
+                else {
+                    remove_upload(mock, i);
+                }
+            }
+            else if (eTags.failed) {
+                free(data);
+            }
+            if (!object) {
+                status = 500;
+            }
+            buffer_free(&eTags);
+        }
+    }
+
+    // The object may be replaced as soon as the mutex is released
+    char eTag[ETAG_SIZE];
+    if (object) {
+        strcpy(eTag, object->eTag);
+    }
+
+    pthread_mutex_unlock(&(mock->mutex));
+
+    free(numbers);
+
+    if (!upload) {
+        return send_no_such_upload(connection, request);
+    }
+    if (status == 500) {
+        return send_out_of_memory(connection, request);
+    }
+    if (status) {
+        return send_error(connection, request, status, code, message);
+    }
+
+    MockBuffer response = { 0, 0, 0, 0 };
+    buffer_printf(&response, XML_DECLARATION
+                  "<CompleteMultipartUploadResult " XML_NAMESPACE ">"
+                  "<Location>http://%s/", mock->hostName);
+    buffer_append_xml(&response, request->bucketName);
+    buffer_append(&response, "/", 1);
+    buffer_append_xml(&response, request->key);
+    buffer_printf(&response, "</Location>");
+    buffer_append_element(&response, "Bucket", request->bucketName);
+    buffer_append_element(&response, "Key", request->key);
+    buffer_printf(&response, "<ETag>&quot;%s&quot;</ETag>"
+                  "</CompleteMultipartUploadResult>", eTag);
+
+    return send_xml(connection, request, &response);
+}
+
+
+static int abort_multipart(MockConnection *connection, MockRequest *request,
+                           const char *uploadId)
+{
+    MockS3 *mock = connection->mock;
+
+    pthread_mutex_lock(&(mock->mutex));
+    int i = find_upload(mock, uploadId, request->bucketName, request->key);
+    if (i != -1) {
+        remove_upload(mock, i);
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    return (i == -1) ? send_no_such_upload(connection, request) :
+        send_response(connection, request, 204, 0, 0, 0);
+}
+
+
+static int list_parts(MockConnection *connection, MockRequest *request,
+                      const char *uploadId)
+{
+    MockS3 *mock = connection->mock;
+    char value[32];
+
+    int marker = 0, maxParts = MAX_LIST_COUNT;
+    if (get_param(request->query, "part-number-marker", value,
+                  sizeof(value))) {
+        marker = atoi(value);
+    }
+    if (get_param(request->query, "max-parts", value, sizeof(value))) {
+        maxParts = atoi(value);
+        if ((maxParts < 0) || (maxParts > MAX_LIST_COUNT)) {
+            maxParts = MAX_LIST_COUNT;
+        }
+    }
+
+    MockBuffer parts = { 0, 0, 0, 0 };
+    int count = 0, truncated = 0, last = marker;
+
+    pthread_mutex_lock(&(mock->mutex));
+    int i = find_upload(mock, uploadId, request->bucketName, request->key);
+    if (i != -1) {
+        MockUpload *upload = mock->uploads[i];
+        int j;
+        for (j = 0; j < upload->partCount; j++) {
+            MockPart *part = &(upload->parts[j]);
+            if (part->number <= marker) {
+                continue;
+            }
+            if (count == maxParts) {
+                truncated = 1;
+                break;
+            }
+            char lastModified[64];
+            format_iso8601(part->lastModified, lastModified,
+                           sizeof(lastModified));
+            buffer_printf(&parts, "<Part><PartNumber>%d</PartNumber>"
+                          "<LastModified>%s</LastModified>"
+                          "<ETag>&quot;%s&quot;</ETag><Size>%lld</Size>"
+                          "</Part>", part->number, lastModified, part->eTag,
+                          (long long) part->size);
+            last = part->number;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    if (i == -1) {
+        buffer_free(&parts);
+        return send_no_such_upload(connection, request);
+    }
+
+    MockBuffer body = { 0, 0, 0, 0 };
+    buffer_printf(&body, XML_DECLARATION "<ListPartsResult "
+                  XML_NAMESPACE ">");
+    buffer_append_element(&body, "Bucket", request->bucketName);
+    buffer_append_element(&body, "Key", request->key);
+    buffer_printf(&body, "<UploadId>%s</UploadId>"
+                  "<Initiator>" XML_OWNER "</Initiator>"
+                  "<Owner>" XML_OWNER "</Owner>"
+                  "<StorageClass>STANDARD</StorageClass>"
+                  "<PartNumberMarker>%d</PartNumberMarker>"
+                  "<NextPartNumberMarker>%d</NextPartNumberMarker>"
+                  "<MaxParts>%d</MaxParts><IsTruncated>%s</IsTruncated>",
+                  uploadId, marker, last, maxParts,
+                  truncated ? "true" : "false");
+    if (parts.data) {
+        buffer_append(&body, parts.data, parts.length);
+    }
+    buffer_printf(&body, "</ListPartsResult>");
+    if (parts.failed) {
+        body.failed = 1;
+    }
+
+    buffer_free(&parts);
+
+    return send_xml(connection, request, &body);
+}
+
+
+static int serve_object_request(MockConnection *connection,
+                                MockRequest *request)
+{
+    const char *method = request->method;
+    char uploadId[64];
+
+    if (has_unsupported_param(request->query)) {
+        return send_error(connection, request, 501, "NotImplemented",
+                          "The mock does not implement this sub-resource.");
+    }
+
+    int multipart = get_param(request->query, "uploadId", uploadId,
+                              sizeof(uploadId));
+
+    if (!strcmp(method, "PUT")) {
+        if (multipart) {
+            return upload_part(connection, request, uploadId);
+        }
+        if (find_header(request->headers, "x-amz-copy-source")) {
+            return copy_object(connection, request);
+        }
+        return put_object(connection, request);
+    }
+    else if (!strcmp(method, "GET")) {
+        return multipart ? list_parts(connection, request, uploadId) :
+            get_object(connection, request);
+    }
+    else if (!strcmp(method, "HEAD")) {
+        return get_object(connection, request);
+    }
+    else if (!strcmp(method, "DELETE")) {
+        return multipart ? abort_multipart(connection, request, uploadId) :
+            delete_object(connection, request);
+    }
+    else if (!strcmp(method, "POST")) {
+        if (multipart) {
+            return complete_multipart(connection, request, uploadId);
+        }
+        if (has_param(request->query, "uploads")) {
+            return initiate_multipart(connection, request);
+        }
+    }
+
+    return send_error(connection, request, 501, "NotImplemented",
+                      "The mock does not implement this request.");
+}
+
+
+// Connections ---------------------------------------------------------------
+
+// Parses the request line at the start of headers into request; returns 0
+// on success or -1 if the request is malformed
+static int parse_request_line(const char *headers, MockRequest *request)
+{
+    if (sscanf(headers, "%15s", request->method) != 1) {
+        return -1;
+    }
+
+    const char *uri = &(headers[strlen(request->method)]);
+    while (*uri == ' ') {
+        uri++;
+    }
+    if (*uri != '/') {
+        return -1;
+    }
+    uri++;
+
+    int pathLen = strcspn(uri, "? \r\n");
+    const char *slash = memchr(uri, '/', pathLen);
+    int bucketNameLen = slash ? (slash - uri) : pathLen;
+    if (url_decode(uri, bucketNameLen, request->bucketName,
+                   sizeof(request->bucketName))) {
+        return -1;
+    }
+    if (!slash) {
+        request->key[0] = 0;
+    }
+    else if (url_decode(slash + 1, pathLen - bucketNameLen - 1,
+                        request->key, sizeof(request->key))) {
+        return -1;
+    }
+
+    request->query[0] = 0;
+    if (uri[pathLen] == '?') {
+        const char *query = &(uri[pathLen + 1]);
+        int queryLen = strcspn(query, " \r\n");
+        if (queryLen >= (int) sizeof(request->query)) {
+            return -1;
+        }
+        memcpy(request->query, query, queryLen);
+        request->query[queryLen] = 0;
+    }
+
+    return 0;
+}
+
+
+// Reads the body of a request into request->body, bufBodyLen bytes of which
+// are already in bufBody.  Returns 0 on success, or -1 if the connection is
+// to be closed.
+static int read_body(MockConnection *connection, MockRequest *request,
+                     const char *bufBody, int bufBodyLen)
+{
+    int64_t bandwidth = connection->mock->options.bandwidth;
+
+    if (!(request->body = (char *) malloc(request->bodyLength + 1))) {
+        return -1;
+    }
+
+    int64_t received = (request->bodyLength < bufBodyLen) ?
+        request->bodyLength : bufBodyLen;
+    memcpy(request->body, bufBody, received);
+
+    int64_t start = now_us();
+    while (received < request->bodyLength) {
+        int64_t remaining = request->bodyLength - received;
+        int len = recv(connection->fd, &(request->body[received]),
+                       (remaining < THROTTLE_PIECE_SIZE) ?
+                       (int) remaining : THROTTLE_PIECE_SIZE, 0);
+        if (len <= 0) {
+            return -1;
+        }
+        received += len;
+        if (bandwidth) {
+            throttle(start, received, bandwidth);
+        }
+    }
+    request->body[request->bodyLength] = 0;
+
+    return 0;
+}
+
+
+// Serves a single request whose headers occupy the first headersLen bytes of
+// buf, of which there are bufLen valid.  Returns the number of bytes of buf
+// consumed by the request, or -1 if the connection is to be closed.
+static int serve_request(MockConnection *connection, char *buf,
+                         int headersLen, int bufLen)
+{
+    MockS3 *mock = connection->mock;
+    MockRequest request;
+
+    buf[headersLen - 2] = 0;
+
+    if (parse_request_line(buf, &request)) {
+        return -1;
+    }
+    request.headers = buf;
+    request.body = 0;
+    request.headOnly = !strcmp(request.method, "HEAD");
+
+    const char *contentLength = find_header(buf, "Content-Length");
+    request.bodyLength = contentLength ? atoll(contentLength) : 0;
+    if (request.bodyLength < 0) {
+        return -1;
+    }
+
+    const char *expect = find_header(buf, "Expect");
+    if (expect && !strncasecmp(expect, "100-continue", 12)) {
+        static const char continueResponse[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        if (send_all(connection->fd, continueResponse,
+                     sizeof(continueResponse) - 1)) {
+            return -1;
+        }
+    }
+
+    const char *connectionHeader = find_header(buf, "Connection");
+    request.closeConnection =
+        connectionHeader && !strncasecmp(connectionHeader, "close", 5);
+
+    int consumed = headersLen;
+    if (request.bodyLength <= (bufLen - headersLen)) {
+        consumed += request.bodyLength;
+    }
+    else {
+        consumed = bufLen;
+    }
+
+    if (read_body(connection, &request, &(buf[headersLen]),
+                  bufLen - headersLen)) {
+        free(request.body);
+        return -1;
+    }
+
+    if (mock->options.latencyUs) {
+        sleep_us(mock->options.latencyUs);
+    }
+
+    int result;
+    if (mock->options.errorPercent &&
+        ((int) (rand_r(&(connection->seed)) % 100) <
+         mock->options.errorPercent)) {
+        result = send_error(connection, &request, 503, "SlowDown",
+                            "Please reduce your request rate.");
+    }
+    else if (!request.bucketName[0]) {
+        result = (strcmp(request.method, "GET") ?
+                  send_error(connection, &request, 501, "NotImplemented",
+                             "The mock does not implement this request.") :
+                  list_service(connection, &request));
+    }
+    else if (!request.key[0]) {
+        result = serve_bucket_request(connection, &request);
+    }
+    else {
+        result = serve_object_request(connection, &request);
+    }
+
+    free(request.body);
+
+    if (result) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&(mock->mutex));
+    mock->requestCount++;
+    pthread_mutex_unlock(&(mock->mutex));
+
+    return request.closeConnection ? -1 : consumed;
+}
+
+
+static void *connection_thread(void *data)
+{
+    MockConnection *connection = (MockConnection *) data;
+    MockS3 *mock = connection->mock;
+
+    char buf[MAX_REQUEST_HEADERS_SIZE + 1];
+    int bufLen = 0;
+
+    while (1) {
+        // Serve every complete request in the buffer
+        char *end;
+        buf[bufLen] = 0;
+        while ((end = strstr(buf, "\r\n\r\n"))) {
+            int consumed = serve_request(connection, buf, (end - buf) + 4,
+                                         bufLen);
+            if (consumed < 0) {
+                goto done;
+            }
+            memmove(buf, &(buf[consumed]), bufLen - consumed);
+            bufLen -= consumed;
+            buf[bufLen] = 0;
+        }
+
+        if (bufLen == MAX_REQUEST_HEADERS_SIZE) {
+            break;
+        }
+
+        int len = recv(connection->fd, &(buf[bufLen]),
+                       MAX_REQUEST_HEADERS_SIZE - bufLen, 0);
+        if (len <= 0) {
+            break;
+        }
+        bufLen += len;
+    }
+
+ done:
+    close(connection->fd);
+
+    pthread_mutex_lock(&(mock->mutex));
+    if (connection->next == connection) {
+        mock->connections = 0;
+    }
+    else {
+        connection->prev->next = connection->next;
+        connection->next->prev = connection->prev;
+        if (mock->connections == connection) {
+            mock->connections = connection->next;
+        }
+    }
+    if (!--mock->connectionCount) {
+        pthread_cond_signal(&(mock->cond));
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    free(connection);
+
+    return 0;
+}
+
+
+static void *accept_thread(void *data)
+{
+    MockS3 *mock = (MockS3 *) data;
+
+    while (1) {
+        int fd = accept(mock->listenFd, 0, 0);
+        if (fd == -1) {
+            pthread_mutex_lock(&(mock->mutex));
+            int stopping = mock->stopping;
+            pthread_mutex_unlock(&(mock->mutex));
+            if (stopping) {
+                return 0;
+            }
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        MockConnection *connection =
+            (MockConnection *) malloc(sizeof(MockConnection));
+        if (!connection) {
+            close(fd);
+            continue;
+        }
+        connection->mock = mock;
+        connection->fd = fd;
+
+        pthread_mutex_lock(&(mock->mutex));
+        if (mock->connections) {
+            connection->prev = mock->connections->prev;
+            connection->next = mock->connections;
+            mock->connections->prev->next = connection;
+            mock->connections->prev = connection;
+        }
+        else {
+            mock->connections = connection->next = connection->prev =
+                connection;
+        }
+        mock->connectionCount++;
+        mock->acceptedCount++;
+        // Each connection fails its own sequence of requests, so that which
+        // requests fail depends only on the seed and the order of requests
+        // on each connection
+        connection->seed = mock->options.seed +
+            (unsigned int) (mock->acceptedCount * 2654435761U);
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&(connection->thread), &attr, &connection_thread,
+                           connection)) {
+            // Let the connection thread cleanup path do the unlinking
+            pthread_mutex_unlock(&(mock->mutex));
+            shutdown(fd, SHUT_RDWR);
+            connection_thread(connection);
+        }
+        else {
+            pthread_mutex_unlock(&(mock->mutex));
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+
+// Mock S3 functions ---------------------------------------------------------
+
+S3Status mocks3_start(MockS3 **mockReturn, const MockS3Options *options)
+{
+    MockS3 *mock = (MockS3 *) calloc(1, sizeof(MockS3));
+    if (!mock) {
+        return S3StatusOutOfMemory;
+    }
+
+    if (options) {
+        mock->options = *options;
+    }
+
+    if ((mock->listenFd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        free(mock);
+        return S3StatusInternalError;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addrLen = sizeof(addr);
+
+    if (bind(mock->listenFd, (struct sockaddr *) &addr, sizeof(addr)) ||
+        listen(mock->listenFd, 1024) ||
+        getsockname(mock->listenFd, (struct sockaddr *) &addr, &addrLen)) {
+        close(mock->listenFd);
+        free(mock);
+        return S3StatusInternalError;
+    }
+
+    snprintf(mock->hostName, sizeof(mock->hostName), "127.0.0.1:%d",
+             ntohs(addr.sin_port));
+
+    pthread_mutex_init(&(mock->mutex), 0);
+    pthread_cond_init(&(mock->cond), 0);
+
+    if (pthread_create(&(mock->acceptThread), 0, &accept_thread, mock)) {
+        pthread_cond_destroy(&(mock->cond));
+        pthread_mutex_destroy(&(mock->mutex));
+        close(mock->listenFd);
+        free(mock);
+        return S3StatusInternalError;
+    }
+
+    *mockReturn = mock;
+
+    return S3StatusOK;
+}
+
+
+void mocks3_stop(MockS3 *mock)
+{
+    pthread_mutex_lock(&(mock->mutex));
+    mock->stopping = 1;
+    pthread_mutex_unlock(&(mock->mutex));
+
+    // Wakes up the accept thread
+    shutdown(mock->listenFd, SHUT_RDWR);
+    pthread_join(mock->acceptThread, 0);
+    close(mock->listenFd);
+
+    // Wake up every connection thread, and wait for them all to finish
+    pthread_mutex_lock(&(mock->mutex));
+    MockConnection *c = mock->connections, *cFirst = c;
+    if (c) do {
+        shutdown(c->fd, SHUT_RDWR);
+        c = c->next;
+    } while (c != cFirst);
+    while (mock->connectionCount) {
+        pthread_cond_wait(&(mock->cond), &(mock->mutex));
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    while (mock->uploadCount) {
+        remove_upload(mock, 0);
+    }
+    free(mock->uploads);
+    while (mock->objectCount) {
+        remove_object(mock, mock->objectCount - 1);
+    }
+    free(mock->objects);
+    while (mock->bucketCount) {
+        free(mock->buckets[--mock->bucketCount].name);
+    }
+    free(mock->buckets);
+
+    pthread_cond_destroy(&(mock->cond));
+    pthread_mutex_destroy(&(mock->mutex));
+    free(mock);
+}
+
+
+const char *mocks3_host_name(const MockS3 *mock)
+{
+    return mock->hostName;
+}
+
+
+void mocks3_get_counts(MockS3 *mock, uint64_t *connectionsReturn,
+                       uint64_t *requestsReturn)
+{
+    pthread_mutex_lock(&(mock->mutex));
+    *connectionsReturn = mock->acceptedCount;
+    *requestsReturn = mock->requestCount;
+    pthread_mutex_unlock(&(mock->mutex));
+}
+
+
+S3Status mocks3_put_object(MockS3 *mock, const char *bucketName,
+                           const char *key, const char *data, int64_t size)
+{
+    char *copy = (char *) malloc(size + 1);
+    if (!copy) {
+        return S3StatusOutOfMemory;
+    }
+    if (data) {
+        memcpy(copy, data, size);
+    }
+    else {
+        memset(copy, 'x', size);
+    }
+
+    MockObject *object = create_object(bucketName, key, "", copy, size);
+    if (!object) {
+        return S3StatusOutOfMemory;
+    }
+
+    pthread_mutex_lock(&(mock->mutex));
+    int result = create_bucket(mock, bucketName);
+    if (result) {
+        release_object(object);
+    }
+    else {
+        result = store_object(mock, object);
+    }
+    pthread_mutex_unlock(&(mock->mutex));
+
+    return result ? S3StatusOutOfMemory : S3StatusOK;
+}
@@ -67,14 +67,32 @@ static void InitialMultipartCompleteCallback
     free(mdata);
 }
 
+// S3_abort_multipart_upload() takes no callback data, so its request's
+// callback data is the handler, and the handler's callbacks are made with 0
+static S3Status AbortMultipartUploadPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    S3AbortMultipartUploadHandler *handler =
+        (S3AbortMultipartUploadHandler *) callbackData;
+
+    if (handler->responseHandler.propertiesCallback) {
+        return (*(handler->responseHandler.propertiesCallback))
+            (responseProperties, 0);
+    }
+    return S3StatusOK;
+}
+
 static void AbortMultipartUploadCompleteCallback
     (S3Status requestStatus, const S3ErrorDetails *s3ErrorDetails,
      void *callbackData)
 {
-    (void) callbackData;
-    (void) s3ErrorDetails;
-    fprintf(stderr, "\nERROR: %s\n", S3_get_status_name(requestStatus));
+    S3AbortMultipartUploadHandler *handler =
+        (S3AbortMultipartUploadHandler *) callbackData;
 
+    if (handler->responseHandler.completeCallback) {
+        (*(handler->responseHandler.completeCallback))
+            (requestStatus, s3ErrorDetails, 0);
+    }
 }
 
 static S3Status initialMultipartXmlCallback(const char *elementPath,
@@ -171,12 +189,12 @@ void S3_abort_multipart_upload(S3BucketContext *bucketContext, const char *key,
         0,                                            // startByte
         0,                                            // byteCount
         0,                                            // putProperties
-        handler->responseHandler.propertiesCallback,  // propertiesCallback
+        AbortMultipartUploadPropertiesCallback,       // propertiesCallback
         0,                                            // toS3Callback
         0,                                            // toS3CallbackTotalSize
         0,                                            // fromS3Callback
         AbortMultipartUploadCompleteCallback,         // completeCallback
-        0,                                            // callbackData
+        handler,                                      // callbackData
         timeoutMs                                     // timeoutMs
     };
 
@@ -631,81 +649,108 @@ static void listPartsCompleteCallback(S3Status requestStatus,
 }
 
 
-static S3Status listMultipartXmlCallback(const char *elementPath,
+// Element IDs of the elements of a ListMultipartUploadsResult
+enum
+{
+    ListMultipartElementIsTruncated = 1,
+    ListMultipartElementNextKeyMarker,
+    ListMultipartElementNextUploadIdMarker,
+    ListMultipartElementUpload,
+    ListMultipartElementUploadKey,
+    ListMultipartElementUploadInitiated,
+    ListMultipartElementUploadUploadId,
+    ListMultipartElementUploadInitiatorId,
+    ListMultipartElementUploadInitiatorDisplayName,
+    ListMultipartElementUploadOwnerId,
+    ListMultipartElementUploadOwnerDisplayName,
+    ListMultipartElementUploadStorageClass,
+    ListMultipartElementCommonPrefixesPrefix
+};
+
+static const char *listMultipartElementPathsG[] =
+{
+    [ListMultipartElementIsTruncated] =
+        "ListMultipartUploadsResult/IsTruncated",
+    [ListMultipartElementNextKeyMarker] =
+        "ListMultipartUploadsResult/NextKeyMarker",
+    [ListMultipartElementNextUploadIdMarker] =
+        "ListMultipartUploadsResult/NextUploadIdMarker",
+    [ListMultipartElementUpload] = "ListMultipartUploadsResult/Upload",
+    [ListMultipartElementUploadKey] = "ListMultipartUploadsResult/Upload/Key",
+    [ListMultipartElementUploadInitiated] =
+        "ListMultipartUploadsResult/Upload/Initiated",
+    [ListMultipartElementUploadUploadId] =
+        "ListMultipartUploadsResult/Upload/UploadId",
+    [ListMultipartElementUploadInitiatorId] =
+        "ListMultipartUploadsResult/Upload/Initiator/ID",
+    [ListMultipartElementUploadInitiatorDisplayName] =
+        "ListMultipartUploadsResult/Upload/Initiator/DisplayName",
+    [ListMultipartElementUploadOwnerId] =
+        "ListMultipartUploadsResult/Upload/Owner/ID",
+    [ListMultipartElementUploadOwnerDisplayName] =
+        "ListMultipartUploadsResult/Upload/Owner/DisplayName",
+    [ListMultipartElementUploadStorageClass] =
+        "ListMultipartUploadsResult/Upload/StorageClass",
+    [ListMultipartElementCommonPrefixesPrefix] =
+        "ListMultipartUploadsResult/CommonPrefixes/Prefix"
+};
+
+static SimpleXmlElements listMultipartElementsG =
+    SIMPLEXML_ELEMENTS(listMultipartElementPathsG);
+
+
+static S3Status listMultipartXmlCallback(int elementId,
+                                         const char *elementPath,
                                          const char *data, int dataLen,
                                          void *callbackData)
 {
+    (void) elementPath;
+
     ListMultipartData *lmData = (ListMultipartData *) callbackData;
 
+    ListMultipartUpload *uploads = &(lmData->uploads[lmData->uploadsCount]);
+
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "ListMultipartUploadsResult/IsTruncated")) {
+        switch (elementId) {
+        case ListMultipartElementIsTruncated:
             string_buffer_append(lmData->isTruncated, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListMultipartUploadsResult/NextKeyMarker")) {
+            break;
+        case ListMultipartElementNextKeyMarker:
             string_buffer_append(lmData->nextKeyMarker, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListMultipartUploadsResult/NextUploadIdMarker")) {
+            break;
+        case ListMultipartElementNextUploadIdMarker:
             string_buffer_append(lmData->nextUploadIdMarker, data, dataLen,
                                  fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListMultipartUploadsResult/Upload/Key")) {
-            ListMultipartUpload *uploads =
-                &(lmData->uploads[lmData->uploadsCount]);
+            break;
+        case ListMultipartElementUploadKey:
             string_buffer_append(uploads->key, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListMultipartUploadsResult/Upload/Initiated")) {
-            ListMultipartUpload *uploads =
-                &(lmData->uploads[lmData->uploadsCount]);
+            break;
+        case ListMultipartElementUploadInitiated:
             string_buffer_append(uploads->initiated, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListMultipartUploadsResult/Upload/UploadId")) {
-            ListMultipartUpload *uploads =
-                &(lmData->uploads[lmData->uploadsCount]);
+            break;
+        case ListMultipartElementUploadUploadId:
             string_buffer_append(uploads->uploadId, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListMultipartUploadsResult/Upload/Initiator/ID")) {
-            ListMultipartUpload *uploads =
-                &(lmData->uploads[lmData->uploadsCount]);
+            break;
+        case ListMultipartElementUploadInitiatorId:
             string_buffer_append(uploads->initiatorId, data, dataLen, fit);
-        }
-        else if (!strcmp
-                 (elementPath,
-                  "ListMultipartUploadsResult/Upload/Initiator/DisplayName")) {
-            ListMultipartUpload *uploads =
-                &(lmData->uploads[lmData->uploadsCount]);
+            break;
+        case ListMultipartElementUploadInitiatorDisplayName:
             string_buffer_append(uploads->initiatorDisplayName, data, dataLen,
                                  fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListMultipartUploadsResult/Upload/Owner/ID")) {
-            ListMultipartUpload *uploads =
-                &(lmData->uploads[lmData->uploadsCount]);
+            break;
+        case ListMultipartElementUploadOwnerId:
             string_buffer_append(uploads->ownerId, data, dataLen, fit);
-        }
-        else if (!strcmp
-                 (elementPath,
-                  "ListMultipartUploadsResult/Upload/Owner/DisplayName")) {
-            ListMultipartUpload *uploads =
-                &(lmData->uploads[lmData->uploadsCount]);
+            break;
+        case ListMultipartElementUploadOwnerDisplayName:
             string_buffer_append
                 (uploads->ownerDisplayName, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListMultipartUploadsResult/Upload/StorageClass")) {
-            ListMultipartUpload *uploads =
-                &(lmData->uploads[lmData->uploadsCount]);
+            break;
+        case ListMultipartElementUploadStorageClass:
             string_buffer_append(uploads->storageClass, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListMultipartUploadsResult/CommonPrefixes/Prefix")) {
+            break;
+        case ListMultipartElementCommonPrefixesPrefix: {
             int which = lmData->commonPrefixesCount;
             lmData->commonPrefixLens[which] +=
                 snprintf(lmData->commonPrefixes[which],
@@ -716,10 +761,14 @@ static S3Status listMultipartXmlCallback(const char *elementPath,
                 (int) sizeof(lmData->commonPrefixes[which])) {
                 return S3StatusXmlParseFailure;
             }
+            break;
+        }
+        default:
+            break;
         }
     }
     else {
-        if (!strcmp(elementPath, "ListMultipartUploadsResult/Upload")) {
+        if (elementId == ListMultipartElementUpload) {
             // Finished a Contents
             lmData->uploadsCount++;
             if (lmData->uploadsCount == MAX_UPLOADS) {
@@ -736,8 +785,7 @@ static S3Status listMultipartXmlCallback(const char *elementPath,
                     (&(lmData->uploads[lmData->uploadsCount]));
             }
         }
-        else if (!strcmp(elementPath,
-                         "ListMultipartUploadsResult/CommonPrefixes/Prefix")) {
+        else if (elementId == ListMultipartElementCommonPrefixesPrefix) {
             // Finished a Prefix
             lmData->commonPrefixesCount++;
             if (lmData->commonPrefixesCount == MAX_COMMON_PREFIXES) {
@@ -763,57 +811,97 @@ static S3Status listMultipartXmlCallback(const char *elementPath,
 }
 
 
-static S3Status listPartsXmlCallback(const char *elementPath,
-                                      const char *data, int dataLen,
-                                      void *callbackData)
+// Element IDs of the elements of a ListPartsResult
+enum
+{
+    ListPartsElementIsTruncated = 1,
+    ListPartsElementNextPartNumberMarker,
+    ListPartsElementStorageClass,
+    ListPartsElementInitiatorId,
+    ListPartsElementInitiatorDisplayName,
+    ListPartsElementOwnerId,
+    ListPartsElementOwnerDisplayName,
+    ListPartsElementPart,
+    ListPartsElementPartPartNumber,
+    ListPartsElementPartLastModified,
+    ListPartsElementPartETag,
+    ListPartsElementPartSize
+};
+
+static const char *listPartsElementPathsG[] =
+{
+    [ListPartsElementIsTruncated] = "ListPartsResult/IsTruncated",
+    [ListPartsElementNextPartNumberMarker] =
+        "ListPartsResult/NextPartNumberMarker",
+    [ListPartsElementStorageClass] = "ListPartsResult/StorageClass",
+    [ListPartsElementInitiatorId] = "ListPartsResult/Initiator/ID",
+    [ListPartsElementInitiatorDisplayName] =
+        "ListPartsResult/Initiator/DisplayName",
+    [ListPartsElementOwnerId] = "ListPartsResult/Owner/ID",
+    [ListPartsElementOwnerDisplayName] = "ListPartsResult/Owner/DisplayName",
+    [ListPartsElementPart] = "ListPartsResult/Part",
+    [ListPartsElementPartPartNumber] = "ListPartsResult/Part/PartNumber",
+    [ListPartsElementPartLastModified] = "ListPartsResult/Part/LastModified",
+    [ListPartsElementPartETag] = "ListPartsResult/Part/ETag",
+    [ListPartsElementPartSize] = "ListPartsResult/Part/Size"
+};
+
+static SimpleXmlElements listPartsElementsG =
+    SIMPLEXML_ELEMENTS(listPartsElementPathsG);
+
+
+static S3Status listPartsXmlCallback(int elementId, const char *elementPath,
+                                     const char *data, int dataLen,
+                                     void *callbackData)
 {
+    (void) elementPath;
+
     ListPartsData *lpData = (ListPartsData *) callbackData;
+    ListPart *parts = &(lpData->parts[lpData->partsCount]);
     int fit;
     if (data) {
-        if (!strcmp(elementPath, "ListPartsResult/IsTruncated")) {
+        switch (elementId) {
+        case ListPartsElementIsTruncated:
             string_buffer_append(lpData->isTruncated, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListPartsResult/NextPartNumberMarker")) {
+            break;
+        case ListPartsElementNextPartNumberMarker:
             string_buffer_append(lpData->nextPartNumberMarker, data, dataLen,
                                  fit);
-        }
-        else if (!strcmp(elementPath, "ListPartsResult/StorageClass")) {
+            break;
+        case ListPartsElementStorageClass:
             string_buffer_append(lpData->storageClass, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListPartsResult/Initiator/ID")) {
+            break;
+        case ListPartsElementInitiatorId:
             string_buffer_append(lpData->initiatorId, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath,
-                         "ListPartsResult/Initiator/DisplayName")) {
+            break;
+        case ListPartsElementInitiatorDisplayName:
             string_buffer_append(lpData->initiatorDisplayName, data, dataLen,
                                  fit);
-        }
-        else if (!strcmp(elementPath, "ListPartsResult/Owner/ID")) {
+            break;
+        case ListPartsElementOwnerId:
             string_buffer_append(lpData->ownerId, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListPartsResult/Owner/DisplayName")) {
+            break;
+        case ListPartsElementOwnerDisplayName:
             string_buffer_append(lpData->ownerDisplayName, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListPartsResult/Part/PartNumber")) {
-            ListPart *parts = &(lpData->parts[lpData->partsCount]);
+            break;
+        case ListPartsElementPartPartNumber:
             string_buffer_append(parts->partNumber, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListPartsResult/Part/LastModified")) {
-            ListPart *parts = &(lpData->parts[lpData->partsCount]);
+            break;
+        case ListPartsElementPartLastModified:
             string_buffer_append(parts->lastModified, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListPartsResult/Part/ETag")) {
-            ListPart *parts = &(lpData->parts[lpData->partsCount]);
+            break;
+        case ListPartsElementPartETag:
             string_buffer_append(parts->eTag, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListPartsResult/Part/Size")) {
-            ListPart *parts = &(lpData->parts[lpData->partsCount]);
+            break;
+        case ListPartsElementPartSize:
             string_buffer_append(parts->size, data, dataLen, fit);
+            break;
+        default:
+            break;
         }
     }
     else {
-        if (!strcmp(elementPath, "ListPartsResult/Part")) {
+        if (elementId == ListPartsElementPart) {
             // Finished a Contents
             lpData->partsCount++;
             if (lpData->partsCount == MAX_PARTS) {
@@ -919,8 +1007,9 @@ void S3_list_multipart_uploads(S3BucketContext *bucketContext,
             return;
         }
 
-        simplexml_initialize(&(lmData->simpleXml), &listMultipartXmlCallback,
-                             lmData);
+        simplexml_initialize_elements(&(lmData->simpleXml),
+                                      &listMultipartElementsG,
+                                      &listMultipartXmlCallback, lmData);
 
         lmData->responsePropertiesCallback =
             handler->responseHandler.propertiesCallback;
@@ -1039,8 +1128,9 @@ void S3_list_parts(S3BucketContext *bucketContext, const char *key,
             return;
         }
 
-        simplexml_initialize(&(lpData->simpleXml), &listPartsXmlCallback,
-                             lpData);
+        simplexml_initialize_elements(&(lpData->simpleXml),
+                                      &listPartsElementsG,
+                                      &listPartsXmlCallback, lpData);
 
         lpData->responsePropertiesCallback =
             handler->responseHandler.propertiesCallback;
@@ -0,0 +1,1055 @@
+/** **************************************************************************
+ * multipart_upload.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libs3.h"
+#include "request.h"
+#include "request_context.h"
+
+
+// S3 never accepts a part larger than this, and S3_upload_part takes the
+// part size as an int anyway
+#define MAX_PART_SIZE 0x7FFFFFFF
+
+// The longest S3 error message that is kept to report in the complete
+// callback of a failed upload
+#define MAX_ERROR_MESSAGE_SIZE 256
+
+// The delay before the first retry of a request, in milliseconds; each
+// further retry of the same request waits twice as long as the one before,
+// up to MAX_RETRY_DELAY_MS, so that retries don't add to S3's load when it
+// is asking for requests to slow down
+#define RETRY_DELAY_MS 100
+
+#define MAX_RETRY_DELAY_MS 5000
+
+
+// One part of a multipart upload
+typedef struct MultipartPart
+{
+    struct MultipartUpload *upload;
+
+    // 1-based part number
+    int number;
+
+    // Number of times that the part has been sent so far
+    int attempts;
+
+    // Offset and size of the part within the object
+    uint64_t offset;
+    int size;
+
+    // Number of bytes of the part supplied to the current attempt so far
+    int position;
+
+    // S3MultipartSourceTypeCallback only: the data of the part, held until
+    // the part has been uploaded
+    char *data;
+
+    // The ETag that S3 returned for the part, once it has been uploaded
+    char *eTag;
+
+    // While the part is waiting to be retried, the monotonic time in
+    // milliseconds before which it is not to be sent again
+    int64_t notBeforeMs;
+
+    // Links the part into the list of parts waiting to be retried
+    struct MultipartPart *nextRetry;
+} MultipartPart;
+
+
+// The complete state of a multipart upload.  Everything that the requests
+// making up the upload need is copied into here, because those requests are
+// made from the callbacks of earlier ones.
+typedef struct MultipartUpload
+{
+    S3BucketContext bucketContext;
+    const char *key;
+    S3PutProperties putProperties;
+
+    // The properties of each part upload; of the put properties, only
+    // useStreamingSignature applies to parts
+    S3PutProperties partProperties;
+    S3MultipartSourceType sourceType;
+    const char *sourceBuffer;
+    int sourceFd;
+    int64_t sourceFdOffset;
+    S3RequestContext *requestContext;
+    int timeoutMs;
+    int maxAttempts;
+    S3MultipartUploadHandler handler;
+    void *callbackData;
+
+    // The handlers of the individual requests of the upload; these must
+    // live as long as the requests do
+    S3MultipartInitialHandler initialHandler;
+    S3PutObjectHandler partHandler;
+    S3MultipartCommitHandler commitHandler;
+
+    // Number of times that the current initiate, commit or abort request
+    // has been sent so far
+    int attempts;
+
+    // Set by the complete callback of an initiate or commit request which is
+    // to be retried; the XML callback which follows it does the retrying
+    int retryPending;
+
+    // Set once any request of the upload has been interrupted by its request
+    // context being destroyed, after which no new requests can be made
+    int interrupted;
+
+    // Added to the request context to make the next retry once it is due;
+    // retry then starts the initiate, commit or abort request again, or
+    // starts the parts whose retries are due
+    RequestContextTimer retryTimer;
+    void (*retry)(struct MultipartUpload *upload);
+
+    // The status of the upload; once this is not S3StatusOK, no more parts
+    // are started, and the upload is aborted once all parts in flight have
+    // finished
+    S3Status status;
+
+    // The message of the S3 error that caused the upload to fail, if any
+    char errorMessage[MAX_ERROR_MESSAGE_SIZE];
+
+    char *uploadId;
+
+    int partCount;
+    MultipartPart *parts;
+    int concurrency;
+
+    // Index of the next part to start
+    int nextPart;
+    int partsInFlight;
+
+    // Parts which failed and are waiting to be sent again
+    MultipartPart *retryParts;
+
+    // Set while more parts are being started, so that callbacks made
+    // synchronously while doing so leave the starting of parts to the
+    // outermost call
+    int startingParts;
+
+    // The CompleteMultipartUpload XML document, and the number of bytes of
+    // it sent so far by the current commit request
+    char *commitXml;
+    int commitXmlSize;
+    int commitXmlPosition;
+
+    // The bucket context strings, key, and put properties strings are all
+    // copied into this single allocation
+    char *strings;
+} MultipartUpload;
+
+
+// Upload setup and teardown -------------------------------------------------
+
+static S3Status copy_parameters(MultipartUpload *upload,
+                                const S3BucketContext *bucketContext,
+                                const char *key,
+                                const S3PutProperties *putProperties)
+{
+    const S3BucketContext *bc = bucketContext;
+    const S3PutProperties *pp = putProperties;
+
+    size_t size = bucket_context_copy_size(bc) + string_copy_size(key);
+
+    int metaDataCount = 0;
+    if (pp) {
+        size += (string_copy_size(pp->contentType) +
+                 string_copy_size(pp->cacheControl) +
+                 string_copy_size(pp->contentDispositionFilename) +
+                 string_copy_size(pp->contentEncoding));
+        if (pp->metaData) {
+            metaDataCount = pp->metaDataCount;
+        }
+        int i;
+        for (i = 0; i < metaDataCount; i++) {
+            size += (string_copy_size(pp->metaData[i].name) +
+                     string_copy_size(pp->metaData[i].value));
+        }
+    }
+
+    // Put the S3NameValue array first, so that it is suitably aligned
+    size_t metaDataSize = metaDataCount * sizeof(S3NameValue);
+
+    if (!(upload->strings = (char *) malloc(metaDataSize + size))) {
+        return S3StatusOutOfMemory;
+    }
+
+    char *pos = upload->strings + metaDataSize;
+
+    bucket_context_copy(&(upload->bucketContext), &pos, bc);
+    upload->key = copy_string(&pos, key);
+
+    if (pp) {
+        upload->putProperties = *pp;
+        upload->putProperties.contentType = copy_string(&pos, pp->contentType);
+        // The MD5 of the whole object doesn't apply to any of the requests
+        upload->putProperties.md5 = 0;
+        upload->putProperties.cacheControl =
+            copy_string(&pos, pp->cacheControl);
+        upload->putProperties.contentDispositionFilename =
+            copy_string(&pos, pp->contentDispositionFilename);
+        upload->putProperties.contentEncoding =
+            copy_string(&pos, pp->contentEncoding);
+        S3NameValue *metaData = (S3NameValue *) upload->strings;
+        int i;
+        for (i = 0; i < metaDataCount; i++) {
+            metaData[i].name = copy_string(&pos, pp->metaData[i].name);
+            metaData[i].value = copy_string(&pos, pp->metaData[i].value);
+        }
+        upload->putProperties.metaDataCount = metaDataCount;
+        upload->putProperties.metaData = metaDataCount ? metaData : 0;
+    }
+    else {
+        memset(&(upload->putProperties), 0, sizeof(S3PutProperties));
+        upload->putProperties.expires = -1;
+    }
+
+    memset(&(upload->partProperties), 0, sizeof(S3PutProperties));
+    upload->partProperties.expires = -1;
+    upload->partProperties.useStreamingSignature =
+        upload->putProperties.useStreamingSignature;
+
+    return S3StatusOK;
+}
+
+
+static void upload_destroy(MultipartUpload *upload)
+{
+    if (upload->parts) {
+        int i;
+        for (i = 0; i < upload->partCount; i++) {
+            free(upload->parts[i].data);
+            free(upload->parts[i].eTag);
+        }
+        free(upload->parts);
+    }
+
+    free(upload->uploadId);
+    free(upload->commitXml);
+    free(upload->strings);
+    free(upload);
+}
+
+
+// Makes the complete callback for the upload as a whole, and frees it
+static void upload_finish(MultipartUpload *upload, S3Status status)
+{
+    S3ErrorDetails errorDetails;
+    memset(&errorDetails, 0, sizeof(errorDetails));
+    errorDetails.message = upload->errorMessage;
+
+    (*(upload->handler.responseHandler.completeCallback))
+        (status, upload->errorMessage[0] ? &errorDetails : 0,
+         upload->callbackData);
+
+    upload_destroy(upload);
+}
+
+
+// Records the status of a failed request as the status of the upload, if it
+// is the first failure
+static void upload_fail(MultipartUpload *upload, S3Status status,
+                        const S3ErrorDetails *errorDetails)
+{
+    if (status == S3StatusInterrupted) {
+        upload->interrupted = 1;
+    }
+
+    if (upload->status != S3StatusOK) {
+        return;
+    }
+
+    upload->status = status;
+
+    if (errorDetails && errorDetails->message) {
+        snprintf(upload->errorMessage, sizeof(upload->errorMessage), "%s",
+                 errorDetails->message);
+    }
+}
+
+
+// Besides the statuses that S3_status_is_retryable() accepts, SlowDown is
+// retried, since the retries are delayed
+static int is_retryable(S3Status status)
+{
+    return (S3_status_is_retryable(status) ||
+            (status == S3StatusErrorSlowDown));
+}
+
+
+static int should_retry(MultipartUpload *upload, S3Status status,
+                        int attempts)
+{
+    return (is_retryable(status) &&
+            (attempts < upload->maxAttempts) &&
+            (upload->status == S3StatusOK));
+}
+
+
+// Returns the time at which a request which has been attempted [attempts]
+// times may be retried
+static int64_t retry_time_ms(int attempts)
+{
+    int64_t delay = RETRY_DELAY_MS;
+    while ((--attempts > 0) && (delay < MAX_RETRY_DELAY_MS)) {
+        delay *= 2;
+    }
+
+    return request_context_now_ms() +
+        ((delay < MAX_RETRY_DELAY_MS) ? delay : MAX_RETRY_DELAY_MS);
+}
+
+
+static void retryTimerCallback(S3Status status, void *data)
+{
+    MultipartUpload *upload = (MultipartUpload *) data;
+
+    if (status != S3StatusOK) {
+        // The request context is being destroyed
+        upload_fail(upload, status, 0);
+    }
+
+    (*(upload->retry))(upload);
+}
+
+
+// Has the request context call retry once the monotonic time [dueMs] has
+// passed, in place of any retry already waiting.  Nothing is held up in the
+// meantime; the request context carries on with its other requests.
+static void retry_at(MultipartUpload *upload, int64_t dueMs,
+                     void (*retry)(MultipartUpload *upload))
+{
+    request_context_remove_timer(upload->requestContext,
+                                 &(upload->retryTimer));
+
+    upload->retry = retry;
+    upload->retryTimer.dueMs = dueMs;
+    upload->retryTimer.callback = &retryTimerCallback;
+    upload->retryTimer.data = upload;
+
+    request_context_add_timer(upload->requestContext, &(upload->retryTimer));
+}
+
+
+// Abort ---------------------------------------------------------------------
+
+static void start_abort(MultipartUpload *upload);
+
+
+static void retry_abort(MultipartUpload *upload)
+{
+    if (upload->interrupted) {
+        upload_finish(upload, upload->status);
+    }
+    else {
+        start_abort(upload);
+    }
+}
+
+
+static void abortCompleteCallback(S3Status requestStatus,
+                                  const S3ErrorDetails *s3ErrorDetails,
+                                  void *callbackData)
+{
+    (void) s3ErrorDetails;
+
+    MultipartUpload *upload = (MultipartUpload *) callbackData;
+
+    if (is_retryable(requestStatus) &&
+        (upload->attempts < upload->maxAttempts)) {
+        retry_at(upload, retry_time_ms(upload->attempts), &retry_abort);
+        return;
+    }
+
+    // Whether or not the abort succeeded, report the failure that caused it
+    upload_finish(upload, upload->status);
+}
+
+
+static void start_abort(MultipartUpload *upload)
+{
+    upload->attempts++;
+
+    char subResource[512];
+    snprintf(subResource, sizeof(subResource), "uploadId=%s",
+             upload->uploadId);
+
+    RequestParams params =
+    {
+        HttpRequestTypeDELETE,                        // httpRequestType
+        upload->bucketContext,                        // bucketContext
+        upload->key,                                  // key
+        0,                                            // queryParams
+        subResource,                                  // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        0,                                            // putProperties
+        0,                                            // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        0,                                            // fromS3Callback
+        &abortCompleteCallback,                       // completeCallback
+        upload,                                       // callbackData
+        upload->timeoutMs                             // timeoutMs
+    };
+
+    request_perform(&params, upload->requestContext);
+}
+
+
+// Called once the upload has failed and no requests of it remain in flight;
+// aborts the upload if it was initiated, so that S3 discards its parts
+static void upload_failed(MultipartUpload *upload)
+{
+    if (upload->uploadId && !upload->interrupted) {
+        upload->attempts = 0;
+        start_abort(upload);
+    }
+    else {
+        upload_finish(upload, upload->status);
+    }
+}
+
+
+// Commit --------------------------------------------------------------------
+
+static void start_commit(MultipartUpload *upload);
+
+
+static void retry_commit(MultipartUpload *upload)
+{
+    if (upload->status != S3StatusOK) {
+        upload_failed(upload);
+    }
+    else {
+        start_commit(upload);
+    }
+}
+
+
+static S3Status commitPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    MultipartUpload *upload = (MultipartUpload *) callbackData;
+
+    if (upload->handler.responseHandler.propertiesCallback) {
+        return (*(upload->handler.responseHandler.propertiesCallback))
+            (responseProperties, upload->callbackData);
+    }
+
+    return S3StatusOK;
+}
+
+
+static void commitCompleteCallback(S3Status requestStatus,
+                                   const S3ErrorDetails *s3ErrorDetails,
+                                   void *callbackData)
+{
+    MultipartUpload *upload = (MultipartUpload *) callbackData;
+
+    if (requestStatus == S3StatusOK) {
+        return;
+    }
+
+    if (should_retry(upload, requestStatus, upload->attempts)) {
+        upload->retryPending = 1;
+    }
+    else {
+        upload_fail(upload, requestStatus, s3ErrorDetails);
+    }
+}
+
+
+// Made after commitCompleteCallback, even if the commit failed
+static S3Status commitXmlCallback(const char *location, const char *etag,
+                                  void *callbackData)
+{
+    MultipartUpload *upload = (MultipartUpload *) callbackData;
+
+    // S3 can fail a commit after it has sent a 200 response, in which case
+    // the body is an Error rather than the result with the ETag.  The commit
+    // is to be retried in that case.
+    if ((upload->status == S3StatusOK) && !upload->retryPending &&
+        (!etag || !etag[0])) {
+        if (upload->attempts < upload->maxAttempts) {
+            upload->retryPending = 1;
+        }
+        else {
+            upload_fail(upload, S3StatusErrorInternalError, 0);
+        }
+    }
+
+    if (upload->retryPending) {
+        upload->retryPending = 0;
+        retry_at(upload, retry_time_ms(upload->attempts), &retry_commit);
+    }
+    else if (upload->status != S3StatusOK) {
+        upload_failed(upload);
+    }
+    else {
+        if (upload->handler.responseXmlCallback) {
+            (*(upload->handler.responseXmlCallback))
+                (location, etag, upload->callbackData);
+        }
+        upload_finish(upload, S3StatusOK);
+    }
+
+    return S3StatusOK;
+}
+
+
+static int commitDataCallback(int bufferSize, char *buffer,
+                              void *callbackData)
+{
+    MultipartUpload *upload = (MultipartUpload *) callbackData;
+
+    int toCopy = upload->commitXmlSize - upload->commitXmlPosition;
+    if (toCopy > bufferSize) {
+        toCopy = bufferSize;
+    }
+
+    memcpy(buffer, &(upload->commitXml[upload->commitXmlPosition]), toCopy);
+    upload->commitXmlPosition += toCopy;
+
+    return toCopy;
+}
+
+
+static S3Status build_commit_xml(MultipartUpload *upload)
+{
+    static const char header[] = "<CompleteMultipartUpload>";
+    static const char footer[] = "</CompleteMultipartUpload>";
+    static const char partFormat[] =
+        "<Part><PartNumber>%d</PartNumber><ETag>%s</ETag></Part>";
+
+    size_t size = sizeof(header) + sizeof(footer);
+    int i;
+    for (i = 0; i < upload->partCount; i++) {
+        // The part number replaces "%d", and has at most 5 digits
+        size += sizeof(partFormat) + 5 + strlen(upload->parts[i].eTag);
+    }
+
+    if (!(upload->commitXml = (char *) malloc(size))) {
+        return S3StatusOutOfMemory;
+    }
+
+    char *pos = upload->commitXml;
+    pos += sprintf(pos, "%s", header);
+    for (i = 0; i < upload->partCount; i++) {
+        pos += sprintf(pos, partFormat, upload->parts[i].number,
+                       upload->parts[i].eTag);
+    }
+    pos += sprintf(pos, "%s", footer);
+
+    upload->commitXmlSize = pos - upload->commitXml;
+
+    return S3StatusOK;
+}
+
+
+static void start_commit(MultipartUpload *upload)
+{
+    upload->attempts++;
+    upload->commitXmlPosition = 0;
+
+    S3_complete_multipart_upload(&(upload->bucketContext), upload->key,
+                                 &(upload->commitHandler), upload->uploadId,
+                                 upload->commitXmlSize,
+                                 upload->requestContext, upload->timeoutMs,
+                                 upload);
+}
+
+
+// Parts ---------------------------------------------------------------------
+
+static void start_part(MultipartPart *part);
+
+
+// Removes and returns a part waiting to be retried whose delay has passed,
+// or returns 0 if there is none
+static MultipartPart *take_retry_part(MultipartUpload *upload)
+{
+    if (!upload->retryParts) {
+        return 0;
+    }
+
+    int64_t now = request_context_now_ms();
+
+    MultipartPart **prev = &(upload->retryParts);
+    while (*prev) {
+        MultipartPart *part = *prev;
+        if (part->notBeforeMs <= now) {
+            *prev = part->nextRetry;
+            return part;
+        }
+        prev = &(part->nextRetry);
+    }
+
+    return 0;
+}
+
+
+// Starts parts, retried ones first once their delay has passed, until as
+// many are in flight as are allowed; and once none remain in flight, moves
+// on to committing or aborting the upload
+static void upload_parts(MultipartUpload *upload)
+{
+    // Requests can complete synchronously, calling back into here while
+    // parts are being started; the outermost call carries on once they
+    // return
+    if (upload->startingParts) {
+        return;
+    }
+
+    upload->startingParts = 1;
+
+    while ((upload->status == S3StatusOK) &&
+           (upload->partsInFlight < upload->concurrency)) {
+        MultipartPart *part = take_retry_part(upload);
+        if (!part && (upload->nextPart < upload->partCount)) {
+            part = &(upload->parts[upload->nextPart++]);
+        }
+        if (!part) {
+            break;
+        }
+        start_part(part);
+    }
+
+    upload->startingParts = 0;
+
+    if ((upload->status == S3StatusOK) && upload->retryParts) {
+        // Parts are waiting for their retries to be due.  If there is room
+        // for more parts in flight, come back here once the first is due;
+        // otherwise parts in flight come back here as they complete.
+        if (upload->partsInFlight < upload->concurrency) {
+            MultipartPart *part = upload->retryParts;
+            int64_t notBeforeMs = part->notBeforeMs;
+            while ((part = part->nextRetry)) {
+                if (part->notBeforeMs < notBeforeMs) {
+                    notBeforeMs = part->notBeforeMs;
+                }
+            }
+            retry_at(upload, notBeforeMs, &upload_parts);
+        }
+        return;
+    }
+
+    // No part is waiting to be retried, or none will be
+    request_context_remove_timer(upload->requestContext,
+                                 &(upload->retryTimer));
+
+    if (upload->partsInFlight) {
+        return;
+    }
+
+    if (upload->status != S3StatusOK) {
+        upload_failed(upload);
+        return;
+    }
+
+    S3Status status = build_commit_xml(upload);
+    if (status != S3StatusOK) {
+        upload_fail(upload, status, 0);
+        upload_failed(upload);
+        return;
+    }
+
+    upload->attempts = 0;
+    start_commit(upload);
+}
+
+
+static S3Status partPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    MultipartPart *part = (MultipartPart *) callbackData;
+
+    if (responseProperties->eTag) {
+        free(part->eTag);
+        if (!(part->eTag = strdup(responseProperties->eTag))) {
+            return S3StatusOutOfMemory;
+        }
+    }
+
+    return S3StatusOK;
+}
+
+
+static void partCompleteCallback(S3Status requestStatus,
+                                 const S3ErrorDetails *s3ErrorDetails,
+                                 void *callbackData)
+{
+    MultipartPart *part = (MultipartPart *) callbackData;
+    MultipartUpload *upload = part->upload;
+
+    upload->partsInFlight--;
+
+    if ((requestStatus == S3StatusOK) && !part->eTag) {
+        // S3 always returns the ETag of a part, and the upload can't be
+        // completed without it
+        requestStatus = S3StatusHttpErrorUnknown;
+    }
+
+    if (requestStatus == S3StatusOK) {
+        free(part->data);
+        part->data = 0;
+    }
+    else if (should_retry(upload, requestStatus, part->attempts)) {
+        part->notBeforeMs = retry_time_ms(part->attempts);
+        part->nextRetry = upload->retryParts;
+        upload->retryParts = part;
+    }
+    else {
+        upload_fail(upload, requestStatus, s3ErrorDetails);
+    }
+
+    upload_parts(upload);
+}
+
+
+// Reads from fd at offset, without using or changing its file offset
+static int read_at(int fd, char *buffer, int size, int64_t offset)
+{
+#ifdef __MINGW32__
+    // There is no pread() on Windows, so this does change the file offset
+    if (_lseeki64(fd, offset, SEEK_SET) == -1) {
+        return -1;
+    }
+    return read(fd, buffer, size);
+#else
+    return pread(fd, buffer, size, (off_t) offset);
+#endif
+}
+
+
+static int partDataCallback(int bufferSize, char *buffer, void *callbackData)
+{
+    MultipartPart *part = (MultipartPart *) callbackData;
+    MultipartUpload *upload = part->upload;
+
+    int toCopy = part->size - part->position;
+    if (toCopy > bufferSize) {
+        toCopy = bufferSize;
+    }
+
+    switch (upload->sourceType) {
+    case S3MultipartSourceTypeBuffer:
+        memcpy(buffer, &(upload->sourceBuffer[part->offset + part->position]),
+               toCopy);
+        break;
+    case S3MultipartSourceTypeFd:
+        if (toCopy) {
+            toCopy = read_at(upload->sourceFd, buffer, toCopy,
+                             (upload->sourceFdOffset + part->offset +
+                              part->position));
+            if (toCopy <= 0) {
+                // Either a read error or a file shorter than contentLength
+                return -1;
+            }
+        }
+        break;
+    default:
+        memcpy(buffer, &(part->data[part->position]), toCopy);
+        break;
+    }
+
+    part->position += toCopy;
+
+    return toCopy;
+}
+
+
+// Reads the whole of a part from the source data callback
+static S3Status read_part_data(MultipartPart *part)
+{
+    MultipartUpload *upload = part->upload;
+
+    if (!(part->data = (char *) malloc(part->size ? part->size : 1))) {
+        return S3StatusOutOfMemory;
+    }
+
+    int position = 0;
+    while (position < part->size) {
+        int count = (*(upload->handler.sourceDataCallback))
+            (part->size - position, &(part->data[position]),
+             upload->callbackData);
+        if (count < 0) {
+            return S3StatusAbortedByCallback;
+        }
+        if (count == 0) {
+            // The source ended before contentLength bytes were supplied
+            return S3StatusErrorIncompleteBody;
+        }
+        position += count;
+    }
+
+    return S3StatusOK;
+}
+
+
+static void start_part(MultipartPart *part)
+{
+    MultipartUpload *upload = part->upload;
+
+    if ((upload->sourceType == S3MultipartSourceTypeCallback) &&
+        !part->data) {
+        S3Status status = read_part_data(part);
+        if (status != S3StatusOK) {
+            upload_fail(upload, status, 0);
+            return;
+        }
+    }
+
+    part->attempts++;
+    part->position = 0;
+    free(part->eTag);
+    part->eTag = 0;
+
+    upload->partsInFlight++;
+
+    S3_upload_part(&(upload->bucketContext), upload->key,
+                   &(upload->partProperties), &(upload->partHandler),
+                   part->number, upload->uploadId, part->size,
+                   upload->requestContext, upload->timeoutMs, part);
+}
+
+
+// Initiate ------------------------------------------------------------------
+
+static void start_initiate(MultipartUpload *upload);
+
+
+static void retry_initiate(MultipartUpload *upload)
+{
+    if (upload->status != S3StatusOK) {
+        upload_failed(upload);
+    }
+    else {
+        start_initiate(upload);
+    }
+}
+
+
+static void initialCompleteCallback(S3Status requestStatus,
+                                    const S3ErrorDetails *s3ErrorDetails,
+                                    void *callbackData)
+{
+    MultipartUpload *upload = (MultipartUpload *) callbackData;
+
+    if (requestStatus == S3StatusOK) {
+        return;
+    }
+
+    if (should_retry(upload, requestStatus, upload->attempts)) {
+        upload->retryPending = 1;
+    }
+    else {
+        upload_fail(upload, requestStatus, s3ErrorDetails);
+    }
+}
+
+
+// Made after initialCompleteCallback, even if the initiate failed
+static S3Status initialXmlCallback(const char *uploadId, void *callbackData)
+{
+    MultipartUpload *upload = (MultipartUpload *) callbackData;
+
+    if (upload->retryPending) {
+        upload->retryPending = 0;
+        retry_at(upload, retry_time_ms(upload->attempts), &retry_initiate);
+        return S3StatusOK;
+    }
+
+    if ((upload->status == S3StatusOK) && !uploadId[0]) {
+        // The response didn't include the upload ID
+        upload_fail(upload, S3StatusXmlParseFailure, 0);
+    }
+
+    if (upload->status != S3StatusOK) {
+        upload_failed(upload);
+        return S3StatusOK;
+    }
+
+    if (!(upload->uploadId = strdup(uploadId))) {
+        upload_fail(upload, S3StatusOutOfMemory, 0);
+        upload_failed(upload);
+        return S3StatusOK;
+    }
+
+    upload_parts(upload);
+
+    return S3StatusOK;
+}
+
+
+static void start_initiate(MultipartUpload *upload)
+{
+    upload->attempts++;
+
+    S3_initiate_multipart(&(upload->bucketContext), upload->key,
+                          &(upload->putProperties), &(upload->initialHandler),
+                          upload->requestContext, upload->timeoutMs, upload);
+}
+
+
+// Public API ----------------------------------------------------------------
+
+void S3_put_object_multipart(const S3BucketContext *bucketContext,
+                             const char *key, uint64_t contentLength,
+                             const S3PutProperties *putProperties,
+                             S3MultipartSourceType sourceType,
+                             const char *sourceBuffer, int sourceFd,
+                             int64_t sourceFdOffset,
+                             const S3MultipartUploadOptions *options,
+                             S3RequestContext *requestContext,
+                             int timeoutMs,
+                             const S3MultipartUploadHandler *handler,
+                             void *callbackData)
+{
+#define return_status(status)                                           \
+    (*(handler->responseHandler.completeCallback))                      \
+        (status, 0, callbackData);                                      \
+    return
+
+    int64_t partSize = S3_MULTIPART_DEFAULT_PART_SIZE;
+    if (options && (options->partSize > 0)) {
+        partSize = options->partSize;
+    }
+    if ((contentLength / partSize) >= S3_MULTIPART_MAX_PARTS) {
+        partSize = ((contentLength + S3_MULTIPART_MAX_PARTS - 1) /
+                    S3_MULTIPART_MAX_PARTS);
+    }
+    if (partSize > MAX_PART_SIZE) {
+        partSize = MAX_PART_SIZE;
+    }
+
+    // An empty object is uploaded as a single empty part
+    uint64_t partCount = (contentLength + partSize - 1) / partSize;
+    if (partCount == 0) {
+        partCount = 1;
+    }
+    else if (partCount > S3_MULTIPART_MAX_PARTS) {
+        return_status(S3StatusErrorEntityTooLarge);
+    }
+
+    MultipartUpload *upload =
+        (MultipartUpload *) calloc(1, sizeof(MultipartUpload));
+    if (!upload) {
+        return_status(S3StatusOutOfMemory);
+    }
+
+    S3Status status = copy_parameters(upload, bucketContext, key,
+                                      putProperties);
+    if (status != S3StatusOK) {
+        free(upload);
+        return_status(status);
+    }
+
+    upload->partCount = partCount;
+    upload->parts =
+        (MultipartPart *) calloc(partCount, sizeof(MultipartPart));
+    if (!upload->parts) {
+        upload_destroy(upload);
+        return_status(S3StatusOutOfMemory);
+    }
+
+    int i;
+    for (i = 0; i < upload->partCount; i++) {
+        MultipartPart *part = &(upload->parts[i]);
+        part->upload = upload;
+        part->number = i + 1;
+        part->offset = i * partSize;
+        uint64_t remaining = contentLength - part->offset;
+        part->size = (remaining > (uint64_t) partSize) ?
+            (int) partSize : (int) remaining;
+    }
+
+    upload->sourceType = sourceType;
+    upload->sourceBuffer = sourceBuffer;
+    upload->sourceFd = sourceFd;
+    upload->sourceFdOffset = sourceFdOffset;
+    upload->timeoutMs = timeoutMs;
+    upload->handler = *handler;
+    upload->callbackData = callbackData;
+    upload->status = S3StatusOK;
+
+    upload->concurrency = S3_MULTIPART_DEFAULT_CONCURRENCY;
+    upload->maxAttempts = S3_MULTIPART_DEFAULT_MAX_ATTEMPTS;
+    if (options && (options->concurrency > 0)) {
+        upload->concurrency = options->concurrency;
+    }
+    if (options && (options->maxAttempts > 0)) {
+        upload->maxAttempts = options->maxAttempts;
+    }
+
+    upload->initialHandler.responseHandler.completeCallback =
+        &initialCompleteCallback;
+    upload->initialHandler.responseXmlCallback = &initialXmlCallback;
+    upload->partHandler.responseHandler.propertiesCallback =
+        &partPropertiesCallback;
+    upload->partHandler.responseHandler.completeCallback =
+        &partCompleteCallback;
+    upload->partHandler.putObjectDataCallback = &partDataCallback;
+    upload->commitHandler.responseHandler.propertiesCallback =
+        &commitPropertiesCallback;
+    upload->commitHandler.responseHandler.completeCallback =
+        &commitCompleteCallback;
+    upload->commitHandler.putObjectDataCallback = &commitDataCallback;
+    upload->commitHandler.responseXmlCallback = &commitXmlCallback;
+
+    if (requestContext) {
+        upload->requestContext = requestContext;
+        start_initiate(upload);
+        return;
+    }
+
+    // No request context was given, so run the upload to completion on a
+    // private one
+    if ((status = S3_create_request_context(&requestContext)) != S3StatusOK) {
+        upload_destroy(upload);
+        return_status(status);
+    }
+
+    upload->requestContext = requestContext;
+    start_initiate(upload);
+
+    // This waits out any retry delays.  If it fails, destroying the request
+    // context interrupts the remaining requests and retries, which finishes
+    // the upload.
+    S3_runall_request_context(requestContext);
+
+    S3_destroy_request_context(requestContext);
+}
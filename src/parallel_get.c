@@ -0,0 +1,674 @@
+/** **************************************************************************
+ * parallel_get.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libs3.h"
+#include "request.h"
+#include "request_context.h"
+
+
+// The longest S3 error message that is kept to report in the complete
+// callback of a failed download
+#define MAX_ERROR_MESSAGE_SIZE 256
+
+// The delay before the first retry of a request, in milliseconds; each
+// further retry of the same request waits twice as long as the one before,
+// up to MAX_RETRY_DELAY_MS
+#define RETRY_DELAY_MS 100
+
+#define MAX_RETRY_DELAY_MS 5000
+
+
+// One byte range of a parallel download
+typedef struct GetRange
+{
+    struct ParallelGet *get;
+
+    // Offset and size of the range within the object
+    uint64_t offset;
+    uint64_t size;
+
+    // Number of bytes of the range written so far; a retry only requests
+    // the bytes after these
+    uint64_t received;
+
+    // Number of times that the range has been requested so far
+    int attempts;
+
+    // While the range is waiting to be retried, the monotonic time in
+    // milliseconds before which it is not to be requested again
+    int64_t notBeforeMs;
+
+    // Links the range into the list of ranges waiting to be retried
+    struct GetRange *nextRetry;
+} GetRange;
+
+
+// The complete state of a parallel download.  Everything that the requests
+// making up the download need is copied into here, because those requests
+// are made from the callbacks of earlier ones.
+typedef struct ParallelGet
+{
+    S3BucketContext bucketContext;
+    const char *key;
+    S3GetConditions getConditions;
+    int fd;
+    uint64_t rangeSize;
+    int concurrency;
+    int maxAttempts;
+    S3RequestContext *requestContext;
+    int timeoutMs;
+    S3ResponseHandler handler;
+    void *callbackData;
+
+    // Number of times that the HEAD request has been sent so far
+    int attempts;
+
+    // Added to the request context to make the next retry once it is due;
+    // retry then sends the HEAD request again, or starts the ranges whose
+    // retries are due
+    RequestContextTimer retryTimer;
+    void (*retry)(struct ParallelGet *get);
+
+    // The status of the download; once this is not S3StatusOK, no more
+    // ranges are started, and the download finishes once all ranges in
+    // flight have finished
+    S3Status status;
+
+    // The message of the S3 error that caused the download to fail, if any
+    char errorMessage[MAX_ERROR_MESSAGE_SIZE];
+
+    // The properties returned by the HEAD request, with the strings that
+    // they refer to copied into headPropertiesStrings.  They are passed on
+    // once the HEAD has succeeded, so that a HEAD which is retried passes
+    // them on only once.
+    S3ResponseProperties headProperties;
+    char *headPropertiesStrings;
+
+    // Learned from the HEAD request.  The ranges are requested on condition
+    // that the object still has the ETag of headProperties, so that a
+    // download never mixes the data of two versions of the object.
+    uint64_t contentLength;
+    S3GetConditions rangeConditions;
+
+    int rangeCount;
+    GetRange *ranges;
+
+    // Index of the next range to start
+    int nextRange;
+    int rangesInFlight;
+
+    // Ranges which failed and are waiting to be requested again
+    GetRange *retryRanges;
+
+    // Set while more ranges are being started, so that callbacks made
+    // synchronously while doing so leave the starting of ranges to the
+    // outermost call
+    int startingRanges;
+
+    // The bucket context strings, key, and get conditions strings are all
+    // copied into this single allocation
+    char *strings;
+} ParallelGet;
+
+
+// Download setup and teardown -----------------------------------------------
+
+static S3Status copy_parameters(ParallelGet *get,
+                                const S3BucketContext *bucketContext,
+                                const char *key,
+                                const S3GetConditions *getConditions)
+{
+    size_t size = bucket_context_copy_size(bucketContext) +
+        string_copy_size(key);
+    if (getConditions) {
+        size += (string_copy_size(getConditions->ifMatchETag) +
+                 string_copy_size(getConditions->ifNotMatchETag));
+    }
+
+    if (!(get->strings = (char *) malloc(size ? size : 1))) {
+        return S3StatusOutOfMemory;
+    }
+
+    char *pos = get->strings;
+
+    bucket_context_copy(&(get->bucketContext), &pos, bucketContext);
+    get->key = copy_string(&pos, key);
+
+    if (getConditions) {
+        get->getConditions = *getConditions;
+        get->getConditions.ifMatchETag =
+            copy_string(&pos, getConditions->ifMatchETag);
+        get->getConditions.ifNotMatchETag =
+            copy_string(&pos, getConditions->ifNotMatchETag);
+    }
+    else {
+        get->getConditions.ifModifiedSince = -1;
+        get->getConditions.ifNotModifiedSince = -1;
+    }
+
+    return S3StatusOK;
+}
+
+
+static void get_destroy(ParallelGet *get)
+{
+    free(get->ranges);
+    free(get->headPropertiesStrings);
+    free(get->strings);
+    free(get);
+}
+
+
+// Makes the complete callback for the download as a whole, and frees it
+static void get_finish(ParallelGet *get)
+{
+    S3ErrorDetails errorDetails;
+    memset(&errorDetails, 0, sizeof(errorDetails));
+    errorDetails.message = get->errorMessage;
+
+    (*(get->handler.completeCallback))
+        (get->status, get->errorMessage[0] ? &errorDetails : 0,
+         get->callbackData);
+
+    get_destroy(get);
+}
+
+
+// Records the status of a failed request as the status of the download, if
+// it is the first failure
+static void get_fail(ParallelGet *get, S3Status status,
+                     const S3ErrorDetails *errorDetails)
+{
+    if (get->status != S3StatusOK) {
+        return;
+    }
+
+    get->status = status;
+
+    if (errorDetails && errorDetails->message) {
+        snprintf(get->errorMessage, sizeof(get->errorMessage), "%s",
+                 errorDetails->message);
+    }
+}
+
+
+// As for a multipart upload, SlowDown is retried as well as the statuses
+// that S3_status_is_retryable() accepts, since the retries are delayed
+static int should_retry(ParallelGet *get, S3Status status, int attempts)
+{
+    return ((S3_status_is_retryable(status) ||
+             (status == S3StatusErrorSlowDown)) &&
+            (attempts < get->maxAttempts) && (get->status == S3StatusOK));
+}
+
+
+// Returns the time at which a request which has been attempted [attempts]
+// times may be retried
+static int64_t retry_time_ms(int attempts)
+{
+    int64_t delay = RETRY_DELAY_MS;
+    while ((--attempts > 0) && (delay < MAX_RETRY_DELAY_MS)) {
+        delay *= 2;
+    }
+
+    return request_context_now_ms() +
+        ((delay < MAX_RETRY_DELAY_MS) ? delay : MAX_RETRY_DELAY_MS);
+}
+
+
+static void retryTimerCallback(S3Status status, void *data)
+{
+    ParallelGet *get = (ParallelGet *) data;
+
+    if (status != S3StatusOK) {
+        // The request context is being destroyed
+        get_fail(get, status, 0);
+    }
+
+    (*(get->retry))(get);
+}
+
+
+// Has the request context call retry once the monotonic time [dueMs] has
+// passed, in place of any retry already waiting
+static void retry_at(ParallelGet *get, int64_t dueMs,
+                     void (*retry)(ParallelGet *get))
+{
+    request_context_remove_timer(get->requestContext, &(get->retryTimer));
+
+    get->retry = retry;
+    get->retryTimer.dueMs = dueMs;
+    get->retryTimer.callback = &retryTimerCallback;
+    get->retryTimer.data = get;
+
+    request_context_add_timer(get->requestContext, &(get->retryTimer));
+}
+
+
+// Ranges --------------------------------------------------------------------
+
+static void start_range(GetRange *range);
+
+
+// Removes and returns a range waiting to be retried whose delay has passed,
+// or returns 0 if there is none
+static GetRange *take_retry_range(ParallelGet *get)
+{
+    if (!get->retryRanges) {
+        return 0;
+    }
+
+    int64_t now = request_context_now_ms();
+
+    GetRange **prev = &(get->retryRanges);
+    while (*prev) {
+        GetRange *range = *prev;
+        if (range->notBeforeMs <= now) {
+            *prev = range->nextRetry;
+            return range;
+        }
+        prev = &(range->nextRetry);
+    }
+
+    return 0;
+}
+
+
+// Starts ranges, retried ones first once their delay has passed, until as
+// many are in flight as are allowed; and once none remain in flight,
+// finishes the download
+static void get_ranges(ParallelGet *get)
+{
+    // Requests can complete synchronously, calling back into here while
+    // ranges are being started; the outermost call carries on once they
+    // return
+    if (get->startingRanges) {
+        return;
+    }
+
+    get->startingRanges = 1;
+
+    while ((get->status == S3StatusOK) &&
+           (get->rangesInFlight < get->concurrency)) {
+        GetRange *range = take_retry_range(get);
+        if (!range && (get->nextRange < get->rangeCount)) {
+            range = &(get->ranges[get->nextRange++]);
+        }
+        if (!range) {
+            break;
+        }
+        start_range(range);
+    }
+
+    get->startingRanges = 0;
+
+    if ((get->status == S3StatusOK) && get->retryRanges) {
+        // Ranges are waiting for their retries to be due.  If there is room
+        // for more ranges in flight, come back here once the first is due;
+        // otherwise ranges in flight come back here as they complete.
+        if (get->rangesInFlight < get->concurrency) {
+            GetRange *range = get->retryRanges;
+            int64_t notBeforeMs = range->notBeforeMs;
+            while ((range = range->nextRetry)) {
+                if (range->notBeforeMs < notBeforeMs) {
+                    notBeforeMs = range->notBeforeMs;
+                }
+            }
+            retry_at(get, notBeforeMs, &get_ranges);
+        }
+        return;
+    }
+
+    // No range is waiting to be retried, or none will be
+    request_context_remove_timer(get->requestContext, &(get->retryTimer));
+
+    if (!get->rangesInFlight) {
+        get_finish(get);
+    }
+}
+
+
+static void rangeCompleteCallback(S3Status requestStatus, uint64_t byteCount,
+                                  const S3ErrorDetails *s3ErrorDetails,
+                                  void *callbackData)
+{
+    GetRange *range = (GetRange *) callbackData;
+    ParallelGet *get = range->get;
+
+    get->rangesInFlight--;
+    range->received += byteCount;
+
+    if ((requestStatus == S3StatusOK) && (range->received < range->size)) {
+        // The connection was closed before the whole range was received
+        requestStatus = S3StatusConnectionFailed;
+    }
+
+    if (requestStatus != S3StatusOK) {
+        if (should_retry(get, requestStatus, range->attempts)) {
+            if (!get->rangeConditions.ifMatchETag) {
+                // Without an ETag to hold the object to, the bytes already
+                // received may be of another version; start again
+                range->received = 0;
+            }
+            range->notBeforeMs = retry_time_ms(range->attempts);
+            range->nextRetry = get->retryRanges;
+            get->retryRanges = range;
+        }
+        else {
+            get_fail(get, requestStatus, s3ErrorDetails);
+        }
+    }
+
+    get_ranges(get);
+}
+
+
+static void start_range(GetRange *range)
+{
+    ParallelGet *get = range->get;
+
+    range->attempts++;
+    get->rangesInFlight++;
+
+    // Each range is written straight to its place in the file
+    S3GetDestination destination;
+    memset(&destination, 0, sizeof(destination));
+    destination.type = S3GetDestinationTypeFd;
+    destination.fd = get->fd;
+    destination.fdOffset = range->offset + range->received;
+
+    S3GetObjectIntoHandler handler = { 0, &rangeCompleteCallback };
+
+    S3_get_object_into(&(get->bucketContext), get->key,
+                       &(get->rangeConditions),
+                       range->offset + range->received,
+                       range->size - range->received, &destination,
+                       get->requestContext, get->timeoutMs, &handler, range);
+}
+
+
+// Sizes the file and splits the object into ranges, once its size is known
+static S3Status setup_ranges(ParallelGet *get)
+{
+    if (ftruncate(get->fd, (off_t) get->contentLength)) {
+        return S3StatusInternalError;
+    }
+
+    // Without an ETag, separate ranges could be of different versions of the
+    // object, so the whole object is downloaded as a single range
+    if (!get->headProperties.eTag && get->contentLength) {
+        get->rangeSize = get->contentLength;
+    }
+
+    uint64_t rangeCount =
+        (get->contentLength + get->rangeSize - 1) / get->rangeSize;
+    if (rangeCount > 0x7FFFFFFF) {
+        return S3StatusNotSupported;
+    }
+
+    get->rangeCount = rangeCount;
+
+    if (!rangeCount) {
+        return S3StatusOK;
+    }
+
+    if (!(get->ranges = (GetRange *) calloc(rangeCount, sizeof(GetRange)))) {
+        return S3StatusOutOfMemory;
+    }
+
+    int i;
+    for (i = 0; i < get->rangeCount; i++) {
+        GetRange *range = &(get->ranges[i]);
+        range->get = get;
+        range->offset = i * get->rangeSize;
+        range->size = get->contentLength - range->offset;
+        if (range->size > get->rangeSize) {
+            range->size = get->rangeSize;
+        }
+    }
+
+    get->rangeConditions.ifModifiedSince = -1;
+    get->rangeConditions.ifNotModifiedSince = -1;
+    get->rangeConditions.ifMatchETag = get->headProperties.eTag;
+
+    return S3StatusOK;
+}
+
+
+// HEAD ----------------------------------------------------------------------
+
+static void start_head(ParallelGet *get);
+
+
+static void retry_head(ParallelGet *get)
+{
+    if (get->status != S3StatusOK) {
+        get_finish(get);
+    }
+    else {
+        start_head(get);
+    }
+}
+
+
+// Copies the properties of a HEAD response, and the strings that they refer
+// to, into get->headProperties
+static S3Status copy_head_properties(ParallelGet *get,
+                                     const S3ResponseProperties *properties)
+{
+    const S3ResponseProperties *p = properties;
+
+    int metaDataCount = p->metaData ? p->metaDataCount : 0;
+
+    size_t size = (string_copy_size(p->requestId) +
+                   string_copy_size(p->requestId2) +
+                   string_copy_size(p->contentType) +
+                   string_copy_size(p->server) + string_copy_size(p->eTag));
+    int i;
+    for (i = 0; i < metaDataCount; i++) {
+        size += (string_copy_size(p->metaData[i].name) +
+                 string_copy_size(p->metaData[i].value));
+    }
+
+    // Put the S3NameValue array first, so that it is suitably aligned
+    size_t metaDataSize = metaDataCount * sizeof(S3NameValue);
+
+    free(get->headPropertiesStrings);
+    if (!(get->headPropertiesStrings =
+          (char *) malloc((metaDataSize + size) ? (metaDataSize + size) :
+                          1))) {
+        return S3StatusOutOfMemory;
+    }
+
+    char *pos = get->headPropertiesStrings + metaDataSize;
+
+    get->headProperties = *p;
+    get->headProperties.requestId = copy_string(&pos, p->requestId);
+    get->headProperties.requestId2 = copy_string(&pos, p->requestId2);
+    get->headProperties.contentType = copy_string(&pos, p->contentType);
+    get->headProperties.server = copy_string(&pos, p->server);
+    get->headProperties.eTag = copy_string(&pos, p->eTag);
+    S3NameValue *metaData = (S3NameValue *) get->headPropertiesStrings;
+    for (i = 0; i < metaDataCount; i++) {
+        metaData[i].name = copy_string(&pos, p->metaData[i].name);
+        metaData[i].value = copy_string(&pos, p->metaData[i].value);
+    }
+    get->headProperties.metaDataCount = metaDataCount;
+    get->headProperties.metaData = metaDataCount ? metaData : 0;
+
+    return S3StatusOK;
+}
+
+
+static S3Status headPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    ParallelGet *get = (ParallelGet *) callbackData;
+
+    get->contentLength = responseProperties->contentLength;
+
+    return copy_head_properties(get, responseProperties);
+}
+
+
+static void headCompleteCallback(S3Status requestStatus,
+                                 const S3ErrorDetails *s3ErrorDetails,
+                                 void *callbackData)
+{
+    ParallelGet *get = (ParallelGet *) callbackData;
+
+    if (requestStatus != S3StatusOK) {
+        if (should_retry(get, requestStatus, get->attempts)) {
+            retry_at(get, retry_time_ms(get->attempts), &retry_head);
+        }
+        else {
+            get_fail(get, requestStatus, s3ErrorDetails);
+            get_finish(get);
+        }
+        return;
+    }
+
+    S3Status status = S3StatusOK;
+    if (get->handler.propertiesCallback) {
+        status = (*(get->handler.propertiesCallback))
+            (&(get->headProperties), get->callbackData);
+    }
+    if (status == S3StatusOK) {
+        status = setup_ranges(get);
+    }
+    if (status != S3StatusOK) {
+        get_fail(get, status, 0);
+        get_finish(get);
+        return;
+    }
+
+    get_ranges(get);
+}
+
+
+static void start_head(ParallelGet *get)
+{
+    get->attempts++;
+
+    RequestParams params =
+    {
+        HttpRequestTypeHEAD,                          // httpRequestType
+        get->bucketContext,                           // bucketContext
+        get->key,                                     // key
+        0,                                            // queryParams
+        0,                                            // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        &(get->getConditions),                        // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        0,                                            // putProperties
+        &headPropertiesCallback,                      // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        0,                                            // fromS3Callback
+        &headCompleteCallback,                        // completeCallback
+        get,                                          // callbackData
+        get->timeoutMs                                // timeoutMs
+    };
+
+    request_perform(&params, get->requestContext);
+}
+
+
+// Public API ----------------------------------------------------------------
+
+void S3_get_object_to_fd(const S3BucketContext *bucketContext,
+                         const char *key,
+                         const S3GetConditions *getConditions, int fd,
+                         const S3ParallelGetOptions *options,
+                         S3RequestContext *requestContext, int timeoutMs,
+                         const S3ResponseHandler *handler,
+                         void *callbackData)
+{
+#define return_status(status)                                           \
+    (*(handler->completeCallback))(status, 0, callbackData);            \
+    return
+
+    ParallelGet *get = (ParallelGet *) calloc(1, sizeof(ParallelGet));
+    if (!get) {
+        return_status(S3StatusOutOfMemory);
+    }
+
+    S3Status status = copy_parameters(get, bucketContext, key,
+                                      getConditions);
+    if (status != S3StatusOK) {
+        free(get);
+        return_status(status);
+    }
+
+    get->fd = fd;
+    get->timeoutMs = timeoutMs;
+    get->handler = *handler;
+    get->callbackData = callbackData;
+    get->status = S3StatusOK;
+
+    get->rangeSize = S3_PARALLEL_GET_DEFAULT_RANGE_SIZE;
+    get->concurrency = S3_PARALLEL_GET_DEFAULT_CONCURRENCY;
+    get->maxAttempts = S3_PARALLEL_GET_DEFAULT_MAX_ATTEMPTS;
+    if (options && (options->rangeSize > 0)) {
+        get->rangeSize = options->rangeSize;
+    }
+    if (options && (options->concurrency > 0)) {
+        get->concurrency = options->concurrency;
+    }
+    if (options && (options->maxAttempts > 0)) {
+        get->maxAttempts = options->maxAttempts;
+    }
+
+    if (requestContext) {
+        get->requestContext = requestContext;
+        start_head(get);
+        return;
+    }
+
+    // No request context was given, so run the download to completion on a
+    // private one
+    if ((status = S3_create_request_context(&requestContext)) != S3StatusOK) {
+        get_destroy(get);
+        return_status(status);
+    }
+
+    get->requestContext = requestContext;
+    start_head(get);
+
+    // This waits out any retry delays.  If it fails, destroying the request
+    // context interrupts the remaining requests and retries, which finishes
+    // the download.
+    S3_runall_request_context(requestContext);
+
+    S3_destroy_request_context(requestContext);
+}
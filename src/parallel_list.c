@@ -0,0 +1,816 @@
+/** **************************************************************************
+ * parallel_list.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libs3.h"
+#include "util.h"
+
+
+// The longest S3 error message that is kept to report in the complete
+// callback of a failed listing
+#define MAX_ERROR_MESSAGE_SIZE 256
+
+
+struct ListPartition;
+
+// A run of keys listed by a partition, or a partition found within it.
+// Sorted listings keep these, in key order, until they can be reported.
+typedef struct ListChunk
+{
+    struct ListChunk *next;
+
+    int contentsCount;
+    S3ListBucketContent *contents;
+
+    // If not 0, the chunk stands for this partition rather than for keys
+    struct ListPartition *partition;
+
+    // The allocation holding the contents and their strings, which several
+    // chunks of a response may share; it is freed with the last of them
+    void *block;
+} ListChunk;
+
+
+// A part of the keyspace which is listed as a series of pages
+typedef struct ListPartition
+{
+    struct ParallelList *list;
+
+    // The keys of the partition are those beginning with prefix, after
+    // startAfter if it is not 0, and up to and including last if it is not
+    // 0
+    const char *prefix;
+    const char *startAfter;
+    const char *last;
+
+    // Depth of the partition in the common prefixes found by delimiter;
+    // partitions shallower than the split depth are listed with it
+    int depth;
+
+    // The continuation token of the next page, or 0 for the first page
+    char *continuationToken;
+
+    // Number of times that the current page has been requested
+    int attempts;
+
+    // Set once the last page of the partition has been listed
+    int done;
+
+    // Sorted listings only: the chunks of the partition not yet reported
+    ListChunk *chunks, **chunksTail;
+
+    // Links the partition into the queue of partitions waiting for a
+    // request
+    struct ListPartition *nextQueued;
+
+    // Filled in as the response for the current page arrives
+    ListChunk *page;
+    int commonPrefixesCount;
+    char **commonPrefixes;
+    int isTruncated;
+    char *nextContinuationToken;
+
+    // The prefix, startAfter and last strings follow the partition
+} ListPartition;
+
+
+// The complete state of a parallel listing.  Everything that the requests
+// making up the listing need is copied into here, because those requests
+// are made from the callbacks of earlier ones.
+typedef struct ParallelList
+{
+    S3BucketContext bucketContext;
+    const char *delimiter;
+    int splitDepth;
+    int concurrency;
+    int maxAttempts;
+    int maxKeys;
+    int fetchOwner;
+    int sorted;
+    S3RequestContext *requestContext;
+    int timeoutMs;
+    S3ParallelListHandler handler;
+    void *callbackData;
+
+    // The status of the listing; once this is not S3StatusOK, no more
+    // requests are started, and the listing finishes once all requests in
+    // flight have finished
+    S3Status status;
+
+    // The message of the S3 error that caused the listing to fail, if any
+    char errorMessage[MAX_ERROR_MESSAGE_SIZE];
+
+    // The partition whose chunks, and those of the partitions within them,
+    // make up the whole listing in key order (sorted listings only)
+    ListPartition *root;
+
+    // Partitions waiting for a request
+    ListPartition *queueHead, **queueTail;
+
+    int requestsInFlight;
+
+    // Set while requests are being started, so that callbacks made
+    // synchronously while doing so leave the starting of requests to the
+    // outermost call
+    int startingRequests;
+
+    // The bucket context strings and the delimiter are copied into this
+    // single allocation
+    char *strings;
+} ParallelList;
+
+
+// Chunks and partitions -----------------------------------------------------
+
+static ListPartition *partition_create(ParallelList *list, const char *prefix,
+                                       const char *startAfter,
+                                       const char *last, int depth)
+{
+    ListPartition *partition = (ListPartition *)
+        calloc(1, sizeof(ListPartition) + string_copy_size(prefix) +
+               string_copy_size(startAfter) + string_copy_size(last));
+    if (!partition) {
+        return 0;
+    }
+
+    char *pos = (char *) &(partition[1]);
+    partition->list = list;
+    partition->prefix = copy_string(&pos, prefix);
+    partition->startAfter = copy_string(&pos, startAfter);
+    partition->last = copy_string(&pos, last);
+    partition->depth = depth;
+    partition->chunksTail = &(partition->chunks);
+
+    return partition;
+}
+
+
+static void chunk_free(ListChunk *chunk)
+{
+    free(chunk->block);
+    free(chunk);
+}
+
+
+static void page_free(ListPartition *partition)
+{
+    int i;
+
+    if (partition->page) {
+        chunk_free(partition->page);
+        partition->page = 0;
+    }
+
+    for (i = 0; i < partition->commonPrefixesCount; i++) {
+        free(partition->commonPrefixes[i]);
+    }
+    free(partition->commonPrefixes);
+    partition->commonPrefixes = 0;
+    partition->commonPrefixesCount = 0;
+
+    free(partition->nextContinuationToken);
+    partition->nextContinuationToken = 0;
+    partition->isTruncated = 0;
+}
+
+
+// Frees a partition, along with any partitions within its chunks
+static void partition_free(ListPartition *partition)
+{
+    while (partition->chunks) {
+        ListChunk *chunk = partition->chunks;
+        partition->chunks = chunk->next;
+        if (chunk->partition) {
+            partition_free(chunk->partition);
+        }
+        chunk_free(chunk);
+    }
+
+    page_free(partition);
+    free(partition->continuationToken);
+    free(partition);
+}
+
+
+// Copies contents, and the strings they refer to, into a single new chunk
+static ListChunk *chunk_create(int contentsCount,
+                               const S3ListBucketContent *contents)
+{
+    size_t size = contentsCount * sizeof(S3ListBucketContent);
+    int i;
+    for (i = 0; i < contentsCount; i++) {
+        const S3ListBucketContent *content = &(contents[i]);
+        size += (string_copy_size(content->key) +
+                 string_copy_size(content->eTag) +
+                 string_copy_size(content->ownerId) +
+                 string_copy_size(content->ownerDisplayName));
+    }
+
+    ListChunk *chunk = (ListChunk *) calloc(1, sizeof(ListChunk));
+    if (!chunk) {
+        return 0;
+    }
+
+    if (!(chunk->block = malloc(size ? size : 1))) {
+        free(chunk);
+        return 0;
+    }
+
+    chunk->contentsCount = contentsCount;
+    chunk->contents = (S3ListBucketContent *) chunk->block;
+    char *pos = (char *) &(chunk->contents[contentsCount]);
+    for (i = 0; i < contentsCount; i++) {
+        S3ListBucketContent *content = &(chunk->contents[i]);
+        *content = contents[i];
+        content->key = copy_string(&pos, contents[i].key);
+        content->eTag = copy_string(&pos, contents[i].eTag);
+        content->ownerId = copy_string(&pos, contents[i].ownerId);
+        content->ownerDisplayName =
+            copy_string(&pos, contents[i].ownerDisplayName);
+    }
+
+    return chunk;
+}
+
+
+static void append_chunk(ListPartition *partition, ListChunk *chunk)
+{
+    chunk->next = 0;
+    *(partition->chunksTail) = chunk;
+    partition->chunksTail = &(chunk->next);
+}
+
+
+static void enqueue(ParallelList *list, ListPartition *partition)
+{
+    partition->nextQueued = 0;
+    *(list->queueTail) = partition;
+    list->queueTail = &(partition->nextQueued);
+}
+
+
+// Listing setup and teardown ------------------------------------------------
+
+static S3Status copy_parameters(ParallelList *list,
+                                const S3BucketContext *bucketContext,
+                                const char *delimiter)
+{
+    size_t size = (bucket_context_copy_size(bucketContext) +
+                   string_copy_size(delimiter));
+
+    if (!(list->strings = (char *) malloc(size ? size : 1))) {
+        return S3StatusOutOfMemory;
+    }
+
+    char *pos = list->strings;
+
+    bucket_context_copy(&(list->bucketContext), &pos, bucketContext);
+    list->delimiter = copy_string(&pos, delimiter);
+
+    return S3StatusOK;
+}
+
+
+static void list_destroy(ParallelList *list)
+{
+    if (list->root) {
+        partition_free(list->root);
+    }
+
+    // Partitions of unsorted listings are only referred to by the queue;
+    // those of sorted listings are all within the root
+    if (!list->sorted) {
+        while (list->queueHead) {
+            ListPartition *partition = list->queueHead;
+            list->queueHead = partition->nextQueued;
+            partition_free(partition);
+        }
+    }
+
+    free(list->strings);
+    free(list);
+}
+
+
+// Makes the complete callback for the listing as a whole, and frees it
+static void list_finish(ParallelList *list)
+{
+    S3ErrorDetails errorDetails;
+    memset(&errorDetails, 0, sizeof(errorDetails));
+    errorDetails.message = list->errorMessage;
+
+    (*(list->handler.responseHandler.completeCallback))
+        (list->status, list->errorMessage[0] ? &errorDetails : 0,
+         list->callbackData);
+
+    list_destroy(list);
+}
+
+
+// Records the status of a failed request as the status of the listing, if
+// it is the first failure
+static void list_fail(ParallelList *list, S3Status status,
+                      const S3ErrorDetails *errorDetails)
+{
+    if (list->status != S3StatusOK) {
+        return;
+    }
+
+    list->status = status;
+
+    if (errorDetails && errorDetails->message) {
+        snprintf(list->errorMessage, sizeof(list->errorMessage), "%s",
+                 errorDetails->message);
+    }
+}
+
+
+// Reporting -----------------------------------------------------------------
+
+static void report(ParallelList *list, int contentsCount,
+                   const S3ListBucketContent *contents)
+{
+    if (!contentsCount || (list->status != S3StatusOK)) {
+        return;
+    }
+
+    S3Status status = (*(list->handler.listCallback))
+        (contentsCount, contents, list->callbackData);
+    if (status != S3StatusOK) {
+        list_fail(list, status, 0);
+    }
+}
+
+
+// Reports, in key order, all of the chunks of a partition which can be; and
+// returns nonzero once the partition has been reported in full
+static int report_sorted(ParallelList *list, ListPartition *partition)
+{
+    while (partition->chunks) {
+        ListChunk *chunk = partition->chunks;
+        if (chunk->partition) {
+            if (!report_sorted(list, chunk->partition)) {
+                return 0;
+            }
+            partition_free(chunk->partition);
+        }
+        else {
+            report(list, chunk->contentsCount, chunk->contents);
+        }
+        partition->chunks = chunk->next;
+        if (!partition->chunks) {
+            partition->chunksTail = &(partition->chunks);
+        }
+        chunk_free(chunk);
+    }
+
+    return partition->done;
+}
+
+
+// Adds a partition for each common prefix of the page.  Sorted listings
+// place them among the page's keys, splitting its chunk around them.
+static S3Status add_common_prefix_partitions(ListPartition *partition)
+{
+    ParallelList *list = partition->list;
+    ListChunk *page = partition->page;
+    int i, k = 0;
+
+    for (i = 0; i < partition->commonPrefixesCount; i++) {
+        ListPartition *child = partition_create
+            (list, partition->commonPrefixes[i], 0, 0, partition->depth + 1);
+        if (!child) {
+            return S3StatusOutOfMemory;
+        }
+
+        if (list->sorted) {
+            // The keys before the common prefix come before the partition
+            int first = k;
+            while ((k < page->contentsCount) &&
+                   (strcmp(page->contents[k].key,
+                           partition->commonPrefixes[i]) < 0)) {
+                k++;
+            }
+            ListChunk *keys = (ListChunk *) calloc(1, sizeof(ListChunk));
+            ListChunk *chunk = (ListChunk *) calloc(1, sizeof(ListChunk));
+            if (!keys || !chunk) {
+                free(keys);
+                free(chunk);
+                partition_free(child);
+                return S3StatusOutOfMemory;
+            }
+            keys->contentsCount = k - first;
+            keys->contents = &(page->contents[first]);
+            append_chunk(partition, keys);
+            chunk->partition = child;
+            append_chunk(partition, chunk);
+        }
+
+        enqueue(list, child);
+    }
+
+    if (list->sorted) {
+        // The remaining keys, which own the page's allocation since they
+        // are the last of its chunks to be reported
+        page->contents = &(page->contents[k]);
+        page->contentsCount -= k;
+        append_chunk(partition, page);
+    }
+    else {
+        report(list, page->contentsCount, page->contents);
+        chunk_free(page);
+    }
+    partition->page = 0;
+
+    return S3StatusOK;
+}
+
+
+// Requests ------------------------------------------------------------------
+
+static void start_partition(ListPartition *partition);
+
+
+// Starts requests for queued partitions until as many are in flight as are
+// allowed; and once none remain in flight, finishes the listing
+static void list_partitions(ParallelList *list)
+{
+    // Requests can complete synchronously, calling back into here while
+    // requests are being started; the outermost call carries on once they
+    // return
+    if (list->startingRequests) {
+        return;
+    }
+
+    list->startingRequests = 1;
+
+    while ((list->status == S3StatusOK) &&
+           (list->requestsInFlight < list->concurrency) && list->queueHead) {
+        ListPartition *partition = list->queueHead;
+        if (!(list->queueHead = partition->nextQueued)) {
+            list->queueTail = &(list->queueHead);
+        }
+        start_partition(partition);
+    }
+
+    list->startingRequests = 0;
+
+    if (!list->requestsInFlight) {
+        list_finish(list);
+    }
+}
+
+
+static S3Status partitionPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    ListPartition *partition = (ListPartition *) callbackData;
+    ParallelList *list = partition->list;
+
+    if (list->handler.responseHandler.propertiesCallback) {
+        return (*(list->handler.responseHandler.propertiesCallback))
+            (responseProperties, list->callbackData);
+    }
+
+    return S3StatusOK;
+}
+
+
+// Keeps the page until the request completes, since a failed request is
+// retried and must not have reported anything
+static S3Status partitionListCallback(int isTruncated,
+                                      const char *nextContinuationToken,
+                                      int contentsCount,
+                                      const S3ListBucketContent *contents,
+                                      int commonPrefixesCount,
+                                      const char **commonPrefixes,
+                                      void *callbackData)
+{
+    ListPartition *partition = (ListPartition *) callbackData;
+    int i;
+
+    page_free(partition);
+
+    partition->isTruncated = isTruncated;
+
+    if (nextContinuationToken && nextContinuationToken[0] &&
+        !(partition->nextContinuationToken =
+          strdup(nextContinuationToken))) {
+        return S3StatusOutOfMemory;
+    }
+
+    if (!(partition->page = chunk_create(contentsCount, contents))) {
+        return S3StatusOutOfMemory;
+    }
+
+    if (commonPrefixesCount) {
+        if (!(partition->commonPrefixes = (char **)
+              malloc(commonPrefixesCount * sizeof(char *)))) {
+            return S3StatusOutOfMemory;
+        }
+        for (i = 0; i < commonPrefixesCount; i++) {
+            if (!(partition->commonPrefixes[i] = strdup(commonPrefixes[i]))) {
+                return S3StatusOutOfMemory;
+            }
+            partition->commonPrefixesCount++;
+        }
+    }
+
+    return S3StatusOK;
+}
+
+
+// Handles a page which was listed successfully, returning the status of the
+// listing
+static S3Status complete_page(ListPartition *partition)
+{
+    ParallelList *list = partition->list;
+
+    // A last page with no keys and no common prefixes makes no list callback
+    if (!partition->page &&
+        !(partition->page = chunk_create(0, 0))) {
+        return S3StatusOutOfMemory;
+    }
+
+    ListChunk *page = partition->page;
+
+    // Leave out any keys after the end of the partition, which also means
+    // that the partition has been listed in full
+    if (partition->last) {
+        int i;
+        for (i = 0; i < page->contentsCount; i++) {
+            if (strcmp(page->contents[i].key, partition->last) > 0) {
+                page->contentsCount = i;
+                partition->isTruncated = 0;
+                break;
+            }
+        }
+    }
+
+    free(partition->continuationToken);
+    partition->continuationToken = partition->nextContinuationToken;
+    partition->nextContinuationToken = 0;
+
+    if (!partition->isTruncated || !partition->continuationToken) {
+        partition->done = 1;
+    }
+
+    S3Status status = add_common_prefix_partitions(partition);
+    page_free(partition);
+    if (status != S3StatusOK) {
+        // The listing fails, so the partition is not listed any further;
+        // only the root refers to the partitions of sorted listings
+        if (!list->sorted) {
+            partition_free(partition);
+        }
+        return status;
+    }
+
+    if (!partition->done) {
+        // List the next page of the partition ahead of partitions not yet
+        // started, so that sorted listings report it sooner
+        partition->attempts = 0;
+        if (!(partition->nextQueued = list->queueHead)) {
+            list->queueTail = &(partition->nextQueued);
+        }
+        list->queueHead = partition;
+    }
+    else if (!list->sorted) {
+        partition_free(partition);
+    }
+
+    if (list->sorted) {
+        report_sorted(list, list->root);
+    }
+
+    return list->status;
+}
+
+
+static void partitionCompleteCallback(S3Status requestStatus,
+                                      const S3ErrorDetails *s3ErrorDetails,
+                                      void *callbackData)
+{
+    ListPartition *partition = (ListPartition *) callbackData;
+    ParallelList *list = partition->list;
+
+    list->requestsInFlight--;
+
+    if (list->status != S3StatusOK) {
+        // Another request failed; nothing more is to be reported
+        page_free(partition);
+        if (!list->sorted) {
+            partition_free(partition);
+        }
+    }
+    else if (requestStatus == S3StatusOK) {
+        S3Status status = complete_page(partition);
+        if (status != S3StatusOK) {
+            list_fail(list, status, 0);
+        }
+    }
+    else if (S3_status_is_retryable(requestStatus) &&
+             (partition->attempts < list->maxAttempts)) {
+        page_free(partition);
+        enqueue(list, partition);
+    }
+    else {
+        page_free(partition);
+        list_fail(list, requestStatus, s3ErrorDetails);
+        if (!list->sorted) {
+            partition_free(partition);
+        }
+    }
+
+    list_partitions(list);
+}
+
+
+static void start_partition(ListPartition *partition)
+{
+    ParallelList *list = partition->list;
+
+    partition->attempts++;
+    list->requestsInFlight++;
+
+    S3ListBucketHandler handler =
+    {
+        { &partitionPropertiesCallback, &partitionCompleteCallback },
+        &partitionListCallback
+    };
+
+    // start-after is only needed until there is a continuation token
+    S3_list_objects_v2(&(list->bucketContext), partition->prefix,
+                       partition->continuationToken,
+                       partition->continuationToken ?
+                       0 : partition->startAfter,
+                       (partition->depth < list->splitDepth) ?
+                       list->delimiter : 0,
+                       list->maxKeys, list->fetchOwner, 0,
+                       list->requestContext, list->timeoutMs, &handler,
+                       partition);
+}
+
+
+// Creates the partitions that the listing starts with
+static S3Status setup_partitions(ParallelList *list, const char *prefix,
+                                 const S3ParallelListOptions *options)
+{
+    int splitPointsCount = options ? options->splitPointsCount : 0;
+
+    if (!splitPointsCount) {
+        // A single partition, which is split further as common prefixes are
+        // found in it if there is a delimiter
+        if (!(list->root = partition_create(list, prefix, 0, 0, 0))) {
+            return S3StatusOutOfMemory;
+        }
+        enqueue(list, list->root);
+        if (!list->sorted) {
+            // The queue now owns it
+            list->root = 0;
+        }
+        return S3StatusOK;
+    }
+
+    // The root only holds the partitions between the split points, in order
+    if (list->sorted) {
+        if (!(list->root = partition_create(list, 0, 0, 0, 0))) {
+            return S3StatusOutOfMemory;
+        }
+        list->root->done = 1;
+    }
+
+    int i;
+    for (i = 0; i <= splitPointsCount; i++) {
+        const char *startAfter = i ? options->splitPoints[i - 1] : 0;
+        const char *last =
+            (i < splitPointsCount) ? options->splitPoints[i] : 0;
+        ListPartition *partition =
+            partition_create(list, prefix, startAfter, last, 0);
+        if (!partition) {
+            return S3StatusOutOfMemory;
+        }
+        if (list->sorted) {
+            ListChunk *chunk = (ListChunk *) calloc(1, sizeof(ListChunk));
+            if (!chunk) {
+                partition_free(partition);
+                return S3StatusOutOfMemory;
+            }
+            chunk->partition = partition;
+            append_chunk(list->root, chunk);
+        }
+        enqueue(list, partition);
+    }
+
+    return S3StatusOK;
+}
+
+
+// Public API ----------------------------------------------------------------
+
+void S3_list_bucket_parallel(const S3BucketContext *bucketContext,
+                             const char *prefix,
+                             const S3ParallelListOptions *options,
+                             S3RequestContext *requestContext, int timeoutMs,
+                             const S3ParallelListHandler *handler,
+                             void *callbackData)
+{
+#define return_status(status)                                           \
+    (*(handler->responseHandler.completeCallback))                      \
+        (status, 0, callbackData);                                      \
+    return
+
+    ParallelList *list = (ParallelList *) calloc(1, sizeof(ParallelList));
+    if (!list) {
+        return_status(S3StatusOutOfMemory);
+    }
+
+    S3Status status = copy_parameters
+        (list, bucketContext, options ? options->delimiter : 0);
+    if (status != S3StatusOK) {
+        free(list);
+        return_status(status);
+    }
+
+    list->timeoutMs = timeoutMs;
+    list->handler = *handler;
+    list->callbackData = callbackData;
+    list->status = S3StatusOK;
+    list->queueTail = &(list->queueHead);
+
+    list->splitDepth = S3_PARALLEL_LIST_DEFAULT_SPLIT_DEPTH;
+    list->concurrency = S3_PARALLEL_LIST_DEFAULT_CONCURRENCY;
+    list->maxAttempts = S3_PARALLEL_LIST_DEFAULT_MAX_ATTEMPTS;
+    if (options) {
+        if (options->splitDepth > 0) {
+            list->splitDepth = options->splitDepth;
+        }
+        if (options->concurrency > 0) {
+            list->concurrency = options->concurrency;
+        }
+        if (options->maxAttempts > 0) {
+            list->maxAttempts = options->maxAttempts;
+        }
+        list->maxKeys = options->maxKeys;
+        list->fetchOwner = options->fetchOwner;
+        list->sorted = options->sorted;
+    }
+
+    // The delimiter only splits the keyspace when split points don't
+    if (!list->delimiter || (options && options->splitPointsCount)) {
+        list->splitDepth = 0;
+    }
+
+    if ((status = setup_partitions(list, prefix, options)) != S3StatusOK) {
+        list_destroy(list);
+        return_status(status);
+    }
+
+    if (requestContext) {
+        list->requestContext = requestContext;
+        list_partitions(list);
+        return;
+    }
+
+    // No request context was given, so run the listing to completion on a
+    // private one
+    if ((status = S3_create_request_context(&requestContext)) != S3StatusOK) {
+        list_destroy(list);
+        return_status(status);
+    }
+
+    list->requestContext = requestContext;
+    list_partitions(list);
+
+    // If this fails, destroying the request context interrupts the
+    // remaining requests, which finishes the listing
+    S3_runall_request_context(requestContext);
+
+    S3_destroy_request_context(requestContext);
+}
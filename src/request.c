@@ -30,22 +30,15 @@
 #include <string.h>
 #include <sys/utsname.h>
 #include <libxml/parser.h>
+#include "connection_share.h"
+#include "metrics.h"
 #include "request.h"
 #include "request_context.h"
+#include "request_pool.h"
 #include "response_headers_handler.h"
-
-#ifdef __APPLE__
-#include <CommonCrypto/CommonHMAC.h>
-#define S3_SHA256_DIGEST_LENGTH CC_SHA256_DIGEST_LENGTH
-#else
-#include <openssl/hmac.h>
-#include <openssl/sha.h>
-#define S3_SHA256_DIGEST_LENGTH SHA256_DIGEST_LENGTH
-#endif
+#include "signing_key_cache.h"
 
 #define USER_AGENT_SIZE 256
-#define REQUEST_STACK_SIZE 32
-#define SIGNATURE_SCOPE_SIZE 64
 
 //#define SIGNATURE_DEBUG
 
@@ -53,96 +46,71 @@ static int verifyPeer;
 
 static char userAgentG[USER_AGENT_SIZE];
 
-static pthread_mutex_t requestStackMutexG;
-
-static Request *requestStackG[REQUEST_STACK_SIZE];
-
-static int requestStackCountG;
-
 char defaultHostNameG[S3_MAX_HOSTNAME_SIZE];
 
+// As set by S3_set_request_stats_callback
+static S3RequestStatsCallback *requestStatsCallbackG;
 
-typedef struct RequestComputedValues
-{
-    // All x-amz- headers, in normalized form (i.e. NAME: VALUE, no other ws)
-    char *amzHeaders[S3_MAX_METADATA_COUNT + 2]; // + 2 for acl and date
-
-    // The number of x-amz- headers
-    int amzHeadersCount;
-
-    // Storage for amzHeaders (the +256 is for x-amz-acl and x-amz-date)
-    char amzHeadersRaw[COMPACTED_METADATA_BUFFER_SIZE + 256 + 1];
-
-    // Length of populated data in raw buffer
-    int amzHeadersRawLength;
-
-    // Canonicalized headers for signature
-    string_multibuffer(canonicalizedSignatureHeaders,
-                       COMPACTED_METADATA_BUFFER_SIZE + 256 + 1);
-
-    // Delimited list of header names used for signature
-    char signedHeaders[COMPACTED_METADATA_BUFFER_SIZE];
-
-    // URL-Encoded key
-    char urlEncodedKey[MAX_URLENCODED_KEY_SIZE + 1];
-
-    // Canonicalized resource
-    char canonicalURI[MAX_CANONICALIZED_RESOURCE_SIZE + 1];
+static void *requestStatsCallbackDataG;
 
-    // Canonical sub-resource & query string
-    char canonicalQueryString[MAX_CANONICALIZED_RESOURCE_SIZE + 1];
+// As set by S3_set_trace_callback
+S3TraceCallback *requestTraceCallbackG;
 
-    // Cache-Control header (or empty)
-    char cacheControlHeader[128];
+static void *requestTraceCallbackDataG;
 
-    // Content-Type header (or empty)
-    char contentTypeHeader[128];
+// The ID of the most recently created request that was traced
+static uint64_t requestTraceIdG;
 
-    // Content-MD5 header (or empty)
-    char md5Header[128];
 
-    // Content-Disposition header (or empty)
-    char contentDispositionHeader[128];
+// The hex SHA-256 of an empty string
+#define EMPTY_SHA256_HEX \
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
 
-    // Content-Encoding header (or empty)
-    char contentEncodingHeader[128];
+// Everything in an aws-chunked chunk header, other than the hex chunk size:
+// ";chunk-signature=" + 64 hex digit signature + "\r\n"
+#define CHUNK_HEADER_FIXED_SIZE (17 + (S3_SHA256_DIGEST_LENGTH * 2) + 2)
 
-    // Expires header (or empty)
-    char expiresHeader[128];
+// Room reserved in the chunk buffer ahead of the chunk data for the chunk
+// header; 8 hex digits is enough for any chunk size
+#define CHUNK_HEADER_MAX_SIZE (8 + CHUNK_HEADER_FIXED_SIZE)
 
-    // If-Modified-Since header
-    char ifModifiedSinceHeader[128];
 
-    // If-Unmodified-Since header
-    char ifUnmodifiedSinceHeader[128];
-
-    // If-Match header
-    char ifMatchHeader[128];
-
-    // If-None-Match header
-    char ifNoneMatchHeader[128];
-
-    // Range header
-    char rangeHeader[128];
+// Returns nonzero if the request's payload is to be sent aws-chunked with
+// streaming signatures
+static int use_streaming_signature(const RequestParams *params)
+{
+    return ((params->httpRequestType == HttpRequestTypePUT) &&
+            params->putProperties &&
+            params->putProperties->useStreamingSignature);
+}
 
-    // Authorization header
-    char authorizationHeader[1024];
 
-    // Request date stamp
-    char requestDateISO8601[64];
+// Returns the number of bytes that an aws-chunked chunk carrying dataSize
+// bytes of data is encoded to
+static uint64_t chunk_encoded_size(uint64_t dataSize)
+{
+    int hexDigits = 1;
+    uint64_t s = dataSize;
+    while (s >>= 4) {
+        hexDigits++;
+    }
 
-    // Credential used for authorization signature
-    char authCredential[MAX_CREDENTIAL_SIZE + 1];
+    // header + data + "\r\n"
+    return hexDigits + CHUNK_HEADER_FIXED_SIZE + dataSize + 2;
+}
 
-    // Computed request signature (hex string)
-    char requestSignatureHex[S3_SHA256_DIGEST_LENGTH * 2 + 1];
 
-    // Host header
-    char hostHeader[128];
+// Returns the Content-Length of an aws-chunked payload carrying dataSize bytes
+// of data, including the final zero length chunk
+static uint64_t streaming_content_length(uint64_t dataSize)
+{
+    uint64_t fullChunks = dataSize / STREAMING_CHUNK_SIZE;
+    uint64_t remainder = dataSize % STREAMING_CHUNK_SIZE;
 
-    // Hex string of hash of request payload
-    char payloadHash[S3_SHA256_DIGEST_LENGTH * 2 + 1];
-} RequestComputedValues;
+    return ((fullChunks * chunk_encoded_size(STREAMING_CHUNK_SIZE)) +
+            (remainder ? chunk_encoded_size(remainder) : 0) +
+            chunk_encoded_size(0));
+}
 
 
 // Called whenever we detect that the request headers have been completely
@@ -192,19 +160,181 @@ static size_t curl_header_func(void *ptr, size_t size, size_t nmemb,
 
     int len = size * nmemb;
 
+    // The connection is only accessible from the curl handle during the
+    // transfer, so note its details upon the first header
+    if (!request->connectionRecorded) {
+        request->connectionRecorded = 1;
+        request->tlsSessionResumed =
+            connection_share_record_connected(request->curl);
+    }
+
     response_headers_handler_add
         (&(request->responseHeadersHandler), (char *) ptr, len);
 
+    // A blank line ends the headers of a response; those of a 1xx response
+    // are followed by those of the final one
+    if (requestTraceCallbackG && (len <= 2) &&
+        ((((char *) ptr)[0] == '\r') || (((char *) ptr)[0] == '\n'))) {
+        long httpResponseCode;
+        if ((curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE,
+                               &httpResponseCode) == CURLE_OK) &&
+            (httpResponseCode >= 200)) {
+            request->httpResponseCode = httpResponseCode;
+            request_trace_event(request, S3TraceEventHeadersReceived);
+        }
+    }
+
     return len;
 }
 
 
+#if LIBCURL_VERSION_NUM >= 0x075000 /* 7.80.0 */
+// Called by curl once it has a connection for the request, just before it
+// sends the request
+static int curl_prereq_func(void *data, char *primaryIp, char *localIp,
+                            int primaryPort, int localPort)
+{
+    Request *request = (Request *) data;
+
+    (void) primaryIp;
+    (void) localIp;
+    (void) primaryPort;
+    (void) localPort;
+
+    request_trace(request, S3TraceEventConnectionAcquired);
+
+    // Without a body, there is nothing more to wait for before sending
+    if (!request->toS3Callback) {
+        request_trace(request, S3TraceEventFirstByteSent);
+    }
+
+    return CURL_PREREQFUNC_OK;
+}
+#endif
+
+
+// Reads the next chunk of data from the toS3Callback into the chunk buffer,
+// and signs and aws-chunked encodes it.  Returns nonzero on success, zero on
+// failure (having set request->status).
+static int encode_next_chunk(Request *request)
+{
+    char *data = &(request->chunkBuffer[CHUNK_HEADER_MAX_SIZE]);
+    int dataLength = 0;
+
+    // Fill the chunk as full as the callback will make it
+    while (request->toS3Callback &&
+           (dataLength < STREAMING_CHUNK_SIZE) &&
+           request->toS3CallbackBytesRemaining) {
+        int len = STREAMING_CHUNK_SIZE - dataLength;
+        if (len > request->toS3CallbackBytesRemaining) {
+            len = request->toS3CallbackBytesRemaining;
+        }
+        int ret = (*(request->toS3Callback))
+            (len, &(data[dataLength]), request->callbackData);
+        if (ret < 0) {
+            request->status = S3StatusAbortedByCallback;
+            return 0;
+        }
+        if (ret == 0) {
+            break;
+        }
+        if (ret > len) {
+            ret = len;
+        }
+        dataLength += ret;
+        request->toS3CallbackBytesRemaining -= ret;
+    }
+
+    if (!dataLength) {
+        request->finalChunkEncoded = 1;
+    }
+
+    // Chunk signature is over the previous signature and the hash of the
+    // chunk data
+    unsigned char md[S3_SHA256_DIGEST_LENGTH];
+#ifdef __APPLE__
+    CC_SHA256(data, dataLength, md);
+#else
+    SHA256((const unsigned char *) data, dataLength, md);
+#endif
+    char dataHashHex[S3_SHA256_DIGEST_LENGTH * 2 + 1];
+    int i;
+    for (i = 0; i < S3_SHA256_DIGEST_LENGTH; i++) {
+        snprintf(&(dataHashHex[i * 2]), 3, "%02x", md[i]);
+    }
+
+    char stringToSign[25 + 17 + SIGNATURE_SCOPE_SIZE + 1 +
+                      (3 * ((S3_SHA256_DIGEST_LENGTH * 2) + 1))];
+    int stringToSignLen =
+        snprintf(stringToSign, sizeof(stringToSign),
+                 "AWS4-HMAC-SHA256-PAYLOAD\n%s\n%s\n%s\n%s\n%s",
+                 request->requestDateISO8601, request->signatureScope,
+                 request->previousSignatureHex, EMPTY_SHA256_HEX, dataHashHex);
+
+#ifdef __APPLE__
+    CCHmac(kCCHmacAlgSHA256, request->signingKey, SIGNING_KEY_SIZE,
+           stringToSign, stringToSignLen, md);
+#else
+    HMAC(EVP_sha256(), request->signingKey, SIGNING_KEY_SIZE,
+         (const unsigned char *) stringToSign, stringToSignLen, md, NULL);
+#endif
+    for (i = 0; i < S3_SHA256_DIGEST_LENGTH; i++) {
+        snprintf(&(request->previousSignatureHex[i * 2]), 3, "%02x", md[i]);
+    }
+
+    // Put the chunk header immediately before the data, and the trailing
+    // CRLF immediately after it
+    char header[CHUNK_HEADER_MAX_SIZE + 1];
+    int headerLength = snprintf(header, sizeof(header),
+                                "%x;chunk-signature=%s\r\n", dataLength,
+                                request->previousSignatureHex);
+    request->chunkPosition = CHUNK_HEADER_MAX_SIZE - headerLength;
+    memcpy(&(request->chunkBuffer[request->chunkPosition]), header,
+           headerLength);
+    memcpy(&(data[dataLength]), "\r\n", 2);
+    request->chunkLength = CHUNK_HEADER_MAX_SIZE + dataLength + 2;
+
+    return 1;
+}
+
+
+// The curl_read_func for streaming signature requests, which supplies the
+// aws-chunked encoding of the toS3Callback data
+static size_t curl_read_streaming(char *ptr, int len, Request *request)
+{
+    int total = 0;
+
+    while (total < len) {
+        if (request->chunkPosition == request->chunkLength) {
+            if (request->finalChunkEncoded) {
+                break;
+            }
+            if (!encode_next_chunk(request)) {
+                return CURL_READFUNC_ABORT;
+            }
+        }
+        int toCopy = request->chunkLength - request->chunkPosition;
+        if (toCopy > (len - total)) {
+            toCopy = len - total;
+        }
+        memcpy(&(ptr[total]), &(request->chunkBuffer[request->chunkPosition]),
+               toCopy);
+        request->chunkPosition += toCopy;
+        total += toCopy;
+    }
+
+    return total;
+}
+
+
 static size_t curl_read_func(void *ptr, size_t size, size_t nmemb, void *data)
 {
     Request *request = (Request *) data;
 
     int len = size * nmemb;
 
+    request_trace(request, S3TraceEventFirstByteSent);
+
     // CURL may call this function before response headers are available,
     // so don't assume response headers are available and attempt to parse
     // them.  Leave that to curl_write_func, which is guaranteed to be called
@@ -214,6 +344,10 @@ static size_t curl_read_func(void *ptr, size_t size, size_t nmemb, void *data)
         return CURL_READFUNC_ABORT;
     }
 
+    if (request->streamingSignature) {
+        return curl_read_streaming((char *) ptr, len, request);
+    }
+
     // If there is no data callback, or the data callback has already returned
     // contentLength bytes, return 0;
     if (!request->toS3Callback || !request->toS3CallbackBytesRemaining) {
@@ -425,8 +559,16 @@ static S3Status compose_amz_headers(const RequestParams *params,
             snprintf(&(values->payloadHash[i * 2]), 3, "%02x", md[i]);
         }
     }
+    else if (!forceUnsignedPayload && use_streaming_signature(params)) {
+        // The payload is signed chunk by chunk as it is sent
+        strcpy(values->payloadHash, "STREAMING-AWS4-HMAC-SHA256-PAYLOAD");
+        char decodedLength[64];
+        snprintf(decodedLength, sizeof(decodedLength), "%llu",
+                 (unsigned long long) params->toS3CallbackTotalSize);
+        append_amz_header(values, 0, "x-amz-decoded-content-length",
+                          decodedLength);
+    }
     else {
-        // TODO: figure out how to manage signed payloads
         strcpy(values->payloadHash, "UNSIGNED-PAYLOAD");
     }
 
@@ -557,6 +699,22 @@ static S3Status compose_standard_headers(const RequestParams *params,
                   contentEncodingHeader, S3StatusBadContentEncoding,
                   S3StatusContentEncodingTooLong);
 
+    // aws-chunked must be the first Content-Encoding, S3 removes it from
+    // what it stores
+    if (use_streaming_signature(params)) {
+        const char *encoding = values->contentEncodingHeader[0] ?
+            &(values->contentEncodingHeader[sizeof("Content-Encoding: ") - 1]) :
+            0;
+        char header[sizeof(values->contentEncodingHeader)];
+        int len = snprintf(header, sizeof(header),
+                           "Content-Encoding: aws-chunked%s%s",
+                           encoding ? "," : "", encoding ? encoding : "");
+        if (len >= (int) sizeof(header)) {
+            return S3StatusContentEncodingTooLong;
+        }
+        strcpy(values->contentEncodingHeader, header);
+    }
+
     // Expires
     if (params->putProperties && (params->putProperties->expires >= 0)) {
         time_t t = (time_t) params->putProperties->expires;
@@ -685,7 +843,7 @@ static void kv_gnome_sort(const char **values, int size, char delim)
 
 
 // Canonicalizes the signature headers into the canonicalizedSignatureHeaders buffer
-static void canonicalize_signature_headers(RequestComputedValues *values)
+void canonicalize_signature_headers(RequestComputedValues *values)
 {
     // Make a copy of the headers that will be sorted
     const char *sortedHeaders[S3_MAX_METADATA_COUNT + 3];
@@ -806,7 +964,7 @@ static void canonicalize_resource(const S3BucketContext *context,
 }
 
 
-static void sort_query_string(const char *queryString, char *result)
+void sort_query_string(const char *queryString, char *result)
 {
 #ifdef SIGNATURE_DEBUG
     printf("\n--\nsort_and_urlencode\nqueryString: %s\n", queryString);
@@ -930,8 +1088,8 @@ static const char *http_request_type_to_verb(HttpRequestType requestType)
 
 
 // Composes the Authorization header for the request
-static S3Status compose_auth_header(const RequestParams *params,
-                                    RequestComputedValues *values)
+S3Status compose_auth_header(const RequestParams *params,
+                             RequestComputedValues *values)
 {
     const char *httpMethod = http_request_type_to_verb(params->httpRequestType);
     int canonicalRequestLen = strlen(httpMethod) + 1 +
@@ -981,8 +1139,8 @@ static S3Status compose_auth_header(const RequestParams *params,
     if (params->bucketContext.authRegion) {
         awsRegion = params->bucketContext.authRegion;
     }
-    char scope[SIGNATURE_SCOPE_SIZE + 1];
-    snprintf(scope, sizeof(scope), "%.8s/%s/s3/aws4_request",
+    char *scope = values->signatureScope;
+    snprintf(scope, sizeof(values->signatureScope), "%.8s/%s/s3/aws4_request",
              values->requestDateISO8601, awsRegion);
 
     char stringToSign[17 + 17 + SIGNATURE_SCOPE_SIZE + 1
@@ -994,48 +1152,17 @@ static S3Status compose_auth_header(const RequestParams *params,
     printf("--\nString to Sign:\n%s\n", stringToSign);
 #endif
 
-    const char *secretAccessKey = params->bucketContext.secretAccessKey;
-    char accessKey[strlen(secretAccessKey) + 5];
-    snprintf(accessKey, sizeof(accessKey), "AWS4%s", secretAccessKey);
-
-#ifdef __APPLE__
-    unsigned char dateKey[S3_SHA256_DIGEST_LENGTH];
-    CCHmac(kCCHmacAlgSHA256, accessKey, strlen(accessKey),
-           values->requestDateISO8601, 8, dateKey);
-    unsigned char dateRegionKey[S3_SHA256_DIGEST_LENGTH];
-    CCHmac(kCCHmacAlgSHA256, dateKey, S3_SHA256_DIGEST_LENGTH, awsRegion,
-           strlen(awsRegion), dateRegionKey);
-    unsigned char dateRegionServiceKey[S3_SHA256_DIGEST_LENGTH];
-    CCHmac(kCCHmacAlgSHA256, dateRegionKey, S3_SHA256_DIGEST_LENGTH, "s3", 2,
-           dateRegionServiceKey);
-    unsigned char signingKey[S3_SHA256_DIGEST_LENGTH];
-    CCHmac(kCCHmacAlgSHA256, dateRegionServiceKey, S3_SHA256_DIGEST_LENGTH,
-           "aws4_request", strlen("aws4_request"), signingKey);
+    unsigned char *signingKey = values->signingKey;
+    signing_key_cache_get(params->bucketContext.accessKeyId,
+                          params->bucketContext.secretAccessKey,
+                          values->requestDateISO8601, awsRegion, signingKey);
 
     unsigned char finalSignature[S3_SHA256_DIGEST_LENGTH];
-    CCHmac(kCCHmacAlgSHA256, signingKey, S3_SHA256_DIGEST_LENGTH, stringToSign,
+#ifdef __APPLE__
+    CCHmac(kCCHmacAlgSHA256, signingKey, SIGNING_KEY_SIZE, stringToSign,
             strlen(stringToSign), finalSignature);
 #else
-    const EVP_MD *sha256evp = EVP_sha256();
-    unsigned char dateKey[S3_SHA256_DIGEST_LENGTH];
-    HMAC(sha256evp, accessKey, strlen(accessKey),
-         (const unsigned char*) values->requestDateISO8601, 8, dateKey,
-         NULL);
-    unsigned char dateRegionKey[S3_SHA256_DIGEST_LENGTH];
-    HMAC(sha256evp, dateKey, S3_SHA256_DIGEST_LENGTH,
-         (const unsigned char*) awsRegion, strlen(awsRegion), dateRegionKey,
-         NULL);
-    unsigned char dateRegionServiceKey[S3_SHA256_DIGEST_LENGTH];
-    HMAC(sha256evp, dateRegionKey, S3_SHA256_DIGEST_LENGTH,
-         (const unsigned char*) "s3", 2, dateRegionServiceKey, NULL);
-    unsigned char signingKey[S3_SHA256_DIGEST_LENGTH];
-    HMAC(sha256evp, dateRegionServiceKey, S3_SHA256_DIGEST_LENGTH,
-         (const unsigned char*) "aws4_request", strlen("aws4_request"),
-         signingKey,
-         NULL);
-
-    unsigned char finalSignature[S3_SHA256_DIGEST_LENGTH];
-    HMAC(sha256evp, signingKey, S3_SHA256_DIGEST_LENGTH,
+    HMAC(EVP_sha256(), signingKey, SIGNING_KEY_SIZE,
          (const unsigned char*) stringToSign, strlen(stringToSign),
          finalSignature, NULL);
 #endif
@@ -1127,10 +1254,11 @@ static S3Status compose_uri(char *buffer, int bufferSize,
     return S3StatusOK;
 }
 
-// Sets up the curl handle given the completely computed RequestParams
-static S3Status setup_curl(Request *request,
-                           const RequestParams *params,
-                           const RequestComputedValues *values)
+// Sets up the options of a newly created curl handle that are the same for
+// every request that it will perform.  Handles are recycled via the request
+// stack without being reset, so that they keep their live connections; any
+// option that can vary between requests must instead be set by setup_curl.
+static S3Status setup_curl_handle(Request *request)
 {
     CURLcode status;
 
@@ -1146,6 +1274,12 @@ static S3Status setup_curl(Request *request,
     // Set private data to request for the benefit of S3RequestContext
     curl_easy_setopt_safe(CURLOPT_PRIVATE, request);
 
+    // Share DNS lookups, TLS sessions and possibly connections with all
+    // other handles
+    if (connection_share_attach(request->curl) != S3StatusOK) {
+        return S3StatusFailedToInitializeRequest;
+    }
+
     // Set header callback and data
     curl_easy_setopt_safe(CURLOPT_HEADERDATA, request);
     curl_easy_setopt_safe(CURLOPT_HEADERFUNCTION, &curl_header_func);
@@ -1158,6 +1292,12 @@ static S3Status setup_curl(Request *request,
     curl_easy_setopt_safe(CURLOPT_WRITEFUNCTION, &curl_write_func);
     curl_easy_setopt_safe(CURLOPT_WRITEDATA, request);
 
+#if LIBCURL_VERSION_NUM >= 0x075000 /* 7.80.0 */
+    // Set the callback reporting that the connection has been acquired
+    curl_easy_setopt_safe(CURLOPT_PREREQFUNCTION, &curl_prereq_func);
+    curl_easy_setopt_safe(CURLOPT_PREREQDATA, request);
+#endif
+
     // Ask curl to parse the Last-Modified header.  This is easier than
     // parsing it ourselves.
     curl_easy_setopt_safe(CURLOPT_FILETIME, 1);
@@ -1183,10 +1323,6 @@ static S3Status setup_curl(Request *request,
     // Don't use Curl's 'netrc' feature
     curl_easy_setopt_safe(CURLOPT_NETRC, CURL_NETRC_IGNORED);
 
-    // Don't verify S3's certificate unless S3_INIT_VERIFY_PEER is set.
-    // The request_context may be set to override this
-    curl_easy_setopt_safe(CURLOPT_SSL_VERIFYPEER, verifyPeer);
-
     // Follow any redirection directives that S3 sends
     curl_easy_setopt_safe(CURLOPT_FOLLOWLOCATION, 1);
 
@@ -1203,10 +1339,25 @@ static S3Status setup_curl(Request *request,
     curl_easy_setopt_safe(CURLOPT_LOW_SPEED_LIMIT, 1024);
     curl_easy_setopt_safe(CURLOPT_LOW_SPEED_TIME, 15);
 
+    return S3StatusOK;
+}
+
 
-    if (params->timeoutMs > 0) {
-        curl_easy_setopt_safe(CURLOPT_TIMEOUT_MS, params->timeoutMs);
-    }
+// Sets up the curl handle given the completely computed RequestParams.
+// Every option set here must be set for every request, since the handle
+// may still hold the value set by its previous request.
+static S3Status setup_curl(Request *request,
+                           const RequestParams *params,
+                           const RequestComputedValues *values)
+{
+    CURLcode status;
+
+    // Don't verify S3's certificate unless S3_INIT_VERIFY_PEER is set.
+    // The request_context may be set to override this
+    curl_easy_setopt_safe(CURLOPT_SSL_VERIFYPEER, verifyPeer);
+
+    curl_easy_setopt_safe(CURLOPT_TIMEOUT_MS,
+                          (params->timeoutMs > 0) ? params->timeoutMs : 0);
 
 
     // Append standard headers
@@ -1219,9 +1370,13 @@ static S3Status setup_curl(Request *request,
     // Would use CURLOPT_INFILESIZE_LARGE, but it is buggy in libcurl
     if ((params->httpRequestType == HttpRequestTypePUT) ||
         (params->httpRequestType == HttpRequestTypePOST)) {
+        uint64_t contentLength = params->toS3CallbackTotalSize;
+        if (use_streaming_signature(params)) {
+            contentLength = streaming_content_length(contentLength);
+        }
         char header[256];
         snprintf(header, sizeof(header), "Content-Length: %llu",
-                 (unsigned long long) params->toS3CallbackTotalSize);
+                 (unsigned long long) contentLength);
         request->headers = curl_slist_append(request->headers, header);
         request->headers = curl_slist_append(request->headers,
                                              "Transfer-Encoding:");
@@ -1258,7 +1413,10 @@ static S3Status setup_curl(Request *request,
     // Set URI
     curl_easy_setopt_safe(CURLOPT_URL, request->uri);
 
-    // Set request type.
+    // Set request type, first undoing whatever the previous request set.
+    // CURLOPT_HTTPGET also turns off CURLOPT_NOBODY and CURLOPT_UPLOAD.
+    curl_easy_setopt_safe(CURLOPT_HTTPGET, 1);
+    curl_easy_setopt_safe(CURLOPT_CUSTOMREQUEST, (char *) 0);
     switch (params->httpRequestType) {
     case HttpRequestTypeHEAD:
         curl_easy_setopt_safe(CURLOPT_NOBODY, 1);
@@ -1289,37 +1447,50 @@ static void request_deinitialize(Request *request)
         curl_slist_free_all(request->headers);
     }
 
+    if (request->chunkBuffer) {
+        free(request->chunkBuffer);
+    }
+
     error_parser_deinitialize(&(request->errorParser));
 
-    // curl_easy_reset prevents connections from being re-used for some
-    // reason.  This makes HTTP Keep-Alive meaningless and is very bad for
-    // performance.  But it is necessary to allow curl to work properly.
-    // xxx todo figure out why
-    curl_easy_reset(request->curl);
+    // The curl handle is deliberately not reset, as that would discard its
+    // connection (and therefore HTTP Keep-Alive) along with all of the
+    // options set up by setup_curl_handle.  setup_curl sets every option
+    // which varies between requests.
 }
 
 
-static S3Status request_get(const RequestParams *params,
-                            const RequestComputedValues *values,
-                            Request **reqReturn)
+// Copies as much of src, up to the first of any of the characters of stop if
+// not 0, as fits into dest
+static void copy_stats_string(char *dest, int destSize, const char *src,
+                              const char *stop)
 {
-    Request *request = 0;
-
-    // Try to get one from the request stack.  We hold the lock for the
-    // shortest time possible here.
-    pthread_mutex_lock(&requestStackMutexG);
+    if (!src) {
+        dest[0] = 0;
+        return;
+    }
 
-    if (requestStackCountG) {
-        request = requestStackG[--requestStackCountG];
+    int len = stop ? strcspn(src, stop) : strlen(src);
+    if (len >= destSize) {
+        len = destSize - 1;
     }
+    memcpy(dest, src, len);
+    dest[len] = 0;
+}
 
-    pthread_mutex_unlock(&requestStackMutexG);
+
+static S3Status request_get(const RequestParams *params,
+                            const RequestComputedValues *values,
+                            Request **reqReturn)
+{
+    // Try to get one from the request pool
+    Request *request = request_pool_get();
 
     // If we got one, deinitialize it for re-use
     if (request) {
         request_deinitialize(request);
     }
-    // Else there wasn't one available in the request stack, so create one
+    // Else there wasn't one available in the request pool, so create one
     else {
         if (!(request = (Request *) malloc(sizeof(Request)))) {
             return S3StatusOutOfMemory;
@@ -1328,6 +1499,11 @@ static S3Status request_get(const RequestParams *params,
             free(request);
             return S3StatusFailedToInitializeRequest;
         }
+        if (setup_curl_handle(request) != S3StatusOK) {
+            curl_easy_cleanup(request->curl);
+            free(request);
+            return S3StatusFailedToInitializeRequest;
+        }
     }
 
     // Initialize the request
@@ -1338,11 +1514,17 @@ static S3Status request_get(const RequestParams *params,
     // an error occurs
     request->status = S3StatusOK;
 
+    // No response yet
+    request->httpResponseCode = 0;
+
     S3Status status;
 
     // Start out with no headers
     request->headers = 0;
 
+    // And no chunk buffer
+    request->chunkBuffer = 0;
+
     // Compute the URL
     if ((status = compose_uri
          (request->uri, sizeof(request->uri),
@@ -1366,6 +1548,26 @@ static S3Status request_get(const RequestParams *params,
 
     request->toS3CallbackBytesRemaining = params->toS3CallbackTotalSize;
 
+    request->streamingSignature = use_streaming_signature(params);
+
+    if (request->streamingSignature) {
+        if (!(request->chunkBuffer = (char *) malloc
+              (CHUNK_HEADER_MAX_SIZE + STREAMING_CHUNK_SIZE + 2))) {
+            curl_slist_free_all(request->headers);
+            curl_easy_cleanup(request->curl);
+            free(request);
+            return S3StatusOutOfMemory;
+        }
+        // The first chunk is signed with the request signature as the seed
+        memcpy(request->signingKey, values->signingKey, SIGNING_KEY_SIZE);
+        strcpy(request->requestDateISO8601, values->requestDateISO8601);
+        strcpy(request->signatureScope, values->signatureScope);
+        strcpy(request->previousSignatureHex, values->requestSignatureHex);
+        request->chunkLength = 0;
+        request->chunkPosition = 0;
+        request->finalChunkEncoded = 0;
+    }
+
     request->fromS3Callback = params->fromS3Callback;
 
     request->completeCallback = params->completeCallback;
@@ -1376,6 +1578,33 @@ static S3Status request_get(const RequestParams *params,
 
     request->propertiesCallbackMade = 0;
 
+    request->connectionRecorded = 0;
+
+    request->tlsSessionResumed = 0;
+
+    request->httpRequestType = params->httpRequestType;
+
+    request->operation = metrics_operation(params);
+
+    // Stats are reported to metrics even without a stats callback, so the
+    // strings are always initialized; they are only filled in for the
+    // callback
+    request->statsBucketName[0] = 0;
+    request->statsKey[0] = 0;
+    request->statsSubResource[0] = 0;
+    if (requestStatsCallbackG) {
+        copy_stats_string(request->statsBucketName,
+                          sizeof(request->statsBucketName),
+                          params->bucketContext.bucketName, 0);
+        copy_stats_string(request->statsKey, sizeof(request->statsKey),
+                          params->key, 0);
+        // Only the name of the sub-resource, and not its value or any
+        // further parameters, identifies the kind of request
+        copy_stats_string(request->statsSubResource,
+                          sizeof(request->statsSubResource),
+                          params->subResource, "=&");
+    }
+
     error_parser_initialize(&(request->errorParser));
 
     *reqReturn = request;
@@ -1394,21 +1623,8 @@ static void request_destroy(Request *request)
 
 static void request_release(Request *request)
 {
-    pthread_mutex_lock(&requestStackMutexG);
-
-    // If the request stack is full, destroy this one
-    if (requestStackCountG == REQUEST_STACK_SIZE) {
-        pthread_mutex_unlock(&requestStackMutexG);
-        request_destroy(request);
-    }
-    // Else put this one at the front of the request stack; we do this because
-    // we want the most-recently-used curl handle to be re-used on the next
-    // request, to maximize our chances of re-using a TCP connection before it
-    // times out
-    else {
-        requestStackG[requestStackCountG++] = request;
-        pthread_mutex_unlock(&requestStackMutexG);
-    }
+    // The request pool destroys it if there is no room for it
+    request_pool_release(request);
 }
 
 
@@ -1428,12 +1644,32 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
 
     if (snprintf(defaultHostNameG, S3_MAX_HOSTNAME_SIZE,
                  "%s", defaultHostName) >= S3_MAX_HOSTNAME_SIZE) {
+        curl_global_cleanup();
         return S3StatusUriTooLong;
     }
 
-    pthread_mutex_init(&requestStackMutexG, 0);
+    signing_key_cache_initialize();
 
-    requestStackCountG = 0;
+    metrics_initialize(flags);
+
+    // If initialization fails partway, whatever was already initialized is
+    // deinitialized again, so that S3_initialize() can be retried
+    S3Status status = connection_share_initialize(flags);
+    if (status != S3StatusOK) {
+        connection_share_deinitialize();
+        metrics_deinitialize();
+        signing_key_cache_deinitialize();
+        curl_global_cleanup();
+        return status;
+    }
+
+    if ((status = request_pool_initialize(&request_destroy)) != S3StatusOK) {
+        connection_share_deinitialize();
+        metrics_deinitialize();
+        signing_key_cache_deinitialize();
+        curl_global_cleanup();
+        return status;
+    }
 
     if (!userAgentInfo || !*userAgentInfo) {
         userAgentInfo = "Unknown";
@@ -1460,17 +1696,21 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
 
 void request_api_deinitialize()
 {
-    pthread_mutex_destroy(&requestStackMutexG);
+    signing_key_cache_deinitialize();
 
     xmlCleanupParser();
-    while (requestStackCountG--) {
-        request_destroy(requestStackG[requestStackCountG]);
-    }
+
+    request_pool_deinitialize();
+
+    // Must come after all curl handles have been destroyed
+    connection_share_deinitialize();
+
+    metrics_deinitialize();
 }
 
-static S3Status setup_request(const RequestParams *params,
-                              RequestComputedValues *computed,
-                              int forceUnsignedPayload)
+S3Status setup_request(const RequestParams *params,
+                       RequestComputedValues *computed,
+                       int forceUnsignedPayload)
 {
     S3Status status;
 
@@ -1529,17 +1769,88 @@ static S3Status setup_request(const RequestParams *params,
     return status;
 }
 
+static int64_t trace_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((int64_t) ts.tv_sec) * 1000000000LL) + ts.tv_nsec;
+}
+
+
+// Reports a trace event to the trace callback
+static void trace(S3TraceEventType type, uint64_t requestId,
+                  S3Operation operation, HttpRequestType httpRequestType,
+                  S3Status status, int httpResponseCode)
+{
+    S3TraceEvent event;
+
+    event.type = type;
+    event.requestId = requestId;
+    event.timeNs = trace_time_ns();
+    event.operation = operation;
+    event.method = http_request_type_to_verb(httpRequestType);
+    event.status = status;
+    event.httpResponseCode = httpResponseCode;
+
+    (*requestTraceCallbackG)(&event, requestTraceCallbackDataG);
+}
+
+
+void request_trace_event(Request *request, S3TraceEventType type)
+{
+    if ((type < S3TraceEventConnectionAcquired) ||
+        (type > S3TraceEventBodyComplete)) {
+        trace(type, request->traceId, request->operation,
+              request->httpRequestType, request->status,
+              request->httpResponseCode);
+        return;
+    }
+
+    // A transfer which ended without a response has no body to complete
+    if ((type == S3TraceEventBodyComplete) &&
+        !(request->traceEvents & (1 << S3TraceEventHeadersReceived))) {
+        return;
+    }
+
+    int event;
+    for (event = S3TraceEventConnectionAcquired; event <= (int) type;
+         event++) {
+        if (!(request->traceEvents & (1 << event))) {
+            request->traceEvents |= (1 << event);
+            trace((S3TraceEventType) event, request->traceId,
+                  request->operation, request->httpRequestType,
+                  request->status, request->httpResponseCode);
+        }
+    }
+}
+
+
 void request_perform(const RequestParams *params, S3RequestContext *context)
 {
     Request *request;
     S3Status status;
     int verifyPeerRequest = verifyPeer;
     CURLcode curlstatus;
+    uint64_t traceId = 0;
+    S3Operation traceOperation = S3OperationOther;
 
 #define return_status(status)                                           \
     (*(params->completeCallback))(status, 0, params->callbackData);     \
+    if (traceId) {                                                      \
+        trace(S3TraceEventFinished, traceId, traceOperation,            \
+              params->httpRequestType, status, 0);                      \
+    }                                                                   \
     return
 
+    // Until there is a Request, trace events are reported straight from
+    // the params
+    if (requestTraceCallbackG) {
+        traceId = __sync_add_and_fetch(&requestTraceIdG, 1);
+        traceOperation = metrics_operation(params);
+        trace(S3TraceEventCreated, traceId, traceOperation,
+              params->httpRequestType, S3StatusOK, 0);
+    }
+
     // These will hold the computed values
     RequestComputedValues computed;
 
@@ -1547,10 +1858,17 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
         return_status(status);
     }
 
+    if (traceId) {
+        trace(S3TraceEventSigned, traceId, traceOperation,
+              params->httpRequestType, S3StatusOK, 0);
+    }
+
     // Get an initialized Request structure now
     if ((status = request_get(params, &computed, &request)) != S3StatusOK) {
         return_status(status);
     }
+    request->traceId = traceId;
+    request->traceEvents = 0;
     if (context && context->verifyPeerSet) {
         verifyPeerRequest = context->verifyPeerSet;
     }
@@ -1564,6 +1882,11 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
         }
     }
 
+    // From here on, the request is always finished by request_finish()
+    if (metrics_enabled()) {
+        metrics_request_started(request->operation);
+    }
+
     // If a RequestContext was provided, add the request to the curl multi
     if (context) {
         CURLMcode code = curl_multi_add_handle(context->curlm, request->curl);
@@ -1577,6 +1900,7 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
             else {
                 context->requests = request->next = request->prev = request;
             }
+            request_trace(request, S3TraceEventQueued);
         }
         else {
             if (request->status == S3StatusOK) {
@@ -1593,6 +1917,8 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
             request->status = request_curl_code_to_status(code);
         }
 
+        request_trace(request, S3TraceEventBodyComplete);
+
         // Finish the request, ensuring that all callbacks have been made, and
         // also releases the request
         request_finish(request);
@@ -1600,6 +1926,108 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
 }
 
 
+// Returns the time, in microseconds since the start of a request, at which
+// one of its phases ended, or 0 if the phase did not take place
+#if LIBCURL_VERSION_NUM >= 0x073d00 /* 7.61.0 */
+#define get_request_time(curl, phase, usReturn)                         \
+    do {                                                                \
+        curl_off_t us;                                                  \
+        usReturn = (curl_easy_getinfo(curl, CURLINFO_##phase##_TIME_T,  \
+                                      &us) == CURLE_OK) ? us : 0;       \
+    } while (0)
+#else
+#define get_request_time(curl, phase, usReturn)                         \
+    do {                                                                \
+        double seconds;                                                 \
+        usReturn = (curl_easy_getinfo(curl, CURLINFO_##phase##_TIME,    \
+                                      &seconds) == CURLE_OK) ?          \
+            (int64_t) (seconds * 1000000) : 0;                          \
+    } while (0)
+#endif
+
+
+// Returns one of the byte counts of a request
+#if LIBCURL_VERSION_NUM >= 0x073700 /* 7.55.0 */
+#define get_request_size(curl, size, bytesReturn)                       \
+    do {                                                                \
+        curl_off_t bytes;                                               \
+        bytesReturn = (curl_easy_getinfo(curl, CURLINFO_##size##_T,     \
+                                         &bytes) == CURLE_OK) ?         \
+            bytes : 0;                                                  \
+    } while (0)
+#else
+#define get_request_size(curl, size, bytesReturn)                       \
+    do {                                                                \
+        double bytes;                                                   \
+        bytesReturn = (curl_easy_getinfo(curl, CURLINFO_##size,         \
+                                         &bytes) == CURLE_OK) ?         \
+            (uint64_t) bytes : 0;                                       \
+    } while (0)
+#endif
+
+
+// Returns the length of the phase of a request between times from and to,
+// either of which is 0 if its phase did not take place
+static int64_t phase_time(int64_t from, int64_t to)
+{
+    return (to > from) ? (to - from) : 0;
+}
+
+
+static void report_stats(Request *request)
+{
+    CURL *curl = request->curl;
+    S3RequestStats stats;
+
+    stats.method = http_request_type_to_verb(request->httpRequestType);
+    stats.bucketName =
+        request->statsBucketName[0] ? request->statsBucketName : 0;
+    stats.key = request->statsKey[0] ? request->statsKey : 0;
+    stats.subResource =
+        request->statsSubResource[0] ? request->statsSubResource : 0;
+    stats.operation = request->operation;
+    stats.status = request->status;
+    stats.httpResponseCode = request->httpResponseCode;
+
+    // curl gives the time at which each phase ended, from the start of the
+    // request
+    int64_t nameLookup, connect, tlsHandshake, preTransfer, firstByte, total;
+    get_request_time(curl, NAMELOOKUP, nameLookup);
+    get_request_time(curl, CONNECT, connect);
+    get_request_time(curl, APPCONNECT, tlsHandshake);
+    get_request_time(curl, PRETRANSFER, preTransfer);
+    get_request_time(curl, STARTTRANSFER, firstByte);
+    get_request_time(curl, TOTAL, total);
+
+    stats.nameLookupUs = nameLookup;
+    stats.connectUs = connect ? phase_time(nameLookup, connect) : 0;
+    stats.tlsHandshakeUs =
+        tlsHandshake ? phase_time(connect, tlsHandshake) : 0;
+    stats.firstByteUs = firstByte ? phase_time(preTransfer, firstByte) : 0;
+    stats.transferUs = firstByte ? phase_time(firstByte, total) : 0;
+    stats.totalUs = total;
+
+    get_request_size(curl, SIZE_UPLOAD, stats.bytesSent);
+    get_request_size(curl, SIZE_DOWNLOAD, stats.bytesReceived);
+
+    long connects;
+    if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects) !=
+        CURLE_OK) {
+        connects = 0;
+    }
+    stats.connectionReused = (!connects && request->httpResponseCode);
+    stats.tlsSessionResumed = request->tlsSessionResumed;
+
+    if (metrics_enabled()) {
+        metrics_request_finished(request->httpRequestType, &stats);
+    }
+
+    if (requestStatsCallbackG) {
+        (*requestStatsCallbackG)(&stats, requestStatsCallbackDataG);
+    }
+}
+
+
 void request_finish(Request *request)
 {
     // If we haven't detected this already, we now know that the headers are
@@ -1672,10 +2100,19 @@ void request_finish(Request *request)
         }
     }
 
+    connection_share_record_finished(request->curl,
+                                     request->httpResponseCode != 0);
+
+    if (requestStatsCallbackG || metrics_enabled()) {
+        report_stats(request);
+    }
+
     (*(request->completeCallback))
         (request->status, &(request->errorParser.s3ErrorDetails),
          request->callbackData);
 
+    request_trace(request, S3TraceEventFinished);
+
     request_release(request);
 }
 
@@ -1752,3 +2189,18 @@ S3Status S3_generate_authenticated_query_string
                        bucketContext, computed.urlEncodedKey, resource,
                        queryParams);
 }
+
+
+void S3_set_request_stats_callback(S3RequestStatsCallback *callback,
+                                   void *callbackData)
+{
+    requestStatsCallbackG = callback;
+    requestStatsCallbackDataG = callbackData;
+}
+
+
+void S3_set_trace_callback(S3TraceCallback *callback, void *callbackData)
+{
+    requestTraceCallbackG = callback;
+    requestTraceCallbackDataG = callbackData;
+}
@@ -25,13 +25,201 @@
  ************************************************************************** **/
 
 #include <curl/curl.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <sys/select.h>
+#include <time.h>
 #include "request.h"
 #include "request_context.h"
 
+#ifdef __linux__
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// Maximum number of epoll events handled per epoll_wait call
+#define EPOLL_MAX_EVENTS 64
+#endif
+
+
+int64_t request_context_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((int64_t) ts.tv_sec) * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+// S3RequestContextModeExternal only: tells the caller's event loop when
+// S3_process_request_context_timeout is next to be called, which is when
+// either curl's timeout expires or the first timer is due
+static void external_set_timer(S3RequestContext *requestContext)
+{
+    (*(requestContext->timerCallback))
+        (S3_get_request_context_timeout(requestContext),
+         requestContext->callbackData);
+}
+
+
+// Called by curl whenever the timeout that it wants applied to
+// curl_multi_socket_action changes
+static int timer_callback(CURLM *curlm, long timeoutMs, void *userp)
+{
+    (void) curlm;
+
+    S3RequestContext *requestContext = (S3RequestContext *) userp;
+
+    requestContext->timeoutDeadlineMs =
+        (timeoutMs < 0) ? -1 : (request_context_now_ms() + timeoutMs);
+
+    if (requestContext->mode == S3RequestContextModeExternal) {
+        external_set_timer(requestContext);
+    }
+
+    return 0;
+}
+
+
+void request_context_add_timer(S3RequestContext *requestContext,
+                               RequestContextTimer *timer)
+{
+    // Timers due at the same time are called back in the order added
+    RequestContextTimer **prev = &(requestContext->timers);
+    while (*prev && ((*prev)->dueMs <= timer->dueMs)) {
+        prev = &((*prev)->next);
+    }
+    timer->next = *prev;
+    *prev = timer;
+    requestContext->timersCount++;
+
+    if ((requestContext->mode == S3RequestContextModeExternal) &&
+        (requestContext->timers == timer)) {
+        external_set_timer(requestContext);
+    }
+}
+
+
+void request_context_remove_timer(S3RequestContext *requestContext,
+                                  RequestContextTimer *timer)
+{
+    RequestContextTimer **prev = &(requestContext->timers);
+    while (*prev) {
+        if (*prev == timer) {
+            *prev = timer->next;
+            requestContext->timersCount--;
+            return;
+        }
+        prev = &((*prev)->next);
+    }
+}
+
+
+// Makes the callbacks of the timers which are due, and returns the number of
+// callbacks made
+static int run_timers(S3RequestContext *requestContext)
+{
+    int64_t nowMs = request_context_now_ms();
+    int count = 0;
+
+    while (requestContext->timers &&
+           (requestContext->timers->dueMs <= nowMs)) {
+        RequestContextTimer *timer = requestContext->timers;
+        requestContext->timers = timer->next;
+        requestContext->timersCount--;
+        (*(timer->callback))(S3StatusOK, timer->data);
+        count++;
+    }
+
+    return count;
+}
+
+
+// Called by curl whenever the events of interest on one of its sockets
+// change; passes them on to the caller's event loop
+static int external_socket_callback(CURL *curl, curl_socket_t s, int what,
+                                    void *userp, void *socketp)
+{
+    (void) curl;
+    (void) socketp;
+
+    S3RequestContext *requestContext = (S3RequestContext *) userp;
+
+    int events = 0;
+
+    if (what != CURL_POLL_REMOVE) {
+        if (what & CURL_POLL_IN) {
+            events |= S3_SOCKET_EVENT_READ;
+        }
+        if (what & CURL_POLL_OUT) {
+            events |= S3_SOCKET_EVENT_WRITE;
+        }
+    }
+
+    return ((*(requestContext->socketCallback))
+            (s, events, requestContext->callbackData) ? -1 : 0);
+}
+
+
+#ifdef __linux__
+
+// Called by curl whenever the events of interest on one of its sockets
+// change; keeps the request context's epoll instance in step
+static int epoll_socket_callback(CURL *curl, curl_socket_t s, int what,
+                                 void *userp, void *socketp)
+{
+    (void) curl;
+
+    S3RequestContext *requestContext = (S3RequestContext *) userp;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.data.fd = s;
+
+    if (what == CURL_POLL_REMOVE) {
+        // Ignore errors; the socket may already have been closed, which
+        // removes it from the epoll instance anyway
+        epoll_ctl(requestContext->epollFd, EPOLL_CTL_DEL, s, &event);
+        return 0;
+    }
+
+    if (what & CURL_POLL_IN) {
+        event.events |= EPOLLIN;
+    }
+    if (what & CURL_POLL_OUT) {
+        event.events |= EPOLLOUT;
+    }
+
+    // socketp is nonzero once the socket has been added to the epoll
+    // instance
+    if (socketp) {
+        if (epoll_ctl(requestContext->epollFd, EPOLL_CTL_MOD, s, &event)) {
+            return -1;
+        }
+    }
+    else {
+        if (epoll_ctl(requestContext->epollFd, EPOLL_CTL_ADD, s, &event)) {
+            return -1;
+        }
+        curl_multi_assign(requestContext->curlm, s, requestContext);
+    }
+
+    return 0;
+}
+
+#endif /* __linux__ */
+
 
 S3Status S3_create_request_context(S3RequestContext **requestContextReturn)
+{
+    return S3_create_request_context_ex(requestContextReturn,
+                                        S3RequestContextModeSelect);
+}
+
+
+static S3Status create_request_context
+    (S3RequestContext **requestContextReturn, S3RequestContextMode mode,
+     S3SocketCallback *socketCallback, S3TimerCallback *timerCallback,
+     void *callbackData)
 {
     *requestContextReturn = 
         (S3RequestContext *) malloc(sizeof(S3RequestContext));
@@ -48,11 +236,81 @@ S3Status S3_create_request_context(S3RequestContext **requestContextReturn)
     (*requestContextReturn)->requests = 0;
     (*requestContextReturn)->verifyPeer = 0;
     (*requestContextReturn)->verifyPeerSet = 0;
+    (*requestContextReturn)->mode = mode;
+    (*requestContextReturn)->runningCount = 0;
+    (*requestContextReturn)->timeoutDeadlineMs = -1;
+    (*requestContextReturn)->epollFd = -1;
+    (*requestContextReturn)->socketCallback = socketCallback;
+    (*requestContextReturn)->timerCallback = timerCallback;
+    (*requestContextReturn)->callbackData = callbackData;
+    (*requestContextReturn)->timers = 0;
+    (*requestContextReturn)->timersCount = 0;
+
+    if (mode == S3RequestContextModeSelect) {
+        return S3StatusOK;
+    }
+
+    CURLM *curlm = (*requestContextReturn)->curlm;
+
+    curl_multi_setopt(curlm, CURLMOPT_TIMERFUNCTION, &timer_callback);
+    curl_multi_setopt(curlm, CURLMOPT_TIMERDATA, *requestContextReturn);
+    curl_multi_setopt(curlm, CURLMOPT_SOCKETDATA, *requestContextReturn);
+
+    if (mode == S3RequestContextModeExternal) {
+        curl_multi_setopt(curlm, CURLMOPT_SOCKETFUNCTION,
+                          &external_socket_callback);
+        return S3StatusOK;
+    }
+
+#ifdef __linux__
+    if (((*requestContextReturn)->epollFd = epoll_create(1)) == -1) {
+        curl_multi_cleanup(curlm);
+        free(*requestContextReturn);
+        return ((errno == ENOMEM) ? S3StatusOutOfMemory :
+                S3StatusInternalError);
+    }
+
+    curl_multi_setopt(curlm, CURLMOPT_SOCKETFUNCTION, &epoll_socket_callback);
+#endif
 
     return S3StatusOK;
 }
 
 
+S3Status S3_create_request_context_ex(S3RequestContext **requestContextReturn,
+                                      S3RequestContextMode mode)
+{
+    switch (mode) {
+    case S3RequestContextModeSelect:
+        break;
+    case S3RequestContextModeEpoll:
+#ifdef __linux__
+        break;
+#else
+        return S3StatusNotSupported;
+#endif
+    default:
+        // S3RequestContextModeExternal needs callbacks, so contexts of that
+        // mode are only created by S3_create_request_context_external
+        return S3StatusNotSupported;
+    }
+
+    return create_request_context(requestContextReturn, mode, 0, 0, 0);
+}
+
+
+S3Status S3_create_request_context_external
+    (S3RequestContext **requestContextReturn,
+     S3SocketCallback *socketCallback, S3TimerCallback *timerCallback,
+     void *callbackData)
+{
+    return create_request_context(requestContextReturn,
+                                  S3RequestContextModeExternal,
+                                  socketCallback, timerCallback,
+                                  callbackData);
+}
+
+
 void S3_destroy_request_context(S3RequestContext *requestContext)
 {
     // For each request in the context, remove curl handle, call back its done
@@ -68,14 +326,285 @@ void S3_destroy_request_context(S3RequestContext *requestContext)
         r = rNext;
     } while (r != rFirst);
 
+    // Then each timer, so that whatever is waiting on it is finished too
+    while (requestContext->timers) {
+        RequestContextTimer *timer = requestContext->timers;
+        requestContext->timers = timer->next;
+        requestContext->timersCount--;
+        (*(timer->callback))(S3StatusInterrupted, timer->data);
+    }
+
     curl_multi_cleanup(requestContext->curlm);
 
+#ifdef __linux__
+    if (requestContext->epollFd != -1) {
+        close(requestContext->epollFd);
+    }
+#endif
+
     free(requestContext);
 }
 
 
+// Finishes every request whose transfer curl reports as done, and returns
+// the number of requests so finished in finishedReturn
+static S3Status finish_done_requests(S3RequestContext *requestContext,
+                                     int *finishedReturn)
+{
+    *finishedReturn = 0;
+
+    CURLMsg *msg;
+    int junk;
+    while ((msg = curl_multi_info_read(requestContext->curlm, &junk))) {
+        if (msg->msg != CURLMSG_DONE) {
+            return S3StatusInternalError;
+        }
+        Request *request;
+        if (curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, 
+                              (char **) (char *) &request) != CURLE_OK) {
+            return S3StatusInternalError;
+        }
+        // Remove the request from the list of requests
+        if (request->prev == request->next) {
+            // It was the only one on the list
+            requestContext->requests = 0;
+        }
+        else {
+            // It doesn't matter what the order of them are, so just in
+            // case request was at the head of the list, put the one after
+            // request to the head of the list
+            requestContext->requests = request->next;
+            request->prev->next = request->next;
+            request->next->prev = request->prev;
+        }
+        if ((msg->data.result != CURLE_OK) &&
+            (request->status == S3StatusOK)) {
+            request->status = request_curl_code_to_status
+                (msg->data.result);
+        }
+        if (curl_multi_remove_handle(requestContext->curlm, 
+                                     msg->easy_handle) != CURLM_OK) {
+            return S3StatusInternalError;
+        }
+        request_trace(request, S3TraceEventBodyComplete);
+        // Finish the request, ensuring that all callbacks have been made,
+        // and also releases the request
+        request_finish(request);
+        (*finishedReturn)++;
+    }
+
+    return S3StatusOK;
+}
+
+
+// Calls curl_multi_socket_action for socket s with the given CURL_CSELECT_XXX
+// events (or CURL_SOCKET_TIMEOUT), then finishes any requests that are done
+// as a result
+static S3Status socket_action(S3RequestContext *requestContext,
+                              curl_socket_t s, int events)
+{
+    int finished;
+
+    do {
+        switch (curl_multi_socket_action(requestContext->curlm, s, events,
+                                         &(requestContext->runningCount))) {
+        case CURLM_OK:
+            break;
+        case CURLM_OUT_OF_MEMORY:
+            return S3StatusOutOfMemory;
+        default:
+            return S3StatusInternalError;
+        }
+
+        S3Status status = finish_done_requests(requestContext, &finished);
+        if (status != S3StatusOK) {
+            return status;
+        }
+
+        // Callbacks made on finished requests may have queued up new
+        // requests; have curl start them immediately, just as
+        // curl_multi_perform would
+        s = CURL_SOCKET_TIMEOUT;
+        events = 0;
+    } while (finished);
+
+    return S3StatusOK;
+}
+
+
+// Runs curl's timeout handling if its deadline has passed
+static S3Status socket_action_timeout(S3RequestContext *requestContext)
+{
+    if ((requestContext->timeoutDeadlineMs == -1) ||
+        (requestContext->timeoutDeadlineMs > request_context_now_ms())) {
+        return S3StatusOK;
+    }
+
+    requestContext->timeoutDeadlineMs = -1;
+
+    return socket_action(requestContext, CURL_SOCKET_TIMEOUT, 0);
+}
+
+
+// Makes the callbacks of the timers which are due, and then has curl start
+// any requests which they added immediately, just as socket_action does
+static S3Status socket_run_timers(S3RequestContext *requestContext)
+{
+    if (!run_timers(requestContext)) {
+        return S3StatusOK;
+    }
+
+    return socket_action(requestContext, CURL_SOCKET_TIMEOUT, 0);
+}
+
+
+#ifdef __linux__
+
+// Waits up to waitMs milliseconds (or forever if waitMs is -1) for I/O on
+// any of curl's sockets, and then services every socket with I/O available
+// and curl's timeout, if it has expired
+static S3Status epoll_run(S3RequestContext *requestContext, int64_t waitMs,
+                          int *requestsRemainingReturn)
+{
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+
+    if (waitMs > 0x7FFFFFFF) {
+        waitMs = 0x7FFFFFFF;
+    }
+
+    int count = epoll_wait(requestContext->epollFd, events, EPOLL_MAX_EVENTS,
+                           (int) waitMs);
+
+    if (count == -1) {
+        if (errno != EINTR) {
+            return S3StatusInternalError;
+        }
+        count = 0;
+    }
+
+    int i;
+    for (i = 0; i < count; i++) {
+        int curlEvents = 0;
+        if (events[i].events & EPOLLIN) {
+            curlEvents |= CURL_CSELECT_IN;
+        }
+        if (events[i].events & EPOLLOUT) {
+            curlEvents |= CURL_CSELECT_OUT;
+        }
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            curlEvents |= CURL_CSELECT_ERR;
+        }
+        S3Status status = socket_action(requestContext, events[i].data.fd,
+                                        curlEvents);
+        if (status != S3StatusOK) {
+            return status;
+        }
+    }
+
+    S3Status status = socket_action_timeout(requestContext);
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    if ((status = socket_run_timers(requestContext)) != S3StatusOK) {
+        return status;
+    }
+
+    *requestsRemainingReturn =
+        requestContext->runningCount + requestContext->timersCount;
+
+    return S3StatusOK;
+}
+
+#endif /* __linux__ */
+
+
+S3Status S3_process_request_context_socket(S3RequestContext *requestContext,
+                                           int fd, int events,
+                                           int *requestsRemainingReturn)
+{
+    if (requestContext->mode == S3RequestContextModeSelect) {
+        return S3StatusNotSupported;
+    }
+
+    int curlEvents = 0;
+    if (events & S3_SOCKET_EVENT_READ) {
+        curlEvents |= CURL_CSELECT_IN;
+    }
+    if (events & S3_SOCKET_EVENT_WRITE) {
+        curlEvents |= CURL_CSELECT_OUT;
+    }
+    if (events & S3_SOCKET_EVENT_ERROR) {
+        curlEvents |= CURL_CSELECT_ERR;
+    }
+
+    S3Status status = socket_action(requestContext, fd, curlEvents);
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    *requestsRemainingReturn =
+        requestContext->runningCount + requestContext->timersCount;
+
+    return S3StatusOK;
+}
+
+
+S3Status S3_process_request_context_timeout(S3RequestContext *requestContext,
+                                            int *requestsRemainingReturn)
+{
+    if (requestContext->mode == S3RequestContextModeSelect) {
+        return S3StatusNotSupported;
+    }
+
+    requestContext->timeoutDeadlineMs = -1;
+
+    S3Status status = socket_action(requestContext, CURL_SOCKET_TIMEOUT, 0);
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    if ((status = socket_run_timers(requestContext)) != S3StatusOK) {
+        return status;
+    }
+
+    // The caller's timer has been used up, and curl only asks for another
+    // for a timeout of its own
+    if (requestContext->mode == S3RequestContextModeExternal) {
+        external_set_timer(requestContext);
+    }
+
+    *requestsRemainingReturn =
+        requestContext->runningCount + requestContext->timersCount;
+
+    return S3StatusOK;
+}
+
+
 S3Status S3_runall_request_context(S3RequestContext *requestContext)
 {
+    if (requestContext->mode == S3RequestContextModeExternal) {
+        // The caller's event loop does the waiting
+        return S3StatusNotSupported;
+    }
+
+#ifdef __linux__
+    if (requestContext->mode == S3RequestContextModeEpoll) {
+        int requestsRemaining;
+        int64_t waitMs = 0;
+        do {
+            S3Status status = epoll_run(requestContext, waitMs,
+                                        &requestsRemaining);
+            if (status != S3StatusOK) {
+                return status;
+            }
+            waitMs = S3_get_request_context_timeout(requestContext);
+        } while (requestsRemaining);
+
+        return S3StatusOK;
+    }
+#endif
+
     int requestsRemaining;
     do {
         fd_set readfds, writefds, exceptfds;
@@ -91,8 +620,10 @@ S3Status S3_runall_request_context(S3RequestContext *requestContext)
         // curl will return -1 if it hasn't even created any fds yet because
         // none of the connections have started yet.  In this case, don't
         // do the select at all, because it will wait forever; instead, just
-        // skip it and go straight to running the underlying CURL handles
-        if (maxfd != -1) {
+        // skip it and go straight to running the underlying CURL handles.
+        // With timers waiting, though, the timeout is never -1, and the
+        // select waits for the first of them.
+        if ((maxfd != -1) || requestContext->timers) {
             int64_t timeout = S3_get_request_context_timeout(requestContext);
             struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
             select(maxfd + 1, &readfds, &writefds, &exceptfds,
@@ -112,6 +643,28 @@ S3Status S3_runall_request_context(S3RequestContext *requestContext)
 S3Status S3_runonce_request_context(S3RequestContext *requestContext, 
                                     int *requestsRemainingReturn)
 {
+#ifdef __linux__
+    if (requestContext->mode == S3RequestContextModeEpoll) {
+        return epoll_run(requestContext, 0, requestsRemainingReturn);
+    }
+#endif
+
+    if (requestContext->mode == S3RequestContextModeExternal) {
+        S3Status status = socket_action_timeout(requestContext);
+        if (status != S3StatusOK) {
+            return status;
+        }
+        if ((status = socket_run_timers(requestContext)) != S3StatusOK) {
+            return status;
+        }
+        *requestsRemainingReturn =
+            requestContext->runningCount + requestContext->timersCount;
+        return S3StatusOK;
+    }
+
+    // Any requests that the timers add are started by curl_multi_perform
+    run_timers(requestContext);
+
     CURLMcode status;
 
     do {
@@ -128,48 +681,20 @@ S3Status S3_runonce_request_context(S3RequestContext *requestContext,
             return S3StatusInternalError;
         }
 
-        CURLMsg *msg;
-        int junk;
-        while ((msg = curl_multi_info_read(requestContext->curlm, &junk))) {
-            if (msg->msg != CURLMSG_DONE) {
-                return S3StatusInternalError;
-            }
-            Request *request;
-            if (curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, 
-                                  (char **) (char *) &request) != CURLE_OK) {
-                return S3StatusInternalError;
-            }
-            // Remove the request from the list of requests
-            if (request->prev == request->next) {
-                // It was the only one on the list
-                requestContext->requests = 0;
-            }
-            else {
-                // It doesn't matter what the order of them are, so just in
-                // case request was at the head of the list, put the one after
-                // request to the head of the list
-                requestContext->requests = request->next;
-                request->prev->next = request->next;
-                request->next->prev = request->prev;
-            }
-            if ((msg->data.result != CURLE_OK) &&
-                (request->status == S3StatusOK)) {
-                request->status = request_curl_code_to_status
-                    (msg->data.result);
-            }
-            if (curl_multi_remove_handle(requestContext->curlm, 
-                                         msg->easy_handle) != CURLM_OK) {
-                return S3StatusInternalError;
-            }
-            // Finish the request, ensuring that all callbacks have been made,
-            // and also releases the request
-            request_finish(request);
-            // Now, since a callback was made, there may be new requests 
-            // queued up to be performed immediately, so do so
+        int finished;
+        S3Status s3status = finish_done_requests(requestContext, &finished);
+        if (s3status != S3StatusOK) {
+            return s3status;
+        }
+        // Now, since a callback was made, there may be new requests 
+        // queued up to be performed immediately, so do so
+        if (finished) {
             status = CURLM_CALL_MULTI_PERFORM;
         }
     } while (status == CURLM_CALL_MULTI_PERFORM);
 
+    *requestsRemainingReturn += requestContext->timersCount;
+
     return S3StatusOK;
 }
 
@@ -177,6 +702,27 @@ S3Status S3_get_request_context_fdsets(S3RequestContext *requestContext,
                                        fd_set *readFdSet, fd_set *writeFdSet,
                                        fd_set *exceptFdSet, int *maxFd)
 {
+    if (requestContext->mode == S3RequestContextModeExternal) {
+        // The caller's event loop is told about sockets via callbacks
+        return S3StatusNotSupported;
+    }
+
+#ifdef __linux__
+    if (requestContext->mode == S3RequestContextModeEpoll) {
+        // The epoll instance is readable whenever any socket in it has I/O
+        // available.  As with curl_multi_fdset, report no fds at all if
+        // there is nothing to wait for.
+        if (requestContext->requests) {
+            FD_SET(requestContext->epollFd, readFdSet);
+            *maxFd = requestContext->epollFd;
+        }
+        else {
+            *maxFd = -1;
+        }
+        return S3StatusOK;
+    }
+#endif
+
     return ((curl_multi_fdset(requestContext->curlm, readFdSet, writeFdSet,
                               exceptFdSet, maxFd) == CURLM_OK) ?
             S3StatusOK : S3StatusInternalError);
@@ -184,12 +730,32 @@ S3Status S3_get_request_context_fdsets(S3RequestContext *requestContext,
 
 int64_t S3_get_request_context_timeout(S3RequestContext *requestContext)
 {
-    long timeout;
+    int64_t nowMs = request_context_now_ms();
+    int64_t timeout;
 
-    if (curl_multi_timeout(requestContext->curlm, &timeout) != CURLM_OK) {
-        timeout = 0;
+    if (requestContext->mode != S3RequestContextModeSelect) {
+        if ((timeout = requestContext->timeoutDeadlineMs) != -1) {
+            timeout = (timeout > nowMs) ? (timeout - nowMs) : 0;
+        }
     }
-    
+    else {
+        long curlTimeout;
+        if (curl_multi_timeout(requestContext->curlm, &curlTimeout) !=
+            CURLM_OK) {
+            curlTimeout = 0;
+        }
+        timeout = curlTimeout;
+    }
+
+    // The first timer may be due before curl's timeout
+    if (requestContext->timers) {
+        int64_t dueMs = requestContext->timers->dueMs;
+        int64_t timerTimeout = (dueMs > nowMs) ? (dueMs - nowMs) : 0;
+        if ((timeout == -1) || (timerTimeout < timeout)) {
+            timeout = timerTimeout;
+        }
+    }
+
     return timeout;
 }
 
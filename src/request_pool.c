@@ -0,0 +1,356 @@
+/** **************************************************************************
+ * request_pool.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "request_pool.h"
+
+// Defaults for S3_set_request_pool_options
+#define DEFAULT_THREAD_CACHE_SIZE 4
+#define DEFAULT_GLOBAL_SIZE 32
+#define DEFAULT_MAX_IDLE_SECONDS 30
+
+
+typedef struct ThreadCache
+{
+    // Every thread cache is on a doubly-linked list so that
+    // request_pool_deinitialize can find them all
+    struct ThreadCache *prev, *next;
+
+    // Index of the global slot at which this thread starts searching, so
+    // that threads tend not to contend for the same slots
+    int slotHint;
+
+    // Number of Requests in requests
+    int count;
+
+    // Most recently released last; threadCacheSizeG entries
+    Request *requests[1];
+} ThreadCache;
+
+
+// Configuration, as set by S3_set_request_pool_options; it only takes effect
+// when request_pool_initialize copies it into the configuration in use below,
+// since the thread caches and global slots are sized by that
+static int pendingThreadCacheSizeG = DEFAULT_THREAD_CACHE_SIZE;
+
+static int pendingGlobalSizeG = DEFAULT_GLOBAL_SIZE;
+
+static int pendingMaxIdleSecondsG = DEFAULT_MAX_IDLE_SECONDS;
+
+// Configuration in use, from request_pool_initialize until
+// request_pool_deinitialize
+static int threadCacheSizeG;
+
+static int globalSizeG;
+
+static int maxIdleSecondsG;
+
+
+static void (*destroyRequestG)(Request *);
+
+// Holds each thread's ThreadCache
+static pthread_key_t threadCacheKeyG;
+
+// Protects threadCachesG; only used when a thread cache is created or
+// destroyed
+static pthread_mutex_t threadCachesMutexG;
+
+static ThreadCache *threadCachesG;
+
+// Used to spread slotHints out
+static int threadCacheCountG;
+
+// globalSizeG slots, each of which is 0 or holds an idle Request.  These are
+// only ever changed by compare-and-swap.
+static Request * volatile *globalSlotsG;
+
+// Approximate number of occupied global slots, so that searching an empty
+// global pool can be skipped
+static volatile int globalCountG;
+
+
+static int64_t now_seconds()
+{
+    struct timespec ts;
+    // Only whole seconds are needed, so use the much cheaper coarse clock
+    // where there is one
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec;
+}
+
+
+static int is_expired(const Request *request, int64_t now)
+{
+    return (maxIdleSecondsG &&
+            ((now - request->idleSinceSeconds) > maxIdleSecondsG));
+}
+
+
+// Puts a Request into a free global slot, returning nonzero on success, or
+// zero if there is none
+static int global_put(Request *request, int slotHint)
+{
+    int i;
+    for (i = 0; i < globalSizeG; i++) {
+        int slot = (slotHint + i) % globalSizeG;
+        if (!globalSlotsG[slot] &&
+            __sync_bool_compare_and_swap(&(globalSlotsG[slot]), 0, request)) {
+            __sync_fetch_and_add(&globalCountG, 1);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+// Takes a Request from the global slots, returning 0 if there is none
+static Request *global_take(int slotHint)
+{
+    if (globalCountG <= 0) {
+        return 0;
+    }
+
+    int i;
+    for (i = 0; i < globalSizeG; i++) {
+        int slot = (slotHint + i) % globalSizeG;
+        Request *request = globalSlotsG[slot];
+        if (request &&
+            __sync_bool_compare_and_swap(&(globalSlotsG[slot]), request, 0)) {
+            __sync_fetch_and_sub(&globalCountG, 1);
+            return request;
+        }
+    }
+
+    return 0;
+}
+
+
+// Called when a thread with a thread cache exits; hands its Requests over to
+// the global slots
+static void thread_cache_destroy(void *data)
+{
+    ThreadCache *cache = (ThreadCache *) data;
+
+    while (cache->count) {
+        Request *request = cache->requests[--cache->count];
+        if (!global_put(request, cache->slotHint)) {
+            (*destroyRequestG)(request);
+        }
+    }
+
+    pthread_mutex_lock(&threadCachesMutexG);
+    if (cache->next == cache) {
+        threadCachesG = 0;
+    }
+    else {
+        cache->prev->next = cache->next;
+        cache->next->prev = cache->prev;
+        if (threadCachesG == cache) {
+            threadCachesG = cache->next;
+        }
+    }
+    pthread_mutex_unlock(&threadCachesMutexG);
+
+    free(cache);
+}
+
+
+// Returns the calling thread's cache, creating it if necessary; returns 0 if
+// thread caches are disabled or one could not be created
+static ThreadCache *thread_cache_get()
+{
+    if (!threadCacheSizeG) {
+        return 0;
+    }
+
+    ThreadCache *cache = (ThreadCache *) pthread_getspecific(threadCacheKeyG);
+
+    if (cache) {
+        return cache;
+    }
+
+    if (!(cache = (ThreadCache *) malloc
+          (sizeof(ThreadCache) +
+           ((threadCacheSizeG - 1) * sizeof(Request *))))) {
+        return 0;
+    }
+
+    cache->count = 0;
+
+    pthread_mutex_lock(&threadCachesMutexG);
+    if (threadCachesG) {
+        cache->prev = threadCachesG->prev;
+        cache->next = threadCachesG;
+        threadCachesG->prev->next = cache;
+        threadCachesG->prev = cache;
+    }
+    else {
+        threadCachesG = cache->next = cache->prev = cache;
+    }
+    // Spread the threads' starting slots evenly, in the order that the
+    // threads first use the pool
+    cache->slotHint = ((threadCacheCountG++ * 7) % (globalSizeG ? globalSizeG :
+                                                    1));
+    pthread_mutex_unlock(&threadCachesMutexG);
+
+    if (pthread_setspecific(threadCacheKeyG, cache)) {
+        thread_cache_destroy(cache);
+        return 0;
+    }
+
+    return cache;
+}
+
+
+void S3_set_request_pool_options(int threadCacheSize, int globalSize,
+                                 int maxIdleSeconds)
+{
+    pendingThreadCacheSizeG = (threadCacheSize < 0) ? 0 : threadCacheSize;
+    pendingGlobalSizeG = (globalSize < 0) ? 0 : globalSize;
+    pendingMaxIdleSecondsG = (maxIdleSeconds < 0) ? 0 : maxIdleSeconds;
+}
+
+
+S3Status request_pool_initialize(void (*destroyRequest)(Request *))
+{
+    destroyRequestG = destroyRequest;
+
+    threadCacheSizeG = pendingThreadCacheSizeG;
+
+    globalSizeG = pendingGlobalSizeG;
+
+    maxIdleSecondsG = pendingMaxIdleSecondsG;
+
+    if (pthread_key_create(&threadCacheKeyG, &thread_cache_destroy)) {
+        return S3StatusInternalError;
+    }
+
+    pthread_mutex_init(&threadCachesMutexG, 0);
+
+    threadCachesG = 0;
+
+    threadCacheCountG = 0;
+
+    if (!(globalSlotsG = (Request * volatile *)
+          calloc(globalSizeG ? globalSizeG : 1, sizeof(Request *)))) {
+        pthread_mutex_destroy(&threadCachesMutexG);
+        pthread_key_delete(threadCacheKeyG);
+        return S3StatusOutOfMemory;
+    }
+
+    globalCountG = 0;
+
+    return S3StatusOK;
+}
+
+
+void request_pool_deinitialize()
+{
+    // No more thread cache destructors may run after this
+    pthread_key_delete(threadCacheKeyG);
+
+    while (threadCachesG) {
+        ThreadCache *cache = threadCachesG;
+        while (cache->count) {
+            (*destroyRequestG)(cache->requests[--cache->count]);
+        }
+        if (cache->next == cache) {
+            threadCachesG = 0;
+        }
+        else {
+            cache->prev->next = cache->next;
+            cache->next->prev = cache->prev;
+            threadCachesG = cache->next;
+        }
+        free(cache);
+    }
+
+    pthread_mutex_destroy(&threadCachesMutexG);
+
+    int i;
+    for (i = 0; i < globalSizeG; i++) {
+        if (globalSlotsG[i]) {
+            (*destroyRequestG)(globalSlotsG[i]);
+        }
+    }
+
+    free((void *) globalSlotsG);
+    globalSlotsG = 0;
+}
+
+
+Request *request_pool_get()
+{
+    int64_t now = now_seconds();
+
+    ThreadCache *cache = thread_cache_get();
+
+    // Re-use the most recently used Request first, to maximize the chances
+    // of re-using a connection before it times out
+    if (cache) {
+        while (cache->count) {
+            Request *request = cache->requests[--cache->count];
+            if (!is_expired(request, now)) {
+                return request;
+            }
+            (*destroyRequestG)(request);
+        }
+    }
+
+    Request *request;
+    while ((request = global_take(cache ? cache->slotHint : 0))) {
+        if (!is_expired(request, now)) {
+            return request;
+        }
+        (*destroyRequestG)(request);
+    }
+
+    return 0;
+}
+
+
+void request_pool_release(Request *request)
+{
+    request->idleSinceSeconds = now_seconds();
+
+    ThreadCache *cache = thread_cache_get();
+
+    if (cache && (cache->count < threadCacheSizeG)) {
+        cache->requests[cache->count++] = request;
+        return;
+    }
+
+    if (!global_put(request, cache ? cache->slotHint : 0)) {
+        (*destroyRequestG)(request);
+    }
+}
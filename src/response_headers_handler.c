@@ -48,6 +48,115 @@ void response_headers_handler_initialize(ResponseHeadersHandler *handler)
 }
 
 
+// The response headers that are kept, other than x-amz-meta- headers
+typedef enum
+{
+    ResponseHeaderUnknown = 0,
+    ResponseHeaderRequestId,
+    ResponseHeaderRequestId2,
+    ResponseHeaderContentType,
+    ResponseHeaderContentLength,
+    ResponseHeaderServer,
+    ResponseHeaderETag,
+    ResponseHeaderServerSideEncryption
+} ResponseHeader;
+
+
+typedef struct ResponseHeaderName
+{
+    const char *name;
+
+    int namelen;
+
+    ResponseHeader header;
+} ResponseHeaderName;
+
+
+#define RESPONSE_HEADER_NAME(name, header)                              \
+    { name, sizeof(name) - 1, header }
+
+// A perfect hash of the header names: the slot of a name is its length plus
+// its last character lowercased, modulo the table size.  Each name occupies
+// its own slot, so a header needs only one comparison to be classified.
+#define RESPONSE_HEADER_HASH_SIZE 16
+
+#define response_header_hash(name, namelen)                             \
+    (((namelen) + (((unsigned char) (name)[(namelen) - 1]) | 0x20)) &   \
+     (RESPONSE_HEADER_HASH_SIZE - 1))
+
+static const ResponseHeaderName responseHeaderNamesG
+    [RESPONSE_HEADER_HASH_SIZE] =
+{
+    [1] = RESPONSE_HEADER_NAME("Content-Type", ResponseHeaderContentType),
+    [4] = RESPONSE_HEADER_NAME("x-amz-request-id", ResponseHeaderRequestId),
+    [6] = RESPONSE_HEADER_NAME("Content-Length",
+                               ResponseHeaderContentLength),
+    [8] = RESPONSE_HEADER_NAME("Server", ResponseHeaderServer),
+    [10] = RESPONSE_HEADER_NAME("x-amz-server-side-encryption",
+                                ResponseHeaderServerSideEncryption),
+    [11] = RESPONSE_HEADER_NAME("ETag", ResponseHeaderETag),
+    [12] = RESPONSE_HEADER_NAME("x-amz-id-2", ResponseHeaderRequestId2)
+};
+
+
+static ResponseHeader lookup_response_header(const char *name, int namelen)
+{
+    if (!namelen) {
+        return ResponseHeaderUnknown;
+    }
+
+    const ResponseHeaderName *entry =
+        &(responseHeaderNamesG[response_header_hash(name, namelen)]);
+
+    if ((entry->namelen != namelen) ||
+        strncasecmp(name, entry->name, namelen)) {
+        return ResponseHeaderUnknown;
+    }
+
+    return entry->header;
+}
+
+
+static void add_meta_data(ResponseHeadersHandler *handler, char *metaName,
+                          int metaNameLen, char *value, int valuelen)
+{
+    int fit;
+
+    // Make sure there is room for another x-amz-meta header
+    if (handler->responseProperties.metaDataCount == S3_MAX_METADATA_COUNT) {
+        return;
+    }
+
+    // Copy the name in
+    char *copiedName = 
+        string_multibuffer_current(handler->responseMetaDataStrings);
+    string_multibuffer_add(handler->responseMetaDataStrings, metaName,
+                           metaNameLen, fit);
+    if (!fit) {
+        return;
+    }
+
+    // Copy the value in
+    char *copiedValue = 
+        string_multibuffer_current(handler->responseMetaDataStrings);
+    string_multibuffer_add(handler->responseMetaDataStrings, value, valuelen,
+                           fit);
+    if (!fit) {
+        return;
+    }
+
+    if (!handler->responseProperties.metaDataCount) {
+        handler->responseProperties.metaData = handler->responseMetaData;
+    }
+
+    S3NameValue *metaHeader = 
+        &(handler->responseMetaData
+          [handler->responseProperties.metaDataCount++]);
+    metaHeader->name = copiedName;
+    metaHeader->value = copiedValue;
+}
+
+
 void response_headers_handler_add(ResponseHeadersHandler *handler,
                                   char *header, int len)
 {
@@ -64,8 +173,8 @@ void response_headers_handler_add(ResponseHeadersHandler *handler,
     // If we've already filled up the response headers, ignore this data.
     // This sucks, but it shouldn't happen - S3 should not be sending back
     // really long headers.
-    if (handler->responsePropertyStringsSize == 
-        (sizeof(handler->responsePropertyStrings) - 1)) {
+    if (handler->responsePropertyStringsSize >=
+        (int) sizeof(handler->responsePropertyStrings)) {
         return;
     }
 
@@ -112,92 +221,62 @@ void response_headers_handler_add(ResponseHeadersHandler *handler,
         c++;
     }
 
-    int valuelen = (end - c) + 1, fit;
+    // A header without a colon has an empty value
+    int valuelen = (c < end) ? (end - c) : 0, fit;
 
-    if (!strncasecmp(header, "x-amz-request-id", namelen)) {
-        responseProperties->requestId = 
-            string_multibuffer_current(handler->responsePropertyStrings);
-        string_multibuffer_add(handler->responsePropertyStrings, c, 
-                               valuelen, fit);
-    }
-    else if (!strncasecmp(header, "x-amz-id-2", namelen)) {
-        responseProperties->requestId2 = 
-            string_multibuffer_current(handler->responsePropertyStrings);
-        string_multibuffer_add(handler->responsePropertyStrings, c, 
-                               valuelen, fit);
-    }
-    else if (!strncasecmp(header, "Content-Type", namelen)) {
-        responseProperties->contentType = 
-            string_multibuffer_current(handler->responsePropertyStrings);
-        string_multibuffer_add(handler->responsePropertyStrings, c, 
-                               valuelen, fit);
-    }
-    else if (!strncasecmp(header, "Content-Length", namelen)) {
-        handler->responseProperties.contentLength = 0;
-        while (*c) {
-            handler->responseProperties.contentLength *= 10;
-            handler->responseProperties.contentLength += (*c++ - '0');
-        }
+    // Most of the headers of a GET of an object with metadata are
+    // x-amz-meta- headers, so these are recognized before anything else
+    if ((namelen > (int) (sizeof(S3_METADATA_HEADER_NAME_PREFIX) - 1)) &&
+        ((header[0] | 0x20) == 'x') &&
+        !strncasecmp(header, S3_METADATA_HEADER_NAME_PREFIX,
+                     sizeof(S3_METADATA_HEADER_NAME_PREFIX) - 1)) {
+        add_meta_data(handler,
+                      &(header[sizeof(S3_METADATA_HEADER_NAME_PREFIX) - 1]),
+                      namelen - (sizeof(S3_METADATA_HEADER_NAME_PREFIX) - 1),
+                      c, valuelen);
+        return;
     }
-    else if (!strncasecmp(header, "Server", namelen)) {
-        responseProperties->server = 
-            string_multibuffer_current(handler->responsePropertyStrings);
-        string_multibuffer_add(handler->responsePropertyStrings, c, 
-                               valuelen, fit);
-    }
-    else if (!strncasecmp(header, "ETag", namelen)) {
-        responseProperties->eTag = 
-            string_multibuffer_current(handler->responsePropertyStrings);
-        string_multibuffer_add(handler->responsePropertyStrings, c, 
-                               valuelen, fit);
-    }
-    else if (!strncasecmp(header, S3_METADATA_HEADER_NAME_PREFIX, 
-                      sizeof(S3_METADATA_HEADER_NAME_PREFIX) - 1)) {
-        // Make sure there is room for another x-amz-meta header
-        if (handler->responseProperties.metaDataCount ==
-            sizeof(handler->responseMetaData)) {
-            return;
-        }
-        // Copy the name in
-        char *metaName = &(header[sizeof(S3_METADATA_HEADER_NAME_PREFIX) - 1]);
-        int metaNameLen = 
-            (namelen - (sizeof(S3_METADATA_HEADER_NAME_PREFIX) - 1));
-        char *copiedName = 
-            string_multibuffer_current(handler->responseMetaDataStrings);
-        string_multibuffer_add(handler->responseMetaDataStrings, metaName,
-                               metaNameLen, fit);
-        if (!fit) {
-            return;
-        }
 
-        // Copy the value in
-        char *copiedValue = 
-            string_multibuffer_current(handler->responseMetaDataStrings);
-        string_multibuffer_add(handler->responseMetaDataStrings,
-                               c, valuelen, fit);
-        if (!fit) {
-            return;
-        }
+    const char **property;
 
-        if (!handler->responseProperties.metaDataCount) {
-            handler->responseProperties.metaData = 
-                handler->responseMetaData;
+    switch (lookup_response_header(header, namelen)) {
+    case ResponseHeaderRequestId:
+        property = &(responseProperties->requestId);
+        break;
+    case ResponseHeaderRequestId2:
+        property = &(responseProperties->requestId2);
+        break;
+    case ResponseHeaderContentType:
+        property = &(responseProperties->contentType);
+        break;
+    case ResponseHeaderServer:
+        property = &(responseProperties->server);
+        break;
+    case ResponseHeaderETag:
+        property = &(responseProperties->eTag);
+        break;
+    case ResponseHeaderContentLength:
+        responseProperties->contentLength = 0;
+        while (*c) {
+            responseProperties->contentLength *= 10;
+            responseProperties->contentLength += (*c++ - '0');
         }
-
-        S3NameValue *metaHeader = 
-            &(handler->responseMetaData
-              [handler->responseProperties.metaDataCount++]);
-        metaHeader->name = copiedName;
-        metaHeader->value = copiedValue;
-    }
-    else if (!strncasecmp(header, "x-amz-server-side-encryption", namelen)) {
+        return;
+    case ResponseHeaderServerSideEncryption:
         if (!strncmp(c, "AES256", sizeof("AES256") - 1)) {
             responseProperties->usesServerSideEncryption = 1;
         }
         // Ignore other values - only AES256 is expected, anything else is
         // assumed to be "None" or some other value indicating no server-side
         // encryption
+        return;
+    default:
+        return;
     }
+
+    *property = string_multibuffer_current(handler->responsePropertyStrings);
+    string_multibuffer_add(handler->responsePropertyStrings, c, valuelen, fit);
+    (void) fit;
 }
 
 
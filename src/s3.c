@@ -135,6 +135,9 @@ static char putenvBufG[256];
 #define USE_SERVER_SIDE_ENCRYPTION_PREFIX "useServerSideEncryption="
 #define USE_SERVER_SIDE_ENCRYPTION_PREFIX_LEN \
     (sizeof(USE_SERVER_SIDE_ENCRYPTION_PREFIX) - 1)
+#define USE_STREAMING_SIGNATURE_PREFIX "useStreamingSignature="
+#define USE_STREAMING_SIGNATURE_PREFIX_LEN \
+    (sizeof(USE_STREAMING_SIGNATURE_PREFIX) - 1)
 #define IF_MODIFIED_SINCE_PREFIX "ifModifiedSince="
 #define IF_MODIFIED_SINCE_PREFIX_LEN (sizeof(IF_MODIFIED_SINCE_PREFIX) - 1)
 #define IF_NOT_MODIFIED_SINCE_PREFIX "ifNotmodifiedSince="
@@ -290,6 +293,8 @@ static void usageExit(FILE *out)
 "     [x-amz-meta-...]]  : Metadata headers to associate with the object\n"
 "     [useServerSideEncryption] : Whether or not to use server-side\n"
 "                          encryption for the object\n"
+"     [useStreamingSignature] : Whether or not to sign the object data as\n"
+"                          it is sent (for use without HTTPS)\n"
 "     [upload-id]        : Upload-id of a uncomplete multipart upload, if you \n"
 "                          want to continue to put the object, you must specifil\n"
 "\n"
@@ -1294,8 +1299,10 @@ static void list_bucket(const char *bucketName, const char *prefix,
     do {
         data.isTruncated = 0;
         do {
-            S3_list_bucket(&bucketContext, prefix, data.nextMarker,
-                           delimiter, maxkeys, 0, timeoutMsG, &listBucketHandler, &data);
+            // Take each page of results in one callback
+            S3_list_bucket_ex(&bucketContext, prefix, data.nextMarker,
+                              delimiter, maxkeys, 0, 0, timeoutMsG,
+                              &listBucketHandler, &data);
         } while (S3_status_is_retryable(statusG) && should_retry());
         if (statusG != S3StatusOK) {
             break;
@@ -2190,6 +2197,7 @@ static void put_object(int argc, char **argv, int optindex,
     int metaPropertiesCount = 0;
     S3NameValue metaProperties[S3_MAX_METADATA_COUNT];
     char useServerSideEncryption = 0;
+    char useStreamingSignature = 0;
     int noStatus = 0;
 
     while (optindex < argc) {
@@ -2271,6 +2279,18 @@ static void put_object(int argc, char **argv, int optindex,
                 useServerSideEncryption = 0;
             }
         }
+        else if (!strncmp(param, USE_STREAMING_SIGNATURE_PREFIX,
+                          USE_STREAMING_SIGNATURE_PREFIX_LEN)) {
+            const char *val = &(param[USE_STREAMING_SIGNATURE_PREFIX_LEN]);
+            if (!strcmp(val, "true") || !strcmp(val, "TRUE") ||
+                !strcmp(val, "yes") || !strcmp(val, "YES") ||
+                !strcmp(val, "1")) {
+                useStreamingSignature = 1;
+            }
+            else {
+                useStreamingSignature = 0;
+            }
+        }
         else if (!strncmp(param, CANNED_ACL_PREFIX, CANNED_ACL_PREFIX_LEN)) {
             char *val = &(param[CANNED_ACL_PREFIX_LEN]);
             if (!strcmp(val, "private")) {
@@ -2393,7 +2413,8 @@ static void put_object(int argc, char **argv, int optindex,
         cannedAcl,
         metaPropertiesCount,
         metaProperties,
-        useServerSideEncryption
+        useServerSideEncryption,
+        useStreamingSignature
     };
 
     if (contentLength <= MULTIPART_CHUNK_SIZE) {
@@ -2812,7 +2833,8 @@ static void copy_object(int argc, char **argv, int optindex)
         cannedAcl,
         metaPropertiesCount,
         metaProperties,
-        useServerSideEncryption
+        useServerSideEncryption,
+        0
     };
 
     S3ResponseHandler responseHandler =
@@ -2993,16 +3015,33 @@ static void get_object(int argc, char **argv, int optindex)
         ifNotMatch
     };
 
-    S3GetObjectHandler getObjectHandler =
-    {
-        { &responsePropertiesCallback, &responseCompleteCallback },
-        &getObjectDataCallback
-    };
+    if (filename && !startByte && !byteCount) {
+        // Whole objects being written to files are downloaded as several
+        // byte ranges at once, each written straight to its place in the
+        // file
+        S3ResponseHandler responseHandler =
+        {
+            &responsePropertiesCallback, &responseCompleteCallback
+        };
 
-    do {
-        S3_get_object(&bucketContext, key, &getConditions, startByte,
-                      byteCount, 0, 0, &getObjectHandler, outfile);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+        do {
+            S3_get_object_to_fd(&bucketContext, key, &getConditions,
+                                fileno(outfile), 0, 0, timeoutMsG,
+                                &responseHandler, 0);
+        } while (S3_status_is_retryable(statusG) && should_retry());
+    }
+    else {
+        S3GetObjectHandler getObjectHandler =
+        {
+            { &responsePropertiesCallback, &responseCompleteCallback },
+            &getObjectDataCallback
+        };
+
+        do {
+            S3_get_object(&bucketContext, key, &getConditions, startByte,
+                          byteCount, 0, 0, &getObjectHandler, outfile);
+        } while (S3_status_is_retryable(statusG) && should_retry());
+    }
 
     if (statusG != S3StatusOK) {
         printError();
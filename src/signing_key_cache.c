@@ -0,0 +1,211 @@
+/** **************************************************************************
+ * signing_key_cache.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "signing_key_cache.h"
+
+#ifdef __APPLE__
+#include <CommonCrypto/CommonHMAC.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+// Number of (access key ID, region) pairs for which signing keys are cached
+#define SIGNING_KEY_CACHE_SIZE 16
+
+// Credentials and regions longer than these are never cached; their keys are
+// simply derived every time
+#define MAX_CACHED_ACCESS_KEY_ID_SIZE 128
+#define MAX_CACHED_SECRET_ACCESS_KEY_SIZE 128
+#define MAX_CACHED_REGION_SIZE 64
+
+
+typedef struct SigningKeyCacheEntry
+{
+    // Nonzero if this entry holds a key
+    int used;
+
+    // Value of signingKeyCacheClockG when this entry was last used; the
+    // entry with the lowest value is the one replaced when the cache is full
+    uint64_t lastUsed;
+
+    // These identify the entry
+    char accessKeyId[MAX_CACHED_ACCESS_KEY_ID_SIZE + 1];
+    char region[MAX_CACHED_REGION_SIZE + 1];
+
+    // These validate the entry; if either differs from the request's, the
+    // key is stale (date rollover or credential change) and is re-derived
+    char secretAccessKey[MAX_CACHED_SECRET_ACCESS_KEY_SIZE + 1];
+    char date[8 + 1];
+
+    unsigned char key[SIGNING_KEY_SIZE];
+} SigningKeyCacheEntry;
+
+
+static pthread_mutex_t signingKeyCacheMutexG;
+
+static SigningKeyCacheEntry signingKeyCacheG[SIGNING_KEY_CACHE_SIZE];
+
+static uint64_t signingKeyCacheClockG;
+
+
+static void hmac_sha256(const void *key, int keyLen, const void *data,
+                        int dataLen, unsigned char *md)
+{
+#ifdef __APPLE__
+    CCHmac(kCCHmacAlgSHA256, key, keyLen, data, dataLen, md);
+#else
+    HMAC(EVP_sha256(), key, keyLen, (const unsigned char *) data, dataLen,
+         md, NULL);
+#endif
+}
+
+
+void signing_key_cache_initialize()
+{
+    pthread_mutex_init(&signingKeyCacheMutexG, 0);
+
+    memset(signingKeyCacheG, 0, sizeof(signingKeyCacheG));
+
+    signingKeyCacheClockG = 0;
+}
+
+
+void signing_key_cache_deinitialize()
+{
+    pthread_mutex_destroy(&signingKeyCacheMutexG);
+
+    // Don't leave secrets or keys lying around in memory
+    memset(signingKeyCacheG, 0, sizeof(signingKeyCacheG));
+}
+
+
+void signing_key_derive(const char *secretAccessKey, const char *date,
+                        const char *region, unsigned char *keyReturn)
+{
+    char accessKey[strlen(secretAccessKey) + 5];
+    snprintf(accessKey, sizeof(accessKey), "AWS4%s", secretAccessKey);
+
+    unsigned char dateKey[SIGNING_KEY_SIZE];
+    hmac_sha256(accessKey, strlen(accessKey), date, 8, dateKey);
+    unsigned char dateRegionKey[SIGNING_KEY_SIZE];
+    hmac_sha256(dateKey, SIGNING_KEY_SIZE, region, strlen(region),
+                dateRegionKey);
+    unsigned char dateRegionServiceKey[SIGNING_KEY_SIZE];
+    hmac_sha256(dateRegionKey, SIGNING_KEY_SIZE, "s3", 2,
+                dateRegionServiceKey);
+    hmac_sha256(dateRegionServiceKey, SIGNING_KEY_SIZE, "aws4_request",
+                sizeof("aws4_request") - 1, keyReturn);
+}
+
+
+// Returns the entry for the given access key ID and region, or 0 if there is
+// none.  Must be called with signingKeyCacheMutexG held.
+static SigningKeyCacheEntry *find_entry(const char *accessKeyId,
+                                        const char *region)
+{
+    int i;
+    for (i = 0; i < SIGNING_KEY_CACHE_SIZE; i++) {
+        SigningKeyCacheEntry *entry = &(signingKeyCacheG[i]);
+        if (entry->used && !strcmp(entry->accessKeyId, accessKeyId) &&
+            !strcmp(entry->region, region)) {
+            return entry;
+        }
+    }
+
+    return 0;
+}
+
+
+void signing_key_cache_get(const char *accessKeyId,
+                           const char *secretAccessKey, const char *date,
+                           const char *region, unsigned char *keyReturn)
+{
+    if (!accessKeyId) {
+        accessKeyId = "";
+    }
+
+    // Don't bother caching anything that won't fit
+    if ((strlen(accessKeyId) > MAX_CACHED_ACCESS_KEY_ID_SIZE) ||
+        (strlen(secretAccessKey) > MAX_CACHED_SECRET_ACCESS_KEY_SIZE) ||
+        (strlen(region) > MAX_CACHED_REGION_SIZE)) {
+        signing_key_derive(secretAccessKey, date, region, keyReturn);
+        return;
+    }
+
+    pthread_mutex_lock(&signingKeyCacheMutexG);
+
+    SigningKeyCacheEntry *entry = find_entry(accessKeyId, region);
+
+    if (entry && !strncmp(entry->date, date, 8) &&
+        !strcmp(entry->secretAccessKey, secretAccessKey)) {
+        entry->lastUsed = ++signingKeyCacheClockG;
+        memcpy(keyReturn, entry->key, SIGNING_KEY_SIZE);
+        pthread_mutex_unlock(&signingKeyCacheMutexG);
+        return;
+    }
+
+    pthread_mutex_unlock(&signingKeyCacheMutexG);
+
+    // Derive the key without holding the lock, so that a miss doesn't stall
+    // every other thread that is signing
+    signing_key_derive(secretAccessKey, date, region, keyReturn);
+
+    pthread_mutex_lock(&signingKeyCacheMutexG);
+
+    // Look again, another thread may have changed the cache in the meantime.
+    // If this (access key ID, region) is not present, take an unused entry,
+    // or else the least recently used one.
+    if (!(entry = find_entry(accessKeyId, region))) {
+        int i;
+        entry = &(signingKeyCacheG[0]);
+        for (i = 0; i < SIGNING_KEY_CACHE_SIZE; i++) {
+            if (!signingKeyCacheG[i].used) {
+                entry = &(signingKeyCacheG[i]);
+                break;
+            }
+            if (signingKeyCacheG[i].lastUsed < entry->lastUsed) {
+                entry = &(signingKeyCacheG[i]);
+            }
+        }
+        strcpy(entry->accessKeyId, accessKeyId);
+        strcpy(entry->region, region);
+        entry->used = 1;
+    }
+
+    // Replacing the secret and date here is what invalidates a key on date
+    // rollover or credential change
+    strcpy(entry->secretAccessKey, secretAccessKey);
+    memcpy(entry->date, date, 8);
+    entry->date[8] = 0;
+    memcpy(entry->key, keyReturn, SIGNING_KEY_SIZE);
+    entry->lastUsed = ++signingKeyCacheClockG;
+
+    pthread_mutex_unlock(&signingKeyCacheMutexG);
+}
@@ -25,9 +25,22 @@
  ************************************************************************** **/
 
 #include <libxml/parser.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include "simplexml.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// AVX2 code is compiled with the target attribute and only used if the CPU
+// supports it, so that the library needn't be built for AVX2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCAN_AVX2
+#endif
+
 // Use libxml2 for parsing XML.  XML is severely overused in modern
 // computing.  It is useful for only a very small subset of tasks, but
 // software developers who don't know better and are afraid to go against the
@@ -45,6 +58,120 @@
 // S3 appears to only use ASCII anyway.
 
 
+// The most hash seeds that are tried when compiling element paths before
+// giving up on finding one that hashes every node to a different slot
+#define MAX_HASH_SEED_ATTEMPTS 10000
+
+// Serializes the compiling of element paths
+static pthread_mutex_t elementsMutexG = PTHREAD_MUTEX_INITIALIZER;
+
+
+// FNV-1a hash of an element's parent node index and name
+static unsigned int element_hash(unsigned int seed, int parent,
+                                 const char *name, int nameLen)
+{
+    unsigned int hash = (2166136261u ^ seed) ^ (unsigned int) (parent + 1);
+    hash *= 16777619u;
+
+    while (nameLen--) {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+// Returns the index of the child node of parent with the given name, or -1
+// if there isn't one
+static int find_element_node(const SimpleXmlElements *elements, int parent,
+                             const char *name, int nameLen)
+{
+    int slot = element_hash(elements->hashSeed, parent, name, nameLen) &
+        (SIMPLEXML_ELEMENT_SLOTS - 1);
+    int node = ((int) elements->slots[slot]) - 1;
+
+    if (node >= 0) {
+        const SimpleXmlElementNode *n = &(elements->nodes[node]);
+        if ((n->parent == parent) && (n->nameLen == nameLen) &&
+            !memcmp(n->name, name, nameLen)) {
+            return node;
+        }
+    }
+
+    return -1;
+}
+
+
+// Builds the element tree of the element paths, and then finds a hash seed
+// under which no two of its nodes share a slot
+static S3Status compile_elements(SimpleXmlElements *elements)
+{
+    elements->nodesCount = 0;
+
+    int i;
+    for (i = 0; i < elements->pathsCount; i++) {
+        const char *path = elements->paths[i];
+        if (!path) {
+            continue;
+        }
+        int parent = -1;
+        while (*path) {
+            const char *slash = strchr(path, '/');
+            int nameLen = slash ? (slash - path) : (int) strlen(path);
+            int node;
+            for (node = 0; node < elements->nodesCount; node++) {
+                const SimpleXmlElementNode *n = &(elements->nodes[node]);
+                if ((n->parent == parent) && (n->nameLen == nameLen) &&
+                    !strncmp(n->name, path, nameLen)) {
+                    break;
+                }
+            }
+            if (node == elements->nodesCount) {
+                if (node == SIMPLEXML_MAX_ELEMENT_NODES) {
+                    return S3StatusInternalError;
+                }
+                SimpleXmlElementNode *n = &(elements->nodes[node]);
+                n->name = path;
+                n->nameLen = nameLen;
+                n->parent = parent;
+                n->id = 0;
+                elements->nodesCount++;
+            }
+            parent = node;
+            path += nameLen;
+            if (*path) {
+                path++;
+            }
+        }
+        if (parent >= 0) {
+            elements->nodes[parent].id = i;
+        }
+    }
+
+    unsigned int seed;
+    for (seed = 0; seed < MAX_HASH_SEED_ATTEMPTS; seed++) {
+        memset(elements->slots, 0, sizeof(elements->slots));
+        int node;
+        for (node = 0; node < elements->nodesCount; node++) {
+            const SimpleXmlElementNode *n = &(elements->nodes[node]);
+            int slot = element_hash(seed, n->parent, n->name, n->nameLen) &
+                (SIMPLEXML_ELEMENT_SLOTS - 1);
+            if (elements->slots[slot]) {
+                break;
+            }
+            elements->slots[slot] = node + 1;
+        }
+        if (node == elements->nodesCount) {
+            elements->hashSeed = seed;
+            return S3StatusOK;
+        }
+    }
+
+    return S3StatusInternalError;
+}
+
+
 static xmlEntityPtr saxGetEntity(void *user_data, const xmlChar *name)
 {
     (void) user_data;
@@ -53,6 +180,43 @@ static xmlEntityPtr saxGetEntity(void *user_data, const xmlChar *name)
 }
 
 
+// Returns the index in elementPath at which the name of a new child of the
+// current element goes
+static int child_name_start(const SimpleXml *simpleXml)
+{
+    return simpleXml->elementPathLen ? (simpleXml->elementPathLen + 1) : 0;
+}
+
+
+// Called when the name of a new element of length len has been put into
+// elementPath at child_name_start(), preceded by a '/' if necessary, to make
+// it the current element
+static void element_started(SimpleXml *simpleXml, int len)
+{
+    const char *name = &(simpleXml->elementPath[child_name_start(simpleXml)]);
+
+    simpleXml->elementPathLen = child_name_start(simpleXml) + len;
+    simpleXml->elementPath[simpleXml->elementPathLen] = 0;
+
+    // Descend into the element's node, if it has one
+    if (simpleXml->elements) {
+        if (simpleXml->unmatchedDepth) {
+            simpleXml->unmatchedDepth++;
+        }
+        else {
+            int node = find_element_node(simpleXml->elements,
+                                         simpleXml->elementNode, name, len);
+            if (node >= 0) {
+                simpleXml->elementNode = node;
+            }
+            else {
+                simpleXml->unmatchedDepth = 1;
+            }
+        }
+    }
+}
+
+
 static void saxStartElement(void *user_data, const xmlChar *nameUtf8,
                             const xmlChar **attr)
 {
@@ -78,26 +242,55 @@ static void saxStartElement(void *user_data, const xmlChar *nameUtf8,
     }
 
     if (simpleXml->elementPathLen) {
-        simpleXml->elementPath[simpleXml->elementPathLen++] = '/';
+        simpleXml->elementPath[simpleXml->elementPathLen] = '/';
     }
-    strcpy(&(simpleXml->elementPath[simpleXml->elementPathLen]), name);
-    simpleXml->elementPathLen += len;
+    strcpy(&(simpleXml->elementPath[child_name_start(simpleXml)]), name);
+
+    element_started(simpleXml, len);
 }
 
 
-static void saxEndElement(void *user_data, const xmlChar *name)
+// Returns the element ID of the current element
+static int current_element_id(const SimpleXml *simpleXml)
 {
-    (void) name;
+    if (simpleXml->unmatchedDepth || (simpleXml->elementNode < 0)) {
+        return 0;
+    }
 
-    SimpleXml *simpleXml = (SimpleXml *) user_data;
+    return simpleXml->elements->nodes[simpleXml->elementNode].id;
+}
 
-    if (simpleXml->status != S3StatusOK) {
-        return;
+
+// Makes the callback, whichever kind of callback it is
+static S3Status make_callback(SimpleXml *simpleXml, const char *data,
+                              int dataLen)
+{
+    if (simpleXml->elements) {
+        return (*(simpleXml->elementCallback))
+            (current_element_id(simpleXml), simpleXml->elementPath, data,
+             dataLen, simpleXml->callbackData);
     }
 
+    return (*(simpleXml->callback))
+        (simpleXml->elementPath, data, dataLen, simpleXml->callbackData);
+}
+
+
+// Ends the current element
+static void element_ended(SimpleXml *simpleXml)
+{
     // Call back with 0 data
-    simpleXml->status = (*(simpleXml->callback))
-        (simpleXml->elementPath, 0, 0, simpleXml->callbackData);
+    simpleXml->status = make_callback(simpleXml, 0, 0);
+
+    if (simpleXml->elements) {
+        if (simpleXml->unmatchedDepth) {
+            simpleXml->unmatchedDepth--;
+        }
+        else if (simpleXml->elementNode >= 0) {
+            simpleXml->elementNode =
+                simpleXml->elements->nodes[simpleXml->elementNode].parent;
+        }
+    }
 
     while ((simpleXml->elementPathLen > 0) &&
            (simpleXml->elementPath[simpleXml->elementPathLen] != '/')) {
@@ -108,6 +301,20 @@ static void saxEndElement(void *user_data, const xmlChar *name)
 }
 
 
+static void saxEndElement(void *user_data, const xmlChar *name)
+{
+    (void) name;
+
+    SimpleXml *simpleXml = (SimpleXml *) user_data;
+
+    if (simpleXml->status != S3StatusOK) {
+        return;
+    }
+
+    element_ended(simpleXml);
+}
+
+
 static void saxCharacters(void *user_data, const xmlChar *ch, int len)
 {
     SimpleXml *simpleXml = (SimpleXml *) user_data;
@@ -116,8 +323,7 @@ static void saxCharacters(void *user_data, const xmlChar *ch, int len)
         return;
     }
 
-    simpleXml->status = (*(simpleXml->callback))
-        (simpleXml->elementPath, (char *) ch, len, simpleXml->callbackData);
+    simpleXml->status = make_callback(simpleXml, (const char *) ch, len);
 }
 
 
@@ -171,14 +377,559 @@ static struct _xmlSAXHandler saxHandlerG =
     0 // xmlStructuredErrorFunc serror;
 };
 
+// The built-in tokenizer
+// ----------------------------------------------------------------------------
+
+// This parses just the subset of XML that S3 sends, directly from the data
+// passed to simplexml_add(), keeping only the little state it needs between
+// calls in the SimpleXml.  Character data is passed to the callback straight
+// from that data, and element names are put directly into the element path.
+// It doesn't validate much more than that the elements are properly nested;
+// S3's documents are assumed to be well-formed otherwise.
+
+// Which token the built-in tokenizer is in the middle of
+typedef enum
+{
+    TokenStateText,
+    TokenStateEntity,
+    TokenStateTagOpen,
+    TokenStateStartTagName,
+    TokenStateAttributes,
+    TokenStateAttributeValue,
+    TokenStateEmptyElementEnd,
+    TokenStateEndTagName,
+    TokenStateEndTagSpace,
+    TokenStateProcessingInstruction,
+    TokenStateMarkup,
+    TokenStateCommentStart,
+    TokenStateComment,
+    TokenStateCDataStart,
+    TokenStateCData,
+    TokenStateDeclaration
+} TokenState;
+
+// Selected by simplexml_api_initialize()
+static int builtinParserG;
+
+
+// Returns a pointer to the first of c1 or c2 in [data, end), or end if
+// there is neither
+static const char *scan_scalar(const char *data, const char *end, char c1,
+                               char c2)
+{
+    while ((data < end) && (*data != c1) && (*data != c2)) {
+        data++;
+    }
+
+    return data;
+}
+
+
+#ifdef __SSE2__
+static const char *scan_sse2(const char *data, const char *end, char c1,
+                             char c2)
+{
+    const __m128i v1 = _mm_set1_epi8(c1), v2 = _mm_set1_epi8(c2);
+
+    while ((end - data) >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) data);
+        int mask = _mm_movemask_epi8
+            (_mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_cmpeq_epi8(v, v2)));
+        if (mask) {
+            return &(data[__builtin_ctz(mask)]);
+        }
+        data += 16;
+    }
+
+    return scan_scalar(data, end, c1, c2);
+}
+#endif
+
+
+#ifdef SCAN_AVX2
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *data, const char *end, char c1,
+                             char c2)
+{
+    const __m256i v1 = _mm256_set1_epi8(c1), v2 = _mm256_set1_epi8(c2);
+
+    while ((end - data) >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) data);
+        unsigned int mask = _mm256_movemask_epi8
+            (_mm256_or_si256(_mm256_cmpeq_epi8(v, v1),
+                             _mm256_cmpeq_epi8(v, v2)));
+        if (mask) {
+            return &(data[__builtin_ctz(mask)]);
+        }
+        data += 32;
+    }
+
+    return scan_scalar(data, end, c1, c2);
+}
+#endif
+
+
+// The fastest of the above that the CPU supports, which is selected by
+// simplexml_api_initialize()
+#ifdef __SSE2__
+static const char *(*scanG)(const char *, const char *, char, char) =
+    &scan_sse2;
+#else
+static const char *(*scanG)(const char *, const char *, char, char) =
+    &scan_scalar;
+#endif
+
+
+static int is_xml_space(char c)
+{
+    return ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n'));
+}
+
+
+static int is_name_char(char c)
+{
+    return (!is_xml_space(c) && (c != '/') && (c != '>') && (c != '<') &&
+            (c != '=') && (c != '"') && (c != '\''));
+}
+
+
+// Passes the gathered character data to the callback
+static void flush_text(SimpleXml *simpleXml)
+{
+    if (simpleXml->textLen) {
+        simpleXml->status = make_callback(simpleXml, simpleXml->text,
+                                          simpleXml->textLen);
+        simpleXml->textLen = 0;
+    }
+}
+
+
+// Adds character data to what is gathered to be passed to the callback in
+// one piece once all of it has been seen.  There is none outside of the root
+// element.
+static void characters(SimpleXml *simpleXml, const char *data, int len)
+{
+    if (!simpleXml->elementPathLen) {
+        return;
+    }
+
+    while (len && (simpleXml->status == S3StatusOK)) {
+        int space = SIMPLEXML_TEXT_SIZE - simpleXml->textLen;
+        if (!space) {
+            // Too much to gather; pass on what there is so far
+            flush_text(simpleXml);
+            continue;
+        }
+        int toCopy = (len < space) ? len : space;
+        memcpy(&(simpleXml->text[simpleXml->textLen]), data, toCopy);
+        simpleXml->textLen += toCopy;
+        data += toCopy;
+        len -= toCopy;
+    }
+}
+
+
+// Passes the character(s) of the entity reference in simpleXml->entity to
+// the callback
+static void entity_characters(SimpleXml *simpleXml)
+{
+    const char *entity = simpleXml->entity;
+    char utf8[4];
+    int len = 0;
+
+    simpleXml->entity[simpleXml->entityLen] = 0;
+
+    if (entity[0] == '#') {
+        char *end;
+        unsigned long c = (entity[1] == 'x') ?
+            strtoul(&(entity[2]), &end, 16) : strtoul(&(entity[1]), &end, 10);
+        if (*end || (end == &(entity[1])) || !c || (c > 0x10FFFF)) {
+            simpleXml->status = S3StatusXmlParseFailure;
+            return;
+        }
+        if (c < 0x80) {
+            utf8[len++] = c;
+        }
+        else if (c < 0x800) {
+            utf8[len++] = 0xC0 | (c >> 6);
+            utf8[len++] = 0x80 | (c & 0x3F);
+        }
+        else if (c < 0x10000) {
+            utf8[len++] = 0xE0 | (c >> 12);
+            utf8[len++] = 0x80 | ((c >> 6) & 0x3F);
+            utf8[len++] = 0x80 | (c & 0x3F);
+        }
+        else {
+            utf8[len++] = 0xF0 | (c >> 18);
+            utf8[len++] = 0x80 | ((c >> 12) & 0x3F);
+            utf8[len++] = 0x80 | ((c >> 6) & 0x3F);
+            utf8[len++] = 0x80 | (c & 0x3F);
+        }
+    }
+    else if (!strcmp(entity, "amp")) {
+        utf8[len++] = '&';
+    }
+    else if (!strcmp(entity, "lt")) {
+        utf8[len++] = '<';
+    }
+    else if (!strcmp(entity, "gt")) {
+        utf8[len++] = '>';
+    }
+    else if (!strcmp(entity, "quot")) {
+        utf8[len++] = '"';
+    }
+    else if (!strcmp(entity, "apos")) {
+        utf8[len++] = '\'';
+    }
+    else {
+        simpleXml->status = S3StatusXmlParseFailure;
+        return;
+    }
+
+    characters(simpleXml, utf8, len);
+}
+
+
+static S3Status builtin_add(SimpleXml *simpleXml, const char *data,
+                            int dataLen)
+{
+    const char *end = &(data[dataLen]);
+
+#define fail()                                                  \
+    do {                                                        \
+        simpleXml->status = S3StatusXmlParseFailure;            \
+        return simpleXml->status;                               \
+    } while (0)
+
+    while ((data < end) && (simpleXml->status == S3StatusOK)) {
+        char c = *data;
+        switch (simpleXml->tokenState) {
+        case TokenStateText: {
+            const char *run = data;
+            data = (*scanG)(data, end, '<', '&');
+            if (((end - data) > 1) && (data[0] == '<') && (data[1] != '!') &&
+                !simpleXml->textLen) {
+                // The whole of the character data is here, so it can be
+                // passed on as it is without being gathered
+                if ((data > run) && simpleXml->elementPathLen) {
+                    simpleXml->status = make_callback(simpleXml, run,
+                                                      data - run);
+                }
+            }
+            else {
+                characters(simpleXml, run, data - run);
+            }
+            if (data < end) {
+                if (*data == '<') {
+                    simpleXml->tokenState = TokenStateTagOpen;
+                }
+                else {
+                    simpleXml->tokenState = TokenStateEntity;
+                    simpleXml->entityLen = 0;
+                }
+                data++;
+            }
+            continue;
+        }
+        case TokenStateEntity:
+            if (c == ';') {
+                entity_characters(simpleXml);
+                simpleXml->tokenState = TokenStateText;
+            }
+            else if (simpleXml->entityLen <
+                     (int) (sizeof(simpleXml->entity) - 1)) {
+                simpleXml->entity[simpleXml->entityLen++] = c;
+            }
+            else {
+                fail();
+            }
+            break;
+        case TokenStateTagOpen:
+            if ((c == '/') ||
+                ((c != '?') && (c != '!') && is_name_char(c))) {
+                // The character data before an element start or end is
+                // complete
+                flush_text(simpleXml);
+                if (simpleXml->status != S3StatusOK) {
+                    break;
+                }
+            }
+            if (c == '/') {
+                if (!simpleXml->elementPathLen) {
+                    fail();
+                }
+                // The name must be that of the current element
+                int start = simpleXml->elementPathLen;
+                while ((start > 0) &&
+                       (simpleXml->elementPath[start - 1] != '/')) {
+                    start--;
+                }
+                simpleXml->endNameStart = start;
+                simpleXml->tokenIndex = 0;
+                simpleXml->tokenState = TokenStateEndTagName;
+            }
+            else if (c == '?') {
+                simpleXml->tokenIndex = 0;
+                simpleXml->tokenState = TokenStateProcessingInstruction;
+            }
+            else if (c == '!') {
+                simpleXml->tokenState = TokenStateMarkup;
+            }
+            else if (is_name_char(c)) {
+                if (simpleXml->elementPathLen) {
+                    simpleXml->elementPath[simpleXml->elementPathLen] = '/';
+                }
+                simpleXml->tokenIndex = 0;
+                simpleXml->tokenState = TokenStateStartTagName;
+                // Process c as the first character of the name
+                continue;
+            }
+            else {
+                fail();
+            }
+            break;
+        case TokenStateStartTagName: {
+            char *name = &(simpleXml->elementPath[child_name_start(simpleXml)]);
+            while ((data < end) && is_name_char(*data)) {
+                // Same limit as saxStartElement
+                if ((simpleXml->elementPathLen + simpleXml->tokenIndex + 2) >=
+                    (int) sizeof(simpleXml->elementPath)) {
+                    fail();
+                }
+                name[simpleXml->tokenIndex++] = *data++;
+            }
+            if (data == end) {
+                continue;
+            }
+            element_started(simpleXml, simpleXml->tokenIndex);
+            simpleXml->tokenState = TokenStateAttributes;
+            // Process the character after the name as an attribute one
+            continue;
+        }
+        case TokenStateAttributes:
+            if ((c == '"') || (c == '\'')) {
+                simpleXml->quote = c;
+                simpleXml->tokenState = TokenStateAttributeValue;
+            }
+            else if (c == '/') {
+                simpleXml->tokenState = TokenStateEmptyElementEnd;
+            }
+            else if (c == '>') {
+                simpleXml->tokenState = TokenStateText;
+            }
+            break;
+        case TokenStateAttributeValue:
+            data = (*scanG)(data, end, simpleXml->quote, simpleXml->quote);
+            if (data < end) {
+                simpleXml->tokenState = TokenStateAttributes;
+                data++;
+            }
+            continue;
+        case TokenStateEmptyElementEnd:
+            if (c != '>') {
+                fail();
+            }
+            element_ended(simpleXml);
+            simpleXml->tokenState = TokenStateText;
+            break;
+        case TokenStateEndTagName: {
+            int nameLen = simpleXml->elementPathLen - simpleXml->endNameStart;
+            // Usually the whole end tag is here, and can be matched at once
+            if (!simpleXml->tokenIndex && ((end - data) > nameLen) &&
+                (data[nameLen] == '>') &&
+                !memcmp(data, &(simpleXml->elementPath
+                                [simpleXml->endNameStart]), nameLen)) {
+                element_ended(simpleXml);
+                simpleXml->tokenState = TokenStateText;
+                data += nameLen + 1;
+                continue;
+            }
+            if ((c == '>') || is_xml_space(c)) {
+                if (simpleXml->tokenIndex != nameLen) {
+                    fail();
+                }
+                if (c == '>') {
+                    element_ended(simpleXml);
+                    simpleXml->tokenState = TokenStateText;
+                }
+                else {
+                    simpleXml->tokenState = TokenStateEndTagSpace;
+                }
+            }
+            else if ((simpleXml->tokenIndex < nameLen) &&
+                     (simpleXml->elementPath[simpleXml->endNameStart +
+                                             simpleXml->tokenIndex] == c)) {
+                simpleXml->tokenIndex++;
+            }
+            else {
+                fail();
+            }
+            break;
+        }
+        case TokenStateEndTagSpace:
+            if (c == '>') {
+                element_ended(simpleXml);
+                simpleXml->tokenState = TokenStateText;
+            }
+            else if (!is_xml_space(c)) {
+                fail();
+            }
+            break;
+        case TokenStateProcessingInstruction:
+            // Ends with "?>"; tokenIndex is set if the last character was '?'
+            if ((c == '>') && simpleXml->tokenIndex) {
+                simpleXml->tokenState = TokenStateText;
+            }
+            simpleXml->tokenIndex = (c == '?');
+            break;
+        case TokenStateMarkup:
+            if (c == '-') {
+                simpleXml->tokenState = TokenStateCommentStart;
+            }
+            else if (c == '[') {
+                simpleXml->tokenIndex = 0;
+                simpleXml->tokenState = TokenStateCDataStart;
+            }
+            else {
+                // A declaration such as <!DOCTYPE ...>; tokenIndex counts
+                // the nesting of [] within it
+                simpleXml->tokenIndex = 0;
+                simpleXml->tokenState = TokenStateDeclaration;
+                continue;
+            }
+            break;
+        case TokenStateCommentStart:
+            if (c != '-') {
+                fail();
+            }
+            simpleXml->tokenIndex = 0;
+            simpleXml->tokenState = TokenStateComment;
+            break;
+        case TokenStateComment:
+            // Ends with "-->"; tokenIndex counts the consecutive '-'
+            if (c == '-') {
+                simpleXml->tokenIndex++;
+            }
+            else if ((c == '>') && (simpleXml->tokenIndex >= 2)) {
+                simpleXml->tokenState = TokenStateText;
+            }
+            else {
+                simpleXml->tokenIndex = 0;
+            }
+            break;
+        case TokenStateCDataStart:
+            if (c != "CDATA["[simpleXml->tokenIndex]) {
+                fail();
+            }
+            if (++(simpleXml->tokenIndex) == (sizeof("CDATA[") - 1)) {
+                simpleXml->tokenIndex = 0;
+                simpleXml->tokenState = TokenStateCData;
+            }
+            break;
+        case TokenStateCData:
+            // Ends with "]]>"; tokenIndex counts the (up to 2) ']' which
+            // have not been passed on yet in case they are the end
+            if (c == ']') {
+                if (simpleXml->tokenIndex < 2) {
+                    simpleXml->tokenIndex++;
+                }
+                else {
+                    characters(simpleXml, "]", 1);
+                }
+                break;
+            }
+            if ((c == '>') && (simpleXml->tokenIndex == 2)) {
+                simpleXml->tokenState = TokenStateText;
+                break;
+            }
+            if (simpleXml->tokenIndex) {
+                characters(simpleXml, "]]", simpleXml->tokenIndex);
+                simpleXml->tokenIndex = 0;
+            }
+            else {
+                const char *run = data;
+                data = (*scanG)(data, end, ']', ']');
+                characters(simpleXml, run, data - run);
+            }
+            continue;
+        default: // TokenStateDeclaration
+            if (c == '[') {
+                simpleXml->tokenIndex++;
+            }
+            else if (c == ']') {
+                simpleXml->tokenIndex--;
+            }
+            else if ((c == '>') && !simpleXml->tokenIndex) {
+                simpleXml->tokenState = TokenStateText;
+            }
+            break;
+        }
+        data++;
+    }
+
+#undef fail
+
+    return simpleXml->status;
+}
+
+
+// Simple XML parsing
+// ----------------------------------------------------------------------------
+
+void simplexml_api_initialize(int flags)
+{
+    builtinParserG = (flags & S3_INIT_BUILTIN_XML) != 0;
+
+#ifdef SCAN_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scanG = &scan_avx2;
+    }
+#endif
+}
+
+
 void simplexml_initialize(SimpleXml *simpleXml, 
                           SimpleXmlCallback *callback, void *callbackData)
 {
+    simpleXml->builtin = builtinParserG;
     simpleXml->callback = callback;
     simpleXml->callbackData = callbackData;
     simpleXml->elementPathLen = 0;
     simpleXml->status = S3StatusOK;
     simpleXml->xmlParser = 0;
+    simpleXml->elements = 0;
+    simpleXml->elementCallback = 0;
+    simpleXml->elementNode = -1;
+    simpleXml->unmatchedDepth = 0;
+    simpleXml->tokenState = TokenStateText;
+    simpleXml->textLen = 0;
+}
+
+
+void simplexml_initialize_elements(SimpleXml *simpleXml,
+                                   SimpleXmlElements *elements,
+                                   SimpleXmlElementCallback *callback,
+                                   void *callbackData)
+{
+    simplexml_initialize(simpleXml, 0, callbackData);
+
+    // Compile the element paths upon their first use
+    if (!__sync_fetch_and_add(&(elements->compiled), 0)) {
+        pthread_mutex_lock(&elementsMutexG);
+        if (!elements->compiled) {
+            elements->compileStatus = compile_elements(elements);
+            __sync_synchronize();
+            elements->compiled = 1;
+        }
+        pthread_mutex_unlock(&elementsMutexG);
+    }
+
+    simpleXml->elements = elements;
+    simpleXml->elementCallback = callback;
+
+    // Nothing can be parsed if the element paths couldn't be compiled
+    simpleXml->status = elements->compileStatus;
 }
 
 
@@ -192,6 +943,10 @@ void simplexml_deinitialize(SimpleXml *simpleXml)
 
 S3Status simplexml_add(SimpleXml *simpleXml, const char *data, int dataLen)
 {
+    if (simpleXml->builtin) {
+        return builtin_add(simpleXml, data, dataLen);
+    }
+
     if (!simpleXml->xmlParser &&
         (!(simpleXml->xmlParser = xmlCreatePushParserCtxt
            (&saxHandlerG, simpleXml, 0, 0, 0)))) {
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include "simplexml.h"
 
@@ -41,9 +42,15 @@ static S3Status simpleXmlCallback(const char *elementPath, const char *data,
 }
 
 
-// The only argument allowed is a specification of the random seed to use
+// The arguments allowed are -b, to use the built-in tokenizer rather than
+// libxml2, followed by a specification of the random seed to use
 int main(int argc, char **argv)
 {
+    if ((argc > 1) && !strcmp(argv[1], "-b")) {
+        simplexml_api_initialize(S3_INIT_BUILTIN_XML);
+        argc--, argv++;
+    }
+
     if (argc > 1) {
         char *arg = argv[1];
         int seed = 0;
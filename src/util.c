@@ -91,6 +91,25 @@ int urlEncode(char *dest, const char *src, int maxSrcSize, int encodeSlash)
 }
 
 
+// Returns the number of days from 1970-01-01 to the given day of the
+// proleptic Gregorian calendar.  [month] is 1 - 12; [day] may be beyond the
+// end of the month, counting on into the months after it.
+static int64_t days_from_civil(int64_t year, int month, int day)
+{
+    // Count years from March, so that the leap day is the last of the year
+    year -= (month <= 2);
+    int64_t era = ((year >= 0) ? year : (year - 399)) / 400;
+    int64_t yearOfEra = year - (era * 400);
+    int64_t dayOfYear =
+        (((153 * (month + ((month > 2) ? -3 : 9))) + 2) / 5) + day - 1;
+    int64_t dayOfEra = ((yearOfEra * 365) + (yearOfEra / 4) -
+                        (yearOfEra / 100) + dayOfYear);
+
+    // 719468 is the number of days from 0000-03-01 to 1970-01-01
+    return (era * 146097) + dayOfEra - 719468;
+}
+
+
 int64_t parseIso8601Time(const char *str)
 {
     // Check to make sure that it has a valid format
@@ -100,33 +119,39 @@ int64_t parseIso8601Time(const char *str)
 
 #define nextnum() (((*str - '0') * 10) + (*(str + 1) - '0'))
 
-    // Convert it
-    struct tm stm;
-    memset(&stm, 0, sizeof(stm));
-
-    stm.tm_year = (nextnum() - 19) * 100;
+    // Convert it.  This is done arithmetically rather than with mktime(),
+    // which is slow, serializes threads on the time zone lock, and converts
+    // from local time rather than UTC.
+    int64_t year = nextnum() * 100;
     str += 2;
-    stm.tm_year += nextnum();
+    year += nextnum();
     str += 3;
 
-    stm.tm_mon = nextnum() - 1;
+    // Months past December carry into the following years, as they do for
+    // mktime()
+    int month = nextnum() - 1;
     str += 3;
+    if (month < 0) {
+        month += 12;
+        year--;
+    }
+    year += month / 12;
+    month = (month % 12) + 1;
 
-    stm.tm_mday = nextnum();
+    int day = nextnum();
     str += 3;
 
-    stm.tm_hour = nextnum();
+    int hour = nextnum();
     str += 3;
 
-    stm.tm_min = nextnum();
+    int minute = nextnum();
     str += 3;
 
-    stm.tm_sec = nextnum();
+    int second = nextnum();
     str += 2;
 
-    stm.tm_isdst = -1;
-
-    int64_t ret = mktime(&stm);
+    int64_t ret = ((days_from_civil(year, month, day) * 86400) +
+                   (hour * 3600) + (minute * 60) + second);
 
     // Skip the millis
 
@@ -173,3 +198,48 @@ int is_blank(char c)
 {
     return ((c == ' ') || (c == '\t'));
 }
+
+
+size_t string_copy_size(const char *str)
+{
+    return str ? (strlen(str) + 1) : 0;
+}
+
+
+const char *copy_string(char **pos, const char *str)
+{
+    if (!str) {
+        return 0;
+    }
+
+    size_t size = strlen(str) + 1;
+    char *copy = *pos;
+    memcpy(copy, str, size);
+    *pos += size;
+
+    return copy;
+}
+
+
+size_t bucket_context_copy_size(const S3BucketContext *bucketContext)
+{
+    return (string_copy_size(bucketContext->hostName) +
+            string_copy_size(bucketContext->bucketName) +
+            string_copy_size(bucketContext->accessKeyId) +
+            string_copy_size(bucketContext->secretAccessKey) +
+            string_copy_size(bucketContext->securityToken) +
+            string_copy_size(bucketContext->authRegion));
+}
+
+
+void bucket_context_copy(S3BucketContext *dest, char **pos,
+                         const S3BucketContext *src)
+{
+    *dest = *src;
+    dest->hostName = copy_string(pos, src->hostName);
+    dest->bucketName = copy_string(pos, src->bucketName);
+    dest->accessKeyId = copy_string(pos, src->accessKeyId);
+    dest->secretAccessKey = copy_string(pos, src->secretAccessKey);
+    dest->securityToken = copy_string(pos, src->securityToken);
+    dest->authRegion = copy_string(pos, src->authRegion);
+}